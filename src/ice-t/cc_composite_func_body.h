@@ -23,6 +23,13 @@
  *              switched without effect.)
  *      DEST_SPARSE_IMAGE - an IceTSparseImage object to place the result.
  *
+ * The following macros are optional:
+ *      FRONT_START, BACK_START, PIXEL_COUNT - If defined, composites only
+ *              PIXEL_COUNT pixels starting at the positions in the front and
+ *              back images given by the IceTRunLengthCursor values FRONT_START
+ *              and BACK_START.  DEST_SPARSE_IMAGE must already have
+ *              PIXEL_COUNT pixels.  Only supported for non-layered images.
+ *
  * All of the above macros are undefined at the end of this file.
  */
 
@@ -42,6 +49,12 @@
 #error Need ACTIVE_RUN_LENGTH macro.  Is this included in image.c?
 #endif
 
+#ifdef FRONT_START
+#define CCC_FRONT_START FRONT_START
+#define CCC_BACK_START  BACK_START
+#define CCC_PIXEL_COUNT PIXEL_COUNT
+#endif
+
 {
     IceTEnum _color_format;
     IceTEnum _depth_format;
@@ -60,84 +73,63 @@
         || (_depth_format != icetSparseImageGetDepthFormat(DEST_SPARSE_IMAGE))
         || (_is_layered != icetSparseImageIsLayered(BACK_SPARSE_IMAGE))
         || (_is_layered != icetSparseImageIsLayered(DEST_SPARSE_IMAGE))
+        || (   icetSparseImageIsBlocked(FRONT_SPARSE_IMAGE)
+            != icetSparseImageIsBlocked(BACK_SPARSE_IMAGE) )
            ) {
         icetRaiseError(ICET_SANITY_CHECK_FAIL,
                        "Input buffers do not agree for compressed-compressed"
                        " composite.");
     }
+    /* The result stores its pixels like the inputs. */
+    icetSparseImageSetBlocked(DEST_SPARSE_IMAGE,
+                              icetSparseImageIsBlocked(FRONT_SPARSE_IMAGE));
 
     if (!_is_layered) {
     if (_composite_mode == ICET_COMPOSITE_MODE_Z_BUFFER) {
         if (_depth_format == ICET_IMAGE_DEPTH_FLOAT) {
           /* Use Z buffer for active pixel testing and compositing. */
             if (_color_format == ICET_IMAGE_COLOR_RGBA_UBYTE) {
-#define UNPACK_PIXEL(pointer, color, depth)     \
-    color = (IceTUInt *)pointer;                \
-    pointer += sizeof(IceTUInt);                \
-    depth = (IceTFloat *)pointer;               \
-    pointer += sizeof(IceTFloat);
 #define CCC_FRONT_COMPRESSED_IMAGE FRONT_SPARSE_IMAGE
 #define CCC_BACK_COMPRESSED_IMAGE BACK_SPARSE_IMAGE
 #define CCC_DEST_COMPRESSED_IMAGE DEST_SPARSE_IMAGE
-#define CCC_COMPOSITE(src1_pointer, src2_pointer, dest_pointer)         \
-    {                                                                   \
-        const IceTUInt *src1_color;                                     \
-        const IceTFloat *src1_depth;                                    \
-        const IceTUInt *src2_color;                                     \
-        const IceTFloat *src2_depth;                                    \
-        IceTUInt *dest_color;                                           \
-        IceTFloat *dest_depth;                                          \
-        UNPACK_PIXEL(src1_pointer, src1_color, src1_depth);             \
-        UNPACK_PIXEL(src2_pointer, src2_color, src2_depth);             \
-        UNPACK_PIXEL(dest_pointer, dest_color, dest_depth);             \
-        if (src1_depth[0] < src2_depth[0]) {                            \
-            dest_color[0] = src1_color[0];                              \
-            dest_depth[0] = src1_depth[0];                              \
-        } else {                                                        \
-            dest_color[0] = src2_color[0];                              \
-            dest_depth[0] = src2_depth[0];                              \
-        }                                                               \
-    }
+#define CCC_COMPOSITE_RUN(src1_pointer, src2_pointer, dest_pointer, count) \
+    icetZCompositeSparseRunub((const IceTUInt *)src1_pointer,           \
+                              (const IceTUInt *)src2_pointer,           \
+                              (IceTUInt *)dest_pointer,                 \
+                              count);                                   \
+    src1_pointer += (count)*CCC_FRAGMENT_SIZE;                          \
+    src2_pointer += (count)*CCC_FRAGMENT_SIZE;                          \
+    dest_pointer += (count)*CCC_FRAGMENT_SIZE;
 #define CCC_FRAGMENT_SIZE (sizeof(IceTUInt) + sizeof(IceTFloat))
 #include "cc_composite_template_body.h"
-#undef UNPACK_PIXEL
             } else if (_color_format == ICET_IMAGE_COLOR_RGBA_FLOAT) {
-#define UNPACK_PIXEL(pointer, color, depth)     \
-    color = (IceTFloat *)pointer;               \
-    pointer += 4*sizeof(IceTUInt);              \
-    depth = (IceTFloat *)pointer;               \
-    pointer += sizeof(IceTFloat);
 #define CCC_FRONT_COMPRESSED_IMAGE FRONT_SPARSE_IMAGE
 #define CCC_BACK_COMPRESSED_IMAGE BACK_SPARSE_IMAGE
 #define CCC_DEST_COMPRESSED_IMAGE DEST_SPARSE_IMAGE
-#define CCC_COMPOSITE(src1_pointer, src2_pointer, dest_pointer)         \
-    {                                                                   \
-        const IceTFloat *src1_color;                                    \
-        const IceTFloat *src1_depth;                                    \
-        const IceTFloat *src2_color;                                    \
-        const IceTFloat *src2_depth;                                    \
-        IceTFloat *dest_color;                                          \
-        IceTFloat *dest_depth;                                          \
-        UNPACK_PIXEL(src1_pointer, src1_color, src1_depth);             \
-        UNPACK_PIXEL(src2_pointer, src2_color, src2_depth);             \
-        UNPACK_PIXEL(dest_pointer, dest_color, dest_depth);             \
-        if (src1_depth[0] < src2_depth[0]) {                            \
-            dest_color[0] = src1_color[0];                              \
-            dest_color[1] = src1_color[1];                              \
-            dest_color[2] = src1_color[2];                              \
-            dest_color[3] = src1_color[3];                              \
-            dest_depth[0] = src1_depth[0];                              \
-        } else {                                                        \
-            dest_color[0] = src2_color[0];                              \
-            dest_color[1] = src2_color[1];                              \
-            dest_color[2] = src2_color[2];                              \
-            dest_color[3] = src2_color[3];                              \
-            dest_depth[0] = src2_depth[0];                              \
-        }                                                               \
-    }
+#define CCC_COMPOSITE_RUN(src1_pointer, src2_pointer, dest_pointer, count) \
+    icetZCompositeSparseRunf((const IceTUInt *)src1_pointer,            \
+                             (const IceTUInt *)src2_pointer,            \
+                             (IceTUInt *)dest_pointer,                  \
+                             count);                                    \
+    src1_pointer += (count)*CCC_FRAGMENT_SIZE;                          \
+    src2_pointer += (count)*CCC_FRAGMENT_SIZE;                          \
+    dest_pointer += (count)*CCC_FRAGMENT_SIZE;
 #define CCC_FRAGMENT_SIZE (5*sizeof(IceTFloat))
 #include "cc_composite_template_body.h"
-#undef UNPACK_PIXEL
+            } else if (_color_format == ICET_IMAGE_COLOR_RGBA_HALF) {
+#define CCC_FRONT_COMPRESSED_IMAGE FRONT_SPARSE_IMAGE
+#define CCC_BACK_COMPRESSED_IMAGE BACK_SPARSE_IMAGE
+#define CCC_DEST_COMPRESSED_IMAGE DEST_SPARSE_IMAGE
+#define CCC_COMPOSITE_RUN(src1_pointer, src2_pointer, dest_pointer, count) \
+    icetZCompositeSparseRunh((const IceTUInt *)src1_pointer,            \
+                             (const IceTUInt *)src2_pointer,            \
+                             (IceTUInt *)dest_pointer,                  \
+                             count);                                    \
+    src1_pointer += (count)*CCC_FRAGMENT_SIZE;                          \
+    src2_pointer += (count)*CCC_FRAGMENT_SIZE;                          \
+    dest_pointer += (count)*CCC_FRAGMENT_SIZE;
+#define CCC_FRAGMENT_SIZE (4*sizeof(IceTUShort) + sizeof(IceTFloat))
+#include "cc_composite_template_body.h"
             } else if (_color_format == ICET_IMAGE_COLOR_RGB_FLOAT) {
 #define UNPACK_PIXEL(pointer, color, depth)     \
     color = (IceTFloat *)pointer;               \
@@ -215,47 +207,47 @@
       /* Use alpha for active pixel and compositing. */
         if (_depth_format == ICET_IMAGE_DEPTH_NONE) {
             if (_color_format == ICET_IMAGE_COLOR_RGBA_UBYTE) {
-#define UNPACK_PIXEL(pointer, color)            \
-    color = (IceTUInt *)pointer;                \
-    pointer += sizeof(IceTUInt);
 #define CCC_FRONT_COMPRESSED_IMAGE FRONT_SPARSE_IMAGE
 #define CCC_BACK_COMPRESSED_IMAGE BACK_SPARSE_IMAGE
 #define CCC_DEST_COMPRESSED_IMAGE DEST_SPARSE_IMAGE
-#define CCC_COMPOSITE(front_pointer, back_pointer, dest_pointer)        \
-    {                                                                   \
-        const IceTUInt *front_color;                                    \
-        const IceTUInt *back_color;                                     \
-        IceTUInt *dest_color;                                           \
-        UNPACK_PIXEL(front_pointer, front_color);                       \
-        UNPACK_PIXEL(back_pointer, back_color);                         \
-        UNPACK_PIXEL(dest_pointer, dest_color);                         \
-        ICET_BLEND_UBYTE((const IceTUByte *)front_color,                \
-                         (const IceTUByte *)back_color,                 \
-                         (IceTUByte *)dest_color);                      \
-    }
+#define CCC_COMPOSITE_RUN(front_pointer, back_pointer, dest_pointer, count) \
+    icetBlendRunub((const IceTUInt *)front_pointer,                     \
+                   (const IceTUInt *)back_pointer,                      \
+                   (IceTUInt *)dest_pointer,                            \
+                   count);                                              \
+    front_pointer += (count)*CCC_FRAGMENT_SIZE;                         \
+    back_pointer += (count)*CCC_FRAGMENT_SIZE;                          \
+    dest_pointer += (count)*CCC_FRAGMENT_SIZE;
 #define CCC_FRAGMENT_SIZE (sizeof(IceTUInt))
 #include "cc_composite_template_body.h"
-#undef UNPACK_PIXEL
             } else if (_color_format == ICET_IMAGE_COLOR_RGBA_FLOAT) {
-#define UNPACK_PIXEL(pointer, color)            \
-    color = (IceTFloat *)pointer;               \
-    pointer += 4*sizeof(IceTUInt);
 #define CCC_FRONT_COMPRESSED_IMAGE FRONT_SPARSE_IMAGE
 #define CCC_BACK_COMPRESSED_IMAGE BACK_SPARSE_IMAGE
 #define CCC_DEST_COMPRESSED_IMAGE DEST_SPARSE_IMAGE
-#define CCC_COMPOSITE(front_pointer, back_pointer, dest_pointer)        \
-    {                                                                   \
-        const IceTFloat *front_color;                                   \
-        const IceTFloat *back_color;                                    \
-        IceTFloat *dest_color;                                          \
-        UNPACK_PIXEL(front_pointer, front_color);                       \
-        UNPACK_PIXEL(back_pointer, back_color);                         \
-        UNPACK_PIXEL(dest_pointer, dest_color);                         \
-        ICET_BLEND_FLOAT(front_color, back_color, dest_color);          \
-    }
+#define CCC_COMPOSITE_RUN(front_pointer, back_pointer, dest_pointer, count) \
+    icetBlendRunf((const IceTFloat *)front_pointer,                     \
+                  (const IceTFloat *)back_pointer,                      \
+                  (IceTFloat *)dest_pointer,                            \
+                  count);                                               \
+    front_pointer += (count)*CCC_FRAGMENT_SIZE;                         \
+    back_pointer += (count)*CCC_FRAGMENT_SIZE;                          \
+    dest_pointer += (count)*CCC_FRAGMENT_SIZE;
 #define CCC_FRAGMENT_SIZE (4*sizeof(IceTFloat))
 #include "cc_composite_template_body.h"
-#undef UNPACK_PIXEL
+            } else if (_color_format == ICET_IMAGE_COLOR_RGBA_HALF) {
+#define CCC_FRONT_COMPRESSED_IMAGE FRONT_SPARSE_IMAGE
+#define CCC_BACK_COMPRESSED_IMAGE BACK_SPARSE_IMAGE
+#define CCC_DEST_COMPRESSED_IMAGE DEST_SPARSE_IMAGE
+#define CCC_COMPOSITE_RUN(front_pointer, back_pointer, dest_pointer, count) \
+    icetBlendRunh((const IceTUShort *)front_pointer,                    \
+                  (const IceTUShort *)back_pointer,                     \
+                  (IceTUShort *)dest_pointer,                           \
+                  count);                                               \
+    front_pointer += (count)*CCC_FRAGMENT_SIZE;                         \
+    back_pointer += (count)*CCC_FRAGMENT_SIZE;                          \
+    dest_pointer += (count)*CCC_FRAGMENT_SIZE;
+#define CCC_FRAGMENT_SIZE (4*sizeof(IceTUShort))
+#include "cc_composite_template_body.h"
             } else if (_color_format == ICET_IMAGE_COLOR_RGB_FLOAT) {
                 icetRaiseError(
                     ICET_INVALID_VALUE,
@@ -279,6 +271,57 @@
                        _composite_mode);
     }
     } else { /* Compositing layered images. */
+#ifdef FRONT_START
+        /* The runs of layered images also count fragments, which cursors do
+         * not track. */
+        icetRaiseError(ICET_SANITY_CHECK_FAIL,
+                       "Layered images cannot be composited from a cursor.");
+#else
+        /* Fragments behind an accumulated opacity of at least this value are
+         * dropped while merging.  A cutoff of 0 disables this. */
+        IceTFloat _opacity_cutoff;
+        /* Fragments beyond this number are blended into the last kept
+         * fragment of a pixel.  A maximum of 0 disables this. */
+        IceTInt _max_fragments;
+        /* Adjacent fragments of a merged pixel are coalesced unless the depth
+         * range between them overlaps one of these intervals, which hold the
+         * depths of all processes not yet merged.  A count of -1 disables
+         * this. */
+        const IceTFloat *_blocked_depths;
+        IceTInt _num_blocked_depths;
+        /* Number of bytes with which each image stores the number of fragments
+         * of its pixels.  Inputs with a single fragment per pixel store none.
+         * The output size is chosen from the largest number of fragments per
+         * pixel of the inputs, so it is only widened once merged pixels may
+         * need it. */
+        const IceTSizeType _front_count_size =
+            icetSparseImageIsSingleFragment(FRONT_SPARSE_IMAGE)
+            ? 0 : icetSparseImageGetLayerCountSize(FRONT_SPARSE_IMAGE);
+        const IceTSizeType _back_count_size =
+            icetSparseImageIsSingleFragment(BACK_SPARSE_IMAGE)
+            ? 0 : icetSparseImageGetLayerCountSize(BACK_SPARSE_IMAGE);
+        const IceTSizeType _dest_count_size =
+            icetSparseImageMergedLayerCountSize(FRONT_SPARSE_IMAGE,
+                                                BACK_SPARSE_IMAGE);
+        /* Largest number of fragments of a merged pixel, which is recorded in
+         * the output along with those of the copied input pixels. */
+        IceTLayerCount _dest_max_frags = 0;
+        icetGetFloatv(ICET_LAYERED_OPACITY_CUTOFF, &_opacity_cutoff);
+        icetGetIntegerv(ICET_MAX_FRAGMENTS_PER_PIXEL, &_max_fragments);
+        _num_blocked_depths = icetSparseImageGetBlockedDepths(
+                FRONT_SPARSE_IMAGE, BACK_SPARSE_IMAGE, &_blocked_depths);
+
+        /* Rather than let the count of a merged pixel overflow, limit its
+         * fragments to the largest count the output can store.  The output
+         * count size is chosen such that this never happens. */
+        icetSparseImageSetLayerCountSize(DEST_SPARSE_IMAGE, _dest_count_size);
+        if (   (_dest_count_size < 4)
+            && (   (_max_fragments <= 0)
+                || (_max_fragments
+                    > (IceTInt)LAYER_COUNT_MAX(_dest_count_size)) ) ) {
+            _max_fragments = (IceTInt)LAYER_COUNT_MAX(_dest_count_size);
+        }
+
         switch (_composite_mode) {
         /* When using a commutative compositing operator, The layers of each
          * input image are already composited into a non-layered image during
@@ -302,6 +345,8 @@
 
                 case ICET_IMAGE_COLOR_RGBA_UBYTE:
 #define CCCL_FRAGMENT_TYPE IceTFragment_RGBA8_D32F
+#define CCCL_ALPHA(frag) ((IceTFloat)(frag)->color[3] * (1.0f/255.0f))
+#define CCCL_UNDER(src, dest) ICET_UNDER_UBYTE((src)->color, (dest)->color)
 #include "cc_composite_template_body_layered.h"
                     break;
 
@@ -312,6 +357,15 @@
 
                 case ICET_IMAGE_COLOR_RGBA_FLOAT:
 #define CCCL_FRAGMENT_TYPE IceTFragment_RGBA32F_D32F
+#define CCCL_ALPHA(frag) ((frag)->color[3])
+#define CCCL_UNDER(src, dest) ICET_UNDER_FLOAT((src)->color, (dest)->color)
+#include "cc_composite_template_body_layered.h"
+                    break;
+
+                case ICET_IMAGE_COLOR_RGBA_HALF:
+#define CCCL_FRAGMENT_TYPE IceTFragment_RGBA16F_D32F
+#define CCCL_ALPHA(frag) icetHalfToFloat((frag)->color[3])
+#define CCCL_UNDER(src, dest) ICET_UNDER_HALF((src)->color, (dest)->color)
 #include "cc_composite_template_body_layered.h"
                     break;
 
@@ -322,6 +376,45 @@
                 } /* switch _color_format */
                 break; /* case ICET_IMAGE_DEPTH_FLOAT */
 
+            /* Normalized 16-bit depths compare in the same order as the float
+             * depths they represent. */
+            case ICET_IMAGE_DEPTH_USHORT:
+                switch (_color_format) {
+                case ICET_IMAGE_COLOR_NONE:
+#define CCCL_FRAGMENT_TYPE IceTFragment_D16
+#include "cc_composite_template_body_layered.h"
+                    break;
+
+                case ICET_IMAGE_COLOR_RGBA_UBYTE:
+#define CCCL_FRAGMENT_TYPE IceTFragment_RGBA8_D16
+#define CCCL_DEPTH(frag) ((IceTFloat)(frag)->depth * (1.0f/65535.0f))
+#define CCCL_ALPHA(frag) ((IceTFloat)(frag)->color[3] * (1.0f/255.0f))
+#define CCCL_UNDER(src, dest) ICET_UNDER_UBYTE((src)->color, (dest)->color)
+#include "cc_composite_template_body_layered.h"
+                    break;
+
+                case ICET_IMAGE_COLOR_RGBA_HALF:
+#define CCCL_FRAGMENT_TYPE IceTFragment_RGBA16F_D16
+#define CCCL_DEPTH(frag) ((IceTFloat)(frag)->depth * (1.0f/65535.0f))
+#define CCCL_ALPHA(frag) icetHalfToFloat((frag)->color[3])
+#define CCCL_UNDER(src, dest) ICET_UNDER_HALF((src)->color, (dest)->color)
+#include "cc_composite_template_body_layered.h"
+                    break;
+
+                case ICET_IMAGE_COLOR_RGB_FLOAT:
+                case ICET_IMAGE_COLOR_RGBA_FLOAT:
+                    icetRaiseError(ICET_INVALID_OPERATION,
+                                   "16-bit depths cannot be combined with "
+                                   "float colors in layered images.");
+                    break;
+
+                default:
+                    icetRaiseError(ICET_SANITY_CHECK_FAIL,
+                                   "Encountered invalid color format %#X.",
+                                   _color_format);
+                } /* switch _color_format */
+                break; /* case ICET_IMAGE_DEPTH_USHORT */
+
             case ICET_IMAGE_DEPTH_NONE:
                 icetRaiseError(ICET_SANITY_CHECK_FAIL,
                                "Layered images must contain depth information.");
@@ -340,9 +433,25 @@
                            "Encountered invalid composite mode %#X.",
                            _composite_mode);
         } /* switch _composite_mode */
+
+        icetSparseImageSetMaxFragments(
+            DEST_SPARSE_IMAGE,
+            MAX(_dest_max_frags,
+                MAX(icetSparseImageGetMaxFragments(FRONT_SPARSE_IMAGE),
+                    icetSparseImageGetMaxFragments(BACK_SPARSE_IMAGE))));
+#endif /*FRONT_START*/
     }
 }
 
 #undef FRONT_SPARSE_IMAGE
 #undef BACK_SPARSE_IMAGE
 #undef DEST_SPARSE_IMAGE
+
+#ifdef FRONT_START
+#undef FRONT_START
+#undef BACK_START
+#undef PIXEL_COUNT
+#undef CCC_FRONT_START
+#undef CCC_BACK_START
+#undef CCC_PIXEL_COUNT
+#endif
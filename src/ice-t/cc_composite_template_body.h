@@ -24,8 +24,33 @@
  *      CCC_FRAGMENT_SIZE - the number of bytes required to store the data
  *              for one fragment, i.e. one color and depth value.
  *
+ * Optionally, the macro CCC_COMPOSITE_RUN(front_pointer, back_pointer,
+ * dest_pointer, count) may be defined instead of CCC_COMPOSITE to composite
+ * count pixels at once, which lets runs of pixels active in both images be
+ * composited with a vectorized kernel.  It must also increment the pointers.
+ * CCC_COMPOSITE_RUN cannot be combined with CCC_LAYERED.
+ *
  * Optionally, the macro CCC_LAYERED may be defined to enable support for
- * combining layered images.
+ * combining layered images.  The input images may then also hold a single
+ * fragment per pixel, in which case their pixels are promoted to the general
+ * layered format of the output.  CCC_COMPOSITE must handle such pixels based
+ * on the variables _front_single and _back_single.  The variables
+ * _front_count_size, _back_count_size and _dest_count_size must hold the number
+ * of bytes with which each image stores the number of fragments per pixel (0
+ * for inputs with a single fragment per pixel).  Inputs whose count size
+ * differs from that of the output are converted pixel by pixel.
+ *
+ * Optionally, the macros CCC_FRONT_START, CCC_BACK_START and CCC_PIXEL_COUNT
+ * may be defined together to composite only part of the images.  The first two
+ * are IceTRunLengthCursor values giving the position in the front and back
+ * images at which to start, and CCC_PIXEL_COUNT is the number of pixels to
+ * composite from there.  Runs extending past the last of these pixels are cut
+ * off.  The dimensions of CCC_DEST_COMPRESSED_IMAGE are left unchanged and must
+ * match CCC_PIXEL_COUNT.  These macros cannot be
+ * combined with CCC_LAYERED and are not undefined at the end of this file.
+ *
+ * Blocked images (see icetSparseImageIsBlocked) are composited block by block
+ * unless CCC_LAYERED or CCC_FRONT_START is defined, which do not support them.
  *
  * All of the above macros are undefined at the end of this file.
  */
@@ -43,16 +68,177 @@
 #ifndef ACTIVE_RUN_LENGTH_FRAGMENTS
 #error Need ACTIVE_RUN_LENGTH_FRAGMENTS macro.  Is this included in image.c?
 #endif
+#if defined(CCC_FRONT_START) && defined(CCC_LAYERED)
+#error CCC_FRONT_START cannot be used with CCC_LAYERED
+#endif
+#if defined(CCC_COMPOSITE_RUN) && defined(CCC_LAYERED)
+#error CCC_COMPOSITE_RUN cannot be used with CCC_LAYERED
+#endif
 
 /* Local utility macros. */
 #define CCC_MIN(x, y) ((x) < (y) ? (x) : (y))
 
+/* When compositing part of the images, runs may extend past its end. */
+#ifdef CCC_PIXEL_COUNT
+#define CCC_CLAMP(count) CCC_MIN(count, _num_pixels - _pixel)
+#else
+#define CCC_CLAMP(count) (count)
+#endif
+
 #ifdef CCC_LAYERED
 #define CCC_RUN_LENGTH_SIZE RUN_LENGTH_SIZE_LAYERED
+#define CCC_FRONT_RUN_LENGTH_SIZE _front_run_length_size
+#define CCC_BACK_RUN_LENGTH_SIZE _back_run_length_size
 #else
 #define CCC_RUN_LENGTH_SIZE RUN_LENGTH_SIZE
+#define CCC_FRONT_RUN_LENGTH_SIZE RUN_LENGTH_SIZE
+#define CCC_BACK_RUN_LENGTH_SIZE RUN_LENGTH_SIZE
+#endif
+
+#ifdef CCC_LAYERED
+/* Copy `count` pixels from `src`, whose fragment counts take `src_count_size`
+ * bytes, to the output, rewriting each count with the size used by the output
+ * and adding the fragments to `frags`.  Pixels without a count (size 0) hold a
+ * single fragment and are promoted to the layered format. */
+#define CCC_CONVERT_PIXELS(src, src_count_size, count, frags)               \
+    for (IceTSizeType _converted = 0; _converted < count; _converted++) {   \
+        const IceTLayerCount _pixel_frags = ((src_count_size) == 0)         \
+            ? 1 : LAYER_COUNT_GET(src, src_count_size);                     \
+        const IceTSizeType _pixel_bytes = _pixel_frags*CCC_FRAGMENT_SIZE;   \
+        src += (src_count_size);                                            \
+        LAYER_COUNT_SET(_dest, _dest_count_size, _pixel_frags);             \
+        _dest += _dest_count_size;                                          \
+        memcpy(_dest, src, _pixel_bytes);                                   \
+        _dest += _pixel_bytes;                                              \
+        src += _pixel_bytes;                                                \
+        frags += _pixel_frags;                                              \
+    }
+#endif
+
+#if !defined(CCC_LAYERED) && !defined(CCC_FRONT_START)
+if (icetSparseImageIsBlocked(CCC_FRONT_COMPRESSED_IMAGE)) {
+    /* Blocked images are composited block by block.  The mask of each block of
+     * the result is the union of the masks of the inputs, and pixels active in
+     * both inputs are composited in runs of consecutive bits. */
+    const IceTByte *_front;
+    const IceTByte *_back;
+    IceTByte *_dest;
+    const IceTVoid *_front_bitmap;
+    const IceTVoid *_back_bitmap;
+    IceTVoid *_dest_bitmap;
+    IceTSparseBlockLayout _layout;
+    IceTSizeType _block;
+
+    if (   (   icetSparseImageGetWidth(CCC_FRONT_COMPRESSED_IMAGE)
+            != icetSparseImageGetWidth(CCC_BACK_COMPRESSED_IMAGE))
+        || (   icetSparseImageGetHeight(CCC_FRONT_COMPRESSED_IMAGE)
+            != icetSparseImageGetHeight(CCC_BACK_COMPRESSED_IMAGE)) ) {
+        icetRaiseError(ICET_SANITY_CHECK_FAIL,
+                       "Input buffers do not agree for compressed-compressed"
+                       " composite.");
+    }
+    icetSparseImageSetDimensions(
+                           CCC_DEST_COMPRESSED_IMAGE,
+                           icetSparseImageGetWidth(CCC_FRONT_COMPRESSED_IMAGE),
+                           icetSparseImageGetHeight(CCC_FRONT_COMPRESSED_IMAGE));
+    icetSparseBlockLayoutInit(
+                          &_layout,
+                          icetSparseImageGetWidth(CCC_FRONT_COMPRESSED_IMAGE),
+                          icetSparseImageGetHeight(CCC_FRONT_COMPRESSED_IMAGE));
+
+    _front = ICET_SPARSE_IMAGE_DATA(CCC_FRONT_COMPRESSED_IMAGE);
+    _back = ICET_SPARSE_IMAGE_DATA(CCC_BACK_COMPRESSED_IMAGE);
+    _dest_bitmap = ICET_SPARSE_IMAGE_DATA(CCC_DEST_COMPRESSED_IMAGE);
+
+    /* Strategies may place the output just before an input and let it grow
+     * over the data already read.  The pixels are read in order, but the
+     * bitmaps are read up to the end, so they are copied first. */
+    {
+        IceTByte *_bitmaps = icetGetStateBuffer(ICET_SPARSE_BLOCK_BITMAP_BUF,
+                                                2*_layout.bitmap_size);
+        memcpy(_bitmaps, _front, _layout.bitmap_size);
+        memcpy(_bitmaps + _layout.bitmap_size, _back, _layout.bitmap_size);
+        _front_bitmap = _bitmaps;
+        _back_bitmap = _bitmaps + _layout.bitmap_size;
+    }
+    _front += _layout.bitmap_size;
+    _back += _layout.bitmap_size;
+    _dest = (IceTByte *)_dest_bitmap + _layout.bitmap_size;
+    memset(_dest_bitmap, 0, _layout.bitmap_size);
+
+    for (_block = 0; _block < _layout.num_blocks; _block++) {
+        IceTUInt _front_mask[2] = { 0, 0 };
+        IceTUInt _back_mask[2] = { 0, 0 };
+        IceTUInt _dest_mask[2];
+        IceTBoolean _in_front = ICET_SPARSE_BLOCK_BIT(_front_bitmap, _block);
+        IceTBoolean _in_back = ICET_SPARSE_BLOCK_BIT(_back_bitmap, _block);
+
+        if (!_in_front && !_in_back) continue;
+
+        if (_in_front) {
+            memcpy(_front_mask, _front, ICET_SPARSE_BLOCK_MASK_SIZE);
+            _front += ICET_SPARSE_BLOCK_MASK_SIZE;
+        }
+        if (_in_back) {
+            memcpy(_back_mask, _back, ICET_SPARSE_BLOCK_MASK_SIZE);
+            _back += ICET_SPARSE_BLOCK_MASK_SIZE;
+        }
+        _dest_mask[0] = _front_mask[0] | _back_mask[0];
+        _dest_mask[1] = _front_mask[1] | _back_mask[1];
+        ICET_SPARSE_BLOCK_SET_BIT(_dest_bitmap, _block);
+        memcpy(_dest, _dest_mask, ICET_SPARSE_BLOCK_MASK_SIZE);
+        _dest += ICET_SPARSE_BLOCK_MASK_SIZE;
+
+        if (!_in_back || !_in_front) {
+            /* Only one image has pixels in this block. */
+            const IceTByte **_src = _in_front ? &_front : &_back;
+            size_t _bytes_to_copy
+                = icetSparseBlockCountBelow(_dest_mask,
+                                            ICET_SPARSE_BLOCK_NUM_PIXELS)
+                  *CCC_FRAGMENT_SIZE;
+            memcpy(_dest, *_src, _bytes_to_copy);
+            _dest += _bytes_to_copy;
+            *_src += _bytes_to_copy;
+        } else {
+            IceTSizeType _bit = 0;
+            while (_bit < ICET_SPARSE_BLOCK_NUM_PIXELS) {
+                IceTUInt _front_bit = ICET_SPARSE_BLOCK_BIT(_front_mask, _bit);
+                IceTUInt _back_bit = ICET_SPARSE_BLOCK_BIT(_back_mask, _bit);
+                IceTSizeType _count = 1;
+
+                while (   (_bit + _count < ICET_SPARSE_BLOCK_NUM_PIXELS)
+                       && (   ICET_SPARSE_BLOCK_BIT(_front_mask, _bit + _count)
+                           == _front_bit)
+                       && (   ICET_SPARSE_BLOCK_BIT(_back_mask, _bit + _count)
+                           == _back_bit) ) {
+                    _count++;
+                }
+                if (_front_bit && _back_bit) {
+#ifdef CCC_COMPOSITE_RUN
+                    CCC_COMPOSITE_RUN(_front, _back, _dest, _count);
+#else
+                    IceTSizeType _i;
+                    for (_i = 0; _i < _count; _i++) {
+                        CCC_COMPOSITE(_front, _back, _dest);
+                    }
 #endif
+                } else if (_front_bit) {
+                    memcpy(_dest, _front, _count*CCC_FRAGMENT_SIZE);
+                    _dest += _count*CCC_FRAGMENT_SIZE;
+                    _front += _count*CCC_FRAGMENT_SIZE;
+                } else if (_back_bit) {
+                    memcpy(_dest, _back, _count*CCC_FRAGMENT_SIZE);
+                    _dest += _count*CCC_FRAGMENT_SIZE;
+                    _back += _count*CCC_FRAGMENT_SIZE;
+                }
+                _bit += _count;
+            }
+        }
+    }
 
+    icetSparseImageSetActualSize(CCC_DEST_COMPRESSED_IMAGE, _dest);
+} else
+#endif
 {
     /* Use IceTByte for byte-based pointer arithmetic. */
     const IceTByte *_front;
@@ -72,8 +258,21 @@
     IceTSizeType _front_num_active_frags = 0;
     IceTSizeType _back_num_active_frags = 0;
     IceTSizeType _dest_num_active_frags = 0;
+    /* Inputs with a single fragment per pixel have neither fragment counts per
+     * run nor per pixel. */
+    const IceTBoolean _front_single =
+        icetSparseImageIsSingleFragment(CCC_FRONT_COMPRESSED_IMAGE);
+    const IceTBoolean _back_single =
+        icetSparseImageIsSingleFragment(CCC_BACK_COMPRESSED_IMAGE);
+    const IceTSizeType _front_run_length_size =
+        _front_single ? RUN_LENGTH_SIZE : RUN_LENGTH_SIZE_LAYERED;
+    const IceTSizeType _back_run_length_size =
+        _back_single ? RUN_LENGTH_SIZE : RUN_LENGTH_SIZE_LAYERED;
 #endif
 
+#ifdef CCC_PIXEL_COUNT
+    _num_pixels = CCC_PIXEL_COUNT;
+#else
     _num_pixels = icetSparseImageGetNumPixels(CCC_FRONT_COMPRESSED_IMAGE);
     if (_num_pixels != icetSparseImageGetNumPixels(CCC_BACK_COMPRESSED_IMAGE)) {
         icetRaiseError(ICET_SANITY_CHECK_FAIL,
@@ -84,15 +283,29 @@
                            CCC_DEST_COMPRESSED_IMAGE,
                            icetSparseImageGetWidth(CCC_FRONT_COMPRESSED_IMAGE),
                            icetSparseImageGetHeight(CCC_BACK_COMPRESSED_IMAGE));
+#endif
+#ifdef CCC_LAYERED
+    /* The output may hold several fragments per pixel. */
+    icetSparseImageSetSingleFragment(CCC_DEST_COMPRESSED_IMAGE, ICET_FALSE);
+#endif
 
-    _front = ICET_IMAGE_DATA(CCC_FRONT_COMPRESSED_IMAGE);
-    _back = ICET_IMAGE_DATA(CCC_BACK_COMPRESSED_IMAGE);
-    _dest = ICET_IMAGE_DATA(CCC_DEST_COMPRESSED_IMAGE);
+    _front = ICET_SPARSE_IMAGE_DATA(CCC_FRONT_COMPRESSED_IMAGE);
+    _back = ICET_SPARSE_IMAGE_DATA(CCC_BACK_COMPRESSED_IMAGE);
+    _dest = ICET_SPARSE_IMAGE_DATA(CCC_DEST_COMPRESSED_IMAGE);
     _dest_runlengths = NULL;
 
     _pixel = 0;
+#ifdef CCC_FRONT_START
+    _front = (CCC_FRONT_START).data;
+    _front_num_inactive = (CCC_FRONT_START).num_inactive;
+    _front_num_active = (CCC_FRONT_START).num_active;
+    _back = (CCC_BACK_START).data;
+    _back_num_inactive = (CCC_BACK_START).num_inactive;
+    _back_num_active = (CCC_BACK_START).num_active;
+#else
     _front_num_inactive = _front_num_active = 0;
     _back_num_inactive = _back_num_active = 0;
+#endif
     _dest_num_active = 0;
     while (_pixel < _num_pixels) {
         /* When num_active is 0, we have exhausted all active pixels and the
@@ -102,23 +315,27 @@
             _front_num_inactive += INACTIVE_RUN_LENGTH(_front);
             _front_num_active = ACTIVE_RUN_LENGTH(_front);
 #ifdef CCC_LAYERED
-            _front_num_active_frags = ACTIVE_RUN_LENGTH_FRAGMENTS(_front);
+            _front_num_active_frags = _front_single
+                ? _front_num_active
+                : (IceTSizeType)ACTIVE_RUN_LENGTH_FRAGMENTS(_front);
 #endif
-            _front += CCC_RUN_LENGTH_SIZE;
+            _front += CCC_FRONT_RUN_LENGTH_SIZE;
         }
         while(   (_back_num_active == 0)
               && ((_back_num_inactive + _pixel) < _num_pixels) ) {
             _back_num_inactive += INACTIVE_RUN_LENGTH(_back);
             _back_num_active = ACTIVE_RUN_LENGTH(_back);
 #ifdef CCC_LAYERED
-            _back_num_active_frags = ACTIVE_RUN_LENGTH_FRAGMENTS(_back);
+            _back_num_active_frags = _back_single
+                ? _back_num_active
+                : (IceTSizeType)ACTIVE_RUN_LENGTH_FRAGMENTS(_back);
 #endif
-            _back += CCC_RUN_LENGTH_SIZE;
+            _back += CCC_BACK_RUN_LENGTH_SIZE;
         }
 
         {
             IceTSizeType _dest_num_inactive
-                = CCC_MIN(_front_num_inactive, _back_num_inactive);
+                = CCC_CLAMP(CCC_MIN(_front_num_inactive, _back_num_inactive));
             if (_dest_num_inactive > 0) {
                 /* Record active pixel count.  (Special case on first iteration
                  * where there is no runlength and no place to put it.) */
@@ -153,17 +370,24 @@
 
         if ((0 < _front_num_inactive) && (0 < _back_num_active)) {
             IceTSizeType _pixels_to_copy
-                = CCC_MIN(_front_num_inactive, _back_num_active);
+                = CCC_CLAMP(CCC_MIN(_front_num_inactive, _back_num_active));
             size_t _bytes_to_copy;
 #ifdef CCC_LAYERED
             IceTSizeType _frags_to_copy;
 
-            if (_pixels_to_copy == _back_num_active) {
+            if (_back_count_size != _dest_count_size) {
+                /* Convert the pixels while copying, leaving nothing to copy
+                   below. */
+                _frags_to_copy = 0;
+                CCC_CONVERT_PIXELS(_back, _back_count_size, _pixels_to_copy,
+                                   _frags_to_copy);
+                _bytes_to_copy = 0;
+            } else if (_pixels_to_copy == _back_num_active) {
                 /* When using the rest of the active run, we already know the
                    number of fragments. */
                 _frags_to_copy = _back_num_active_frags;
-                _bytes_to_copy =  _pixels_to_copy*sizeof(IceTLayerCount)    /* Frags per pixel. */
-                                + _frags_to_copy*CCC_FRAGMENT_SIZE;         /* Fragment data. */
+                _bytes_to_copy =  _pixels_to_copy*_back_count_size  /* Frags per pixel. */
+                                + _frags_to_copy*CCC_FRAGMENT_SIZE;  /* Fragment data. */
             } else {
                 /* Otherwise we will have to iterate over the active pixels to
                    count the fragments. */
@@ -171,6 +395,7 @@
                 icetSparseLayeredImageScanFragments(&_new_back,
                                                     _pixels_to_copy,
                                                     CCC_FRAGMENT_SIZE,
+                                                    _back_count_size,
                                                     &_frags_to_copy);
                 _bytes_to_copy = (const IceTByte *)_new_back - _back;
             }
@@ -191,17 +416,24 @@
 
         if ((0 < _back_num_inactive) && (0 < _front_num_active)) {
             IceTSizeType _pixels_to_copy
-                = CCC_MIN(_back_num_inactive, _front_num_active);
+                = CCC_CLAMP(CCC_MIN(_back_num_inactive, _front_num_active));
             size_t _bytes_to_copy;
 #ifdef CCC_LAYERED
             IceTSizeType _frags_to_copy;
 
-            if (_pixels_to_copy == _front_num_active) {
+            if (_front_count_size != _dest_count_size) {
+                /* Convert the pixels while copying, leaving nothing to copy
+                   below. */
+                _frags_to_copy = 0;
+                CCC_CONVERT_PIXELS(_front, _front_count_size, _pixels_to_copy,
+                                   _frags_to_copy);
+                _bytes_to_copy = 0;
+            } else if (_pixels_to_copy == _front_num_active) {
                 /* When using the rest of the active run, we already know the
                    number of fragments. */
                 _frags_to_copy = _front_num_active_frags;
-                _bytes_to_copy =  _pixels_to_copy*sizeof(IceTLayerCount)    /* Frags per pixel. */
-                                + _frags_to_copy*CCC_FRAGMENT_SIZE;         /* Fragment data. */
+                _bytes_to_copy =  _pixels_to_copy*_front_count_size /* Frags per pixel. */
+                                + _frags_to_copy*CCC_FRAGMENT_SIZE; /* Fragment data. */
             } else {
                 /* Otherwise we will have to iterate over the active pixels to
                    count the fragments. */
@@ -209,6 +441,7 @@
                 icetSparseLayeredImageScanFragments(&_new_front,
                                                     _pixels_to_copy,
                                                     CCC_FRAGMENT_SIZE,
+                                                    _front_count_size,
                                                     &_frags_to_copy);
                 _bytes_to_copy = (const IceTByte *)_new_front - _front;
             }
@@ -229,14 +462,18 @@
 
         if ((_front_num_inactive == 0) && (_back_num_inactive == 0)) {
             IceTSizeType _num_to_composite
-                = CCC_MIN(_front_num_active, _back_num_active);
+                = CCC_CLAMP(CCC_MIN(_front_num_active, _back_num_active));
             _front_num_active -= _num_to_composite;
             _back_num_active -= _num_to_composite;
             _dest_num_active += _num_to_composite;
             _pixel += _num_to_composite;
+#ifdef CCC_COMPOSITE_RUN
+            CCC_COMPOSITE_RUN(_front, _back, _dest, _num_to_composite);
+#else
             for ( ; 0 < _num_to_composite; _num_to_composite--) {
                 CCC_COMPOSITE(_front, _back, _dest);
             }
+#endif
         }
     }
 
@@ -265,10 +502,18 @@
 }
 
 /* Undefine local macros. */
+#undef CCC_CLAMP
 #undef CCC_FRONT_COMPRESSED_IMAGE
 #undef CCC_BACK_COMPRESSED_IMAGE
 #undef CCC_DEST_COMPRESSED_IMAGE
+#ifdef CCC_COMPOSITE_RUN
+#undef CCC_COMPOSITE_RUN
+#else
 #undef CCC_COMPOSITE
+#endif
 #undef CCC_FRAGMENT_SIZE
 #undef CCC_LAYERED
 #undef CCC_RUN_LENGTH_SIZE
+#undef CCC_FRONT_RUN_LENGTH_SIZE
+#undef CCC_BACK_RUN_LENGTH_SIZE
+#undef CCC_CONVERT_PIXELS
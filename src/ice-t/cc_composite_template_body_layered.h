@@ -12,58 +12,159 @@
 #define CCCL_CONCAT_IMPL(a, b) a##b
 #define CCCL_CONCAT(a, b) CCCL_CONCAT_IMPL(a, b)
 
+/* When the fragment format has an alpha channel, accumulate the opacity of the
+ * fragment just written to the output pixel.  If an opacity cutoff is set and
+ * the accumulated opacity reaches it, the remaining fragments are hidden behind
+ * an (almost) opaque front and are dropped.  Fragments merged in later can only
+ * add to the opacity in front of the dropped ones, so their contribution to the
+ * final pixel color is bounded by 1 - cutoff.
+ */
+#ifdef CCCL_ALPHA
+#define CCCL_DECLARE_OPACITY IceTFloat opacity = 0.0f;
+#define CCCL_ACCUMULATE_OPACITY(frag)                                           \
+    if (_opacity_cutoff > 0.0f) {                                               \
+        opacity += (1.0f - opacity) * CCCL_ALPHA(frag);                         \
+        if (opacity >= _opacity_cutoff) {                                       \
+            goto CCCL_CONCAT(pixel_complete_, CCCL_FRAGMENT_TYPE);              \
+        }                                                                       \
+    }
+#else
+#define CCCL_DECLARE_OPACITY
+#define CCCL_ACCUMULATE_OPACITY(frag)
+#endif
+
+/* Normalized depth of a fragment, which is compared against the depth bounds
+ * of other processes when coalescing fragments. */
+#ifndef CCCL_DEPTH
+#define CCCL_DEPTH(frag) ((IceTFloat)(frag)->depth)
+#endif
+
+/* Append a fragment to the output pixel.  If a maximum number of fragments per
+ * pixel is set and the output pixel is full, the fragment is instead blended
+ * under the last one, as in a k-buffer.  The same happens if no process whose
+ * image is still to be merged has geometry between the last fragment and this
+ * one, since no fragment can end up between them anymore.  The blended fragment
+ * keeps the depth of its front-most part.  Fragments without an alpha channel
+ * cannot be blended, so the remaining ones are dropped.
+ */
+#ifdef CCCL_UNDER
+#define CCCL_APPEND_FRAGMENT(frag)                                              \
+    if (   (_num_blocked_depths >= 0)                                           \
+        && (dest_frag > dest_begin)                                             \
+        && icetDepthRangeIsClosed(_blocked_depths, _num_blocked_depths,         \
+                                  &blocked_first,                               \
+                                  CCCL_DEPTH(dest_frag - 1),                    \
+                                  CCCL_DEPTH(frag)) ) {                         \
+        CCCL_UNDER(frag, dest_frag - 1);                                        \
+    } else if (dest_frag < dest_limit) {                                        \
+        *(dest_frag++) = *(frag);                                               \
+    } else {                                                                    \
+        CCCL_UNDER(frag, dest_frag - 1);                                        \
+    }
+/* Fragments are appended in depth order, so the blocked depth intervals ending
+ * in front of the pixel are skipped once with a binary search, and
+ * icetDepthRangeIsClosed walks the rest from there. */
+#define CCCL_DECLARE_BLOCKED IceTInt blocked_first = 0;
+#define CCCL_FIND_BLOCKED(frag1, num_frags1, frag2, num_frags2)                 \
+    if ((_num_blocked_depths > 0) && (num_frags1 + num_frags2 > 1)) {           \
+        const CCCL_FRAGMENT_TYPE *const front_frag =                            \
+              (num_frags2 == 0)                                                 \
+           || ((num_frags1 > 0) && ((frag1)->depth <= (frag2)->depth))          \
+            ? (frag1) : (frag2);                                                \
+        blocked_first = icetDepthIntervalsFirstBehind(_blocked_depths,          \
+                                                      _num_blocked_depths,      \
+                                                      CCCL_DEPTH(front_frag));  \
+    }
+#else
+#define CCCL_APPEND_FRAGMENT(frag)                                              \
+    if (dest_frag < dest_limit) {                                               \
+        *(dest_frag++) = *(frag);                                               \
+    } else {                                                                    \
+        goto CCCL_CONCAT(pixel_complete_, CCCL_FRAGMENT_TYPE);                  \
+    }
+#define CCCL_DECLARE_BLOCKED
+#define CCCL_FIND_BLOCKED(frag1, num_frags1, frag2, num_frags2)
+#endif
+
 /* Combine two pixels from different images into one by merging their fragments
- * ordered by depth.  The order of the input images is arbitrary.
+ * ordered by depth.  The order of the input images is arbitrary, but pixel 1
+ * must be from the front and pixel 2 from the back image to tell whether they
+ * hold a single fragment without a preceding count.
  */
 #define CCC_COMPOSITE(pixel1_pointer, pixel2_pointer, dest_pointer)             \
 {                                                                               \
     /* Retrieve the number of fragments in each input pixel. */                 \
-    const IceTLayerCount num_frags1 = *(const IceTLayerCount *)pixel1_pointer;  \
-    const IceTLayerCount num_frags2 = *(const IceTLayerCount *)pixel2_pointer;  \
-    /* Advance pointers past the layer count. */                                \
+    const IceTLayerCount num_frags1 = _front_single                             \
+        ? 1 : LAYER_COUNT_GET(pixel1_pointer, _front_count_size);               \
+    const IceTLayerCount num_frags2 = _back_single                              \
+        ? 1 : LAYER_COUNT_GET(pixel2_pointer, _back_count_size);                \
+    /* Advance pointers past the layer count, if any. */                        \
     const CCCL_FRAGMENT_TYPE *frag1 = (const CCCL_FRAGMENT_TYPE *)              \
-                                     (pixel1_pointer + sizeof(IceTLayerCount)); \
+        (pixel1_pointer + _front_count_size);                                   \
     const CCCL_FRAGMENT_TYPE *frag2 = (const CCCL_FRAGMENT_TYPE *)              \
-                                     (pixel2_pointer + sizeof(IceTLayerCount)); \
-    CCCL_FRAGMENT_TYPE *dest_frag = (CCCL_FRAGMENT_TYPE *)                      \
-                                   (dest_pointer + sizeof(IceTLayerCount));     \
+        (pixel2_pointer + _back_count_size);                                    \
+    CCCL_FRAGMENT_TYPE *const dest_begin = (CCCL_FRAGMENT_TYPE *)               \
+                                   (dest_pointer + _dest_count_size);           \
+    CCCL_FRAGMENT_TYPE *dest_frag = dest_begin;                                 \
     /* Calculate the address past the last fragment in each pixel. */           \
     const CCCL_FRAGMENT_TYPE *const end1 = frag1 + num_frags1;                  \
     const CCCL_FRAGMENT_TYPE *const end2 = frag2 + num_frags2;                  \
+    /* Calculate the address past the last fragment that may be written. */     \
+    CCCL_FRAGMENT_TYPE *const dest_limit =                                      \
+          (_max_fragments > 0)                                                  \
+       && ((IceTLayerCount)_max_fragments < num_frags1 + num_frags2)            \
+        ? dest_begin + _max_fragments                                           \
+        : dest_begin + num_frags1 + num_frags2;                                 \
+    IceTLayerCount num_dest_frags;                                              \
+    const CCCL_FRAGMENT_TYPE *rest;                                             \
+    const CCCL_FRAGMENT_TYPE *rest_end;                                         \
+    CCCL_DECLARE_OPACITY                                                        \
+    CCCL_DECLARE_BLOCKED                                                        \
                                                                                 \
-    /* Write the total number of fragments to the ouput pixel. */               \
-    *(IceTLayerCount *)dest_pointer = num_frags1 + num_frags2;                  \
+    CCCL_FIND_BLOCKED(frag1, num_frags1, frag2, num_frags2)                     \
                                                                                 \
-    /* Copy pixels in order. */                                                 \
-    while (ICET_TRUE) {                                                         \
-        switch ((frag1 < end1) | ((frag2 < end2) << 1)) {                       \
-        case 0: /* All fragments have been copied, the pixel is complete. */    \
-            goto CCCL_CONCAT(pixel_complete_, CCCL_FRAGMENT_TYPE);              \
-        case 1: /* Only pixel 1 has a fragment left, copy it. */                \
-            *(dest_frag++) = *(frag1++);                                        \
-            continue;                                                           \
-        case 2: /* Only pixel 2 has a fragment left, copy it. */                \
-            *(dest_frag++) = *(frag2++);                                        \
-            continue;                                                           \
-        case 3: /* Both pixels have a fragment left, copy the one in front. */  \
-            if (frag1->depth <= frag2->depth) {                                 \
-                *(dest_frag++) = *(frag1++);                                    \
-            } else {                                                            \
-                *(dest_frag++) = *(frag2++);                                    \
-            }                                                                   \
-            continue;                                                           \
+    /* Copy fragments in order while both pixels have some left.  The one in   \
+     * front is selected without a branch, since the outcome of the depth      \
+     * comparison is hard to predict for interleaved fragments.  Ties take the  \
+     * fragment from pixel 1 first. */                                          \
+    while ((frag1 < end1) & (frag2 < end2)) {                                   \
+        const int take1 = (frag1->depth <= frag2->depth);                       \
+        const CCCL_FRAGMENT_TYPE *const next_frag = take1 ? frag1 : frag2;      \
+        frag1 += take1;                                                         \
+        frag2 += 1 - take1;                                                     \
+        CCCL_APPEND_FRAGMENT(next_frag);                                        \
+        CCCL_ACCUMULATE_OPACITY(next_frag);                                     \
+    }                                                                           \
+    /* Copy the remaining fragments of the other pixel.  Without an opacity     \
+     * cutoff, fragment limit or coalescing in effect, no checks are needed. */ \
+    rest = (frag1 < end1) ? frag1 : frag2;                                      \
+    rest_end = (frag1 < end1) ? end1 : end2;                                    \
+    if (   (_opacity_cutoff <= 0.0f)                                            \
+        && (_num_blocked_depths < 0)                                            \
+        && (dest_frag + (rest_end - rest) <= dest_limit) ) {                    \
+        for (; rest < rest_end; rest++) {                                       \
+            *(dest_frag++) = *rest;                                             \
+        }                                                                       \
+    } else {                                                                    \
+        for (; rest < rest_end; rest++) {                                       \
+            CCCL_APPEND_FRAGMENT(rest);                                         \
+            CCCL_ACCUMULATE_OPACITY(rest);                                      \
         }                                                                       \
     }                                                                           \
     /* Label to break from the loop, tagged with the fragment type to           \
      * distinguish between template instantiations. */                          \
     CCCL_CONCAT(pixel_complete_, CCCL_FRAGMENT_TYPE):;                          \
+    /* Write the number of kept fragments to the ouput pixel. */                \
+    num_dest_frags = (IceTLayerCount)(dest_frag - dest_begin);                  \
+    LAYER_COUNT_SET(dest_pointer, _dest_count_size, num_dest_frags);            \
+    if (num_dest_frags > _dest_max_frags) _dest_max_frags = num_dest_frags;     \
     /* Count fragments as processed. */                                         \
     _front_num_active_frags -= num_frags1;                                      \
     _back_num_active_frags -= num_frags2;                                       \
-    _dest_num_active_frags += num_frags1 + num_frags2;                          \
-    /* Advance pointers past the pixel. */                                      \
-    pixel1_pointer = (const IceTByte*)frag1;                                    \
-    pixel2_pointer = (const IceTByte*)frag2;                                    \
+    _dest_num_active_frags += num_dest_frags;                                   \
+    /* Advance pointers past the pixel, including any dropped fragments. */     \
+    pixel1_pointer = (const IceTByte*)end1;                                     \
+    pixel2_pointer = (const IceTByte*)end2;                                     \
     dest_pointer = (IceTByte*)dest_frag;                                        \
 }
 
@@ -80,4 +181,12 @@
 /* Undefine local macros. */
 #undef CCCL_CONCAT
 #undef CCCL_CONCAT_IMPl
+#undef CCCL_DECLARE_OPACITY
+#undef CCCL_ACCUMULATE_OPACITY
+#undef CCCL_APPEND_FRAGMENT
+#undef CCCL_DECLARE_BLOCKED
+#undef CCCL_FIND_BLOCKED
+#undef CCCL_DEPTH
 #undef CCCL_FRAGMENT_TYPE
+#undef CCCL_ALPHA
+#undef CCCL_UNDER
@@ -36,6 +36,10 @@
  *              pixels in memory.  If defined, then REGION_OFFSET_X,
  *              REGION_OFFSET_Y, REGION_WIDTH, and REGION_HEIGHT must also be
  *              defined.
+ *      UNTIMED - If defined, the compression is neither timed nor reported
+ *              with icetRaiseDebug, so that several threads can compress
+ *              parts of an image at once.  The caller is responsible for
+ *              timing the compression.
  *
  * All of the above macros are undefined at the end of this file.
  */
@@ -61,6 +65,10 @@
 #endif
 #endif
 
+#ifdef UNTIMED
+#define CT_UNTIMED
+#endif
+
 {
     IceTEnum _color_format, _depth_format;
     IceTSizeType _pixel_count;
@@ -171,8 +179,20 @@
                                     _depth += _region_x_skip;           \
                                     _region_count = 0;                  \
                                 }
+#define CT_SCAN_RUN(active, max) icetScanRunDepthf(_depth,              \
+                                MIN(max, _region_width-_region_count),  \
+                                active)
+#define CT_ADVANCE_PIXELS(count) _color += (count);  _depth += (count); \
+                                _region_count += (count);               \
+                                if (_region_count >= _region_width) {   \
+                                    _color += _region_x_skip;           \
+                                    _depth += _region_x_skip;           \
+                                    _region_count = 0;                  \
+                                }
 #else
 #define CT_INCREMENT_PIXEL()    _color++;  _depth++;
+#define CT_SCAN_RUN(active, max) icetScanRunDepthf(_depth, max, active)
+#define CT_ADVANCE_PIXELS(count) _color += (count);  _depth += (count);
 #endif
 #ifdef PADDING
 #define CT_PADDING
@@ -216,8 +236,80 @@
                                     _depth += _region_x_skip;           \
                                     _region_count = 0;                  \
                                 }
+#define CT_SCAN_RUN(active, max) icetScanRunDepthf(_depth,              \
+                                MIN(max, _region_width-_region_count),  \
+                                active)
+#define CT_ADVANCE_PIXELS(count) _color += 4*(count);  _depth += (count);\
+                                _region_count += (count);               \
+                                if (_region_count >= _region_width) {   \
+                                    _color += 4*_region_x_skip;         \
+                                    _depth += _region_x_skip;           \
+                                    _region_count = 0;                  \
+                                }
 #else
 #define CT_INCREMENT_PIXEL()    _color += 4;  _depth++;
+#define CT_SCAN_RUN(active, max) icetScanRunDepthf(_depth, max, active)
+#define CT_ADVANCE_PIXELS(count) _color += 4*(count);  _depth += (count);
+#endif
+#ifdef PADDING
+#define CT_PADDING
+#define CT_SPACE_BOTTOM         SPACE_BOTTOM
+#define CT_SPACE_TOP            SPACE_TOP
+#define CT_SPACE_LEFT           SPACE_LEFT
+#define CT_SPACE_RIGHT          SPACE_RIGHT
+#define CT_FULL_WIDTH           FULL_WIDTH
+#define CT_FULL_HEIGHT          FULL_HEIGHT
+#endif
+#include "compress_template_body.h"
+#undef CT_ACTIVE
+#undef CT_WRITE_PIXEL
+            } else if (_color_format == ICET_IMAGE_COLOR_RGBA_HALF) {
+                const IceTUShort *_color;
+                IceTUShort *_c_out;
+                IceTFloat *_d_out;
+#ifdef REGION
+                IceTSizeType _region_count = 0;
+#endif
+                _color = icetImageGetColorConstVoid(INPUT_IMAGE, NULL);
+#ifdef OFFSET
+                _color += 4*(OFFSET);
+#endif
+#define CT_COMPRESSED_IMAGE     OUTPUT_SPARSE_IMAGE
+#define CT_COLOR_FORMAT         _color_format
+#define CT_DEPTH_FORMAT         _depth_format
+#define CT_PIXEL_COUNT          _pixel_count
+#define CT_ACTIVE()             (_depth[0] < 1.0)
+#define CT_WRITE_PIXEL(dest)    _c_out = (IceTUShort *)dest;    \
+                                _c_out[0] = _color[0];          \
+                                _c_out[1] = _color[1];          \
+                                _c_out[2] = _color[2];          \
+                                _c_out[3] = _color[3];          \
+                                dest += 4*sizeof(IceTUShort);   \
+                                _d_out = (IceTFloat *)dest;     \
+                                _d_out[0] = _depth[0];          \
+                                dest += sizeof(IceTFloat);
+#ifdef REGION
+#define CT_INCREMENT_PIXEL()    _color += 4;  _depth++;                 \
+                                _region_count++;                        \
+                                if (_region_count >= _region_width) {   \
+                                    _color += 4*_region_x_skip;         \
+                                    _depth += _region_x_skip;           \
+                                    _region_count = 0;                  \
+                                }
+#define CT_SCAN_RUN(active, max) icetScanRunDepthf(_depth,              \
+                                MIN(max, _region_width-_region_count),  \
+                                active)
+#define CT_ADVANCE_PIXELS(count) _color += 4*(count);  _depth += (count);\
+                                _region_count += (count);               \
+                                if (_region_count >= _region_width) {   \
+                                    _color += 4*_region_x_skip;         \
+                                    _depth += _region_x_skip;           \
+                                    _region_count = 0;                  \
+                                }
+#else
+#define CT_INCREMENT_PIXEL()    _color += 4;  _depth++;
+#define CT_SCAN_RUN(active, max) icetScanRunDepthf(_depth, max, active)
+#define CT_ADVANCE_PIXELS(count) _color += 4*(count);  _depth += (count);
 #endif
 #ifdef PADDING
 #define CT_PADDING
@@ -260,8 +352,20 @@
                                     _depth += _region_x_skip;           \
                                     _region_count = 0;                  \
                                 }
+#define CT_SCAN_RUN(active, max) icetScanRunDepthf(_depth,              \
+                                MIN(max, _region_width-_region_count),  \
+                                active)
+#define CT_ADVANCE_PIXELS(count) _color += 3*(count);  _depth += (count);\
+                                _region_count += (count);               \
+                                if (_region_count >= _region_width) {   \
+                                    _color += 3*_region_x_skip;         \
+                                    _depth += _region_x_skip;           \
+                                    _region_count = 0;                  \
+                                }
 #else
 #define CT_INCREMENT_PIXEL()    _color += 3;  _depth++;
+#define CT_SCAN_RUN(active, max) icetScanRunDepthf(_depth, max, active)
+#define CT_ADVANCE_PIXELS(count) _color += 3*(count);  _depth += (count);
 #endif
 #ifdef PADDING
 #define CT_PADDING
@@ -295,8 +399,19 @@
                                     _depth += _region_x_skip;           \
                                     _region_count = 0;                  \
                                 }
+#define CT_SCAN_RUN(active, max) icetScanRunDepthf(_depth,              \
+                                MIN(max, _region_width-_region_count),  \
+                                active)
+#define CT_ADVANCE_PIXELS(count) _depth += (count);                     \
+                                _region_count += (count);               \
+                                if (_region_count >= _region_width) {   \
+                                    _depth += _region_x_skip;           \
+                                    _region_count = 0;                  \
+                                }
 #else
 #define CT_INCREMENT_PIXEL()    _depth++;
+#define CT_SCAN_RUN(active, max) icetScanRunDepthf(_depth, max, active)
+#define CT_ADVANCE_PIXELS(count) _depth += (count);
 #endif
 #ifdef PADDING
 #define CT_PADDING
@@ -356,8 +471,23 @@
                                     _color += _region_x_skip;           \
                                     _region_count = 0;                  \
                                 }
+#define CT_SCAN_RUN(active, max)                                        \
+                                icetScanRunAlphaub(                     \
+                                    (const IceTUByte *)_color,          \
+                                    MIN(max, _region_width-_region_count),\
+                                    active)
+#define CT_ADVANCE_PIXELS(count) _color += (count);                     \
+                                _region_count += (count);               \
+                                if (_region_count >= _region_width) {   \
+                                    _color += _region_x_skip;           \
+                                    _region_count = 0;                  \
+                                }
 #else
 #define CT_INCREMENT_PIXEL()    _color++;
+#define CT_SCAN_RUN(active, max)                                        \
+                                icetScanRunAlphaub(                     \
+                                    (const IceTUByte *)_color, max, active)
+#define CT_ADVANCE_PIXELS(count) _color += (count);
 #endif
 #ifdef PADDING
 #define CT_PADDING
@@ -399,8 +529,73 @@
                                     _color += 4*_region_x_skip;         \
                                     _region_count = 0;                  \
                                 }
+#define CT_SCAN_RUN(active, max) icetScanRunAlphaf(_color,              \
+                                MIN(max, _region_width-_region_count),  \
+                                active)
+#define CT_ADVANCE_PIXELS(count) _color += 4*(count);                   \
+                                _region_count += (count);               \
+                                if (_region_count >= _region_width) {   \
+                                    _color += 4*_region_x_skip;         \
+                                    _region_count = 0;                  \
+                                }
+#else
+#define CT_INCREMENT_PIXEL()    _color += 4;
+#define CT_SCAN_RUN(active, max) icetScanRunAlphaf(_color, max, active)
+#define CT_ADVANCE_PIXELS(count) _color += 4*(count);
+#endif
+#ifdef PADDING
+#define CT_PADDING
+#define CT_SPACE_BOTTOM         SPACE_BOTTOM
+#define CT_SPACE_TOP            SPACE_TOP
+#define CT_SPACE_LEFT           SPACE_LEFT
+#define CT_SPACE_RIGHT          SPACE_RIGHT
+#define CT_FULL_WIDTH           FULL_WIDTH
+#define CT_FULL_HEIGHT          FULL_HEIGHT
+#endif
+#include "compress_template_body.h"
+#undef CT_ACTIVE
+#undef CT_WRITE_PIXEL
+        } else if (_color_format == ICET_IMAGE_COLOR_RGBA_HALF) {
+            const IceTUShort *_color;
+            IceTUShort *_out;
+#ifdef REGION
+            IceTSizeType _region_count = 0;
+#endif
+            _color = icetImageGetColorConstVoid(INPUT_IMAGE, NULL);
+#ifdef OFFSET
+            _color += 4*(OFFSET);
+#endif
+#define CT_COMPRESSED_IMAGE     OUTPUT_SPARSE_IMAGE
+#define CT_COLOR_FORMAT         _color_format
+#define CT_DEPTH_FORMAT         _depth_format
+#define CT_PIXEL_COUNT          _pixel_count
+#define CT_ACTIVE()             ((_color[3] & 0x7FFF) != 0)
+#define CT_WRITE_PIXEL(dest)    _out = (IceTUShort *)dest;      \
+                                _out[0] = _color[0];            \
+                                _out[1] = _color[1];            \
+                                _out[2] = _color[2];            \
+                                _out[3] = _color[3];            \
+                                dest += 4*sizeof(IceTUShort);
+#ifdef REGION
+#define CT_INCREMENT_PIXEL()    _color += 4;                            \
+                                _region_count++;                        \
+                                if (_region_count >= _region_width) {   \
+                                    _color += 4*_region_x_skip;         \
+                                    _region_count = 0;                  \
+                                }
+#define CT_SCAN_RUN(active, max) icetScanRunAlphah(_color,              \
+                                MIN(max, _region_width-_region_count),  \
+                                active)
+#define CT_ADVANCE_PIXELS(count) _color += 4*(count);                   \
+                                _region_count += (count);               \
+                                if (_region_count >= _region_width) {   \
+                                    _color += 4*_region_x_skip;         \
+                                    _region_count = 0;                  \
+                                }
 #else
 #define CT_INCREMENT_PIXEL()    _color += 4;
+#define CT_SCAN_RUN(active, max) icetScanRunAlphah(_color, max, active)
+#define CT_ADVANCE_PIXELS(count) _color += 4*(count);
 #endif
 #ifdef PADDING
 #define CT_PADDING
@@ -419,7 +614,7 @@
             icetRaiseError(
                 ICET_INVALID_VALUE,
                 "Compressing image for blending with no alpha channel.");
-            _out = ICET_IMAGE_DATA(OUTPUT_SPARSE_IMAGE);
+            _out = ICET_SPARSE_IMAGE_DATA(OUTPUT_SPARSE_IMAGE);
             INACTIVE_RUN_LENGTH(_out) = _pixel_count;
             ACTIVE_RUN_LENGTH(_out) = 0;
             _out++;
@@ -428,7 +623,7 @@
             IceTUInt *_out;
             icetRaiseWarning(ICET_INVALID_OPERATION,
                              "Compressing image with no data.");
-            _out = ICET_IMAGE_DATA(OUTPUT_SPARSE_IMAGE);
+            _out = ICET_SPARSE_IMAGE_DATA(OUTPUT_SPARSE_IMAGE);
             INACTIVE_RUN_LENGTH(_out) = _pixel_count;
             ACTIVE_RUN_LENGTH(_out) = 0;
             _out++;
@@ -449,6 +644,10 @@
     } else { /* Input image is layered. */
         const IceTSizeType _num_layers =
             icetLayeredImageGetHeaderConst(INPUT_IMAGE)->num_layers;
+        /* Whether active fragments may be stored in any order rather than
+         * front to back. */
+        const IceTBoolean _sort_fragments =
+            icetIsEnabled(ICET_SORT_INPUT_FRAGMENTS);
 
         switch (_composite_mode) {
         /* When only the closest fragment of each pixel is kept, the output
@@ -466,11 +665,23 @@
 /* Since active fragments must be ordered before inactive ones, it is sufficient
  * to check the first one.
  */
-#define CT_ACTIVE() (_depth[0] < 1.0)
+#define CT_ACTIVE() (CTL_DEPTH(0) < 1.0)
 
-/* Copy the front-most fragment, which must be stored first.
+/* Copy the front-most fragment, which is stored first unless the fragments are
+ * unsorted, in which case it is searched for among the active ones.
  */
-#define CT_WRITE_PIXEL(dest) CTL_WRITE_FRAGMENT(0, dest);
+#define CT_WRITE_PIXEL(dest)                                                    \
+{                                                                               \
+    IceTSizeType front = 0;                                                     \
+    if (_sort_fragments) {                                                      \
+        for (IceTSizeType layer = 1;                                            \
+             (layer < _num_layers) && (CTL_DEPTH(layer) < 1.0);                 \
+             layer++) {                                                         \
+            if (CTL_DEPTH(layer) < CTL_DEPTH(front)) front = layer;             \
+        }                                                                       \
+    }                                                                           \
+    CTL_WRITE_FRAGMENT(front, dest);                                            \
+}
 
             /* Instantiate template for all possible fragment formats. */
             switch (_depth_format) {
@@ -497,6 +708,12 @@
                 case ICET_IMAGE_COLOR_RGBA_FLOAT:
 #define CTL_COLOR_TYPE      IceTFloat
 #define CTL_COLOR_CHANNELS  4
+#include "compress_template_body_layered.h"
+                    break;
+
+                case ICET_IMAGE_COLOR_RGBA_HALF:
+#define CTL_COLOR_TYPE      IceTUShort
+#define CTL_COLOR_CHANNELS  4
 #include "compress_template_body_layered.h"
                     break;
 
@@ -508,6 +725,12 @@
 #undef CTL_DEPTH_TYPE
                 break; /* case ICET_IMAGE_DEPTH_FLOAT */
 
+            case ICET_IMAGE_DEPTH_USHORT:
+                icetRaiseError(ICET_INVALID_OPERATION,
+                               "16-bit depths are only supported for blending "
+                               "layered images.");
+                break;
+
             case ICET_IMAGE_DEPTH_NONE:
                 icetRaiseError(ICET_SANITY_CHECK_FAIL,
                                "Layered images must contain depth information.");
@@ -525,7 +748,30 @@
 #undef CT_WRITE_PIXEL
             break; /* case ICET_COMPOSITE_MODE_Z_BUFFER */
 
-        case ICET_COMPOSITE_MODE_BLEND:
+        case ICET_COMPOSITE_MODE_BLEND: {
+            /* Fragments beyond this number are blended into the last kept
+             * fragment of a pixel, so that no compressed image exceeds the
+             * limit set by ICET_MAX_FRAGMENTS_PER_PIXEL. */
+            IceTInt _max_fragments;
+            /* Indices of the active fragments of the current pixel ordered
+             * front to back, if they need to be sorted. */
+            IceTLayerCount *_fragment_order = NULL;
+            /* No fragments of other processes can lie between those of a
+             * process with convex data, so they are blended into a single
+             * fragment per pixel right away.  Like images with only one
+             * layer, the output is then stored without fragment counts. */
+            const IceTBoolean _single_fragment =
+                (_num_layers == 1) || icetIsEnabled(ICET_CONVEX_DATA);
+            const IceTSizeType _run_length_size =
+                _single_fragment ? RUN_LENGTH_SIZE : RUN_LENGTH_SIZE_LAYERED;
+            /* Number of bytes with which the number of active fragments of
+             * each pixel is stored. */
+            const IceTSizeType _count_size =
+                icetLayerCountSizeForLayers(_num_layers);
+            /* Largest number of fragments written to a pixel, which decides
+             * the count size of images this one is composited into. */
+            IceTLayerCount _max_pixel_size = 0;
+
             /* The over-operator is non-commutative, so it can only be applied
              * once fragments have been collected from all ranks.  Until then,
              * all fragments must be stored separately in a layered image. */
@@ -535,37 +781,153 @@
                 break;
             }
 
+            icetSparseImageSetSingleFragment(OUTPUT_SPARSE_IMAGE,
+                                             _single_fragment);
+            icetSparseImageSetLayerCountSize(OUTPUT_SPARSE_IMAGE, _count_size);
+
+            icetGetIntegerv(ICET_MAX_FRAGMENTS_PER_PIXEL, &_max_fragments);
+            if ((_max_fragments <= 0) || (_max_fragments > _num_layers)) {
+                _max_fragments = (IceTInt)_num_layers;
+            }
+            if (_single_fragment) _max_fragments = 1;
+
+            if (_sort_fragments) {
+                _fragment_order = icetGetStateBuffer(
+                    ICET_SORT_FRAGMENTS_BUF,
+                    _num_layers*sizeof(IceTLayerCount));
+            }
+
 /* Track and store the number of active fragments in each run, since there is no
  * fixed number of fragments per pixel.
  */
 #define CT_ACTIVE_FRAGS     _active_frags
-#define CT_RUN_LENGTH_SIZE  RUN_LENGTH_SIZE_LAYERED
+#define CT_RUN_LENGTH_SIZE  _run_length_size
 
 /* Active fragments must come first.
  */
-#define CT_ACTIVE() (_color[CTL_ALPHA_CHANNEL] != 0)
+#define CT_ACTIVE() (CTL_COLOR(0)[CTL_ALPHA_CHANNEL] != 0)
 
-/* Copy fragments until an inactive one is encountered.
+/* Whether fragment `a` of the current pixel belongs in front of fragment `b`.
+ * Ties are broken by index, so that sorting gives the same result as a stable
+ * sort.
+ */
+#define CT_FRAGMENT_BEFORE(a, b)                                                \
+    (   (CTL_DEPTH(a) < CTL_DEPTH(b))                                           \
+     || ((CTL_DEPTH(a) == CTL_DEPTH(b)) && ((a) < (b))) )
+
+/* Compare-exchange two entries of `_fragment_order` without branching. */
+#define CT_SORT_PAIR(i, j)                                                      \
+{                                                                               \
+    const IceTLayerCount first = _fragment_order[i];                            \
+    const IceTLayerCount second = _fragment_order[j];                           \
+    const int in_order = CT_FRAGMENT_BEFORE(first, second);                     \
+    _fragment_order[i] = in_order ? first : second;                             \
+    _fragment_order[j] = in_order ? second : first;                             \
+}
+
+/* Sort the indices of the first `count` fragments of the current pixel front to
+ * back into `_fragment_order`.  Pixels rarely hold many fragments, so small
+ * counts use optimal sorting networks and larger ones an insertion sort.
+ */
+#define CT_SORT_FRAGMENTS(count)                                                \
+{                                                                               \
+    for (IceTLayerCount i = 0; i < count; i++) _fragment_order[i] = i;          \
+    switch (count) {                                                            \
+    case 0:                                                                     \
+    case 1:                                                                     \
+        break;                                                                  \
+    case 2:                                                                     \
+        CT_SORT_PAIR(0, 1);                                                     \
+        break;                                                                  \
+    case 3:                                                                     \
+        CT_SORT_PAIR(1, 2); CT_SORT_PAIR(0, 2); CT_SORT_PAIR(0, 1);             \
+        break;                                                                  \
+    case 4:                                                                     \
+        CT_SORT_PAIR(0, 1); CT_SORT_PAIR(2, 3); CT_SORT_PAIR(0, 2);             \
+        CT_SORT_PAIR(1, 3); CT_SORT_PAIR(1, 2);                                 \
+        break;                                                                  \
+    case 5:                                                                     \
+        CT_SORT_PAIR(0, 1); CT_SORT_PAIR(3, 4); CT_SORT_PAIR(2, 4);             \
+        CT_SORT_PAIR(2, 3); CT_SORT_PAIR(0, 3); CT_SORT_PAIR(0, 2);             \
+        CT_SORT_PAIR(1, 4); CT_SORT_PAIR(1, 3); CT_SORT_PAIR(1, 2);             \
+        break;                                                                  \
+    case 6:                                                                     \
+        CT_SORT_PAIR(1, 2); CT_SORT_PAIR(0, 2); CT_SORT_PAIR(0, 1);             \
+        CT_SORT_PAIR(4, 5); CT_SORT_PAIR(3, 5); CT_SORT_PAIR(3, 4);             \
+        CT_SORT_PAIR(0, 3); CT_SORT_PAIR(1, 4); CT_SORT_PAIR(2, 5);             \
+        CT_SORT_PAIR(2, 4); CT_SORT_PAIR(1, 3); CT_SORT_PAIR(2, 3);             \
+        break;                                                                  \
+    case 7:                                                                     \
+        CT_SORT_PAIR(0, 1); CT_SORT_PAIR(2, 3); CT_SORT_PAIR(4, 5);             \
+        CT_SORT_PAIR(0, 2); CT_SORT_PAIR(1, 3); CT_SORT_PAIR(4, 6);             \
+        CT_SORT_PAIR(1, 2); CT_SORT_PAIR(5, 6); CT_SORT_PAIR(0, 4);             \
+        CT_SORT_PAIR(1, 5); CT_SORT_PAIR(2, 6); CT_SORT_PAIR(1, 4);             \
+        CT_SORT_PAIR(3, 6); CT_SORT_PAIR(2, 4); CT_SORT_PAIR(3, 5);             \
+        CT_SORT_PAIR(3, 4);                                                     \
+        break;                                                                  \
+    case 8:                                                                     \
+        CT_SORT_PAIR(0, 1); CT_SORT_PAIR(2, 3); CT_SORT_PAIR(4, 5);             \
+        CT_SORT_PAIR(6, 7); CT_SORT_PAIR(0, 2); CT_SORT_PAIR(1, 3);             \
+        CT_SORT_PAIR(4, 6); CT_SORT_PAIR(5, 7); CT_SORT_PAIR(1, 2);             \
+        CT_SORT_PAIR(5, 6); CT_SORT_PAIR(0, 4); CT_SORT_PAIR(3, 7);             \
+        CT_SORT_PAIR(1, 5); CT_SORT_PAIR(2, 6); CT_SORT_PAIR(1, 4);             \
+        CT_SORT_PAIR(3, 6); CT_SORT_PAIR(2, 4); CT_SORT_PAIR(3, 5);             \
+        CT_SORT_PAIR(3, 4);                                                     \
+        break;                                                                  \
+    default:                                                                    \
+        for (IceTLayerCount i = 1; i < count; i++) {                            \
+            const IceTLayerCount layer = _fragment_order[i];                    \
+            IceTLayerCount j = i;                                               \
+            for (; (j > 0) && CT_FRAGMENT_BEFORE(layer, _fragment_order[j-1]);  \
+                 j--) {                                                         \
+                _fragment_order[j] = _fragment_order[j-1];                      \
+            }                                                                   \
+            _fragment_order[j] = layer;                                         \
+        }                                                                       \
+    }                                                                           \
+}
+
+/* Copy fragments until an inactive one is encountered, sorting them first if
+ * requested.
  */
 #define CT_WRITE_PIXEL(dest)                                                    \
 {                                                                               \
     /* Count active fragments. */                                               \
+    IceTLayerCount num_active = 0;                                              \
     IceTLayerCount pixel_size = 0;                                              \
                                                                                 \
     /* Leave room to store the number of active fragments and                   \
      * remember the location. */                                                \
-    IceTLayerCount *const pixel_size_out = (IceTLayerCount *)dest;              \
-    dest += sizeof(IceTLayerCount);                                             \
+    IceTByte *const pixel_size_out = (IceTByte *)dest;                          \
+    if (!_single_fragment) dest += _count_size;                                 \
                                                                                 \
-    /* Copy active fragments, which must come first. */                         \
-    for (IceTLayerCount layer = 0; layer < _num_layers; ++layer) {              \
-        if (_color[layer*CTL_COLOR_CHANNELS + CTL_ALPHA_CHANNEL] == 0) break;   \
+    /* Find the active fragments, which must come first. */                     \
+    while (num_active < (IceTLayerCount)_num_layers) {                          \
+        if (CTL_COLOR(num_active)[CTL_ALPHA_CHANNEL] == 0) {                    \
+            break;                                                              \
+        }                                                                       \
+        ++num_active;                                                           \
+    }                                                                           \
+    if (_sort_fragments) CT_SORT_FRAGMENTS(num_active);                         \
+                                                                                \
+    /* Copy active fragments front to back. */                                  \
+    for (IceTLayerCount n = 0; n < num_active; ++n) {                           \
+        const IceTLayerCount layer = _sort_fragments ? _fragment_order[n] : n;  \
+        if (pixel_size == (IceTLayerCount)_max_fragments) {                     \
+            /* Blend fragments beyond the maximum under the last kept one. */   \
+            CTL_UNDER(CTL_COLOR(layer),                                         \
+                      (CTL_COLOR_TYPE *)(dest - CTL_FRAGMENT_SIZE));            \
+            continue;                                                           \
+        }                                                                       \
         CTL_WRITE_FRAGMENT(layer, dest);                                        \
         ++pixel_size;                                                           \
     }                                                                           \
                                                                                 \
     /* Write the number of active fragments to the reserved location. */        \
-    *pixel_size_out = pixel_size;                                               \
+    if (!_single_fragment) {                                                    \
+        LAYER_COUNT_SET(pixel_size_out, _count_size, pixel_size);               \
+    }                                                                           \
+    if (pixel_size > _max_pixel_size) _max_pixel_size = pixel_size;             \
     CT_ACTIVE_FRAGS += pixel_size;                                              \
 }
 
@@ -579,16 +941,30 @@
 #define CTL_COLOR_TYPE      IceTUByte
 #define CTL_COLOR_CHANNELS  4
 #define CTL_ALPHA_CHANNEL   3
+#define CTL_UNDER           ICET_UNDER_UBYTE
 #include "compress_template_body_layered.h"
 #undef CTL_ALPHA_CHANNEL
+#undef CTL_UNDER
                     break;
 
                 case ICET_IMAGE_COLOR_RGBA_FLOAT:
 #define CTL_COLOR_TYPE      IceTFloat
 #define CTL_COLOR_CHANNELS  4
 #define CTL_ALPHA_CHANNEL   3
+#define CTL_UNDER           ICET_UNDER_FLOAT
+#include "compress_template_body_layered.h"
+#undef CTL_ALPHA_CHANNEL
+#undef CTL_UNDER
+                    break;
+
+                case ICET_IMAGE_COLOR_RGBA_HALF:
+#define CTL_COLOR_TYPE      IceTUShort
+#define CTL_COLOR_CHANNELS  4
+#define CTL_ALPHA_CHANNEL   3
+#define CTL_UNDER           ICET_UNDER_HALF
 #include "compress_template_body_layered.h"
 #undef CTL_ALPHA_CHANNEL
+#undef CTL_UNDER
                     break;
 
                 case ICET_IMAGE_COLOR_RGB_FLOAT:
@@ -606,6 +982,53 @@
 #undef CTL_DEPTH_TYPE
                 break; /* case ICET_IMAGE_DEPTH_FLOAT */
 
+            case ICET_IMAGE_DEPTH_USHORT:
+#define CTL_DEPTH_TYPE  IceTUShort
+
+                switch (_color_format) {
+                case ICET_IMAGE_COLOR_RGBA_UBYTE:
+#define CTL_COLOR_TYPE      IceTUByte
+#define CTL_COLOR_CHANNELS  4
+#define CTL_ALPHA_CHANNEL   3
+#define CTL_UNDER           ICET_UNDER_UBYTE
+#include "compress_template_body_layered.h"
+#undef CTL_ALPHA_CHANNEL
+#undef CTL_UNDER
+                    break;
+
+                case ICET_IMAGE_COLOR_RGBA_HALF:
+#define CTL_COLOR_TYPE      IceTUShort
+#define CTL_COLOR_CHANNELS  4
+#define CTL_ALPHA_CHANNEL   3
+#define CTL_UNDER           ICET_UNDER_HALF
+#include "compress_template_body_layered.h"
+#undef CTL_ALPHA_CHANNEL
+#undef CTL_UNDER
+                    break;
+
+                case ICET_IMAGE_COLOR_RGBA_FLOAT:
+                    /* The fragment type of this combination would contain
+                     * padding, which compressed fragments do not. */
+                    icetRaiseError(ICET_INVALID_OPERATION,
+                                   "16-bit depths cannot be combined with "
+                                   "float colors in layered images.");
+                    break;
+
+                case ICET_IMAGE_COLOR_RGB_FLOAT:
+                case ICET_IMAGE_COLOR_NONE:
+                    icetRaiseError(ICET_INVALID_OPERATION,
+                                   "Blending requires a color format with an alpha channel.");
+                    break;
+
+                default:
+                    icetRaiseError(ICET_SANITY_CHECK_FAIL,
+                                   "Encountered invalid color format %#X.",
+                                   _color_format);
+                }
+
+#undef CTL_DEPTH_TYPE
+                break; /* case ICET_IMAGE_DEPTH_USHORT */
+
             case ICET_IMAGE_DEPTH_NONE:
                 icetRaiseError(ICET_SANITY_CHECK_FAIL,
                                "Layered images must contain depth information.");
@@ -617,12 +1040,19 @@
                                _depth_format);
             } /* end switch (_depth_format) */
 
+            icetSparseImageSetMaxFragments(OUTPUT_SPARSE_IMAGE,
+                                           _max_pixel_size);
+
 /* Undefine macros common to composite mode "blend". */
 #undef CT_ACTIVE_FRAGS
 #undef CT_RUN_LENGTH_SIZE
 #undef CT_ACTIVE
 #undef CT_WRITE_PIXEL
-            break; /* case ICET_COMPOSITE_MODE_BLEND */
+#undef CT_FRAGMENT_BEFORE
+#undef CT_SORT_PAIR
+#undef CT_SORT_FRAGMENTS
+            break;
+        } /* case ICET_COMPOSITE_MODE_BLEND */
         default:
             icetRaiseError(ICET_SANITY_CHECK_FAIL,
                            "Encountered invalid composite mode %#X.",
@@ -630,6 +1060,7 @@
         } /* end switch (_composite_mode) */
     } /* end if (isLayered(INPUT_IMAGE)) */
 
+#ifndef UNTIMED
     icetRaiseDebug("Compression: %f%%\n",
         100.0f - (  100.0f*icetSparseImageGetCompressedBufferSize(OUTPUT_SPARSE_IMAGE)
                   /(  icetImageIsLayered(INPUT_IMAGE)
@@ -645,6 +1076,7 @@
                                   icetSparseImageGetWidth(OUTPUT_SPARSE_IMAGE),
                                   icetSparseImageGetHeight(OUTPUT_SPARSE_IMAGE))
                   ) ));
+#endif
 }
 
 #undef INPUT_IMAGE
@@ -675,3 +1107,8 @@
 #ifdef PIXEL_COUNT
 #undef PIXEL_COUNT
 #endif
+
+#ifdef UNTIMED
+#undef UNTIMED
+#undef CT_UNTIMED
+#endif
@@ -25,7 +25,8 @@
  *     *CT_RUN_LENGTH_SIZE - the number of `IceTRunLengthType` values stored per
  *              run.  Should be either `RUN_LENGTH_SIZE` or
  *              `RUN_LENGTH_SIZE_LAYERED`, depending on the format of the
- *              compressed image.
+ *              compressed image.  May also be a variable if the format is
+ *              only known at run time.
  *     *CT_ACTIVE() - provides a true value if the current pixel is active.
  *     *CT_WRITE_PIXEL(pointer) - writes the current pixel to the pointer and
  *              increments the pointer.
@@ -38,9 +39,21 @@
  *              and CT_FULL_HEIGHT must all also be defined.
  *     *CT_ACTIVE_FRAGS - If defined, must contain the name of a variable which
  *              will be used to accumulate the number of active fragments in a
- *              run.  This number will then be stored as part of the run length.
- *              Therefore, it should only be used in with `CT_RUN_LENGTH_SIZE`
- *              == `RUN_LENGTH_SIZE_LAYERED`.
+ *              run.  This number will then be stored as part of the run length
+ *              whenever `CT_RUN_LENGTH_SIZE` == `RUN_LENGTH_SIZE_LAYERED`.
+ *     *CT_UNTIMED - If defined, the compression is not added to the compress
+ *              time.  Timing is not safe to use from several threads.
+ *      CT_SCAN_RUN(active, max) - If defined, evaluates to the number of
+ *              pixels, at most max, from the current pixel on that are active
+ *              if active is true or inactive otherwise.  The current pixel is
+ *              not changed.  May stop short of the end of a run where pixels
+ *              are not contiguous (such as at the end of a row of a region),
+ *              but must count at least the current pixel if it matches.
+ *              Lets runs be found for many pixels at once rather than with
+ *              CT_ACTIVE() for each pixel.  If defined, CT_ADVANCE_PIXELS must
+ *              also be defined.
+ *      CT_ADVANCE_PIXELS(count) - Skips count input pixels counted by
+ *              CT_SCAN_RUN(ICET_FALSE, max).
  *
  * All of the above macros not marked with an asterisk are undefined at the end
  * of this file.
@@ -102,9 +115,11 @@
 #endif
     IceTSizeType _compressed_size;
 
+#ifndef CT_UNTIMED
     icetTimingCompressBegin();
+#endif
 
-    _dest = ICET_IMAGE_DATA(CT_COMPRESSED_IMAGE);
+    _dest = ICET_SPARSE_IMAGE_DATA(CT_COMPRESSED_IMAGE);
 
 #ifndef CT_PADDING
     _count = 0;
@@ -122,9 +137,16 @@
                 IceTVoid *_runlengths;
                 /* Count background pixels. */
                 while ((_x < _lastx) && (!CT_ACTIVE())) {
+#ifdef CT_SCAN_RUN
+                    IceTSizeType _run = CT_SCAN_RUN(ICET_FALSE, _lastx - _x);
+                    _x += _run;
+                    _count += _run;
+                    CT_ADVANCE_PIXELS(_run);
+#else
                     _x++;
                     _count++;
                     CT_INCREMENT_PIXEL();
+#endif
                 }
                 if (_x >= _lastx) break;
                 _runlengths = _dest;
@@ -136,17 +158,29 @@
                 /* Count and store active pixels. */
                 _count = 0;
                 while ((_x < _lastx) && CT_ACTIVE()) {
+#ifdef CT_SCAN_RUN
+                    IceTSizeType _run = CT_SCAN_RUN(ICET_TRUE, _lastx - _x);
+                    _count += _run;
+                    _x += _run;
+                    for ( ; _run > 0; _run--) {
+                        CT_WRITE_PIXEL(_dest);
+                        CT_INCREMENT_PIXEL();
+                    }
+#else
                     CT_WRITE_PIXEL(_dest);
                     CT_INCREMENT_PIXEL();
                     _count++;
                     _x++;
+#endif
                 }
                 ACTIVE_RUN_LENGTH(_runlengths) = _count;
 
 /* Optionally store the number of active fragments, which may differ from the
  * number of active pixels for layered images. */
 #ifdef CT_ACTIVE_FRAGS
-                ACTIVE_RUN_LENGTH_FRAGMENTS(_runlengths) = CT_ACTIVE_FRAGS;
+                if (CT_RUN_LENGTH_SIZE == RUN_LENGTH_SIZE_LAYERED) {
+                    ACTIVE_RUN_LENGTH_FRAGMENTS(_runlengths) = CT_ACTIVE_FRAGS;
+                }
                 CT_ACTIVE_FRAGS = 0;
 #endif
 
@@ -168,9 +202,16 @@
             _dest += CT_RUN_LENGTH_SIZE;
           /* Count background pixels. */
             while ((_p < _pixels) && (!CT_ACTIVE())) {
+#ifdef CT_SCAN_RUN
+                IceTSizeType _run = CT_SCAN_RUN(ICET_FALSE, _pixels - _p);
+                _p += _run;
+                _count += _run;
+                CT_ADVANCE_PIXELS(_run);
+#else
                 _p++;
                 _count++;
                 CT_INCREMENT_PIXEL();
+#endif
             }
             INACTIVE_RUN_LENGTH(_runlengths) = _count;
 #ifdef DEBUG
@@ -180,17 +221,29 @@
           /* Count and store active pixels. */
             _count = 0;
             while ((_p < _pixels) && CT_ACTIVE()) {
+#ifdef CT_SCAN_RUN
+                IceTSizeType _run = CT_SCAN_RUN(ICET_TRUE, _pixels - _p);
+                _count += _run;
+                _p += _run;
+                for ( ; _run > 0; _run--) {
+                    CT_WRITE_PIXEL(_dest);
+                    CT_INCREMENT_PIXEL();
+                }
+#else
                 CT_WRITE_PIXEL(_dest);
                 CT_INCREMENT_PIXEL();
                 _count++;
                 _p++;
+#endif
             }
             ACTIVE_RUN_LENGTH(_runlengths) = _count;
 
 /* Optionally store the number of active fragments, which may differ from the
  * number of active pixels for layered images. */
 #ifdef CT_ACTIVE_FRAGS
-            ACTIVE_RUN_LENGTH_FRAGMENTS(_runlengths) = CT_ACTIVE_FRAGS;
+            if (CT_RUN_LENGTH_SIZE == RUN_LENGTH_SIZE_LAYERED) {
+                ACTIVE_RUN_LENGTH_FRAGMENTS(_runlengths) = CT_ACTIVE_FRAGS;
+            }
             CT_ACTIVE_FRAGS = 0;
 #endif
 
@@ -207,6 +260,9 @@
     if (_count > 0) {
         INACTIVE_RUN_LENGTH(_dest) = _count;
         ACTIVE_RUN_LENGTH(_dest) = 0;
+#ifdef CT_ACTIVE_FRAGS
+        ACTIVE_RUN_LENGTH_FRAGMENTS(_dest) = 0;
+#endif
         _dest += CT_RUN_LENGTH_SIZE;
 #ifdef DEBUG
         _totalcount += _count;
@@ -227,7 +283,9 @@
     }
 #endif /*DEBUG*/
 
+#ifndef CT_UNTIMED
     icetTimingCompressEnd();
+#endif
 
     _compressed_size
         = (IceTSizeType)
@@ -246,6 +304,10 @@
 #undef CT_DEPTH_FORMAT
 #undef CT_PIXEL_COUNT
 #undef CT_INCREMENT_PIXEL
+#ifdef CT_SCAN_RUN
+#undef CT_SCAN_RUN
+#undef CT_ADVANCE_PIXELS
+#endif
 #undef COMPRESSED_SIZE
 
 #ifdef CT_PADDING
@@ -17,28 +17,37 @@
 #endif
 
 {
-/* Define macros for copying fragment data and advancing input iterator.
+/* Fragments are read through a pointer to the start of each layer, offset by
+ * the position of the current pixel.  This supports both images with the
+ * fragments of each pixel stored contiguously and planar images with a separate
+ * buffer per layer, which only differ in the pointers and the distance between
+ * consecutive pixels.
+ * Define macros for accessing fragment data and advancing the input iterator.
  * They differ between formats with and without color.
  */
+#define CTL_DEPTH(layer) (_depth_layers[layer][_depth_offset])
 #ifdef CTL_COLOR_TYPE
+#define CTL_COLOR(layer) (_color_layers[layer] + _color_offset)
 #define CTL_WRITE_FRAGMENT(layer, dest)                                 \
     /* Copy color.  The compiler should unroll this loop. */            \
     for (int i = 0; i < CTL_COLOR_CHANNELS; i++) {                      \
-        *(CTL_COLOR_TYPE *)dest = _color[layer*CTL_COLOR_CHANNELS + i]; \
+        *(CTL_COLOR_TYPE *)dest = CTL_COLOR(layer)[i];                  \
         dest += sizeof(CTL_COLOR_TYPE);                                 \
     }                                                                   \
     /* Copy depth. */                                                   \
-    *(CTL_DEPTH_TYPE *)dest = _depth[layer];                            \
+    *(CTL_DEPTH_TYPE *)dest = CTL_DEPTH(layer);                         \
     dest += sizeof(CTL_DEPTH_TYPE);
 #define CTL_INCREMENT_N_PIXELS(num_pixels)                      \
-    _color += _num_layers * num_pixels * CTL_COLOR_CHANNELS;    \
-    _depth += _num_layers * num_pixels;
+    _color_offset += num_pixels * _color_stride;                \
+    _depth_offset += num_pixels * _depth_stride;
+#define CTL_FRAGMENT_SIZE                                       \
+    (CTL_COLOR_CHANNELS*sizeof(CTL_COLOR_TYPE) + sizeof(CTL_DEPTH_TYPE))
 #else
 #define CTL_WRITE_FRAGMENT(layer, dest)         \
-    *(CTL_DEPTH_TYPE *)dest = _depth[layer];    \
+    *(CTL_DEPTH_TYPE *)dest = CTL_DEPTH(layer); \
     dest += sizeof(CTL_DEPTH_TYPE);
 #define CTL_INCREMENT_N_PIXELS(num_pixels)  \
-    _depth += _num_layers * num_pixels;
+    _depth_offset += num_pixels * _depth_stride;
 #endif
 
 /* Define macros that are independent of the fragment format, but nevertheless
@@ -81,13 +90,61 @@
     IceTSizeType CT_ACTIVE_FRAGS = 0;
 #endif
 
-    /* Input iterators. */
+    /* Input iterators.  The pointers to the layers are stored in a state
+     * buffer, with the color layers followed by the depth layers. */
 #ifdef CTL_COLOR_TYPE
-    const CTL_COLOR_TYPE *_color =
-        icetImageGetColorConstVoid(INPUT_IMAGE, NULL);
+    const CTL_COLOR_TYPE **const _color_layers = icetGetStateBuffer(
+        ICET_LAYER_POINTERS_BUF, 2*_num_layers*sizeof(const IceTVoid *));
+    const CTL_DEPTH_TYPE **const _depth_layers =
+        (const CTL_DEPTH_TYPE **)(_color_layers + _num_layers);
+    IceTSizeType _color_stride;
+    IceTSizeType _color_offset = 0;
+#else
+    const CTL_DEPTH_TYPE **const _depth_layers = icetGetStateBuffer(
+        ICET_LAYER_POINTERS_BUF, _num_layers*sizeof(const IceTVoid *));
+#endif
+    IceTSizeType _depth_stride;
+    IceTSizeType _depth_offset = 0;
+
+    if (icetLayeredImageIsPlanar(INPUT_IMAGE)) {
+#ifdef CTL_COLOR_TYPE
+        const IceTVoid *const *color_layers =
+            icetLayeredImageGetColorLayersConst(INPUT_IMAGE);
+#endif
+        const IceTVoid *const *depth_layers =
+            icetLayeredImageGetDepthLayersConst(INPUT_IMAGE);
+        IceTSizeType layer;
+
+        for (layer = 0; layer < _num_layers; layer++) {
+#ifdef CTL_COLOR_TYPE
+            _color_layers[layer] = color_layers[layer];
+#endif
+            _depth_layers[layer] = depth_layers[layer];
+        }
+#ifdef CTL_COLOR_TYPE
+        _color_stride = CTL_COLOR_CHANNELS;
+#endif
+        _depth_stride = 1;
+    } else {
+#ifdef CTL_COLOR_TYPE
+        const CTL_COLOR_TYPE *color =
+            icetImageGetColorConstVoid(INPUT_IMAGE, NULL);
+#endif
+        const CTL_DEPTH_TYPE *depth =
+            icetImageGetDepthConstVoid(INPUT_IMAGE, NULL);
+        IceTSizeType layer;
+
+        for (layer = 0; layer < _num_layers; layer++) {
+#ifdef CTL_COLOR_TYPE
+            _color_layers[layer] = color + layer*CTL_COLOR_CHANNELS;
+#endif
+            _depth_layers[layer] = depth + layer;
+        }
+#ifdef CTL_COLOR_TYPE
+        _color_stride = _num_layers*CTL_COLOR_CHANNELS;
 #endif
-    const CTL_DEPTH_TYPE *_depth =
-        icetImageGetDepthConstVoid(INPUT_IMAGE, NULL);
+        _depth_stride = _num_layers;
+    }
 
 #ifdef OFFSET
     CTL_INCREMENT_N_PIXELS(OFFSET);
@@ -98,7 +155,10 @@
 }
 
 /* Undefine local macros. */
+#undef CTL_DEPTH
+#undef CTL_COLOR
 #undef CTL_WRITE_FRAGMENT
 #undef CTL_INCREMENT_N_PIXELS
+#undef CTL_FRAGMENT_SIZE
 #undef CTL_COLOR_TYPE
 #undef CTL_COLOR_CHANNELS
@@ -34,6 +34,8 @@
  *                      values.
  *              BLEND_RGBA_FLOAT(src, dest) - same as above except src and dest
  *                      are IceTFloat arrays.
+ *              BLEND_RGBA_HALF(src, dest) - same as above except src and dest
+ *                      are IceTUShort arrays of half precision floats.
  *	CORRECT_BACKGROUND - if defined, the output color will be blended
  *		with the true background color.  This should only be set
  *		if ICET_NEED_BACKGROUND_CORRECTION is true.
@@ -214,6 +216,69 @@
                                 }
 #endif
 #include "decompress_template_body.h"
+#undef COPY_PIXEL
+            } else if (_color_format == ICET_IMAGE_COLOR_RGBA_HALF) {
+                IceTUShort *_color;
+                const IceTUShort *_c_in;
+                const IceTFloat *_d_in;
+#ifndef COMPOSITE
+                IceTFloat _background_float[4];
+                IceTUShort _background_color[4];
+                int _channel;
+#endif
+                _color = icetImageGetColorVoid(OUTPUT_IMAGE, NULL);
+#ifdef OFFSET
+                _color += 4*(OFFSET);
+#endif
+#ifndef COMPOSITE
+                icetGetFloatv(ICET_BACKGROUND_COLOR, _background_float);
+                for (_channel = 0; _channel < 4; _channel++) {
+                    _background_color[_channel] =
+                        icetFloatToHalf(_background_float[_channel]);
+                }
+#endif
+#ifdef COMPOSITE
+#define COPY_PIXEL(c_src, c_dest, d_src, d_dest)                \
+                                if (d_src[0] < d_dest[0]) {     \
+                                    c_dest[0] = c_src[0];       \
+                                    c_dest[1] = c_src[1];       \
+                                    c_dest[2] = c_src[2];       \
+                                    c_dest[3] = c_src[3];       \
+                                    d_dest[0] = d_src[0];       \
+                                }
+#else
+#define COPY_PIXEL(c_src, c_dest, d_src, d_dest)                \
+                                c_dest[0] = c_src[0];           \
+                                c_dest[1] = c_src[1];           \
+                                c_dest[2] = c_src[2];           \
+                                c_dest[3] = c_src[3];           \
+                                d_dest[0] = d_src[0];
+#endif
+#define DT_COMPRESSED_IMAGE     INPUT_SPARSE_IMAGE
+#define DT_READ_PIXEL(src)      _c_in = (IceTUShort *)src;      \
+                                src += 4*sizeof(IceTUShort);    \
+                                _d_in = (IceTFloat *)src;       \
+                                src += sizeof(IceTFloat);       \
+                                COPY_PIXEL(_c_in, _color,       \
+                                           _d_in, _depth);      \
+                                _color += 4;  _depth++;
+#ifdef COMPOSITE
+#define DT_INCREMENT_INACTIVE_PIXELS(count) _color += 4*count;  _depth += count;
+#else
+#define DT_INCREMENT_INACTIVE_PIXELS(count)                             \
+                                {                                       \
+                                    IceTSizeType __i;                   \
+                                    for (__i = 0; __i < count; __i++) { \
+                                        _color[0] =_background_color[0];\
+                                        _color[1] =_background_color[1];\
+                                        _color[2] =_background_color[2];\
+                                        _color[3] =_background_color[3];\
+                                        _color += 4;                    \
+                                        *(_depth++) = 1.0f;             \
+                                    }                                   \
+                                }
+#endif
+#include "decompress_template_body.h"
 #undef COPY_PIXEL
             } else if (_color_format == ICET_IMAGE_COLOR_RGB_FLOAT) {
                 IceTFloat *_color;
@@ -406,6 +471,63 @@
                                 }
 #endif
 #include "decompress_template_body.h"
+#undef COPY_PIXEL
+        } else if (_color_format == ICET_IMAGE_COLOR_RGBA_HALF) {
+            IceTUShort *_color;
+            const IceTUShort *_c_in;
+#ifndef COMPOSITE
+            IceTFloat _background_float[4];
+            IceTUShort _background_color[4];
+            int _channel;
+#endif
+            _color = icetImageGetColorVoid(OUTPUT_IMAGE, NULL);
+#ifdef OFFSET
+            _color += 4*(OFFSET);
+#endif
+#ifndef COMPOSITE
+#ifdef CORRECT_BACKGROUND
+            icetGetFloatv(ICET_TRUE_BACKGROUND_COLOR, _background_float);
+#else
+            icetGetFloatv(ICET_BACKGROUND_COLOR, _background_float);
+#endif
+            for (_channel = 0; _channel < 4; _channel++) {
+                _background_color[_channel] =
+                    icetFloatToHalf(_background_float[_channel]);
+            }
+#endif
+#ifdef COMPOSITE
+#define COPY_PIXEL(c_src, c_dest) BLEND_RGBA_HALF(c_src, c_dest);
+#elif defined(CORRECT_BACKGROUND)
+#define COPY_PIXEL(c_src, c_dest) \
+            ICET_BLEND_HALF(c_src, _background_color, c_dest);
+#else
+#define COPY_PIXEL(c_src, c_dest)                               \
+                                c_dest[0] = c_src[0];           \
+                                c_dest[1] = c_src[1];           \
+                                c_dest[2] = c_src[2];           \
+                                c_dest[3] = c_src[3];
+#endif
+#define DT_COMPRESSED_IMAGE     INPUT_SPARSE_IMAGE
+#define DT_READ_PIXEL(src)      _c_in = (IceTUShort *)src;      \
+                                src += 4*sizeof(IceTUShort);    \
+                                COPY_PIXEL(_c_in, _color);      \
+                                _color += 4;
+#ifdef COMPOSITE
+#define DT_INCREMENT_INACTIVE_PIXELS(count) _color += 4*count;
+#else
+#define DT_INCREMENT_INACTIVE_PIXELS(count)                             \
+                                {                                       \
+                                    IceTSizeType __i;                   \
+                                    for (__i = 0; __i < count; __i++) { \
+                                        _color[0] =_background_color[0];\
+                                        _color[1] =_background_color[1];\
+                                        _color[2] =_background_color[2];\
+                                        _color[3] =_background_color[3];\
+                                        _color += 4;                    \
+                                    }                                   \
+                                }
+#endif
+#include "decompress_template_body.h"
 #undef COPY_PIXEL
         } else if (_color_format == ICET_IMAGE_COLOR_RGB_FLOAT) {
             IceTFloat *_color;
@@ -459,8 +581,18 @@
 /* Undefine macros common to all non-layered cases. */
 #undef DT_RUN_LENGTH_SIZE
     } else { /* Input image is layered. */
+        /* Layered images with a single fragment per pixel are stored like
+         * non-layered images, without fragment counts. */
+        const IceTBoolean _single_fragment =
+            icetSparseImageIsSingleFragment(INPUT_SPARSE_IMAGE);
+        const IceTSizeType _run_length_size =
+            _single_fragment ? RUN_LENGTH_SIZE : RUN_LENGTH_SIZE_LAYERED;
+        /* Number of bytes storing the number of fragments of each pixel. */
+        const IceTSizeType _count_size = _single_fragment
+            ? 0 : icetSparseImageGetLayerCountSize(INPUT_SPARSE_IMAGE);
+
 /* Layered images have a specific run length format. */
-#define DT_RUN_LENGTH_SIZE RUN_LENGTH_SIZE_LAYERED
+#define DT_RUN_LENGTH_SIZE _run_length_size
 
         switch (_composite_mode) {
         /* When using a commutative compositing operator, The layers of each
@@ -473,51 +605,101 @@
                            "commutative compositing operators.");
             break;
 
-        case ICET_COMPOSITE_MODE_BLEND:
+        case ICET_COMPOSITE_MODE_BLEND: {
+            /* The background color is converted to each color format. */
+            IceTFloat _background_color[4];
+#ifdef CORRECT_BACKGROUND
+            icetGetFloatv(ICET_TRUE_BACKGROUND_COLOR, _background_color);
+#else
+            icetGetFloatv(ICET_BACKGROUND_COLOR, _background_color);
+#endif
+
+/* Unsigned byte colors are accumulated in integers scaled by 255*255, which
+ * keeps the rounding error of each fragment far below that of the result.
+ * Half colors are accumulated as floats. */
+#define DTL_UBYTE_ACCUM_TYPE        IceTUInt
+#define DTL_UBYTE_ACCUM_OPAQUE      (255*255)
+#define DTL_UBYTE_ACCUM(transmittance, value)                           \
+    ((transmittance)*(IceTUInt)(value)/255)
+#define DTL_UBYTE_FROM_ACCUM(value) ((IceTUByte)(((value) + 127)/255))
+#define DTL_FLOAT_ACCUM(transmittance, value) ((transmittance)*(value))
+#define DTL_HALF_ACCUM(transmittance, value)                            \
+    ((transmittance)*icetHalfToFloat(value))
+
             /* Instantiate template for all possible fragment formats. */
             switch (_depth_format) {
             case ICET_IMAGE_DEPTH_FLOAT:
                 switch (_color_format) {
-                case ICET_IMAGE_COLOR_RGBA_UBYTE: {
-                    /* Get background color. */
-                    IceTUByte _background_color[4];
-                    IceTUByte *_color =
-                        (IceTUByte *)icetImageGetColorui(OUTPUT_IMAGE);
+                case ICET_IMAGE_COLOR_RGBA_UBYTE:
+#define DTL_FRAGMENT_TYPE   IceTFragment_RGBA8_D32F
+#define DTL_COLOR_TYPE      IceTUByte
+#define DTL_ACCUM_TYPE      DTL_UBYTE_ACCUM_TYPE
+#define DTL_ACCUM_OPAQUE    DTL_UBYTE_ACCUM_OPAQUE
+#define DTL_ACCUM           DTL_UBYTE_ACCUM
+#define DTL_FROM_ACCUM      DTL_UBYTE_FROM_ACCUM
+#include "decompress_template_body_layered.h"
+                    break;
 
-#ifdef CORRECT_BACKGROUND
-                    icetGetIntegerv(ICET_TRUE_BACKGROUND_COLOR_WORD,
-                            (IceTInt *)&_background_color);
-#else
-                    icetGetIntegerv(ICET_BACKGROUND_COLOR_WORD,
-                            (IceTInt *)&_background_color);
-#endif
+                case ICET_IMAGE_COLOR_RGBA_FLOAT:
+#define DTL_FRAGMENT_TYPE   IceTFragment_RGBA32F_D32F
+#define DTL_COLOR_TYPE      IceTFloat
+#define DTL_ACCUM_TYPE      IceTFloat
+#define DTL_ACCUM_OPAQUE    1.0f
+#define DTL_ACCUM           DTL_FLOAT_ACCUM
+#define DTL_FROM_ACCUM(value) (value)
+#include "decompress_template_body_layered.h"
+                    break;
 
-/* Define macros depending on the fragment format and instantiate
- * the implementation. */
-#define DTL_FRAGMENT_TYPE   IceTFragment_RGBA8_D32F
-#define DTL_OVER            ICET_OVER_UBYTE
+                case ICET_IMAGE_COLOR_RGBA_HALF:
+#define DTL_FRAGMENT_TYPE   IceTFragment_RGBA16F_D32F
+#define DTL_COLOR_TYPE      IceTUShort
+#define DTL_ACCUM_TYPE      IceTFloat
+#define DTL_ACCUM_OPAQUE    1.0f
+#define DTL_ACCUM           DTL_HALF_ACCUM
+#define DTL_FROM_ACCUM      icetFloatToHalf
 #include "decompress_template_body_layered.h"
                     break;
-                }
 
-                /* The implementation for all other supported formats is
-                 * analogous. */
+                case ICET_IMAGE_COLOR_RGB_FLOAT:
+                case ICET_IMAGE_COLOR_NONE:
+                    icetRaiseError(ICET_INVALID_OPERATION,
+                                   "Blending requires a color format with an alpha channel.");
+                    break;
 
-                case ICET_IMAGE_COLOR_RGBA_FLOAT: {
-                        IceTFloat _background_color[4];
-                        IceTFloat *_color = icetImageGetColorf(OUTPUT_IMAGE);
+                default:
+                    icetRaiseError(ICET_SANITY_CHECK_FAIL,
+                                   "Encountered invalid color format %#X.",
+                                   _color_format);
+                }
+                break; /* case ICET_IMAGE_DEPTH_FLOAT */
 
-#ifdef CORRECT_BACKGROUND
-                        icetGetFloatv(ICET_TRUE_BACKGROUND_COLOR, _background_color);
-#else
-                        icetGetFloatv(ICET_BACKGROUND_COLOR, _background_color);
-#endif
+            case ICET_IMAGE_DEPTH_USHORT:
+                switch (_color_format) {
+                case ICET_IMAGE_COLOR_RGBA_UBYTE:
+#define DTL_FRAGMENT_TYPE   IceTFragment_RGBA8_D16
+#define DTL_COLOR_TYPE      IceTUByte
+#define DTL_ACCUM_TYPE      DTL_UBYTE_ACCUM_TYPE
+#define DTL_ACCUM_OPAQUE    DTL_UBYTE_ACCUM_OPAQUE
+#define DTL_ACCUM           DTL_UBYTE_ACCUM
+#define DTL_FROM_ACCUM      DTL_UBYTE_FROM_ACCUM
+#include "decompress_template_body_layered.h"
+                    break;
 
-#define DTL_FRAGMENT_TYPE   IceTFragment_RGBA32F_D32F
-#define DTL_OVER            ICET_OVER_FLOAT
+                case ICET_IMAGE_COLOR_RGBA_HALF:
+#define DTL_FRAGMENT_TYPE   IceTFragment_RGBA16F_D16
+#define DTL_COLOR_TYPE      IceTUShort
+#define DTL_ACCUM_TYPE      IceTFloat
+#define DTL_ACCUM_OPAQUE    1.0f
+#define DTL_ACCUM           DTL_HALF_ACCUM
+#define DTL_FROM_ACCUM      icetFloatToHalf
 #include "decompress_template_body_layered.h"
                     break;
-                }
+
+                case ICET_IMAGE_COLOR_RGBA_FLOAT:
+                    icetRaiseError(ICET_INVALID_OPERATION,
+                                   "16-bit depths cannot be combined with "
+                                   "float colors in layered images.");
+                    break;
 
                 case ICET_IMAGE_COLOR_RGB_FLOAT:
                 case ICET_IMAGE_COLOR_NONE:
@@ -530,7 +712,7 @@
                                    "Encountered invalid color format %#X.",
                                    _color_format);
                 }
-                break; /* case ICET_IMAGE_DEPTH_FLOAT */
+                break; /* case ICET_IMAGE_DEPTH_USHORT */
 
             case ICET_IMAGE_DEPTH_NONE:
                 icetRaiseError(ICET_SANITY_CHECK_FAIL,
@@ -542,7 +724,15 @@
                                "Encountered invalid depth format %#X.",
                                _depth_format);
             }
-            break; /* case ICET_COMPOSITE_MODE_BLEND */
+
+#undef DTL_UBYTE_ACCUM_TYPE
+#undef DTL_UBYTE_ACCUM_OPAQUE
+#undef DTL_UBYTE_ACCUM
+#undef DTL_UBYTE_FROM_ACCUM
+#undef DTL_FLOAT_ACCUM
+#undef DTL_HALF_ACCUM
+            break;
+        } /* case ICET_COMPOSITE_MODE_BLEND */
 
         default:
             icetRaiseError(ICET_SANITY_CHECK_FAIL,
@@ -570,6 +760,7 @@
 #undef COMPOSITE
 #undef BLEND_RGBA_UBYTE
 #undef BLEND_RGBA_FLOAT
+#undef BLEND_RGBA_HALF
 #endif
 
 #ifdef OFFSET
@@ -61,7 +61,7 @@
     IceTSizeType _i;
 
     _pixels = icetSparseImageGetNumPixels(DT_COMPRESSED_IMAGE);
-    _src = ICET_IMAGE_DATA(DT_COMPRESSED_IMAGE);
+    _src = ICET_SPARSE_IMAGE_DATA(DT_COMPRESSED_IMAGE);
 
     _p = 0;
     while (_p < _pixels) {
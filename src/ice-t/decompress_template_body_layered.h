@@ -1,28 +1,54 @@
 /* This file instantiates the blending of a sparse layered image into a regular
  * non-layered image, implemented in `decompress_template_body.h`, for a given
  * fragment format.
- * The corresponding type must be defined as `DTL_FRAGMENT_TYPE`.
- * Additionally, the matching over-operator must be defined as `DTL_OVER`.
- * Both macros are undefined at the end of this file.  The file should only be
- * included at the appropriate locations in `decompress_func_body.h`.
+ * The corresponding type must be defined as `DTL_FRAGMENT_TYPE` and the type of
+ * a single color channel as `DTL_COLOR_TYPE`.  Fragments are accumulated front
+ * to back in `DTL_ACCUM_TYPE`, in which `DTL_ACCUM_OPAQUE` stands for full
+ * opacity.  `DTL_ACCUM(transmittance, value)` must convert a color channel to
+ * the accumulator and scale it by the given transmittance, and
+ * `DTL_FROM_ACCUM` convert an accumulated channel back to a color channel.
+ * All six macros are undefined at the end of this file.  The file should only
+ * be included at the appropriate locations in `decompress_func_body.h`, where
+ * `_background_color` must hold the background color as floats and
+ * `_single_fragment` whether pixels are stored without their fragment count and
+ * `_count_size` the number of bytes of the fragment count otherwise.
  */
 
 /* Check for required macros. */
 #ifndef DTL_FRAGMENT_TYPE
 #error "Missing macro DTL_FRAGMENT_TYPE."
 #endif
-#ifndef DTL_OVER
-#error "Missing macro DTL_OVER."
+#ifndef DTL_COLOR_TYPE
+#error "Missing macro DTL_COLOR_TYPE."
+#endif
+#ifndef DTL_ACCUM_TYPE
+#error "Missing macro DTL_ACCUM_TYPE."
+#endif
+#ifndef DTL_ACCUM_OPAQUE
+#error "Missing macro DTL_ACCUM_OPAQUE."
+#endif
+#ifndef DTL_ACCUM
+#error "Missing macro DTL_ACCUM."
+#endif
+#ifndef DTL_FROM_ACCUM
+#error "Missing macro DTL_FROM_ACCUM."
 #endif
 
 {
+    /* Output iterator. */
+    DTL_COLOR_TYPE *_color = icetImageGetColorVoid(OUTPUT_IMAGE, NULL);
+
+    /* The background color converted to the output format, which is copied
+     * to inactive pixels. */
+    DTL_COLOR_TYPE _background_pixel[4];
+
 /* Local utility to write the configured background color to the current pixel,
  * without advancing the output pointer.
  */
 #define DTL_COPY_BACKGROUND()                           \
 {                                                       \
     for (int channel = 0; channel < 4; channel++) {     \
-        _color[channel] = _background_color[channel];   \
+        _color[channel] = _background_pixel[channel];   \
     }                                                   \
 }
 
@@ -38,29 +64,44 @@
     }                                           \
 }
 
-/* For a single active pixel, set the output to the configured background color,
- * then blend all fragments over it.
+/* For a single active pixel, blend its fragments front to back into the
+ * accumulator, which rounds to the color format only once per pixel.  Once the
+ * accumulated color is opaque, the remaining fragments are hidden and skipped.
+ * Finally, blend the result over the background.
  */
-#define DT_READ_PIXEL(src)                                          \
-{                                                                   \
-    const IceTLayerCount num_layers = *(const IceTLayerCount *)src; \
-    src += sizeof(IceTLayerCount);                                  \
-                                                                    \
-    DTL_COPY_BACKGROUND();                                          \
-                                                                    \
-    for (                                                           \
-        const DTL_FRAGMENT_TYPE *in_frag =                          \
-            (const DTL_FRAGMENT_TYPE *)src + num_layers - 1;        \
-        (const IceTByte *)in_frag >= src;                           \
-        in_frag--                                                   \
-    ) {                                                             \
-        DTL_OVER(in_frag->color, _color);                           \
-    }                                                               \
-                                                                    \
-    src += num_layers * sizeof(DTL_FRAGMENT_TYPE);                  \
-    _color += 4;                                                    \
+#define DT_READ_PIXEL(src)                                                  \
+{                                                                           \
+    const IceTLayerCount num_layers =                                       \
+        _single_fragment ? 1 : LAYER_COUNT_GET(src, _count_size);           \
+    const DTL_FRAGMENT_TYPE *in_frag =                                      \
+        (const DTL_FRAGMENT_TYPE *)(src + _count_size);                     \
+    const DTL_FRAGMENT_TYPE *const in_end = in_frag + num_layers;           \
+    DTL_ACCUM_TYPE accum[4] = { 0, 0, 0, 0 };                               \
+    DTL_ACCUM_TYPE transmittance = DTL_ACCUM_OPAQUE;                        \
+                                                                            \
+    for (; (in_frag < in_end) && (transmittance > 0); in_frag++) {       \
+        for (int channel = 0; channel < 4; channel++) {                     \
+            accum[channel] +=                                               \
+                DTL_ACCUM(transmittance, in_frag->color[channel]);          \
+        }                                                                   \
+        transmittance = DTL_ACCUM_OPAQUE - accum[3];                        \
+    }                                                                       \
+                                                                            \
+    for (int channel = 0; channel < 4; channel++) {                         \
+        _color[channel] = DTL_FROM_ACCUM(                                   \
+              accum[channel]                                                \
+            + DTL_ACCUM(transmittance, _background_pixel[channel]));        \
+    }                                                                       \
+                                                                            \
+    src = (const IceTByte *)in_end;                                         \
+    _color += 4;                                                            \
 }
 
+    for (int channel = 0; channel < 4; channel++) {
+        _background_pixel[channel] =
+            DTL_FROM_ACCUM(DTL_ACCUM_OPAQUE*_background_color[channel]);
+    }
+
 /* Account for initial offset. */
 #ifdef OFFSET
     _color += 4*(OFFSET);
@@ -73,4 +114,8 @@
 /* Undefine local macros. */
 #undef DTL_COPY_BACKGROUND
 #undef DTL_FRAGMENT_TYPE
-#undef DTL_OVER
+#undef DTL_COLOR_TYPE
+#undef DTL_ACCUM_TYPE
+#undef DTL_ACCUM_OPAQUE
+#undef DTL_ACCUM
+#undef DTL_FROM_ACCUM
@@ -86,6 +86,54 @@ void icetCompositeMode(IceTEnum mode)
     icetStateSetInteger(ICET_COMPOSITE_MODE, mode);
 }
 
+void icetWireCodec(IceTEnum codec)
+{
+    if (    (codec != ICET_WIRE_CODEC_NONE)
+         && (codec != ICET_WIRE_CODEC_BYTE_DELTA) ) {
+        icetRaiseError(ICET_INVALID_ENUM, "Invalid wire codec 0x%x.", codec);
+        return;
+    }
+
+    icetStateSetInteger(ICET_WIRE_CODEC, codec);
+}
+
+void icetNumThreads(IceTInt num_threads)
+{
+    if (num_threads < 1) {
+        icetRaiseError(ICET_INVALID_VALUE,
+                       "Number of threads must be at least 1, not %d.",
+                       num_threads);
+        return;
+    }
+
+    icetStateSetInteger(ICET_NUM_THREADS, num_threads);
+}
+
+void icetLayeredOpacityCutoff(IceTFloat cutoff)
+{
+    if ((cutoff < 0.0f) || (cutoff > 1.0f)) {
+        icetRaiseError(ICET_INVALID_VALUE,
+                       "Layered opacity cutoff must be in [0, 1], not %f.",
+                       cutoff);
+        return;
+    }
+
+    icetStateSetFloat(ICET_LAYERED_OPACITY_CUTOFF, cutoff);
+}
+
+void icetMaxFragmentsPerPixel(IceTInt max_fragments)
+{
+    if (max_fragments < 0) {
+        icetRaiseError(ICET_INVALID_VALUE,
+                       "Maximum number of fragments per pixel must not be"
+                       " negative, not %d.",
+                       max_fragments);
+        return;
+    }
+
+    icetStateSetInteger(ICET_MAX_FRAGMENTS_PER_PIXEL, max_fragments);
+}
+
 void icetCompositeOrder(const IceTInt *process_ranks)
 {
     IceTInt num_proc;
@@ -729,6 +777,33 @@ static void drawCollectTileInformation(void)
     }
 }
 
+/* Collects the depth range of the geometry of all processes, which tells the
+ * compositing of layered images which fragments no image of another process can
+ * interleave with (see ICET_COALESCE_FRAGMENTS).  This adds an allgather of two
+ * doubles per process to every frame, so it is skipped unless fragments are
+ * blended and may be coalesced. */
+static void drawCollectDepthBounds(void)
+{
+    IceTDouble *all_depth_bounds;
+    IceTDouble depth_bounds[2];
+    IceTInt num_proc;
+    IceTEnum composite_mode;
+
+    if (!icetIsEnabled(ICET_COALESCE_FRAGMENTS)) { return; }
+    icetGetEnumv(ICET_COMPOSITE_MODE, &composite_mode);
+    if (composite_mode != ICET_COMPOSITE_MODE_BLEND) { return; }
+
+    icetGetIntegerv(ICET_NUM_PROCESSES, &num_proc);
+    icetGetDoublev(ICET_NEAR_DEPTH, &depth_bounds[0]);
+    icetGetDoublev(ICET_FAR_DEPTH, &depth_bounds[1]);
+
+    all_depth_bounds
+        = icetStateAllocateDouble(ICET_ALL_DEPTH_BOUNDS, 2*num_proc);
+
+    icetRaiseDebug("Gathering depth bounds.");
+    icetCommAllgather(depth_bounds, 2, ICET_DOUBLE, all_depth_bounds);
+}
+
 static IceTImage drawInvokeStrategy(void)
 {
     IceTImage image;
@@ -748,6 +823,18 @@ static IceTImage drawInvokeStrategy(void)
     icetRaiseDebug("Calling strategy");
     icetStateSetBoolean(ICET_IS_DRAWING_FRAME, 1);
     icetGetEnumv(ICET_STRATEGY, &strategy);
+    if (   icetIsEnabled(ICET_TEMPORAL_DELTA)
+        && (strategy != ICET_STRATEGY_SEQUENTIAL) ) {
+        icetRaiseWarning(ICET_INVALID_OPERATION,
+                         "ICET_TEMPORAL_DELTA is only used by the sequential"
+                         " strategy.");
+    }
+    if (   icetIsEnabled(ICET_BLOCK_SPARSE_IMAGES)
+        && icetSparseImageWireEncodingEnabled() ) {
+        icetRaiseWarning(ICET_INVALID_OPERATION,
+                         "Images stored in blocks are sent without the wire"
+                         " codec or quantization.");
+    }
     image = icetInvokeStrategy(strategy);
 
     icetStateSetBoolean(ICET_IS_DRAWING_FRAME, 0);
@@ -761,7 +848,8 @@ static IceTImage drawInvokeStrategy(void)
                        "Display tile: %d, valid tile: %d",
                        display_tile, valid_tile);
     }
-    if (valid_tile >= 0) {
+    if (   (valid_tile >= 0)
+        && !icetUnsafeStateGetBoolean(ICET_KEEP_DEEP_IMAGE)[0]) {
         const IceTInt *valid_tile_viewport
             = icetUnsafeStateGetInteger(ICET_TILE_VIEWPORTS) + 4*valid_tile;
         if (   (valid_tile_viewport[2] != icetImageGetWidth(image))
@@ -824,6 +912,8 @@ static IceTImage drawDoFrame(const IceTDouble *projection_matrix,
 
     drawCollectTileInformation();
 
+    drawCollectDepthBounds();
+
     {
         IceTInt tile_displayed;
         icetGetIntegerv(ICET_TILE_DISPLAYED, &tile_displayed);
@@ -833,14 +923,26 @@ static IceTImage drawDoFrame(const IceTDouble *projection_matrix,
                 = icetUnsafeStateGetInteger(ICET_TILE_VIEWPORTS);
             IceTInt num_pixels = (  tile_viewports[4*tile_displayed+2]
                                   * tile_viewports[4*tile_displayed+3] );
+            IceTInt changed_range[2];
+            changed_range[0] = 0;
+            changed_range[1] = num_pixels;
             icetStateSetInteger(ICET_VALID_PIXELS_TILE, tile_displayed);
             icetStateSetInteger(ICET_VALID_PIXELS_OFFSET, 0);
             icetStateSetInteger(ICET_VALID_PIXELS_NUM, num_pixels);
+            icetStateSetInteger(ICET_CHANGED_PIXELS_NUM, num_pixels);
+            icetStateSetInteger(ICET_CHANGED_PIXELS_NUM_RANGES, 1);
+            icetStateSetIntegerv(ICET_CHANGED_PIXELS_RANGES, 2, changed_range);
         } else {
             icetStateSetInteger(ICET_VALID_PIXELS_TILE, -1);
             icetStateSetInteger(ICET_VALID_PIXELS_OFFSET, 0);
             icetStateSetInteger(ICET_VALID_PIXELS_NUM, 0);
+            icetStateSetInteger(ICET_CHANGED_PIXELS_NUM, 0);
+            icetStateSetInteger(ICET_CHANGED_PIXELS_NUM_RANGES, 0);
+            icetStateSetIntegerv(ICET_CHANGED_PIXELS_RANGES, 0, NULL);
         }
+        /* Strategies that only recomposite the pixels changed since the last
+           frame narrow these ranges (see ICET_TEMPORAL_DELTA). */
+        icetStateSetInteger(ICET_CHANGED_PIXELS_OFFSET, 0);
     }
 
     image = drawInvokeStrategy();
@@ -902,18 +1004,10 @@ IceTImage icetCompositeImage(const IceTVoid *color_buffer,
     return drawDoFrame(projection_matrix, modelview_matrix, background_color);
 }
 
-IceTImage icetCompositeImageLayered(const IceTVoid *color_buffer,
-                                    const IceTVoid *depth_buffer,
-                                    IceTInt num_layers,
-                                    const IceTInt *valid_pixels_viewport,
-                                    const IceTDouble *projection_matrix,
-                                    const IceTDouble *modelview_matrix,
-                                    const IceTFloat *background_color)
+/* Checks whether the current configuration supports compositing layered images
+ * and raises an error if not. */
+static IceTBoolean drawCheckLayeredSupport(void)
 {
-    IceTInt global_viewport[4];
-
-    icetRaiseDebug("In icetCompositeImageLayered");
-
     /* Check whether it makes sense to use layered rather than regular
      * compositing. */
     {
@@ -927,6 +1021,33 @@ IceTImage icetCompositeImageLayered(const IceTVoid *color_buffer,
         }
     }
 
+    /* Check whether the formats can be compressed as layered images.  This is
+     * done here rather than when compressing so that all processes reject the
+     * frame before any of them starts communicating. */
+    {
+        IceTEnum composite_mode;
+        IceTEnum color_format;
+        IceTEnum depth_format;
+        icetGetEnumv(ICET_COMPOSITE_MODE, &composite_mode);
+        icetGetEnumv(ICET_COLOR_FORMAT, &color_format);
+        icetGetEnumv(ICET_DEPTH_FORMAT, &depth_format);
+
+        if (depth_format == ICET_IMAGE_DEPTH_USHORT) {
+            if (composite_mode != ICET_COMPOSITE_MODE_BLEND) {
+                icetRaiseError(ICET_INVALID_OPERATION,
+                               "16-bit depths are only supported for blending "
+                               "layered images.");
+                return ICET_FALSE;
+            }
+            if (color_format == ICET_IMAGE_COLOR_RGBA_FLOAT) {
+                icetRaiseError(ICET_INVALID_OPERATION,
+                               "16-bit depths cannot be combined with float "
+                               "colors in layered images.");
+                return ICET_FALSE;
+            }
+        }
+    }
+
     /* Check whether the selected strategy supports layered images.  Single
      * image strategies are checked in icetInvokeSingleImageStrategy. */
     {
@@ -937,10 +1058,29 @@ IceTImage icetCompositeImageLayered(const IceTVoid *color_buffer,
             icetRaiseError(ICET_INVALID_OPERATION,
                        "Strategy %s currently does not support layered images.",
                        icetStrategyNameFromEnum(strategy));
-            return icetImageNull();
+            return ICET_FALSE;
         }
     }
 
+    return ICET_TRUE;
+}
+
+IceTImage icetCompositeImageLayered(const IceTVoid *color_buffer,
+                                    const IceTVoid *depth_buffer,
+                                    IceTInt num_layers,
+                                    const IceTInt *valid_pixels_viewport,
+                                    const IceTDouble *projection_matrix,
+                                    const IceTDouble *modelview_matrix,
+                                    const IceTFloat *background_color)
+{
+    IceTInt global_viewport[4];
+
+    icetRaiseDebug("In icetCompositeImageLayered");
+
+    if (!drawCheckLayeredSupport()) {
+        return icetImageNull();
+    }
+
     icetGetIntegerv(ICET_GLOBAL_VIEWPORT, global_viewport);
 
     icetStateSetBoolean(ICET_PRE_RENDERED, ICET_TRUE);
@@ -958,3 +1098,82 @@ IceTImage icetCompositeImageLayered(const IceTVoid *color_buffer,
 
     return drawDoFrame(projection_matrix, modelview_matrix, background_color);
 }
+
+IceTImage icetCompositeImageLayeredPlanar(const IceTVoid *const *color_layers,
+                                          const IceTVoid *const *depth_layers,
+                                          IceTInt num_layers,
+                                          const IceTInt *valid_pixels_viewport,
+                                          const IceTDouble *projection_matrix,
+                                          const IceTDouble *modelview_matrix,
+                                          const IceTFloat *background_color)
+{
+    IceTInt global_viewport[4];
+
+    icetRaiseDebug("In icetCompositeImageLayeredPlanar");
+
+    if (!drawCheckLayeredSupport()) {
+        return icetImageNull();
+    }
+
+    icetGetIntegerv(ICET_GLOBAL_VIEWPORT, global_viewport);
+
+    icetStateSetBoolean(ICET_PRE_RENDERED, ICET_TRUE);
+    icetGetStatePlanarLayeredImage(ICET_RENDER_BUFFER,
+                                   global_viewport[2],
+                                   global_viewport[3],
+                                   num_layers,
+                                   color_layers,
+                                   depth_layers);
+    if (valid_pixels_viewport) {
+        icetStateSetIntegerv(ICET_RENDERED_VIEWPORT, 4, valid_pixels_viewport);
+    } else {
+        icetStateSetIntegerv(ICET_RENDERED_VIEWPORT, 0, NULL);
+    }
+
+    return drawDoFrame(projection_matrix, modelview_matrix, background_color);
+}
+
+IceTSparseImage icetCompositeImageLayeredDeep(const IceTVoid *color_buffer,
+                                              const IceTVoid *depth_buffer,
+                                              IceTInt num_layers,
+                                              const IceTInt *valid_pixels_viewport,
+                                              const IceTDouble *projection_matrix,
+                                              const IceTDouble *modelview_matrix)
+{
+    IceTInt global_viewport[4];
+    IceTInt valid_num;
+
+    icetRaiseDebug("In icetCompositeImageLayeredDeep");
+
+    if (!drawCheckLayeredSupport()) {
+        return icetSparseImageNull();
+    }
+
+    icetGetIntegerv(ICET_GLOBAL_VIEWPORT, global_viewport);
+
+    icetStateSetBoolean(ICET_PRE_RENDERED, ICET_TRUE);
+    icetGetStatePointerLayeredImage(ICET_RENDER_BUFFER,
+                                    global_viewport[2],
+                                    global_viewport[3],
+                                    num_layers,
+                                    color_buffer,
+                                    depth_buffer);
+    if (valid_pixels_viewport) {
+        icetStateSetIntegerv(ICET_RENDERED_VIEWPORT, 4, valid_pixels_viewport);
+    } else {
+        icetStateSetIntegerv(ICET_RENDERED_VIEWPORT, 0, NULL);
+    }
+
+    /* The strategy leaves the merged fragments in ICET_DEEP_IMAGE_BUF on all
+       processes with valid pixels.  The background is never blended in. */
+    icetStateSetInteger(ICET_VALID_PIXELS_NUM, 0);
+    icetStateSetBoolean(ICET_KEEP_DEEP_IMAGE, ICET_TRUE);
+    drawDoFrame(projection_matrix, modelview_matrix, black);
+    icetStateSetBoolean(ICET_KEEP_DEEP_IMAGE, ICET_FALSE);
+
+    icetGetIntegerv(ICET_VALID_PIXELS_NUM, &valid_num);
+    if (valid_num <= 0) {
+        return icetSparseImageNull();
+    }
+    return icetRetrieveStateSparseImage(ICET_DEEP_IMAGE_BUF);
+}
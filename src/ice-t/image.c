@@ -27,6 +27,82 @@
  * layered format, allowing for multiple color and depth values per pixel.
  */
 #define ICET_IMAGE_FLAG_LAYERED         (IceTEnum)0x00000001
+/* Flag combined with the magic number of a layered pointer image to indicate
+ * that its fragments are stored in a separate buffer per layer rather than
+ * interleaved per pixel.
+ */
+#define ICET_IMAGE_FLAG_PLANAR          (IceTEnum)0x00000002
+/* Flag combined with the magic number of a sparse layered image to indicate
+ * that each active pixel holds exactly one fragment.  Such images use the run
+ * lengths and pixel format of non-layered images, i.e. they store neither the
+ * number of active fragments per run nor per pixel.
+ */
+#define ICET_IMAGE_FLAG_SINGLE_FRAGMENT (IceTEnum)0x00000004
+/* Flags combined with the magic number of a sparse layered image to indicate
+ * that the number of fragments of each active pixel is stored with 2 or 4 bytes
+ * rather than 1.  The size is chosen from the number of fragments the pixels
+ * of the image may hold, see ICET_IMAGE_MAX_FRAGMENTS_INDEX.
+ */
+#define ICET_IMAGE_FLAG_LAYER_COUNT_16  (IceTEnum)0x00000008
+#define ICET_IMAGE_FLAG_LAYER_COUNT_32  (IceTEnum)0x00000010
+/* Flag combined with the magic number of a sparse image to indicate that an
+ * index of its run lengths is stored after the end of its data.  The index is
+ * not part of the actual buffer size, so it is never sent.  Changing the data
+ * of the image drops the flag.  See icetSparseImageBuildIndex.
+ */
+#define ICET_IMAGE_FLAG_RUN_INDEX       (IceTEnum)0x00000020
+/* Flag combined with the magic number of a non-layered sparse image to indicate
+ * that its pixels are stored in 2D blocks rather than runs.  See
+ * ICET_SPARSE_BLOCK_NUM_PIXELS.
+ */
+#define ICET_IMAGE_FLAG_BLOCKS          (IceTEnum)0x00000040
+
+/* Blocked sparse images group their pixels into blocks of
+ * ICET_SPARSE_BLOCK_NUM_PIXELS pixels.  Blocks are ICET_SPARSE_BLOCK_HEIGHT
+ * rows high in images with at least that many rows and a single row otherwise,
+ * which includes the pieces images are split into.  The data starts with a
+ * bitmap of the blocks holding active pixels, one bit per block in row-major
+ * order of the blocks, padded to a multiple of 32 bits.  It is followed by each
+ * of these blocks: a mask of its active pixels, stored as two 32-bit words with
+ * the first pixel of the block in the lowest bit of the first word, and the
+ * data of those pixels in row-major order within the block.
+ */
+#define ICET_SPARSE_BLOCK_NUM_PIXELS    64
+#define ICET_SPARSE_BLOCK_HEIGHT        8
+#define ICET_SPARSE_BLOCK_MASK_SIZE     ((IceTSizeType)(2*sizeof(IceTUInt)))
+#define ICET_SPARSE_BLOCK_BIT(words, bit) \
+    ((((const IceTUInt *)(words))[(bit) >> 5] >> ((bit) & 31)) & 1u)
+#define ICET_SPARSE_BLOCK_SET_BIT(words, bit) \
+    (((IceTUInt *)(words))[(bit) >> 5] |= 1u << ((bit) & 31))
+
+/* The sparse image index records the position of every ICET_RUN_INDEX_STRIDE
+ * run lengths.  It starts at the first multiple of ICET_RUN_INDEX_ALIGNMENT
+ * bytes after the data with the actual buffer size it was built for and the
+ * number of entries.  Each entry holds the pixel a run starts at and the
+ * offset of its run lengths in bytes from the start of the image buffer.
+ */
+#define ICET_RUN_INDEX_STRIDE           32
+#define ICET_RUN_INDEX_ALIGNMENT        8
+#define ICET_RUN_INDEX_SIZE_INDEX       0
+#define ICET_RUN_INDEX_NUM_ENTRIES_INDEX 1
+#define ICET_RUN_INDEX_ENTRIES_INDEX    2
+
+/* Sparse images encoded for sending with a wire codec start with a header of
+ * this magic number, the codec, the sizes of the encoded and decoded image and
+ * the number of bytes per pixel the codec predicts from, followed by the size
+ * of the image the codec was applied to and the color format to restore.  The
+ * latter two differ from the decoded image only if its colors were quantized.
+ * Otherwise, the color format is ICET_IMAGE_COLOR_NONE.
+ */
+#define ICET_ENCODED_SPARSE_IMAGE_MAGIC_NUM (IceTEnum)0x004D7000
+#define ICET_ENCODED_MAGIC_NUM_INDEX            0
+#define ICET_ENCODED_CODEC_INDEX                1
+#define ICET_ENCODED_SIZE_INDEX                 2
+#define ICET_ENCODED_DECODED_SIZE_INDEX         3
+#define ICET_ENCODED_STRIDE_INDEX               4
+#define ICET_ENCODED_QUANTIZED_SIZE_INDEX       5
+#define ICET_ENCODED_COLOR_FORMAT_INDEX         6
+#define ICET_ENCODED_HEADER_SIZE                (7*sizeof(IceTInt32))
 
 #define ICET_IMAGE_MAGIC_NUM_INDEX              0
 #define ICET_IMAGE_COLOR_FORMAT_INDEX           1
@@ -37,10 +113,34 @@
 #define ICET_IMAGE_ACTUAL_BUFFER_SIZE_INDEX     6
 #define ICET_IMAGE_DATA_START_INDEX             7
 
+/* Sparse layered images extend the header with the processes that contributed
+ * to them, recorded as the range of their positions in the composite order and
+ * the number of processes in that range that did.  A count of 0 means the
+ * contributors are unknown.  See ICET_COALESCE_FRAGMENTS.
+ */
+#define ICET_IMAGE_FIRST_CONTRIBUTOR_INDEX      7
+#define ICET_IMAGE_LAST_CONTRIBUTOR_INDEX       8
+#define ICET_IMAGE_NUM_CONTRIBUTORS_INDEX       9
+/* Sparse layered images also record an upper bound for the number of fragments
+ * of any of their pixels, from which compositing chooses the size of the
+ * fragment counts of the result without asking other processes.
+ */
+#define ICET_IMAGE_MAX_FRAGMENTS_INDEX          10
+#define ICET_SPARSE_LAYERED_IMAGE_DATA_START_INDEX 11
+
 #define ICET_IMAGE_HEADER(image)        ((IceTInt *)image.opaque_internals)
 #define ICET_IMAGE_DATA(image) \
     ((IceTVoid *)&(ICET_IMAGE_HEADER(image)[ICET_IMAGE_DATA_START_INDEX]))
 
+#define ICET_SPARSE_IMAGE_DATA_START_INDEX(image)                              \
+    (  (ICET_IMAGE_HEADER(image)[ICET_IMAGE_MAGIC_NUM_INDEX]                   \
+        & ICET_IMAGE_FLAG_LAYERED)                                             \
+     ? ICET_SPARSE_LAYERED_IMAGE_DATA_START_INDEX                              \
+     : ICET_IMAGE_DATA_START_INDEX )
+#define ICET_SPARSE_IMAGE_DATA(image)                                          \
+    ((IceTVoid *)&(ICET_IMAGE_HEADER(image)                                    \
+                   [ICET_SPARSE_IMAGE_DATA_START_INDEX(image)]))
+
 /* In addition to the regular header, layered images have a nested sub-header
  * at the start of their data containing metadata specific to layered images.
  * Color and depth are stored after the sub-header either directly in the image
@@ -61,6 +161,16 @@ typedef struct IceTLayeredImagePointerData {
     const IceTVoid *depth_buffer;
 } IceTLayeredImagePointerData;
 
+/* Planar layered images store an array with one color and depth buffer per
+ * layer.  The arrays have the same size as the pointers of interleaved layered
+ * images, so both share a buffer size.
+ */
+typedef struct IceTLayeredImagePlanarData {
+    IceTLayeredImageHeader header;
+    const IceTVoid *const *color_layers;
+    const IceTVoid *const *depth_layers;
+} IceTLayeredImagePlanarData;
+
 typedef IceTUnsignedInt32 IceTRunLengthType;
 
 #define INACTIVE_RUN_LENGTH(rl) (((IceTRunLengthType *)(rl))[0])
@@ -74,14 +184,37 @@ typedef IceTUnsignedInt32 IceTRunLengthType;
 #define ACTIVE_RUN_LENGTH_FRAGMENTS(rl) (((IceTRunLengthType *)(rl))[2])
 #define RUN_LENGTH_SIZE_LAYERED         ((IceTSizeType)(3*sizeof(IceTRunLengthType)))
 
+/* Read or write the number of fragments of an active pixel in a sparse layered
+ * image, which is stored with count_size bytes.  The largest number that fits
+ * is the maximum number of fragments a pixel may hold.
+ */
+#define LAYER_COUNT_GET(pointer, count_size)                                   \
+    (IceTLayerCount)(                                                          \
+          ((count_size) == 1) ? *(const IceTUnsignedInt8 *)(pointer)           \
+        : ((count_size) == 2) ? *(const IceTUnsignedInt16 *)(pointer)          \
+        :                       *(const IceTUnsignedInt32 *)(pointer) )
+#define LAYER_COUNT_SET(pointer, count_size, value)                            \
+    if ((count_size) == 1) {                                                   \
+        *(IceTUnsignedInt8 *)(pointer) = (IceTUnsignedInt8)(value);            \
+    } else if ((count_size) == 2) {                                            \
+        *(IceTUnsignedInt16 *)(pointer) = (IceTUnsignedInt16)(value);          \
+    } else {                                                                   \
+        *(IceTUnsignedInt32 *)(pointer) = (IceTUnsignedInt32)(value);          \
+    }
+#define LAYER_COUNT_MAX(count_size)                                            \
+    (  ((count_size) == 1) ? (IceTLayerCount)0xFF                              \
+     : ((count_size) == 2) ? (IceTLayerCount)0xFFFF                            \
+     : (IceTLayerCount)0xFFFFFFFF )
+
 #ifdef DEBUG
 static void ICET_TEST_IMAGE_HEADER(IceTImage image)
 {
     if (!icetImageIsNull(image)) {
         IceTEnum magic_num =
                 ICET_IMAGE_HEADER(image)[ICET_IMAGE_MAGIC_NUM_INDEX];
-        /* Allow both layered and non-layered images by ignoring the flag. */
-        IceTEnum base_magic_num = magic_num & ~ICET_IMAGE_FLAG_LAYERED;
+        /* Allow both layered and non-layered images by ignoring the flags. */
+        IceTEnum base_magic_num =
+            magic_num & ~(ICET_IMAGE_FLAG_LAYERED | ICET_IMAGE_FLAG_PLANAR);
 
         if (   (base_magic_num != ICET_IMAGE_MAGIC_NUM)
             && (base_magic_num != ICET_IMAGE_POINTERS_MAGIC_NUM) ) {
@@ -108,6 +241,8 @@ static void ICET_TEST_LAYERED_IMAGE_HEADER(IceTImage image)
     switch (magic_num) {
     case ICET_IMAGE_MAGIC_NUM | ICET_IMAGE_FLAG_LAYERED:
     case ICET_IMAGE_POINTERS_MAGIC_NUM | ICET_IMAGE_FLAG_LAYERED:
+    case ICET_IMAGE_POINTERS_MAGIC_NUM | ICET_IMAGE_FLAG_LAYERED
+                                       | ICET_IMAGE_FLAG_PLANAR:
         /* Valid layered format. */
         return;
     default:
@@ -122,8 +257,14 @@ static void ICET_TEST_SPARSE_IMAGE_HEADER(IceTSparseImage image)
     if (!icetSparseImageIsNull(image)) {
         const IceTEnum magic_num =
             ICET_IMAGE_HEADER(image)[ICET_IMAGE_MAGIC_NUM_INDEX];
-        /* Allow both layered and non-layered images by ignoring the flag. */
-        const IceTEnum base_magic_num = magic_num & ~ICET_IMAGE_FLAG_LAYERED;
+        /* Allow both layered and non-layered images by ignoring the flags. */
+        const IceTEnum base_magic_num =
+            magic_num & ~(ICET_IMAGE_FLAG_LAYERED
+                          | ICET_IMAGE_FLAG_SINGLE_FRAGMENT
+                          | ICET_IMAGE_FLAG_LAYER_COUNT_16
+                          | ICET_IMAGE_FLAG_LAYER_COUNT_32
+                          | ICET_IMAGE_FLAG_RUN_INDEX
+                          | ICET_IMAGE_FLAG_BLOCKS);
         if (base_magic_num != ICET_SPARSE_IMAGE_MAGIC_NUM ) {
             icetRaiseError(ICET_SANITY_CHECK_FAIL,
                            "Detected invalid image header (magic num = 0x%X).",
@@ -164,6 +305,132 @@ static void ICET_TEST_SPARSE_IMAGE_HEADER(IceTSparseImage image)
 static IceTSizeType colorPixelSize(IceTEnum color_format);
 static IceTSizeType depthPixelSize(IceTEnum depth_format);
 
+/* Set or clear the flag marking a sparse layered image as storing a single
+   fragment per active pixel.  This does not convert the image data. */
+static void icetSparseImageSetSingleFragment(IceTSparseImage image,
+                                             IceTBoolean single_fragment);
+
+/* Set or clear the flag marking a non-layered sparse image as storing its
+   pixels in blocks.  This does not convert the image data. */
+static void icetSparseImageSetBlocked(IceTSparseImage image,
+                                      IceTBoolean blocked);
+
+/* The blocks of a blocked sparse image of a given size. */
+typedef struct IceTSparseBlockLayout {
+    IceTSizeType width;
+    IceTSizeType height;
+    IceTSizeType block_width;
+    IceTSizeType block_height;
+    IceTSizeType blocks_per_row;
+    IceTSizeType num_block_rows;
+    IceTSizeType num_blocks;
+    IceTSizeType bitmap_size;
+} IceTSparseBlockLayout;
+
+static void icetSparseBlockLayoutInit(IceTSparseBlockLayout *layout,
+                                      IceTSizeType width,
+                                      IceTSizeType height);
+
+/* Returns the number of bytes of the bitmap and the masks of a blocked sparse
+   image of the given size in which every block has an active pixel. */
+static IceTSizeType icetSparseBlockImageOverhead(IceTSizeType width,
+                                                 IceTSizeType height);
+
+/* Returns the number of bits set in a block mask before the given bit. */
+static IceTSizeType icetSparseBlockCountBelow(const IceTUInt *mask,
+                                              IceTSizeType bit);
+
+/* Stores the pixels of a sparse image with runs as blocks in out_image, which
+   gets the same dimensions. */
+static void icetSparseBlockImageFromRuns(const IceTSparseImage in_image,
+                                         IceTSparseImage out_image);
+
+/* Copies num_pixels pixels of a blocked sparse image, starting at in_offset, to
+   out_image, which gets dimensions num_pixels x 1 and stores the pixels as
+   blocks if out_blocked is true and as runs otherwise. */
+static void icetSparseBlockImageCopyPixels(const IceTSparseImage in_image,
+                                           IceTSizeType in_offset,
+                                           IceTSizeType num_pixels,
+                                           IceTBoolean out_blocked,
+                                           IceTSparseImage out_image);
+
+/* Returns a sparse image in the given state buffer that holds the pixels of a
+   blocked sparse image as runs, for the functions that only read runs. */
+static IceTSparseImage icetSparseBlockImageToRuns(const IceTSparseImage image,
+                                                  IceTEnum pname);
+
+/* Get or set the number of bytes with which a sparse layered image stores the
+   number of fragments of each active pixel.  Setting it does not convert the
+   image data. */
+static IceTSizeType icetSparseImageGetLayerCountSize(
+                                                const IceTSparseImage image);
+static void icetSparseImageSetLayerCountSize(IceTSparseImage image,
+                                             IceTSizeType count_size);
+
+/* Get or set the upper bound for the number of fragments of any pixel recorded
+   in the header of a sparse layered image.  Images with a single fragment per
+   pixel always report 1. */
+static IceTLayerCount icetSparseImageGetMaxFragments(
+                                                const IceTSparseImage image);
+static void icetSparseImageSetMaxFragments(IceTSparseImage image,
+                                           IceTLayerCount max_fragments);
+
+/* Returns the number of bytes with which sparse layered images with up to
+   num_layers fragments per pixel store their fragment counts, taking
+   ICET_MAX_FRAGMENTS_PER_PIXEL into account. */
+static IceTSizeType icetLayerCountSizeForLayers(IceTLayerCount num_layers);
+
+/* Returns the number of bytes with which the result of compositing two sparse
+   layered images stores its fragment counts.  This is the smallest size that
+   holds the fragments of both images at any pixel as well as the counts of
+   either input. */
+static IceTSizeType icetSparseImageMergedLayerCountSize(
+                                                const IceTSparseImage front,
+                                                const IceTSparseImage back);
+
+/* Returns an upper bound for the size in bytes of a sparse layered image once
+   its fragment counts are stored with count_size bytes, promoting it to the
+   general layered format if it holds a single fragment per pixel. */
+static IceTSizeType icetSparseLayeredImageConvertedBufferSize(
+                                                const IceTSparseImage image,
+                                                IceTSizeType count_size);
+
+/* Copy the range of contributing processes from one sparse layered image to
+   another, or set it to the union of the ranges of two images being
+   composited.  Non-layered images do not record their contributors, so these
+   do nothing for them. */
+static void icetSparseImageCopyContributors(const IceTSparseImage src,
+                                            IceTSparseImage dest);
+static void icetSparseImageMergeContributors(const IceTSparseImage front,
+                                             const IceTSparseImage back,
+                                             IceTSparseImage dest);
+
+/* Collects the depth intervals of all processes that have not contributed to
+   either of the given images but may still be composited with them.  Returns
+   the number of disjoint intervals, which are written in increasing order to
+   *blocked_p as pairs of normalized depths, or -1 if fragments of the images
+   may not be coalesced.  See ICET_COALESCE_FRAGMENTS. */
+static IceTInt icetSparseImageGetBlockedDepths(const IceTSparseImage front,
+                                               const IceTSparseImage back,
+                                               const IceTFloat **blocked_p);
+
+/* Returns the index of the first of the given blocked depth intervals that
+   does not end in front of depth, or num_blocked if there is none. */
+static IceTInt icetDepthIntervalsFirstBehind(const IceTFloat *blocked,
+                                             IceTInt num_blocked,
+                                             IceTFloat depth);
+
+/* Returns whether none of the given blocked depth intervals overlaps the
+   interval [front_depth, back_depth].  The search starts at the interval
+   *first, which is advanced past all intervals ending in front of
+   front_depth, so a pixel whose fragments are checked in depth order walks
+   the intervals only once. */
+static IceTBoolean icetDepthRangeIsClosed(const IceTFloat *blocked,
+                                          IceTInt num_blocked,
+                                          IceTInt *first,
+                                          IceTFloat front_depth,
+                                          IceTFloat back_depth);
+
 /* Given a sparse image and a pointer to the end of the data, fill in the entry
    for the actual buffer size. */
 static void icetSparseImageSetActualSize(IceTSparseImage image,
@@ -243,13 +510,38 @@ static void icetSparseImageCopyPixelsInPlaceInternal(
                                           IceTSizeType pixel_size,
                                           IceTSparseImage out_image);
 
+/* If ICET_SPARSE_IMAGE_INDEX is enabled, records the position of every few
+   run lengths of a non-layered sparse image in its buffer after the end of
+   its data, provided the buffer has room.  Called after compressing. */
+static void icetSparseImageBuildIndex(IceTSparseImage image);
+
+/* Finds the last run length of a sparse image that starts at or before the
+   given pixel with the index of the image.  Sets data_p to point to the run
+   length and returns the pixel it starts at.  If the image has no index, this
+   is the first run length of the image. */
+static IceTSizeType icetSparseImageSeekRun(const IceTSparseImage image,
+                                           IceTSizeType pixel,
+                                           const IceTVoid **data_p);
+
+/* Behaves like icetSparseImageScanPixels without copying, given that the scan
+   parameters are at pixel of a non-layered image.  Uses the index of the image
+   to jump over whole runs when possible. */
+static void icetSparseImageSkipPixels(const IceTSparseImage image,
+                                      IceTSizeType pixel,
+                                      const IceTVoid **in_data_p,
+                                      IceTSizeType *inactive_before_p,
+                                      IceTSizeType *active_till_next_runl_p,
+                                      IceTSizeType pixels_to_skip,
+                                      IceTSizeType pixel_size);
+
 /* Choose the partitions (defined by offsets) for the given number of partitions
    and size.  The partitions are choosen such that if given a power of 2 as the
    number of partitions, you will get the same partitions if you recursively
    partition the size by 2s.  That is, creating 4 partitions is equivalent to
    creating 2 partitions and then recursively creating 2 more partitions.  If
    the size does not split evenly by 4, the remainder will be divided amongst
-   the partitions in the same way. */
+   the partitions in the same way.  If ICET_SPLIT_PARTITION_OFFSETS is set, the
+   partitions are instead taken from that table. */
 static void icetSparseImageSplitChoosePartitions(
                                            IceTInt num_partitions,
                                            IceTSizeType eventual_num_partitions,
@@ -324,6 +616,7 @@ static IceTSizeType colorPixelSize(IceTEnum color_format)
       case ICET_IMAGE_COLOR_RGBA_UBYTE: return 4;
       case ICET_IMAGE_COLOR_RGBA_FLOAT: return 4*sizeof(IceTFloat);
       case ICET_IMAGE_COLOR_RGB_FLOAT:  return 3*sizeof(IceTFloat);
+      case ICET_IMAGE_COLOR_RGBA_HALF:  return 4*sizeof(IceTUShort);
       case ICET_IMAGE_COLOR_NONE:       return 0;
       default:
           icetRaiseError(ICET_INVALID_ENUM,
@@ -336,6 +629,7 @@ static IceTSizeType depthPixelSize(IceTEnum depth_format)
 {
     switch (depth_format) {
       case ICET_IMAGE_DEPTH_FLOAT: return sizeof(IceTFloat);
+      case ICET_IMAGE_DEPTH_USHORT: return sizeof(IceTUShort);
       case ICET_IMAGE_DEPTH_NONE:  return 0;
       default:
           icetRaiseError(ICET_INVALID_ENUM,
@@ -445,6 +739,15 @@ IceTSizeType icetSparseImageBufferSizeType(IceTEnum color_format,
     if (pixel_size < RUN_LENGTH_SIZE) {
         size += (RUN_LENGTH_SIZE - pixel_size)*((width*height+1)/2);
     }
+
+    /* Images stored as blocks need a bitmap and a mask for each block
+     * instead. */
+    if (icetIsEnabled(ICET_BLOCK_SPARSE_IMAGES)) {
+        size = MAX(size,
+                   (  icetImageBufferSizeType(color_format, depth_format,
+                                              width, height)
+                    + icetSparseBlockImageOverhead(width, height) ));
+    }
     return size;
 }
 
@@ -473,13 +776,14 @@ IceTSizeType icetSparseLayeredImageBufferSizeType(IceTEnum color_format,
     /* Each pixel starts with the number of active fragments at that pixel,
      * followed by the fragments themselves.  A pixel is largest if all
      * fragments are active. */
-    const IceTSizeType pixel_size =  sizeof(IceTLayerCount)
+    const IceTSizeType pixel_size =  icetLayerCountSizeForLayers(num_layers)
                                    + num_layers*fragment_size;
 
     /* Usually the maximum size will be that of an image with only active
      * fragments. */
     IceTSizeType size =
-          ICET_IMAGE_DATA_START_INDEX*sizeof(IceTUInt)  /* Header. */
+          ICET_SPARSE_LAYERED_IMAGE_DATA_START_INDEX*sizeof(IceTUInt)
+                                                        /* Header. */
         + RUN_LENGTH_SIZE_LAYERED                       /* Run lengths. */
         + width*height*pixel_size;                      /* Active pixels. */
 
@@ -493,6 +797,110 @@ IceTSizeType icetSparseLayeredImageBufferSizeType(IceTEnum color_format,
     return size;
 }
 
+/* Returns an upper bound for the size in bytes of a sparse layered image with a
+ * buffer of compressed_size bytes once the fragment counts of its pixels, which
+ * take in_count_size bytes, are stored with out_count_size bytes.  An input
+ * count size of 0 denotes an image with a single fragment per pixel, which is
+ * promoted to the general layered format.
+ */
+static IceTSizeType icetSparseLayeredImageGrownBufferSize(
+                                                IceTSizeType compressed_size,
+                                                IceTSizeType fragment_size,
+                                                IceTSizeType in_count_size,
+                                                IceTSizeType out_count_size)
+{
+    const IceTSizeType data_size =
+          compressed_size
+        - ICET_SPARSE_LAYERED_IMAGE_DATA_START_INDEX*sizeof(IceTInt);
+
+    if ((data_size <= 0) || (fragment_size <= 0)) return compressed_size;
+
+    if (in_count_size == 0) {
+        /* Promotion adds one field to each set of run lengths and the number
+         * of fragments to each active pixel, so the data grows by at most the
+         * larger of the two ratios. */
+        return compressed_size
+            + MAX(  data_size*(IceTSizeType)sizeof(IceTRunLengthType)
+                    /RUN_LENGTH_SIZE,
+                    data_size*out_count_size/fragment_size)
+            + 1;
+    }
+
+    /* Each active pixel holds at least one fragment besides its count. */
+    if (in_count_size >= out_count_size) return compressed_size;
+    return compressed_size
+        +  data_size*(out_count_size - in_count_size)
+          /(in_count_size + fragment_size)
+        + 1;
+}
+
+IceTSizeType icetSparseLayeredImagePromotedBufferSize(
+                                                IceTSizeType compressed_size)
+{
+    IceTEnum color_format, depth_format;
+
+    icetGetEnumv(ICET_COLOR_FORMAT, &color_format);
+    icetGetEnumv(ICET_DEPTH_FORMAT, &depth_format);
+
+    /* Compositing widens the fragment counts as far as needed by the merged
+     * pixels, which only ICET_MAX_FRAGMENTS_PER_PIXEL limits. */
+    return icetSparseLayeredImageGrownBufferSize(
+                  compressed_size,
+                  colorPixelSize(color_format) + depthPixelSize(depth_format),
+                  0,
+                  icetLayerCountSizeForLayers((IceTLayerCount)0x7FFFFFFF));
+}
+
+void icetSparseLayeredImageGetFragmentCounts(const IceTSparseImage image,
+                                             IceTSizeType *count_size,
+                                             IceTLayerCount *max_fragments)
+{
+    *count_size = icetSparseImageIsSingleFragment(image)
+                  ? 0 : icetSparseImageGetLayerCountSize(image);
+    *max_fragments = icetSparseImageGetMaxFragments(image);
+}
+
+IceTSizeType icetSparseLayeredImageCompositeCountSize(
+                                        IceTLayerCount largest_max_fragments,
+                                        IceTLayerCount total_max_fragments)
+{
+    /* Every merge picks the smallest count size for the fragments of both of
+     * its inputs, which never exceeds that of all images together. */
+    return MAX(icetLayerCountSizeForLayers(total_max_fragments),
+               icetSparseLayeredImageLayerCountSize(
+                                       (IceTSizeType)largest_max_fragments));
+}
+
+IceTSizeType icetSparseLayeredImageCompositeBufferSize(
+                                        IceTSizeType compressed_size,
+                                        IceTSizeType count_size,
+                                        IceTSizeType composite_count_size)
+{
+    IceTEnum color_format, depth_format;
+
+    icetGetEnumv(ICET_COLOR_FORMAT, &color_format);
+    icetGetEnumv(ICET_DEPTH_FORMAT, &depth_format);
+
+    return icetSparseLayeredImageGrownBufferSize(
+                  compressed_size,
+                  colorPixelSize(color_format) + depthPixelSize(depth_format),
+                  count_size,
+                  composite_count_size);
+}
+
+static IceTSizeType icetSparseLayeredImageConvertedBufferSize(
+                                                const IceTSparseImage image,
+                                                IceTSizeType count_size)
+{
+    return icetSparseLayeredImageGrownBufferSize(
+                icetSparseImageGetCompressedBufferSize(image),
+                  colorPixelSize(icetSparseImageGetColorFormat(image))
+                + depthPixelSize(icetSparseImageGetDepthFormat(image)),
+                icetSparseImageIsSingleFragment(image)
+                    ? 0 : icetSparseImageGetLayerCountSize(image),
+                count_size);
+}
+
 IceTImage icetGetStateBufferImage(IceTEnum pname,
                                   IceTSizeType width,
                                   IceTSizeType height)
@@ -512,6 +920,12 @@ IceTImage icetRetrieveStateImage(IceTEnum pname)
                 (IceTVoid *)icetUnsafeStateGetBuffer(pname));
 }
 
+IceTSparseImage icetRetrieveStateSparseImage(IceTEnum pname)
+{
+    return icetSparseImageUnpackageFromReceive(
+                (IceTVoid *)icetUnsafeStateGetBuffer(pname));
+}
+
 IceTImage icetGetStatePointerImage(IceTEnum pname,
                                    IceTSizeType width,
                                    IceTSizeType height,
@@ -545,6 +959,23 @@ IceTImage icetGetStatePointerLayeredImage(IceTEnum pname,
                 buffer, width, height, num_layers, color_buffer, depth_buffer);
 }
 
+IceTImage icetGetStatePlanarLayeredImage(IceTEnum pname,
+                                         IceTSizeType width,
+                                         IceTSizeType height,
+                                         IceTLayerCount num_layers,
+                                         const IceTVoid *const *color_layers,
+                                         const IceTVoid *const *depth_layers)
+{
+    IceTVoid *buffer;
+    IceTSizeType buffer_size;
+
+    buffer_size = icetLayeredImagePointerBufferSize();
+    buffer = icetGetStateBuffer(pname, buffer_size);
+
+    return icetLayeredImagePlanarAssignBuffer(
+                buffer, width, height, num_layers, color_layers, depth_layers);
+}
+
 IceTImage icetImageAssignBuffer(IceTVoid *buffer,
                                 IceTSizeType width,
                                 IceTSizeType height)
@@ -569,12 +1000,14 @@ IceTImage icetImageAssignBuffer(IceTVoid *buffer,
     if (   (color_format != ICET_IMAGE_COLOR_RGBA_UBYTE)
         && (color_format != ICET_IMAGE_COLOR_RGBA_FLOAT)
         && (color_format != ICET_IMAGE_COLOR_RGB_FLOAT)
+        && (color_format != ICET_IMAGE_COLOR_RGBA_HALF)
         && (color_format != ICET_IMAGE_COLOR_NONE) ) {
         icetRaiseError(ICET_INVALID_ENUM,
                        "Invalid color format 0x%X.", color_format);
         color_format = ICET_IMAGE_COLOR_NONE;
     }
     if (   (depth_format != ICET_IMAGE_DEPTH_FLOAT)
+        && (depth_format != ICET_IMAGE_DEPTH_USHORT)
         && (depth_format != ICET_IMAGE_DEPTH_NONE) ) {
         icetRaiseError(ICET_INVALID_ENUM,
                        "Invalid depth format 0x%X.", depth_format);
@@ -707,6 +1140,45 @@ IceTImage icetLayeredImagePointerAssignBuffer(IceTVoid *buffer,
     return image;
 }
 
+IceTImage icetLayeredImagePlanarAssignBuffer(IceTVoid *buffer,
+                                             IceTSizeType width,
+                                             IceTSizeType height,
+                                             IceTLayerCount num_layers,
+                                             const IceTVoid *const *color_layers,
+                                             const IceTVoid *const *depth_layers)
+{
+    /* Most fields are the same as for interleaved layered images. */
+    IceTImage image = icetLayeredImagePointerAssignBuffer(
+        buffer, width, height, num_layers, color_layers, depth_layers);
+    IceTLayeredImagePlanarData *data;
+    IceTLayerCount layer;
+
+    if (icetImageIsNull(image)) {
+        return image;
+    }
+
+    ICET_IMAGE_HEADER(image)[ICET_IMAGE_MAGIC_NUM_INDEX] |=
+        ICET_IMAGE_FLAG_PLANAR;
+
+    /* Check that each layer has its buffers. */
+    for (layer = 0; layer < num_layers; layer++) {
+        if ((color_layers != NULL) && (color_layers[layer] == NULL)) {
+            icetRaiseError(ICET_INVALID_VALUE,
+                           "Missing color buffer of layer %d.", (int)layer);
+        }
+        if ((depth_layers != NULL) && (depth_layers[layer] == NULL)) {
+            icetRaiseError(ICET_INVALID_VALUE,
+                           "Missing depth buffer of layer %d.", (int)layer);
+        }
+    }
+
+    data = ICET_IMAGE_DATA(image);
+    data->color_layers = color_layers;
+    data->depth_layers = depth_layers;
+
+    return image;
+}
+
 IceTImage icetImageNull(void)
 {
     IceTImage image;
@@ -729,6 +1201,36 @@ IceTBoolean icetImageIsLayered(const IceTImage image)
         & ICET_IMAGE_FLAG_LAYERED;
 }
 
+IceTBoolean icetLayeredImageIsPlanar(const IceTImage image)
+{
+    return (  ICET_IMAGE_HEADER(image)[ICET_IMAGE_MAGIC_NUM_INDEX]
+            & ICET_IMAGE_FLAG_PLANAR) != 0;
+}
+
+const IceTVoid *const *icetLayeredImageGetColorLayersConst(
+                                                        const IceTImage image)
+{
+    if (!icetLayeredImageIsPlanar(image)) {
+        icetRaiseError(ICET_SANITY_CHECK_FAIL,
+                       "Only planar layered images store one buffer per layer.");
+        return NULL;
+    }
+    return ((const IceTLayeredImagePlanarData *)ICET_IMAGE_DATA(image))
+        ->color_layers;
+}
+
+const IceTVoid *const *icetLayeredImageGetDepthLayersConst(
+                                                        const IceTImage image)
+{
+    if (!icetLayeredImageIsPlanar(image)) {
+        icetRaiseError(ICET_SANITY_CHECK_FAIL,
+                       "Only planar layered images store one buffer per layer.");
+        return NULL;
+    }
+    return ((const IceTLayeredImagePlanarData *)ICET_IMAGE_DATA(image))
+        ->depth_layers;
+}
+
 IceTSparseImage icetGetStateBufferSparseImage(IceTEnum pname,
                                               IceTSizeType width,
                                               IceTSizeType height)
@@ -766,12 +1268,14 @@ IceTSparseImage icetSparseImageAssignBuffer(IceTVoid *buffer,
     if (   (color_format != ICET_IMAGE_COLOR_RGBA_UBYTE)
         && (color_format != ICET_IMAGE_COLOR_RGBA_FLOAT)
         && (color_format != ICET_IMAGE_COLOR_RGB_FLOAT)
+        && (color_format != ICET_IMAGE_COLOR_RGBA_HALF)
         && (color_format != ICET_IMAGE_COLOR_NONE) ) {
         icetRaiseError(ICET_INVALID_ENUM,
                        "Invalid color format 0x%X.", color_format);
         color_format = ICET_IMAGE_COLOR_NONE;
     }
     if (   (depth_format != ICET_IMAGE_DEPTH_FLOAT)
+        && (depth_format != ICET_IMAGE_DEPTH_USHORT)
         && (depth_format != ICET_IMAGE_DEPTH_NONE) ) {
         icetRaiseError(ICET_INVALID_ENUM,
                        "Invalid depth format 0x%X.", depth_format);
@@ -786,6 +1290,10 @@ IceTSparseImage icetSparseImageAssignBuffer(IceTVoid *buffer,
     header[ICET_IMAGE_MAX_NUM_PIXELS_INDEX]     = (IceTInt)(width*height);
     header[ICET_IMAGE_ACTUAL_BUFFER_SIZE_INDEX] = 0;
 
+    /* The context chooses how new images store their pixels.  Functions that
+     * fill an image from another sparse image use the format of their input. */
+    icetSparseImageSetBlocked(image, icetIsEnabled(ICET_BLOCK_SPARSE_IMAGES));
+
   /* Make sure the runlengths are valid. */
     icetClearSparseImage(image);
 
@@ -831,6 +1339,7 @@ IceTSparseImage icetSparseLayeredImageAssignBuffer(IceTVoid *buffer,
         case ICET_IMAGE_COLOR_RGBA_UBYTE:
         case ICET_IMAGE_COLOR_RGBA_FLOAT:
         case ICET_IMAGE_COLOR_RGB_FLOAT:
+        case ICET_IMAGE_COLOR_RGBA_HALF:
         case ICET_IMAGE_COLOR_NONE:
             /* Format OK. */
             break;
@@ -842,6 +1351,7 @@ IceTSparseImage icetSparseLayeredImageAssignBuffer(IceTVoid *buffer,
 
         switch (depth_format) {
         case ICET_IMAGE_DEPTH_FLOAT:
+        case ICET_IMAGE_DEPTH_USHORT:
             /* Format OK. */
             break;
         case ICET_IMAGE_DEPTH_NONE:
@@ -867,6 +1377,10 @@ IceTSparseImage icetSparseLayeredImageAssignBuffer(IceTVoid *buffer,
         header[ICET_IMAGE_HEIGHT_INDEX]             = (IceTInt)height;
         header[ICET_IMAGE_MAX_NUM_PIXELS_INDEX]     = (IceTInt)(width*height);
         header[ICET_IMAGE_ACTUAL_BUFFER_SIZE_INDEX] = 0;
+        header[ICET_IMAGE_FIRST_CONTRIBUTOR_INDEX]  = 0;
+        header[ICET_IMAGE_LAST_CONTRIBUTOR_INDEX]   = 0;
+        header[ICET_IMAGE_NUM_CONTRIBUTORS_INDEX]   = 0;
+        header[ICET_IMAGE_MAX_FRAGMENTS_INDEX]      = 0;
     }
 
   /* Make sure the runlengths are valid. */
@@ -897,6 +1411,332 @@ IceTBoolean icetSparseImageIsLayered(const IceTSparseImage image)
           & ICET_IMAGE_FLAG_LAYERED;
 }
 
+IceTBoolean icetSparseImageIsSingleFragment(const IceTSparseImage image)
+{
+    return (  ICET_IMAGE_HEADER(image)[ICET_IMAGE_MAGIC_NUM_INDEX]
+            & ICET_IMAGE_FLAG_SINGLE_FRAGMENT) != 0;
+}
+
+IceTBoolean icetSparseImageIsBlocked(const IceTSparseImage image)
+{
+    return (  ICET_IMAGE_HEADER(image)[ICET_IMAGE_MAGIC_NUM_INDEX]
+            & ICET_IMAGE_FLAG_BLOCKS) != 0;
+}
+
+static void icetSparseImageSetBlocked(IceTSparseImage image,
+                                      IceTBoolean blocked)
+{
+    IceTInt *header = ICET_IMAGE_HEADER(image);
+
+    if (blocked && !icetSparseImageIsLayered(image)) {
+        header[ICET_IMAGE_MAGIC_NUM_INDEX] |= ICET_IMAGE_FLAG_BLOCKS;
+    } else {
+        header[ICET_IMAGE_MAGIC_NUM_INDEX] &= ~ICET_IMAGE_FLAG_BLOCKS;
+    }
+}
+
+static void icetSparseImageSetSingleFragment(IceTSparseImage image,
+                                             IceTBoolean single_fragment)
+{
+    IceTInt *header = ICET_IMAGE_HEADER(image);
+
+    if (!icetSparseImageIsLayered(image)) {
+        if (single_fragment) {
+            icetRaiseError(ICET_SANITY_CHECK_FAIL,
+                           "Only layered images can be marked as having a"
+                           " single fragment per pixel.");
+        }
+        return;
+    }
+
+    if (single_fragment) {
+        header[ICET_IMAGE_MAGIC_NUM_INDEX] |= ICET_IMAGE_FLAG_SINGLE_FRAGMENT;
+    } else {
+        header[ICET_IMAGE_MAGIC_NUM_INDEX] &= ~ICET_IMAGE_FLAG_SINGLE_FRAGMENT;
+    }
+}
+
+static IceTSizeType icetSparseImageGetLayerCountSize(
+                                                const IceTSparseImage image)
+{
+    const IceTEnum magic_num =
+        ICET_IMAGE_HEADER(image)[ICET_IMAGE_MAGIC_NUM_INDEX];
+
+    if (magic_num & ICET_IMAGE_FLAG_LAYER_COUNT_32) {
+        return 4;
+    } else if (magic_num & ICET_IMAGE_FLAG_LAYER_COUNT_16) {
+        return 2;
+    } else {
+        return 1;
+    }
+}
+
+static void icetSparseImageSetLayerCountSize(IceTSparseImage image,
+                                             IceTSizeType count_size)
+{
+    IceTInt *header = ICET_IMAGE_HEADER(image);
+
+    if (!icetSparseImageIsLayered(image)) { return; }
+
+    header[ICET_IMAGE_MAGIC_NUM_INDEX] &= ~(  ICET_IMAGE_FLAG_LAYER_COUNT_16
+                                            | ICET_IMAGE_FLAG_LAYER_COUNT_32);
+    switch (count_size) {
+    case 1:
+        break;
+    case 2:
+        header[ICET_IMAGE_MAGIC_NUM_INDEX] |= ICET_IMAGE_FLAG_LAYER_COUNT_16;
+        break;
+    case 4:
+        header[ICET_IMAGE_MAGIC_NUM_INDEX] |= ICET_IMAGE_FLAG_LAYER_COUNT_32;
+        break;
+    default:
+        icetRaiseError(ICET_SANITY_CHECK_FAIL,
+                       "Invalid size of fragment counts: %d.",
+                       (int)count_size);
+    }
+}
+
+IceTSizeType icetSparseLayeredImageLayerCountSize(IceTSizeType max_fragments)
+{
+    if (max_fragments <= (IceTSizeType)LAYER_COUNT_MAX(1)) {
+        return 1;
+    } else if (max_fragments <= (IceTSizeType)LAYER_COUNT_MAX(2)) {
+        return 2;
+    } else {
+        return 4;
+    }
+}
+
+static IceTLayerCount icetSparseImageGetMaxFragments(
+                                                const IceTSparseImage image)
+{
+    if (icetSparseImageIsSingleFragment(image)) { return 1; }
+    return (IceTLayerCount)
+        ICET_IMAGE_HEADER(image)[ICET_IMAGE_MAX_FRAGMENTS_INDEX];
+}
+
+static void icetSparseImageSetMaxFragments(IceTSparseImage image,
+                                           IceTLayerCount max_fragments)
+{
+    if (!icetSparseImageIsLayered(image)) { return; }
+    ICET_IMAGE_HEADER(image)[ICET_IMAGE_MAX_FRAGMENTS_INDEX]
+        = (IceTInt)max_fragments;
+}
+
+static IceTSizeType icetLayerCountSizeForLayers(IceTLayerCount num_layers)
+{
+    IceTInt max_fragments;
+    IceTSizeType max_count;
+
+    icetGetIntegerv(ICET_MAX_FRAGMENTS_PER_PIXEL, &max_fragments);
+
+    max_count = (IceTSizeType)MIN(num_layers, 0x7FFFFFFF);
+    if ((max_fragments > 0) && (max_fragments < max_count)) {
+        max_count = max_fragments;
+    }
+
+    return icetSparseLayeredImageLayerCountSize(max_count);
+}
+
+static IceTSizeType icetSparseImageMergedLayerCountSize(
+                                                const IceTSparseImage front,
+                                                const IceTSparseImage back)
+{
+    const IceTLayerCount front_max = icetSparseImageGetMaxFragments(front);
+    const IceTLayerCount back_max = icetSparseImageGetMaxFragments(back);
+    /* Stop at the largest count size, which keeps the sum from overflowing. */
+    const IceTLayerCount merged_max =
+        MIN(front_max, 0x7FFFFFFF - back_max) + back_max;
+
+    return MAX(icetLayerCountSizeForLayers(merged_max),
+               icetSparseLayeredImageLayerCountSize(
+                   (IceTSizeType)MAX(front_max, back_max)));
+}
+
+/* Returns the position of a process in the order in which the strategies
+ * composite images. */
+static IceTInt icetProcessCompositePosition(IceTInt rank)
+{
+    if (icetIsEnabled(ICET_ORDERED_COMPOSITE)) {
+        return icetUnsafeStateGetInteger(ICET_PROCESS_ORDERS)[rank];
+    } else {
+        return rank;
+    }
+}
+
+static void icetSparseImageCopyContributors(const IceTSparseImage src,
+                                            IceTSparseImage dest)
+{
+    const IceTInt *src_header = ICET_IMAGE_HEADER(src);
+    IceTInt *dest_header = ICET_IMAGE_HEADER(dest);
+
+    if (!icetSparseImageIsLayered(src) || !icetSparseImageIsLayered(dest)) {
+        return;
+    }
+
+    dest_header[ICET_IMAGE_FIRST_CONTRIBUTOR_INDEX] =
+        src_header[ICET_IMAGE_FIRST_CONTRIBUTOR_INDEX];
+    dest_header[ICET_IMAGE_LAST_CONTRIBUTOR_INDEX] =
+        src_header[ICET_IMAGE_LAST_CONTRIBUTOR_INDEX];
+    dest_header[ICET_IMAGE_NUM_CONTRIBUTORS_INDEX] =
+        src_header[ICET_IMAGE_NUM_CONTRIBUTORS_INDEX];
+}
+
+static void icetSparseImageMergeContributors(const IceTSparseImage front,
+                                             const IceTSparseImage back,
+                                             IceTSparseImage dest)
+{
+    const IceTInt *front_header = ICET_IMAGE_HEADER(front);
+    const IceTInt *back_header = ICET_IMAGE_HEADER(back);
+    IceTInt *dest_header = ICET_IMAGE_HEADER(dest);
+    IceTInt front_count;
+    IceTInt back_count;
+
+    if (!icetSparseImageIsLayered(dest)) { return; }
+
+    front_count = front_header[ICET_IMAGE_NUM_CONTRIBUTORS_INDEX];
+    back_count = back_header[ICET_IMAGE_NUM_CONTRIBUTORS_INDEX];
+    if ((front_count < 1) || (back_count < 1)) {
+        /* Contributors of one of the images are unknown. */
+        dest_header[ICET_IMAGE_FIRST_CONTRIBUTOR_INDEX] = 0;
+        dest_header[ICET_IMAGE_LAST_CONTRIBUTOR_INDEX] = 0;
+        dest_header[ICET_IMAGE_NUM_CONTRIBUTORS_INDEX] = 0;
+        return;
+    }
+
+    /* Each process contributes to a composited image only once, so the
+     * contributors of both images are disjoint and their counts add up. */
+    dest_header[ICET_IMAGE_FIRST_CONTRIBUTOR_INDEX] =
+        MIN(front_header[ICET_IMAGE_FIRST_CONTRIBUTOR_INDEX],
+            back_header[ICET_IMAGE_FIRST_CONTRIBUTOR_INDEX]);
+    dest_header[ICET_IMAGE_LAST_CONTRIBUTOR_INDEX] =
+        MAX(front_header[ICET_IMAGE_LAST_CONTRIBUTOR_INDEX],
+            back_header[ICET_IMAGE_LAST_CONTRIBUTOR_INDEX]);
+    dest_header[ICET_IMAGE_NUM_CONTRIBUTORS_INDEX] = front_count + back_count;
+}
+
+static int icetCompareDepthIntervals(const void *a, const void *b)
+{
+    IceTFloat near_a = *(const IceTFloat *)a;
+    IceTFloat near_b = *(const IceTFloat *)b;
+    return (near_a > near_b) - (near_a < near_b);
+}
+
+static IceTInt icetSparseImageGetBlockedDepths(const IceTSparseImage front,
+                                               const IceTSparseImage back,
+                                               const IceTFloat **blocked_p)
+{
+    const IceTInt *front_header = ICET_IMAGE_HEADER(front);
+    const IceTInt *back_header = ICET_IMAGE_HEADER(back);
+    const IceTDouble *all_bounds;
+    IceTFloat *blocked;
+    IceTInt first, last, count;
+    IceTInt num_proc;
+    IceTInt num_blocked;
+    IceTInt rank;
+    IceTInt i;
+
+    *blocked_p = NULL;
+
+    if (   !icetIsEnabled(ICET_COALESCE_FRAGMENTS)
+        || !icetSparseImageIsLayered(front)
+        || !icetSparseImageIsLayered(back)
+        || (front_header[ICET_IMAGE_NUM_CONTRIBUTORS_INDEX] < 1)
+        || (back_header[ICET_IMAGE_NUM_CONTRIBUTORS_INDEX] < 1) ) {
+        return -1;
+    }
+
+    icetGetIntegerv(ICET_NUM_PROCESSES, &num_proc);
+    if (icetStateGetNumEntries(ICET_ALL_DEPTH_BOUNDS) != 2*num_proc) {
+        return -1;
+    }
+
+    first = MIN(front_header[ICET_IMAGE_FIRST_CONTRIBUTOR_INDEX],
+                back_header[ICET_IMAGE_FIRST_CONTRIBUTOR_INDEX]);
+    last = MAX(front_header[ICET_IMAGE_LAST_CONTRIBUTOR_INDEX],
+               back_header[ICET_IMAGE_LAST_CONTRIBUTOR_INDEX]);
+    count =  front_header[ICET_IMAGE_NUM_CONTRIBUTORS_INDEX]
+           + back_header[ICET_IMAGE_NUM_CONTRIBUTORS_INDEX];
+
+    /* Only when the contributors form a contiguous range is it known which
+     * processes remain. */
+    if (count != last - first + 1) {
+        return -1;
+    }
+
+    /* Gather the depth intervals of all processes outside of the range.  The
+     * bounds are in normalized device coordinates.  They are padded by the
+     * resolution of 16-bit depths to account for rounding of fragment
+     * depths. */
+    all_bounds = icetUnsafeStateGetDouble(ICET_ALL_DEPTH_BOUNDS);
+    blocked = icetGetStateBuffer(ICET_COALESCE_DEPTHS_BUF,
+                                 2*num_proc*sizeof(IceTFloat));
+    num_blocked = 0;
+    for (rank = 0; rank < num_proc; rank++) {
+        IceTInt position = icetProcessCompositePosition(rank);
+        IceTDouble znear = all_bounds[2*rank + 0];
+        IceTDouble zfar = all_bounds[2*rank + 1];
+        if ((position >= first) && (position <= last)) continue;
+        if (znear > zfar) continue; /* No geometry in front of the viewer. */
+        blocked[2*num_blocked + 0] =
+            (IceTFloat)(0.5*znear + 0.5) - 1.0f/65535.0f;
+        blocked[2*num_blocked + 1] =
+            (IceTFloat)(0.5*zfar + 0.5) + 1.0f/65535.0f;
+        num_blocked++;
+    }
+
+    /* Sort the intervals by their near depth and merge overlapping ones. */
+    qsort(blocked, num_blocked, 2*sizeof(IceTFloat), icetCompareDepthIntervals);
+    if (num_blocked > 0) {
+        IceTInt num_merged = 1;
+        for (i = 1; i < num_blocked; i++) {
+            IceTFloat *merged = blocked + 2*(num_merged - 1);
+            if (blocked[2*i + 0] <= merged[1]) {
+                merged[1] = MAX(merged[1], blocked[2*i + 1]);
+            } else {
+                blocked[2*num_merged + 0] = blocked[2*i + 0];
+                blocked[2*num_merged + 1] = blocked[2*i + 1];
+                num_merged++;
+            }
+        }
+        num_blocked = num_merged;
+    }
+
+    *blocked_p = blocked;
+    return num_blocked;
+}
+
+static IceTInt icetDepthIntervalsFirstBehind(const IceTFloat *blocked,
+                                             IceTInt num_blocked,
+                                             IceTFloat depth)
+{
+    IceTInt low = 0;
+    IceTInt high = num_blocked;
+    while (low < high) {
+        IceTInt middle = (low + high)/2;
+        if (blocked[2*middle + 1] < depth) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+static IceTBoolean icetDepthRangeIsClosed(const IceTFloat *blocked,
+                                          IceTInt num_blocked,
+                                          IceTInt *first,
+                                          IceTFloat front_depth,
+                                          IceTFloat back_depth)
+{
+    IceTInt low = *first;
+    while ((low < num_blocked) && (blocked[2*low + 1] < front_depth)) {
+        low++;
+    }
+    *first = low;
+    return (low == num_blocked) || (blocked[2*low + 0] > back_depth);
+}
+
 void icetImageAdjustForOutput(IceTImage image)
 {
     IceTEnum color_format;
@@ -983,6 +1823,12 @@ const IceTLayeredImageHeader *icetLayeredImageGetHeaderConst(const IceTImage ima
     return (const IceTLayeredImageHeader *)ICET_IMAGE_DATA(image);
 }
 
+IceTLayerCount icetImageGetNumLayers(const IceTImage image)
+{
+    if (!icetImageIsLayered(image)) return 1;
+    return icetLayeredImageGetHeaderConst(image)->num_layers;
+}
+
 IceTEnum icetSparseImageGetColorFormat(const IceTSparseImage image)
 {
     ICET_TEST_SPARSE_IMAGE_HEADER(image);
@@ -1107,6 +1953,10 @@ static void icetSparseImageSetActualSize(IceTSparseImage image,
     IceTPointerArithmetic compressed_size = buffer_end - buffer_begin;
     ICET_IMAGE_HEADER(image)[ICET_IMAGE_ACTUAL_BUFFER_SIZE_INDEX]
         = (IceTInt)compressed_size;
+
+    /* The data has changed, so any index of it is stale. */
+    ICET_IMAGE_HEADER(image)[ICET_IMAGE_MAGIC_NUM_INDEX]
+        &= ~ICET_IMAGE_FLAG_RUN_INDEX;
 }
 
 const IceTVoid *icetImageGetColorConstVoid(const IceTImage image,
@@ -1133,6 +1983,11 @@ const IceTVoid *icetImageGetColorConstVoid(const IceTImage image,
         return ((const IceTVoid **)ICET_IMAGE_DATA(image))[0];
     case ICET_IMAGE_POINTERS_MAGIC_NUM | ICET_IMAGE_FLAG_LAYERED:
         return ((IceTLayeredImagePointerData *)ICET_IMAGE_DATA(image))->color_buffer;
+    case ICET_IMAGE_POINTERS_MAGIC_NUM | ICET_IMAGE_FLAG_LAYERED
+                                       | ICET_IMAGE_FLAG_PLANAR:
+        icetRaiseError(ICET_INVALID_OPERATION,
+                       "Planar layered images have no single color buffer.");
+        return NULL;
     default:
         icetRaiseError(ICET_SANITY_CHECK_FAIL,
                        "Detected invalid image header.");
@@ -1260,6 +2115,11 @@ const IceTVoid *icetImageGetDepthConstVoid(const IceTImage image,
         return ((const IceTVoid **)ICET_IMAGE_DATA(image))[1];
     case ICET_IMAGE_POINTERS_MAGIC_NUM | ICET_IMAGE_FLAG_LAYERED:
         return ((IceTLayeredImagePointerData *)ICET_IMAGE_DATA(image))->depth_buffer;
+    case ICET_IMAGE_POINTERS_MAGIC_NUM | ICET_IMAGE_FLAG_LAYERED
+                                       | ICET_IMAGE_FLAG_PLANAR:
+        icetRaiseError(ICET_INVALID_OPERATION,
+                       "Planar layered images have no single depth buffer.");
+        return NULL;
     default:
         icetRaiseError(ICET_SANITY_CHECK_FAIL,
                        "Detected invalid image header (magic_num = 0x%X).",
@@ -1314,6 +2174,9 @@ IceTFloat *icetImageGetDepthf(IceTImage image)
  * For every combination of color and depth format, define a fragment type and
  * the correspondingly typed fragment buffer accessor function, using a naming
  * scheme based on OpenGL image formats.
+ * Fragments are stored without padding, so the size of each type must match
+ * the sum of its color and depth pixel sizes.  This is why float colors are not
+ * combined with 16-bit depths.
  */
 #define FRAGMENT_FORMAT(format, color_type, color_channels, depth_type) \
     typedef struct IceTFragment_##format {                              \
@@ -1324,6 +2187,9 @@ IceTFloat *icetImageGetDepthf(IceTImage image)
 FRAGMENT_FORMAT(RGBA8_D32F, IceTUnsignedInt8, 4, IceTFloat);
 FRAGMENT_FORMAT(RGB32F_D32F, IceTFloat, 3, IceTFloat);
 FRAGMENT_FORMAT(RGBA32F_D32F, IceTFloat, 4, IceTFloat);
+FRAGMENT_FORMAT(RGBA16F_D32F, IceTUShort, 4, IceTFloat);
+FRAGMENT_FORMAT(RGBA8_D16, IceTUnsignedInt8, 4, IceTUShort);
+FRAGMENT_FORMAT(RGBA16F_D16, IceTUShort, 4, IceTUShort);
 
 #undef FRAGMENT_FORMAT
 
@@ -1336,9 +2202,76 @@ FRAGMENT_FORMAT(RGBA32F_D32F, IceTFloat, 4, IceTFloat);
     } IceTFragment_##format;
 
 FRAGMENT_FORMAT_NO_COLOR(D32F, float);
+FRAGMENT_FORMAT_NO_COLOR(D16, IceTUShort);
 
 #undef FRAGMENT_FORMAT_NO_COLOR
 
+IceTFloat icetHalfToFloat(IceTUShort half)
+{
+    IceTUInt sign = (IceTUInt)(half & 0x8000) << 16;
+    IceTUInt exponent = (half >> 10) & 0x1F;
+    IceTUInt mantissa = half & 0x03FF;
+    IceTUInt bits;
+    IceTFloat value;
+
+    if (exponent == 0) {
+        /* Zero or subnormal, which is a normal float. */
+        value = (IceTFloat)mantissa * (1.0f/16777216.0f);
+        return sign ? -value : value;
+    } else if (exponent == 0x1F) {
+        /* Infinity or NaN. */
+        bits = sign | 0x7F800000 | (mantissa << 13);
+    } else {
+        bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+    }
+
+    memcpy(&value, &bits, sizeof(IceTFloat));
+    return value;
+}
+
+IceTUShort icetFloatToHalf(IceTFloat value)
+{
+    IceTUInt bits, magnitude, remainder;
+    IceTUShort sign, half;
+
+    memcpy(&bits, &value, sizeof(IceTUInt));
+    sign = (IceTUShort)((bits >> 16) & 0x8000);
+    magnitude = bits & 0x7FFFFFFF;
+
+    if (magnitude >= 0x7F800000) {
+        /* Infinity or NaN. */
+        return sign | ((magnitude > 0x7F800000) ? 0x7E00 : 0x7C00);
+    }
+    if (magnitude >= 0x477FF000) {
+        /* Rounds to a value beyond the largest half (65504). */
+        return sign | 0x7C00;
+    }
+    if (magnitude < 0x38800000) {
+        /* Subnormal half.  Shift the mantissa, including its implicit leading
+         * bit, to a multiple of 2^-24 and round to nearest even. */
+        IceTUInt exponent = magnitude >> 23;
+        IceTUInt mantissa = (magnitude & 0x007FFFFF) | 0x00800000;
+        IceTUInt shift = 126 - exponent;
+        if (shift > 24) return sign;
+        half = (IceTUShort)(mantissa >> shift);
+        remainder = mantissa & ((1u << shift) - 1);
+        if (   (remainder > (1u << (shift - 1)))
+            || ((remainder == (1u << (shift - 1))) && (half & 1)) ) {
+            half++;
+        }
+        return sign | half;
+    }
+
+    /* Normal half.  Rebias the exponent and round the mantissa to nearest
+     * even, where a carry correctly propagates into the exponent. */
+    half = (IceTUShort)((magnitude - 0x38000000) >> 13);
+    remainder = magnitude & 0x1FFF;
+    if ((remainder > 0x1000) || ((remainder == 0x1000) && (half & 1))) {
+        half++;
+    }
+    return sign | half;
+}
+
 void icetImageCopyColorub(const IceTImage image,
                           IceTUByte *color_buffer,
                           IceTEnum out_color_format)
@@ -1392,6 +2325,17 @@ void icetImageCopyColorub(const IceTImage image,
             in += 3;
             out += 4;
         }
+    } else if (   (in_color_format == ICET_IMAGE_COLOR_RGBA_HALF)
+               && (out_color_format == ICET_IMAGE_COLOR_RGBA_UBYTE) ) {
+        const IceTUShort *in_buffer = icetImageGetColorConstVoid(image, NULL);
+        IceTSizeType num_fragments = icetImageGetNumPixels(image)*num_layers;
+        IceTSizeType i;
+        const IceTUShort *in;
+        IceTUByte *out;
+        for (i = 0, in = in_buffer, out = color_buffer; i < 4*num_fragments;
+             i++, in++, out++) {
+            out[0] = (IceTUByte)(255*icetHalfToFloat(in[0]));
+        }
     } else {
         icetRaiseError(ICET_SANITY_CHECK_FAIL,
                        "Encountered unexpected color format combination "
@@ -1482,6 +2426,31 @@ void icetImageCopyColorf(const IceTImage image,
             in += 3;
             out += 4;
         }
+    } else if (   (in_color_format == ICET_IMAGE_COLOR_RGBA_HALF)
+               && (out_color_format == ICET_IMAGE_COLOR_RGBA_FLOAT) ) {
+        const IceTUShort *in_buffer = icetImageGetColorConstVoid(image, NULL);
+        IceTSizeType num_fragments = icetImageGetNumPixels(image)*num_layers;
+        IceTSizeType i;
+        const IceTUShort *in;
+        IceTFloat *out;
+        for (i = 0, in = in_buffer, out = color_buffer; i < 4*num_fragments;
+             i++, in++, out++) {
+            out[0] = icetHalfToFloat(in[0]);
+        }
+    } else if (   (in_color_format == ICET_IMAGE_COLOR_RGBA_HALF)
+               && (out_color_format == ICET_IMAGE_COLOR_RGB_FLOAT) ) {
+        const IceTUShort *in_buffer = icetImageGetColorConstVoid(image, NULL);
+        IceTSizeType num_fragments = icetImageGetNumPixels(image)*num_layers;
+        IceTSizeType i;
+        const IceTUShort *in = in_buffer;
+        IceTFloat *out = color_buffer;
+        for (i = 0; i < num_fragments; i++) {
+            out[0] = icetHalfToFloat(in[0]);
+            out[1] = icetHalfToFloat(in[1]);
+            out[2] = icetHalfToFloat(in[2]);
+            in += 4;
+            out += 3;
+        }
     } else {
         icetRaiseError(ICET_SANITY_CHECK_FAIL,
                        "Unexpected format combination "
@@ -1511,14 +2480,24 @@ void icetImageCopyDepthf(const IceTImage image,
         return;
     }
 
-  /* Currently only possibility is
-     in_color_format == out_color_format == ICET_IMAGE_DEPTH_FLOAT. */
-    {
+    if (in_depth_format == out_depth_format) {
         const IceTFloat *in_buffer = icetImageGetDepthcf(image);
         IceTSizeType depth_format_bytes = (  icetImageGetNumPixels(image)
                                            * depthPixelSize(in_depth_format)
                                            * num_layers );
         memcpy(depth_buffer, in_buffer, depth_format_bytes);
+    } else if (in_depth_format == ICET_IMAGE_DEPTH_USHORT) {
+        const IceTUShort *in_buffer = icetImageGetDepthConstVoid(image, NULL);
+        IceTSizeType num_fragments = icetImageGetNumPixels(image)*num_layers;
+        IceTSizeType i;
+        for (i = 0; i < num_fragments; i++) {
+            depth_buffer[i] = (IceTFloat)in_buffer[i]/65535.0f;
+        }
+    } else {
+        icetRaiseError(ICET_SANITY_CHECK_FAIL,
+                       "Unexpected format combination "
+                       "(in format = 0x%X, out format = 0x%X).",
+                       in_depth_format, out_depth_format);
     }
 }
 
@@ -1788,7 +2767,69 @@ void icetImageClearAroundRegion(IceTImage image, const IceTInt *region)
                 }
             }
         }
-    } else if (color_format == ICET_IMAGE_COLOR_RGB_FLOAT) {
+    } else if (color_format == ICET_IMAGE_COLOR_RGBA_HALF) {
+        IceTUShort *color_buffer = icetImageGetColorVoid(image, NULL);
+        IceTFloat background_color_f[4];
+        IceTUShort background_color[4];
+
+        icetGetFloatv(ICET_BACKGROUND_COLOR, background_color_f);
+        background_color[0] = icetFloatToHalf(background_color_f[0]);
+        background_color[1] = icetFloatToHalf(background_color_f[1]);
+        background_color[2] = icetFloatToHalf(background_color_f[2]);
+        background_color[3] = icetFloatToHalf(background_color_f[3]);
+
+      /* Clear out bottom. */
+        for (y = 0; y < region[1]; y++) {
+            for (x = 0; x < width; x++) {
+                for (layer = 0; layer < num_layers; layer++) {
+                    const IceTSizeType offset =
+                        ((y*width + x) * num_layers + layer) * 4;
+                    color_buffer[offset + 0] = background_color[0];
+                    color_buffer[offset + 1] = background_color[1];
+                    color_buffer[offset + 2] = background_color[2];
+                    color_buffer[offset + 3] = background_color[3];
+                }
+            }
+        }
+      /* Clear out left and right. */
+        if ((region[0] > 0) || (region[0]+region[2] < width)) {
+            for (y = region[1]; y < region[1]+region[3]; y++) {
+                for (x = 0; x < region[0]; x++) {
+                    for (layer = 0; layer < num_layers; layer++) {
+                        const IceTSizeType offset =
+                            ((y*width + x) * num_layers + layer) * 4;
+                        color_buffer[offset + 0] = background_color[0];
+                        color_buffer[offset + 1] = background_color[1];
+                        color_buffer[offset + 2] = background_color[2];
+                        color_buffer[offset + 3] = background_color[3];
+                    }
+                }
+                for (x = region[0]+region[2]; x < width; x++) {
+                    for (layer = 0; layer < num_layers; layer++) {
+                        const IceTSizeType offset =
+                            ((y*width + x) * num_layers + layer) * 4;
+                        color_buffer[offset + 0] = background_color[0];
+                        color_buffer[offset + 1] = background_color[1];
+                        color_buffer[offset + 2] = background_color[2];
+                        color_buffer[offset + 3] = background_color[3];
+                    }
+                }
+            }
+        }
+      /* Clear out top. */
+        for (y = region[1]+region[3]; y < height; y++) {
+            for (x = 0; x < width; x++) {
+                for (layer = 0; layer < num_layers; layer++) {
+                    const IceTSizeType offset =
+                        ((y*width + x) * num_layers + layer) * 4;
+                    color_buffer[offset + 0] = background_color[0];
+                    color_buffer[offset + 1] = background_color[1];
+                    color_buffer[offset + 2] = background_color[2];
+                    color_buffer[offset + 3] = background_color[3];
+                }
+            }
+        }
+    } else if (color_format == ICET_IMAGE_COLOR_RGB_FLOAT) {
         IceTFloat *color_buffer = icetImageGetColorf(image);
         IceTFloat background_color[4];
 
@@ -1880,6 +2921,40 @@ void icetImageClearAroundRegion(IceTImage image, const IceTInt *region)
                 }
             }
         }
+    } else if (depth_format == ICET_IMAGE_DEPTH_USHORT) {
+        IceTUShort *depth_buffer = icetImageGetDepthVoid(image, NULL);
+
+      /* Clear out bottom. */
+        for (y = 0; y < region[1]; y++) {
+            for (x = 0; x < width; x++) {
+                for (layer = 0; layer < num_layers; layer++) {
+                    depth_buffer[(y*width + x) * num_layers + layer] = 0xFFFF;
+                }
+            }
+        }
+      /* Clear out left and right. */
+        if ((region[0] > 0) || (region[0]+region[2] < width)) {
+            for (y = region[1]; y < region[1]+region[3]; y++) {
+                for (x = 0; x < region[0]; x++) {
+                    for (layer = 0; layer < num_layers; layer++) {
+                        depth_buffer[(y*width + x) * num_layers + layer] = 0xFFFF;
+                    }
+                }
+                for (x = region[0]+region[2]; x < width; x++) {
+                    for (layer = 0; layer < num_layers; layer++) {
+                        depth_buffer[(y*width + x) * num_layers + layer] = 0xFFFF;
+                    }
+                }
+            }
+        }
+      /* Clear out top. */
+        for (y = region[1]+region[3]; y < height; y++) {
+            for (x = 0; x < width; x++) {
+                for (layer = 0; layer < num_layers; layer++) {
+                    depth_buffer[(y*width + x) * num_layers + layer] = 0xFFFF;
+                }
+            }
+        }
     } else if (depth_format != ICET_IMAGE_DEPTH_NONE) {
         icetRaiseError(ICET_SANITY_CHECK_FAIL,
                        "Invalid depth format 0x%X.", depth_format);
@@ -1935,7 +3010,8 @@ IceTImage icetImageUnpackageFromReceive(IceTVoid *buffer)
 
   /* Check the image for validity. */
     magic_number = ICET_IMAGE_HEADER(image)[ICET_IMAGE_MAGIC_NUM_INDEX];
-    base_magic_num = magic_number & ~ICET_IMAGE_FLAG_LAYERED;
+    base_magic_num =
+        magic_number & ~(ICET_IMAGE_FLAG_LAYERED | ICET_IMAGE_FLAG_PLANAR);
     if (   (base_magic_num != ICET_IMAGE_MAGIC_NUM)
         && (base_magic_num != ICET_IMAGE_POINTERS_MAGIC_NUM) ) {
         icetRaiseError(ICET_INVALID_VALUE,
@@ -1949,6 +3025,7 @@ IceTImage icetImageUnpackageFromReceive(IceTVoid *buffer)
     if (    (color_format != ICET_IMAGE_COLOR_RGBA_UBYTE)
          && (color_format != ICET_IMAGE_COLOR_RGBA_FLOAT)
          && (color_format != ICET_IMAGE_COLOR_RGB_FLOAT)
+         && (color_format != ICET_IMAGE_COLOR_RGBA_HALF)
          && (color_format != ICET_IMAGE_COLOR_NONE) ) {
         icetRaiseError(ICET_INVALID_VALUE,
                        "Invalid image buffer: invalid color format 0x%X.",
@@ -1959,6 +3036,7 @@ IceTImage icetImageUnpackageFromReceive(IceTVoid *buffer)
 
     depth_format = icetImageGetDepthFormat(image);
     if (    (depth_format != ICET_IMAGE_DEPTH_FLOAT)
+         && (depth_format != ICET_IMAGE_DEPTH_USHORT)
          && (depth_format != ICET_IMAGE_DEPTH_NONE) ) {
         icetRaiseError(ICET_INVALID_VALUE,
                        "Invalid image buffer: invalid depth format 0x%X.",
@@ -1999,6 +3077,8 @@ IceTImage icetImageUnpackageFromReceive(IceTVoid *buffer)
 
     case ICET_IMAGE_POINTERS_MAGIC_NUM:
     case ICET_IMAGE_POINTERS_MAGIC_NUM | ICET_IMAGE_FLAG_LAYERED:
+    case ICET_IMAGE_POINTERS_MAGIC_NUM | ICET_IMAGE_FLAG_LAYERED
+                                       | ICET_IMAGE_FLAG_PLANAR:
         if (buffer_size != -1) {
             icetRaiseError(ICET_INVALID_VALUE,
                            "Size information not consistent with image type.");
@@ -2032,6 +3112,10 @@ void icetSparseImagePackageForSend(IceTSparseImage image,
         return;
     }
 
+    /* The index is not sent, so the receiver must not look for it. */
+    ICET_IMAGE_HEADER(image)[ICET_IMAGE_MAGIC_NUM_INDEX]
+        &= ~ICET_IMAGE_FLAG_RUN_INDEX;
+
     *buffer = image.opaque_internals;
     *size = ICET_IMAGE_HEADER(image)[ICET_IMAGE_ACTUAL_BUFFER_SIZE_INDEX];
 }
@@ -2045,7 +3129,10 @@ IceTSparseImage icetSparseImageUnpackageFromReceive(IceTVoid *buffer)
 
   /* Check the image for validity. */
     if (    (ICET_IMAGE_HEADER(image)[ICET_IMAGE_MAGIC_NUM_INDEX]
-             & ~ICET_IMAGE_FLAG_LAYERED)
+             & ~(  ICET_IMAGE_FLAG_LAYERED | ICET_IMAGE_FLAG_SINGLE_FRAGMENT
+                 | ICET_IMAGE_FLAG_LAYER_COUNT_16
+                 | ICET_IMAGE_FLAG_LAYER_COUNT_32
+                 | ICET_IMAGE_FLAG_BLOCKS))
          != ICET_SPARSE_IMAGE_MAGIC_NUM ) {
         icetRaiseError(ICET_INVALID_VALUE,
                        "Invalid image buffer: no magic number.");
@@ -2057,6 +3144,7 @@ IceTSparseImage icetSparseImageUnpackageFromReceive(IceTVoid *buffer)
     if (    (color_format != ICET_IMAGE_COLOR_RGBA_UBYTE)
          && (color_format != ICET_IMAGE_COLOR_RGBA_FLOAT)
          && (color_format != ICET_IMAGE_COLOR_RGB_FLOAT)
+         && (color_format != ICET_IMAGE_COLOR_RGBA_HALF)
          && (color_format != ICET_IMAGE_COLOR_NONE) ) {
         icetRaiseError(ICET_INVALID_VALUE,
                        "Invalid image buffer: invalid color format 0x%X.",
@@ -2065,58 +3153,1276 @@ IceTSparseImage icetSparseImageUnpackageFromReceive(IceTVoid *buffer)
         return image;
     }
 
-    depth_format = icetSparseImageGetDepthFormat(image);
-    if (    (depth_format != ICET_IMAGE_DEPTH_FLOAT)
-         && (depth_format != ICET_IMAGE_DEPTH_NONE) ) {
-        icetRaiseError(ICET_INVALID_VALUE,
-                       "Invalid image buffer: invalid depth format 0x%X.",
-                       depth_format);
-        image.opaque_internals = NULL;
-        return image;
-    }
+    depth_format = icetSparseImageGetDepthFormat(image);
+    if (    (depth_format != ICET_IMAGE_DEPTH_FLOAT)
+         && (depth_format != ICET_IMAGE_DEPTH_USHORT)
+         && (depth_format != ICET_IMAGE_DEPTH_NONE) ) {
+        icetRaiseError(ICET_INVALID_VALUE,
+                       "Invalid image buffer: invalid depth format 0x%X.",
+                       depth_format);
+        image.opaque_internals = NULL;
+        return image;
+    }
+
+    /* The size of sparse layered images can currently not be checked since
+     * calculating their expected size requires the maximum number of layers,
+     * which is not stored. */
+    if (!icetSparseImageIsLayered(image)) {
+        IceTSizeType max_size
+            = icetSparseImageBufferSizeType(color_format, depth_format,
+                                            icetSparseImageGetWidth(image),
+                                            icetSparseImageGetHeight(image));
+        if (icetSparseImageIsBlocked(image)) {
+            /* The sender may store blocks even if this process does not. */
+            max_size = MAX(max_size,
+                             icetImageBufferSizeType(
+                                               color_format,
+                                               depth_format,
+                                               icetSparseImageGetWidth(image),
+                                               icetSparseImageGetHeight(image))
+                           + icetSparseBlockImageOverhead(
+                                             icetSparseImageGetWidth(image),
+                                             icetSparseImageGetHeight(image)));
+        }
+        if (max_size
+            < ICET_IMAGE_HEADER(image)[ICET_IMAGE_ACTUAL_BUFFER_SIZE_INDEX]) {
+            icetRaiseError(ICET_INVALID_VALUE,
+                           "Inconsistent sizes in image data.");
+            image.opaque_internals = NULL;
+            return image;
+        }
+    }
+
+  /* The source may have used a bigger buffer than allocated here at the
+     receiver.  Record only size that holds current image. */
+    ICET_IMAGE_HEADER(image)[ICET_IMAGE_MAX_NUM_PIXELS_INDEX]
+        = (IceTInt)icetSparseImageGetNumPixels(image);
+
+  /* The image is valid (as far as we can tell). */
+    return image;
+}
+
+/* The byte delta codec walks the runs of a packaged sparse image.  The header,
+ * run lengths and fragment counts are passed through unchanged, followed by
+ * the fragments of all active pixels, stride bytes each.  Blocks of
+ * ICET_BYTE_DELTA_BLOCK fragments are transposed into byte planes, and each
+ * byte is replaced with its difference to the same byte of the previous
+ * fragment.  Neighboring fragments tend to have similar values, so this turns
+ * the high-order bytes of colors and depths into long runs of zeros.  All bytes
+ * are then run-length coded with a token byte followed by either 1 to 128
+ * literal bytes (token < 0x80) or a single byte repeated
+ * ICET_BYTE_DELTA_MIN_REPEAT or more times. */
+#define ICET_BYTE_DELTA_BLOCK           1024
+#define ICET_BYTE_DELTA_MAX_LITERALS    128
+#define ICET_BYTE_DELTA_MIN_REPEAT      3
+#define ICET_BYTE_DELTA_MAX_REPEAT      (ICET_BYTE_DELTA_MIN_REPEAT + 0x7F)
+
+typedef struct IceTByteDeltaEncoderStruct {
+    IceTByte *out;
+    IceTSizeType pos;
+    IceTSizeType max_size;
+    IceTSizeType literal_token; /* Position of the token of open literals. */
+    IceTInt num_literals;
+    IceTByte repeat_value;
+    IceTInt num_repeats;
+    IceTBoolean overflow;
+} IceTByteDeltaEncoder;
+
+typedef struct IceTByteDeltaDecoderStruct {
+    const IceTByte *in;
+    const IceTByte *in_end;
+    IceTSizeType count;  /* Bytes left of the current token. */
+    IceTBoolean repeat;
+    IceTByte repeat_value;
+    IceTBoolean underflow;
+} IceTByteDeltaDecoder;
+
+/* Steps through the fragments of the sparse image whose data starts at data.
+ * The run lengths and fragment counts in between must already be in place, so
+ * the decoder can walk the image it is restoring. */
+typedef struct IceTFragmentCursorStruct {
+    IceTByte *data;
+    IceTSizeType pixel;
+    IceTSizeType num_pixels;
+    IceTSizeType active_left;   /* Active pixels left in the current run. */
+    IceTLayerCount frags_left;  /* Fragments left of the current pixel. */
+    IceTBoolean layered;
+    IceTSizeType count_size;
+    IceTSizeType run_length_size;
+    IceTSizeType stride;
+} IceTFragmentCursor;
+
+static void icetByteDeltaFlush(IceTByteDeltaEncoder *e)
+{
+    IceTInt i;
+
+    /* A flush writes at most 2 literals with 2 tokens. */
+    if (e->pos + 4 > e->max_size) {
+        e->overflow = ICET_TRUE;
+        e->num_repeats = 0;
+        return;
+    }
+
+    if (e->num_repeats >= ICET_BYTE_DELTA_MIN_REPEAT) {
+        e->out[e->pos++]
+            = (IceTByte)(0x80 | (e->num_repeats - ICET_BYTE_DELTA_MIN_REPEAT));
+        e->out[e->pos++] = e->repeat_value;
+        e->num_literals = 0;
+    } else {
+        for (i = 0; i < e->num_repeats; i++) {
+            if (   (e->num_literals == 0)
+                || (e->num_literals == ICET_BYTE_DELTA_MAX_LITERALS) ) {
+                e->literal_token = e->pos++;
+                e->num_literals = 0;
+            }
+            e->out[e->pos++] = e->repeat_value;
+            e->num_literals++;
+            e->out[e->literal_token] = (IceTByte)(e->num_literals - 1);
+        }
+    }
+    e->num_repeats = 0;
+}
+
+static void icetByteDeltaPut(IceTByteDeltaEncoder *e, IceTByte value)
+{
+    if (   (e->num_repeats > 0)
+        && (value == e->repeat_value)
+        && (e->num_repeats < ICET_BYTE_DELTA_MAX_REPEAT) ) {
+        e->num_repeats++;
+        return;
+    }
+    icetByteDeltaFlush(e);
+    e->repeat_value = value;
+    e->num_repeats = 1;
+}
+
+/* Returns the next decoded byte, or 0 and sets underflow if the encoded data
+ * ends early. */
+static IceTByte icetByteDeltaGet(IceTByteDeltaDecoder *d)
+{
+    if (d->count == 0) {
+        IceTByte token;
+
+        if (d->in >= d->in_end) {
+            d->underflow = ICET_TRUE;
+            return 0;
+        }
+        token = *(d->in++);
+        d->repeat = (token & 0x80) != 0;
+        if (d->repeat) {
+            d->count = (token & 0x7F) + ICET_BYTE_DELTA_MIN_REPEAT;
+            if (d->in >= d->in_end) {
+                d->underflow = ICET_TRUE;
+                return 0;
+            }
+            d->repeat_value = *(d->in++);
+        } else {
+            d->count = token + 1;
+            if (d->in + d->count > d->in_end) {
+                d->underflow = ICET_TRUE;
+                return 0;
+            }
+        }
+    }
+
+    d->count--;
+    return d->repeat ? d->repeat_value : *(d->in++);
+}
+
+static void icetFragmentCursorInit(IceTFragmentCursor *cursor,
+                                   const IceTSparseImage image)
+{
+    cursor->data = ICET_SPARSE_IMAGE_DATA(image);
+    cursor->pixel = 0;
+    cursor->num_pixels = icetSparseImageGetNumPixels(image);
+    cursor->active_left = 0;
+    cursor->frags_left = 0;
+    cursor->layered =    icetSparseImageIsLayered(image)
+                      && !icetSparseImageIsSingleFragment(image);
+    cursor->count_size = icetSparseImageGetLayerCountSize(image);
+    cursor->run_length_size =
+        cursor->layered ? RUN_LENGTH_SIZE_LAYERED : RUN_LENGTH_SIZE;
+    cursor->stride = colorPixelSize(icetSparseImageGetColorFormat(image))
+                   + depthPixelSize(icetSparseImageGetDepthFormat(image));
+}
+
+/* Returns the next fragment of the image, or NULL past the last one. */
+static IceTByte *icetFragmentCursorNext(IceTFragmentCursor *cursor)
+{
+    IceTByte *fragment;
+
+    while (cursor->frags_left == 0) {
+        if (cursor->active_left > 0) {
+            cursor->active_left--;
+            if (cursor->layered) {
+                cursor->frags_left
+                    = LAYER_COUNT_GET(cursor->data, cursor->count_size);
+                cursor->data += cursor->count_size;
+            } else {
+                cursor->frags_left = 1;
+            }
+        } else if (cursor->pixel < cursor->num_pixels) {
+            cursor->active_left = ACTIVE_RUN_LENGTH(cursor->data);
+            cursor->pixel +=   INACTIVE_RUN_LENGTH(cursor->data)
+                             + cursor->active_left;
+            cursor->data += cursor->run_length_size;
+        } else {
+            return NULL;
+        }
+    }
+
+    cursor->frags_left--;
+    fragment = cursor->data;
+    cursor->data += cursor->stride;
+    return fragment;
+}
+
+/* Passes size bytes at data through the encoder e, or reads them from the
+ * decoder d if e is NULL. */
+static void icetByteDeltaTransfer(IceTByteDeltaEncoder *e,
+                                  IceTByteDeltaDecoder *d,
+                                  IceTByte *data,
+                                  IceTSizeType size)
+{
+    IceTSizeType i;
+
+    if (e != NULL) {
+        for (i = 0; i < size; i++) { icetByteDeltaPut(e, data[i]); }
+    } else {
+        for (i = 0; i < size; i++) { data[i] = icetByteDeltaGet(d); }
+    }
+}
+
+/* Encodes the packaged sparse image in buffer with e, or decodes it into
+ * buffer, which holds size bytes, with d if e is NULL.  Both directions walk
+ * the image in the same order, the decoder reading each run length and
+ * fragment count right after restoring it.  Returns false if the decoded run
+ * lengths and counts do not describe an image of exactly size bytes. */
+static IceTBoolean icetByteDeltaCode(IceTByteDeltaEncoder *e,
+                                     IceTByteDeltaDecoder *d,
+                                     IceTVoid *buffer,
+                                     IceTSizeType size)
+{
+    IceTSparseImage image;
+    IceTByte *data = buffer;
+    IceTByte *data_end = data + size;
+    IceTFragmentCursor cursor;
+    IceTByte *records[ICET_BYTE_DELTA_BLOCK];
+    const IceTByte *previous = NULL;
+    IceTSizeType num_records;
+    IceTSizeType header_size;
+
+    image.opaque_internals = buffer;
+
+    /* The header, whose first entry tells how long it is. */
+    if (size < (IceTSizeType)(ICET_IMAGE_DATA_START_INDEX*sizeof(IceTInt))) {
+        return ICET_FALSE;
+    }
+    icetByteDeltaTransfer(e, d, data, sizeof(IceTInt));
+    header_size = ICET_SPARSE_IMAGE_DATA_START_INDEX(image)*sizeof(IceTInt);
+    if (header_size > size) { return ICET_FALSE; }
+    icetByteDeltaTransfer(e, d, data + sizeof(IceTInt),
+                          header_size - sizeof(IceTInt));
+
+    /* The run lengths and fragment counts, skipping the fragments. */
+    icetFragmentCursorInit(&cursor, image);
+    data += header_size;
+    while (cursor.pixel < cursor.num_pixels) {
+        IceTSizeType num_active;
+
+        if (data + cursor.run_length_size > data_end) { return ICET_FALSE; }
+        icetByteDeltaTransfer(e, d, data, cursor.run_length_size);
+        num_active = ACTIVE_RUN_LENGTH(data);
+        cursor.pixel += INACTIVE_RUN_LENGTH(data) + num_active;
+        data += cursor.run_length_size;
+
+        for ( ; num_active > 0; num_active--) {
+            IceTSizeType num_frags = 1;
+            if (cursor.layered) {
+                if (data + cursor.count_size > data_end) { return ICET_FALSE; }
+                icetByteDeltaTransfer(e, d, data, cursor.count_size);
+                num_frags = LAYER_COUNT_GET(data, cursor.count_size);
+                data += cursor.count_size;
+            }
+            if (num_frags*cursor.stride > data_end - data) {
+                return ICET_FALSE;
+            }
+            data += num_frags*cursor.stride;
+        }
+    }
+    if ((data != data_end) || (cursor.pixel != cursor.num_pixels)) {
+        return ICET_FALSE;
+    }
+
+    /* The fragments, delta coded a block at a time. */
+    icetFragmentCursorInit(&cursor, image);
+    do {
+        IceTSizeType plane;
+        IceTSizeType i;
+
+        for (num_records = 0;
+             num_records < ICET_BYTE_DELTA_BLOCK;
+             num_records++) {
+            records[num_records] = icetFragmentCursorNext(&cursor);
+            if (records[num_records] == NULL) { break; }
+        }
+
+        for (plane = 0; plane < cursor.stride; plane++) {
+            IceTByte last = previous ? previous[plane] : 0;
+            if (e != NULL) {
+                for (i = 0; i < num_records; i++) {
+                    icetByteDeltaPut(e, (IceTByte)(records[i][plane] - last));
+                    last = records[i][plane];
+                }
+            } else {
+                for (i = 0; i < num_records; i++) {
+                    last = (IceTByte)(icetByteDeltaGet(d) + last);
+                    records[i][plane] = last;
+                }
+            }
+        }
+        if (num_records > 0) { previous = records[num_records - 1]; }
+    } while (   (num_records == ICET_BYTE_DELTA_BLOCK)
+             && ((e == NULL) || !e->overflow) );
+
+    return ICET_TRUE;
+}
+
+/* Encodes the packaged sparse image into at most max_size bytes of out.
+ * Returns the encoded size or -1 if the encoded data does not fit. */
+static IceTSizeType icetByteDeltaEncode(const IceTSparseImage image,
+                                        IceTByte *out,
+                                        IceTSizeType max_size)
+{
+    IceTByteDeltaEncoder e;
+
+    e.out = out;
+    e.pos = 0;
+    e.max_size = max_size;
+    e.literal_token = 0;
+    e.num_literals = 0;
+    e.repeat_value = 0;
+    e.num_repeats = 0;
+    e.overflow = ICET_FALSE;
+
+    if (!icetByteDeltaCode(&e,
+                           NULL,
+                           image.opaque_internals,
+                           icetSparseImageGetCompressedBufferSize(image))) {
+        return -1;
+    }
+    icetByteDeltaFlush(&e);
+
+    return e.overflow ? -1 : e.pos;
+}
+
+/* Reverses icetByteDeltaEncode.  Returns false if the encoded data does not
+ * decode to an image of exactly size bytes. */
+static IceTBoolean icetByteDeltaDecode(const IceTByte *in,
+                                       IceTSizeType in_size,
+                                       IceTByte *out,
+                                       IceTSizeType size)
+{
+    IceTByteDeltaDecoder d;
+
+    d.in = in;
+    d.in_end = in + in_size;
+    d.count = 0;
+    d.repeat = ICET_FALSE;
+    d.repeat_value = 0;
+    d.underflow = ICET_FALSE;
+
+    return (   icetByteDeltaCode(NULL, &d, out, size)
+            && !d.underflow
+            && (d.count == 0)
+            && (d.in == d.in_end) );
+}
+
+/* Colors quantized for sending are converted from RGBA floats to RGBA bytes.
+ * The run lengths and depths of the image are kept as they are. */
+#define ICET_QUANTIZED_COLOR_FORMAT ICET_IMAGE_COLOR_RGBA_UBYTE
+
+static IceTBoolean icetSparseImageQuantizeColors(const IceTSparseImage image)
+{
+    return (   icetIsEnabled(ICET_QUANTIZE_WIRE_COLORS)
+            && (   icetSparseImageGetColorFormat(image)
+                == ICET_IMAGE_COLOR_RGBA_FLOAT ) );
+}
+
+/* Calls body once for every active fragment of the sparse image whose data
+ * starts at in_data, after copying the run lengths and fragment counts in
+ * front of it to out_data.  The fragment starts at in_data, and body must
+ * advance in_data and out_data past it.  Copies are done with memmove, so
+ * out_data may lag behind in_data in the same buffer. */
+#define ICET_SPARSE_IMAGE_FOR_EACH_FRAGMENT(image, in_data, out_data, body)   \
+{                                                                              \
+    const IceTSizeType _num_pixels = icetSparseImageGetNumPixels(image);      \
+    const IceTBoolean _is_layered =    icetSparseImageIsLayered(image)        \
+                                    && !icetSparseImageIsSingleFragment(image);\
+    const IceTSizeType _count_size = icetSparseImageGetLayerCountSize(image); \
+    const IceTSizeType _run_length_size                                        \
+        = _is_layered ? RUN_LENGTH_SIZE_LAYERED : RUN_LENGTH_SIZE;             \
+    IceTSizeType _pixel = 0;                                                   \
+    while (_pixel < _num_pixels) {                                             \
+        IceTSizeType _num_active = ACTIVE_RUN_LENGTH(in_data);                 \
+        _pixel += INACTIVE_RUN_LENGTH(in_data) + _num_active;                  \
+        memmove(out_data, in_data, _run_length_size);                          \
+        in_data += _run_length_size;                                           \
+        out_data += _run_length_size;                                          \
+        for (; _num_active > 0; _num_active--) {                               \
+            IceTLayerCount _num_frags = 1;                                     \
+            if (_is_layered) {                                                 \
+                _num_frags = LAYER_COUNT_GET(in_data, _count_size);            \
+                memmove(out_data, in_data, _count_size);                       \
+                in_data += _count_size;                                        \
+                out_data += _count_size;                                       \
+            }                                                                  \
+            for (; _num_frags > 0; _num_frags--) body                          \
+        }                                                                      \
+    }                                                                          \
+}
+
+/* Converts the RGBA float colors of a packaged sparse image to bytes and
+ * returns the size of the resulting image. */
+static IceTSizeType icetSparseImageQuantize(const IceTSparseImage image,
+                                            IceTVoid *out_buffer)
+{
+    const IceTSizeType depth_size
+        = depthPixelSize(icetSparseImageGetDepthFormat(image));
+    const IceTByte *in_data = ICET_SPARSE_IMAGE_DATA(image);
+    IceTSparseImage out_image;
+    IceTByte *out_data;
+
+    out_image.opaque_internals = out_buffer;
+    memcpy(out_buffer,
+           image.opaque_internals,
+           ICET_SPARSE_IMAGE_DATA_START_INDEX(image)*sizeof(IceTInt));
+    ICET_IMAGE_HEADER(out_image)[ICET_IMAGE_COLOR_FORMAT_INDEX]
+        = ICET_QUANTIZED_COLOR_FORMAT;
+    out_data = ICET_SPARSE_IMAGE_DATA(out_image);
+
+    ICET_SPARSE_IMAGE_FOR_EACH_FRAGMENT(image, in_data, out_data, {
+        IceTFloat color[4];
+        int channel;
+        memcpy(color, in_data, sizeof(color));
+        for (channel = 0; channel < 4; channel++) {
+            IceTFloat value = color[channel];
+            if (value < 0.0f) { value = 0.0f; }
+            if (value > 1.0f) { value = 1.0f; }
+            out_data[channel] = (IceTUByte)(255.0f*value + 0.5f);
+        }
+        memcpy(out_data + 4, in_data + sizeof(color), depth_size);
+        in_data += sizeof(color) + depth_size;
+        out_data += 4 + depth_size;
+    })
+
+    icetSparseImageSetActualSize(out_image, out_data);
+    return icetSparseImageGetCompressedBufferSize(out_image);
+}
+
+/* Reverses icetSparseImageQuantize.  The quantized image may be stored at the
+ * end of out_buffer, since restoring a fragment never writes past the start of
+ * the next one. */
+static void icetSparseImageDequantize(const IceTVoid *in_buffer,
+                                      IceTVoid *out_buffer)
+{
+    IceTSparseImage image;
+    IceTSparseImage out_image;
+    IceTSizeType depth_size;
+    const IceTByte *in_data;
+    IceTByte *out_data;
+
+    image.opaque_internals = (IceTVoid *)in_buffer;
+    out_image.opaque_internals = out_buffer;
+    depth_size = depthPixelSize(icetSparseImageGetDepthFormat(image));
+    in_data = ICET_SPARSE_IMAGE_DATA(image);
+
+    memmove(out_buffer,
+            in_buffer,
+            ICET_SPARSE_IMAGE_DATA_START_INDEX(image)*sizeof(IceTInt));
+    ICET_IMAGE_HEADER(out_image)[ICET_IMAGE_COLOR_FORMAT_INDEX]
+        = ICET_IMAGE_COLOR_RGBA_FLOAT;
+    out_data = ICET_SPARSE_IMAGE_DATA(out_image);
+
+    ICET_SPARSE_IMAGE_FOR_EACH_FRAGMENT(out_image, in_data, out_data, {
+        IceTFloat color[4];
+        IceTByte depth[4];
+        int channel;
+        for (channel = 0; channel < 4; channel++) {
+            color[channel] = ((const IceTUByte *)in_data)[channel]
+                           *(1.0f/255.0f);
+        }
+        memcpy(depth, in_data + 4, depth_size);
+        memcpy(out_data, color, sizeof(color));
+        memcpy(out_data + sizeof(color), depth, depth_size);
+        in_data += 4 + depth_size;
+        out_data += sizeof(color) + depth_size;
+    })
+
+    icetSparseImageSetActualSize(out_image, out_data);
+}
+
+IceTBoolean icetSparseImageWireEncodingEnabled(void)
+{
+    IceTEnum codec;
+
+    icetGetEnumv(ICET_WIRE_CODEC, &codec);
+    return (   (codec != ICET_WIRE_CODEC_NONE)
+            || icetIsEnabled(ICET_QUANTIZE_WIRE_COLORS) );
+}
+
+IceTSizeType icetSparseImageEncodeBufferSize(const IceTSparseImage image)
+{
+    IceTSizeType size = icetSparseImageGetCompressedBufferSize(image);
+
+    /* Quantized images are encoded from a copy after the encoded image. */
+    if (!icetSparseImageIsNull(image) && icetSparseImageQuantizeColors(image)) {
+        size *= 2;
+    }
+    return size;
+}
+
+void icetSparseImageEncodeForSend(IceTSparseImage image,
+                                  IceTVoid *encode_buffer,
+                                  IceTVoid **buffer,
+                                  IceTSizeType *size)
+{
+    IceTEnum codec;
+    IceTBoolean quantize;
+    IceTSizeType package_size;
+    IceTSizeType max_size;
+    IceTSizeType stride;
+    IceTSizeType encoded_size;
+    IceTByte *payload;
+    IceTSparseImage payload_image;
+    IceTSizeType payload_size;
+    IceTInt32 *header;
+
+    icetSparseImagePackageForSend(image, buffer, size);
+    package_size = *size;
+
+    icetGetEnumv(ICET_WIRE_CODEC, &codec);
+    quantize = icetSparseImageQuantizeColors(image);
+    if (   ((codec == ICET_WIRE_CODEC_NONE) && !quantize)
+        || (package_size <= (IceTSizeType)ICET_ENCODED_HEADER_SIZE)
+        || icetSparseImageIsBlocked(image) ) {
+        /* The codecs read runs, so blocked images are sent as they are. */
+        return;
+    }
+
+    icetTimingEncodeBegin();
+
+    /* Encoded images that would not be smaller than the packaged image are not
+     * sent.  The receiver tells them apart by their magic number. */
+    max_size = package_size - ICET_ENCODED_HEADER_SIZE - 1;
+    payload = (IceTByte *)encode_buffer + ICET_ENCODED_HEADER_SIZE;
+
+    payload_image = image;
+    payload_size = package_size;
+    if (quantize) {
+        /* Without a codec, the quantized image is sent as it is. */
+        payload_image.opaque_internals = (codec == ICET_WIRE_CODEC_NONE)
+            ? payload : (IceTByte *)encode_buffer + package_size;
+        payload_size = icetSparseImageQuantize(image,
+                                               payload_image.opaque_internals);
+    }
+
+    stride = colorPixelSize(icetSparseImageGetColorFormat(payload_image))
+           + depthPixelSize(icetSparseImageGetDepthFormat(payload_image));
+    if (stride < 1) { stride = 1; }
+
+    encoded_size = -1;
+    if (codec != ICET_WIRE_CODEC_NONE) {
+        encoded_size = icetByteDeltaEncode(
+                            payload_image,
+                            payload,
+                            (payload_size <= max_size) ? payload_size - 1
+                                                       : max_size);
+
+        {
+            /* Doubles do not overflow with the bytes of many large images. */
+            IceTDouble bytes_in
+                = icetUnsafeStateGetDouble(ICET_ENCODE_BYTES_IN)[0]
+                + payload_size;
+            IceTDouble bytes_out
+                = icetUnsafeStateGetDouble(ICET_ENCODE_BYTES_OUT)[0]
+                + ((encoded_size >= 0) ? encoded_size : payload_size);
+            icetStateSetDouble(ICET_ENCODE_BYTES_IN, bytes_in);
+            icetStateSetDouble(ICET_ENCODE_BYTES_OUT, bytes_out);
+            icetStateSetDouble(ICET_ENCODE_RATIO, bytes_in/bytes_out);
+        }
+    }
+    if ((encoded_size < 0) && quantize && (payload_size <= max_size)) {
+        if (payload_image.opaque_internals != payload) {
+            memcpy(payload, payload_image.opaque_internals, payload_size);
+        }
+        codec = ICET_WIRE_CODEC_NONE;
+        encoded_size = payload_size;
+    }
+
+    if (encoded_size >= 0) {
+        header = encode_buffer;
+        header[ICET_ENCODED_MAGIC_NUM_INDEX]
+            = ICET_ENCODED_SPARSE_IMAGE_MAGIC_NUM;
+        header[ICET_ENCODED_CODEC_INDEX] = codec;
+        header[ICET_ENCODED_SIZE_INDEX]
+            = ICET_ENCODED_HEADER_SIZE + encoded_size;
+        header[ICET_ENCODED_DECODED_SIZE_INDEX] = package_size;
+        header[ICET_ENCODED_STRIDE_INDEX] = stride;
+        header[ICET_ENCODED_QUANTIZED_SIZE_INDEX] = payload_size;
+        header[ICET_ENCODED_COLOR_FORMAT_INDEX] = quantize
+            ? icetSparseImageGetColorFormat(image) : ICET_IMAGE_COLOR_NONE;
+        *buffer = encode_buffer;
+        *size = header[ICET_ENCODED_SIZE_INDEX];
+
+        if (quantize) {
+            IceTDouble bytes_saved
+                = icetUnsafeStateGetDouble(ICET_QUANTIZE_BYTES_SAVED)[0]
+                + (package_size - payload_size);
+            icetStateSetDouble(ICET_QUANTIZE_BYTES_SAVED, bytes_saved);
+        }
+    }
+
+    icetTimingEncodeEnd();
+}
+
+IceTSizeType icetSparseImageDecodedBufferSize(const IceTVoid *buffer)
+{
+    const IceTInt32 *header = buffer;
+
+    if (   header[ICET_ENCODED_MAGIC_NUM_INDEX]
+        != (IceTInt32)ICET_ENCODED_SPARSE_IMAGE_MAGIC_NUM ) {
+        return 0;
+    }
+    return header[ICET_ENCODED_DECODED_SIZE_INDEX];
+}
+
+IceTSparseImage icetSparseImageDecodeFromReceive(IceTVoid *buffer,
+                                                 IceTVoid *decode_buffer)
+{
+    const IceTInt32 *header = buffer;
+    const IceTByte *payload = (const IceTByte *)buffer+ICET_ENCODED_HEADER_SIZE;
+    IceTSizeType payload_size;
+    IceTSizeType decoded_size;
+    IceTSizeType quantized_size;
+    IceTBoolean quantized;
+    IceTBoolean success = ICET_TRUE;
+
+    if (   header[ICET_ENCODED_MAGIC_NUM_INDEX]
+        != (IceTInt32)ICET_ENCODED_SPARSE_IMAGE_MAGIC_NUM ) {
+        return icetSparseImageUnpackageFromReceive(buffer);
+    }
+
+    if (   (header[ICET_ENCODED_CODEC_INDEX] != ICET_WIRE_CODEC_NONE)
+        && (header[ICET_ENCODED_CODEC_INDEX] != ICET_WIRE_CODEC_BYTE_DELTA) ) {
+        icetRaiseError(ICET_INVALID_VALUE,
+                       "Invalid encoded image: unknown codec 0x%X.",
+                       header[ICET_ENCODED_CODEC_INDEX]);
+        return icetSparseImageNull();
+    }
+    payload_size = header[ICET_ENCODED_SIZE_INDEX] - ICET_ENCODED_HEADER_SIZE;
+    decoded_size = header[ICET_ENCODED_DECODED_SIZE_INDEX];
+    quantized_size = header[ICET_ENCODED_QUANTIZED_SIZE_INDEX];
+    quantized = (   header[ICET_ENCODED_COLOR_FORMAT_INDEX]
+                 == ICET_IMAGE_COLOR_RGBA_FLOAT );
+    if (   (payload_size < 0)
+        || (header[ICET_ENCODED_STRIDE_INDEX] < 1)
+        || (quantized_size < (IceTSizeType)ICET_ENCODED_HEADER_SIZE)
+        || (quantized_size > decoded_size)
+        || (   !quantized
+            && (  header[ICET_ENCODED_COLOR_FORMAT_INDEX]
+                != ICET_IMAGE_COLOR_NONE) )
+        || (   (header[ICET_ENCODED_CODEC_INDEX] == ICET_WIRE_CODEC_NONE)
+            && (!quantized || (payload_size != quantized_size)) ) ) {
+        icetRaiseError(ICET_INVALID_VALUE, "Invalid encoded image header.");
+        return icetSparseImageNull();
+    }
+
+    icetTimingDecodeBegin();
+    if (header[ICET_ENCODED_CODEC_INDEX] != ICET_WIRE_CODEC_NONE) {
+        /* Quantized images are decoded to the end of the buffer and then
+         * restored towards its start. */
+        IceTByte *decoded
+            = (IceTByte *)decode_buffer + (decoded_size - quantized_size);
+        success = icetByteDeltaDecode(payload,
+                                      payload_size,
+                                      decoded,
+                                      quantized_size);
+        payload = decoded;
+    }
+    if (success && quantized) {
+        icetSparseImageDequantize(payload, decode_buffer);
+        success = (   ((const IceTInt *)decode_buffer)
+                          [ICET_IMAGE_ACTUAL_BUFFER_SIZE_INDEX]
+                   == decoded_size );
+    }
+    icetTimingDecodeEnd();
+
+    if (!success) {
+        icetRaiseError(ICET_INVALID_VALUE,
+                       "Invalid encoded image: inconsistent sizes.");
+        return icetSparseImageNull();
+    }
+
+    return icetSparseImageUnpackageFromReceive(decode_buffer);
+}
+
+IceTBoolean icetSparseImageEqual(const IceTSparseImage image1,
+                                 const IceTSparseImage image2)
+{
+    return image1.opaque_internals == image2.opaque_internals;
+}
+
+void icetSparseImageSwap(IceTSparseImage *image1, IceTSparseImage *image2)
+{
+    IceTSparseImage old_image1 = *image1;
+    *image1 = *image2;
+    *image2 = old_image1;
+}
+
+static void icetSparseBlockLayoutInit(IceTSparseBlockLayout *layout,
+                                      IceTSizeType width,
+                                      IceTSizeType height)
+{
+    layout->width = width;
+    layout->height = height;
+    layout->block_height
+        = (height >= ICET_SPARSE_BLOCK_HEIGHT) ? ICET_SPARSE_BLOCK_HEIGHT : 1;
+    layout->block_width = ICET_SPARSE_BLOCK_NUM_PIXELS/layout->block_height;
+    layout->blocks_per_row
+        = (width + layout->block_width - 1)/layout->block_width;
+    layout->num_block_rows
+        = (height + layout->block_height - 1)/layout->block_height;
+    layout->num_blocks = layout->blocks_per_row*layout->num_block_rows;
+    layout->bitmap_size
+        = ((layout->num_blocks + 31)/32)*(IceTSizeType)sizeof(IceTUInt);
+}
+
+static IceTSizeType icetSparseBlockImageOverhead(IceTSizeType width,
+                                                 IceTSizeType height)
+{
+    IceTSparseBlockLayout layout;
+    icetSparseBlockLayoutInit(&layout, width, height);
+    return layout.bitmap_size + layout.num_blocks*ICET_SPARSE_BLOCK_MASK_SIZE;
+}
+
+static IceTSizeType icetSparseBlockPopCount(IceTUInt word)
+{
+    word = word - ((word >> 1) & 0x55555555u);
+    word = (word & 0x33333333u) + ((word >> 2) & 0x33333333u);
+    word = (word + (word >> 4)) & 0x0F0F0F0Fu;
+    return (IceTSizeType)(((word*0x01010101u) & 0xFFFFFFFFu) >> 24);
+}
+
+static IceTSizeType icetSparseBlockCountBelow(const IceTUInt *mask,
+                                              IceTSizeType bit)
+{
+    if (bit < 32) {
+        return (bit > 0)
+            ? icetSparseBlockPopCount(mask[0] & ((1u << bit) - 1u)) : 0;
+    } else if (bit < 64) {
+        return  icetSparseBlockPopCount(mask[0])
+              + icetSparseBlockPopCount(mask[1] & ((1u << (bit - 32)) - 1u));
+    } else {
+        return  icetSparseBlockPopCount(mask[0])
+              + icetSparseBlockPopCount(mask[1]);
+    }
+}
+
+/* One block of the block row being converted: its mask and where its pixels
+ * are read from or written to. */
+typedef struct IceTSparseBlockEntry {
+    IceTUInt mask[2];
+    const IceTByte *data;
+    IceTByte *out;
+} IceTSparseBlockEntry;
+
+/* A position within the runs of a non-layered sparse image. */
+typedef struct IceTSparseBlockRunReader {
+    const IceTByte *data;
+    IceTSizeType num_inactive;
+    IceTSizeType num_active;
+    IceTSizeType pixel_size;
+} IceTSparseBlockRunReader;
+
+/* Returns the number of pixels, at most max, that the reader advances over
+ * before the pixels change between inactive and active.  active_data is set to
+ * the first of these pixels if they are active and to NULL otherwise. */
+static IceTSizeType icetSparseBlockRunReaderNext(
+                                            IceTSparseBlockRunReader *reader,
+                                            IceTSizeType max,
+                                            const IceTByte **active_data)
+{
+    IceTSizeType count;
+
+    while ((reader->num_inactive == 0) && (reader->num_active == 0)) {
+        reader->num_inactive = INACTIVE_RUN_LENGTH(reader->data);
+        reader->num_active = ACTIVE_RUN_LENGTH(reader->data);
+        reader->data += RUN_LENGTH_SIZE;
+    }
+
+    if (reader->num_inactive > 0) {
+        count = MIN(max, reader->num_inactive);
+        reader->num_inactive -= count;
+        *active_data = NULL;
+    } else {
+        count = MIN(max, reader->num_active);
+        reader->num_active -= count;
+        *active_data = reader->data;
+        reader->data += count*reader->pixel_size;
+    }
+    return count;
+}
+
+/* Writes consecutive pixels to a sparse image with a single row, either as
+ * runs or as blocks, which are then a single row high. */
+typedef struct IceTSparseBlockSink {
+    IceTSparseImage image;
+    IceTBoolean blocked;
+    IceTSizeType pixel_size;
+    IceTSizeType pixel;
+    IceTByte *data;
+    IceTVoid *run_length;
+    IceTUInt *mask;
+    IceTSizeType block;
+} IceTSparseBlockSink;
+
+static void icetSparseBlockSinkInit(IceTSparseBlockSink *sink,
+                                    IceTSparseImage image,
+                                    IceTSizeType pixel_size)
+{
+    sink->image = image;
+    sink->blocked = icetSparseImageIsBlocked(image);
+    sink->pixel_size = pixel_size;
+    sink->pixel = 0;
+    sink->data = ICET_SPARSE_IMAGE_DATA(image);
+    sink->mask = NULL;
+    sink->block = -1;
+    if (sink->blocked) {
+        /* The bitmap was cleared with the image. */
+        IceTSparseBlockLayout layout;
+        icetSparseBlockLayoutInit(&layout,
+                                  icetSparseImageGetNumPixels(image),
+                                  1);
+        sink->data += layout.bitmap_size;
+        sink->run_length = NULL;
+    } else {
+        sink->run_length = sink->data;
+        INACTIVE_RUN_LENGTH(sink->run_length) = 0;
+        ACTIVE_RUN_LENGTH(sink->run_length) = 0;
+        sink->data += RUN_LENGTH_SIZE;
+    }
+}
+
+static void icetSparseBlockSinkInactive(IceTSparseBlockSink *sink,
+                                        IceTSizeType count)
+{
+    if (!sink->blocked) {
+        if (ACTIVE_RUN_LENGTH(sink->run_length) > 0) {
+            sink->run_length = sink->data;
+            INACTIVE_RUN_LENGTH(sink->run_length) = 0;
+            ACTIVE_RUN_LENGTH(sink->run_length) = 0;
+            sink->data += RUN_LENGTH_SIZE;
+        }
+        INACTIVE_RUN_LENGTH(sink->run_length) += count;
+    }
+    sink->pixel += count;
+}
+
+static void icetSparseBlockSinkActive(IceTSparseBlockSink *sink,
+                                      const IceTByte *data,
+                                      IceTSizeType count)
+{
+    if (!sink->blocked) {
+        memcpy(sink->data, data, count*sink->pixel_size);
+        sink->data += count*sink->pixel_size;
+        ACTIVE_RUN_LENGTH(sink->run_length) += count;
+        sink->pixel += count;
+        return;
+    }
+
+    while (count > 0) {
+        IceTSizeType block = sink->pixel/ICET_SPARSE_BLOCK_NUM_PIXELS;
+        IceTSizeType bit = sink->pixel%ICET_SPARSE_BLOCK_NUM_PIXELS;
+        IceTSizeType segment = MIN(count, ICET_SPARSE_BLOCK_NUM_PIXELS - bit);
+        IceTSizeType i;
+
+        if (block != sink->block) {
+            ICET_SPARSE_BLOCK_SET_BIT(ICET_SPARSE_IMAGE_DATA(sink->image),
+                                      block);
+            sink->mask = (IceTUInt *)sink->data;
+            sink->mask[0] = sink->mask[1] = 0;
+            sink->data += ICET_SPARSE_BLOCK_MASK_SIZE;
+            sink->block = block;
+        }
+        for (i = 0; i < segment; i++) {
+            ICET_SPARSE_BLOCK_SET_BIT(sink->mask, bit + i);
+        }
+        memcpy(sink->data, data, segment*sink->pixel_size);
+        sink->data += segment*sink->pixel_size;
+        data += segment*sink->pixel_size;
+        sink->pixel += segment;
+        count -= segment;
+    }
+}
+
+static void icetSparseBlockImageFromRuns(const IceTSparseImage in_image,
+                                         IceTSparseImage out_image)
+{
+    IceTSizeType width = icetSparseImageGetWidth(in_image);
+    IceTSizeType height = icetSparseImageGetHeight(in_image);
+    IceTSizeType pixel_size
+        = (  colorPixelSize(icetSparseImageGetColorFormat(in_image))
+           + depthPixelSize(icetSparseImageGetDepthFormat(in_image)) );
+    IceTSparseBlockLayout layout;
+    IceTSparseBlockEntry *row;
+    IceTSparseBlockRunReader reader;
+    IceTUInt *bitmap;
+    IceTByte *out_data;
+    IceTSizeType block_row;
+
+    icetTimingCompressBegin();
+
+    icetSparseImageSetBlocked(out_image, ICET_TRUE);
+    icetSparseImageSetDimensions(out_image, width, height);
+    if (icetSparseImageGetNumPixels(out_image) != width*height) {
+        /* Setting the dimensions failed and raised an error. */
+        icetTimingCompressEnd();
+        return;
+    }
+
+    icetSparseBlockLayoutInit(&layout, width, height);
+    row = icetGetStateBuffer(ICET_SPARSE_BLOCK_ROW_BUF,
+                             layout.blocks_per_row*sizeof(IceTSparseBlockEntry));
+    bitmap = ICET_SPARSE_IMAGE_DATA(out_image);
+    out_data = (IceTByte *)bitmap + layout.bitmap_size;
+
+    reader.data = ICET_SPARSE_IMAGE_DATA(in_image);
+    reader.num_inactive = reader.num_active = 0;
+    reader.pixel_size = pixel_size;
+
+    /* Each row of blocks is read twice: first to find the masks of its blocks
+     * and then to copy the pixels into the blocks laid out after the first. */
+    for (block_row = 0; block_row < layout.num_block_rows; block_row++) {
+        IceTSizeType first_y = block_row*layout.block_height;
+        IceTSizeType num_pixels
+            = MIN(layout.block_height, height - first_y)*width;
+        IceTSparseBlockRunReader row_start = reader;
+        int pass;
+
+        memset(row, 0, layout.blocks_per_row*sizeof(IceTSparseBlockEntry));
+        for (pass = 0; pass < 2; pass++) {
+            IceTSizeType pixel = 0;
+
+            reader = row_start;
+            while (pixel < num_pixels) {
+                const IceTByte *active;
+                IceTSizeType count = icetSparseBlockRunReaderNext(
+                                         &reader, num_pixels - pixel, &active);
+
+                if (active == NULL) {
+                    pixel += count;
+                    continue;
+                }
+                while (count > 0) {
+                    IceTSizeType y = pixel/width;
+                    IceTSizeType x = pixel%width;
+                    IceTSizeType x_in_block = x%layout.block_width;
+                    IceTSizeType bit = y*layout.block_width + x_in_block;
+                    IceTSizeType segment
+                        = MIN(count, MIN(layout.block_width - x_in_block,
+                                         width - x));
+                    IceTSparseBlockEntry *entry
+                        = row + x/layout.block_width;
+
+                    if (pass == 0) {
+                        IceTSizeType i;
+                        for (i = 0; i < segment; i++) {
+                            ICET_SPARSE_BLOCK_SET_BIT(entry->mask, bit + i);
+                        }
+                    } else {
+                        memcpy(entry->out, active, segment*pixel_size);
+                        entry->out += segment*pixel_size;
+                        active += segment*pixel_size;
+                    }
+                    pixel += segment;
+                    count -= segment;
+                }
+            }
+
+            if (pass == 0) {
+                IceTSizeType block;
+                for (block = 0; block < layout.blocks_per_row; block++) {
+                    IceTSparseBlockEntry *entry = row + block;
+                    if ((entry->mask[0] | entry->mask[1]) == 0) continue;
+                    ICET_SPARSE_BLOCK_SET_BIT(
+                                bitmap, block_row*layout.blocks_per_row + block);
+                    memcpy(out_data, entry->mask, ICET_SPARSE_BLOCK_MASK_SIZE);
+                    entry->out = out_data + ICET_SPARSE_BLOCK_MASK_SIZE;
+                    out_data = entry->out
+                        + icetSparseBlockCountBelow(entry->mask,
+                                                    ICET_SPARSE_BLOCK_NUM_PIXELS)
+                          *pixel_size;
+                }
+            }
+        }
+    }
+
+    icetSparseImageSetActualSize(out_image, out_data);
+
+    icetTimingCompressEnd();
+}
+
+/* Passes count pixels of a block, starting at the given bit of its mask, to a
+ * sink. */
+static void icetSparseBlockEntryEmit(const IceTSparseBlockEntry *entry,
+                                     IceTSizeType bit,
+                                     IceTSizeType count,
+                                     IceTSparseBlockSink *sink)
+{
+    const IceTByte *data
+        = entry->data
+        + icetSparseBlockCountBelow(entry->mask, bit)*sink->pixel_size;
+    IceTSizeType i = 0;
+
+    while (i < count) {
+        IceTUInt active = ICET_SPARSE_BLOCK_BIT(entry->mask, bit + i);
+        IceTSizeType run = 1;
+
+        while (   (i + run < count)
+               && (ICET_SPARSE_BLOCK_BIT(entry->mask, bit + i + run) == active)) {
+            run++;
+        }
+        if (active) {
+            icetSparseBlockSinkActive(sink, data, run);
+            data += run*sink->pixel_size;
+        } else {
+            icetSparseBlockSinkInactive(sink, run);
+        }
+        i += run;
+    }
+}
+
+static void icetSparseBlockImageCopyPixels(const IceTSparseImage in_image,
+                                           IceTSizeType in_offset,
+                                           IceTSizeType num_pixels,
+                                           IceTBoolean out_blocked,
+                                           IceTSparseImage out_image)
+{
+    IceTSizeType width = icetSparseImageGetWidth(in_image);
+    IceTSizeType height = icetSparseImageGetHeight(in_image);
+    IceTSizeType end = in_offset + num_pixels;
+    IceTSizeType pixel_size
+        = (  colorPixelSize(icetSparseImageGetColorFormat(in_image))
+           + depthPixelSize(icetSparseImageGetDepthFormat(in_image)) );
+    IceTSparseBlockLayout layout;
+    IceTSparseBlockEntry *row;
+    IceTSparseBlockSink sink;
+    const IceTUInt *bitmap;
+    const IceTByte *in_data;
+    IceTSizeType block;
+    IceTSizeType block_row;
+
+    icetSparseImageSetBlocked(out_image, out_blocked);
+    icetSparseImageSetDimensions(out_image, num_pixels, 1);
+    if (icetSparseImageGetNumPixels(out_image) != num_pixels) {
+        /* Setting the dimensions failed and raised an error. */
+        return;
+    }
+    icetSparseBlockSinkInit(&sink, out_image, pixel_size);
+
+    if (num_pixels > 0) {
+        icetSparseBlockLayoutInit(&layout, width, height);
+        row = icetGetStateBuffer(
+                           ICET_SPARSE_BLOCK_ROW_BUF,
+                           layout.blocks_per_row*sizeof(IceTSparseBlockEntry));
+        bitmap = ICET_SPARSE_IMAGE_DATA(in_image);
+        in_data = (const IceTByte *)bitmap + layout.bitmap_size;
+
+        /* Skip the blocks before the row of blocks holding the first pixel. */
+        block_row = (in_offset/width)/layout.block_height;
+        for (block = 0; block < block_row*layout.blocks_per_row; block++) {
+            if (ICET_SPARSE_BLOCK_BIT(bitmap, block)) {
+                IceTUInt mask[2];
+                memcpy(mask, in_data, ICET_SPARSE_BLOCK_MASK_SIZE);
+                in_data += ICET_SPARSE_BLOCK_MASK_SIZE
+                    + icetSparseBlockCountBelow(mask,
+                                                ICET_SPARSE_BLOCK_NUM_PIXELS)
+                      *pixel_size;
+            }
+        }
+
+        for ( ;
+             (   (block_row < layout.num_block_rows)
+              && (block_row*layout.block_height*width < end) );
+             block_row++) {
+            IceTSizeType first_y = block_row*layout.block_height;
+            IceTSizeType last_y = MIN(first_y + layout.block_height, height);
+            IceTSizeType y;
+
+            for (block = 0; block < layout.blocks_per_row; block++) {
+                IceTSparseBlockEntry *entry = row + block;
+                if (ICET_SPARSE_BLOCK_BIT(
+                        bitmap, block_row*layout.blocks_per_row + block)) {
+                    memcpy(entry->mask, in_data, ICET_SPARSE_BLOCK_MASK_SIZE);
+                    entry->data = in_data + ICET_SPARSE_BLOCK_MASK_SIZE;
+                    in_data = entry->data
+                        + icetSparseBlockCountBelow(entry->mask,
+                                                    ICET_SPARSE_BLOCK_NUM_PIXELS)
+                          *pixel_size;
+                } else {
+                    entry->mask[0] = entry->mask[1] = 0;
+                    entry->data = NULL;
+                }
+            }
+
+            for (y = first_y; y < last_y; y++) {
+                IceTSizeType row_start = y*width;
+                IceTSizeType x = MAX(in_offset - row_start, 0);
+                IceTSizeType x_end = MIN(end - row_start, width);
+
+                while (x < x_end) {
+                    IceTSizeType x_in_block = x%layout.block_width;
+                    IceTSizeType count
+                        = MIN(layout.block_width - x_in_block, x_end - x);
+                    const IceTSparseBlockEntry *entry
+                        = row + x/layout.block_width;
+
+                    if (entry->data == NULL) {
+                        icetSparseBlockSinkInactive(&sink, count);
+                    } else {
+                        icetSparseBlockEntryEmit(
+                                  entry,
+                                  (y - first_y)*layout.block_width + x_in_block,
+                                  count,
+                                  &sink);
+                    }
+                    x += count;
+                }
+            }
+        }
+    }
+
+    icetSparseImageSetActualSize(out_image, sink.data);
+}
 
-    /* The size of sparse layered images can currently not be checked since
-     * calculating their expected size requires the maximum number of layers,
-     * which is not stored. */
-    if (!icetSparseImageIsLayered(image) &&
-           icetSparseImageBufferSizeType(color_format, depth_format,
-                                         icetSparseImageGetWidth(image),
-                                         icetSparseImageGetHeight(image))
-         < ICET_IMAGE_HEADER(image)[ICET_IMAGE_ACTUAL_BUFFER_SIZE_INDEX] ) {
-        icetRaiseError(ICET_INVALID_VALUE, "Inconsistent sizes in image data.");
-        image.opaque_internals = NULL;
-        return image;
-    }
+/* Returns a cleared sparse image in the given state buffer with the formats of
+ * like that stores its pixels as runs. */
+static IceTSparseImage icetSparseImageRunScratch(IceTEnum pname,
+                                                 const IceTSparseImage like,
+                                                 IceTSizeType width,
+                                                 IceTSizeType height)
+{
+    IceTEnum color_format = icetSparseImageGetColorFormat(like);
+    IceTEnum depth_format = icetSparseImageGetDepthFormat(like);
+    IceTVoid *buffer;
+    IceTSparseImage image;
+    IceTInt *header;
 
-  /* The source may have used a bigger buffer than allocated here at the
-     receiver.  Record only size that holds current image. */
-    ICET_IMAGE_HEADER(image)[ICET_IMAGE_MAX_NUM_PIXELS_INDEX]
-        = (IceTInt)icetSparseImageGetNumPixels(image);
+    buffer = icetGetStateBuffer(pname,
+                                icetSparseImageBufferSizeType(color_format,
+                                                              depth_format,
+                                                              width,
+                                                              height));
+    image = icetSparseImageAssignBuffer(buffer, width, height);
+
+    header = ICET_IMAGE_HEADER(image);
+    header[ICET_IMAGE_COLOR_FORMAT_INDEX] = color_format;
+    header[ICET_IMAGE_DEPTH_FORMAT_INDEX] = depth_format;
+    icetSparseImageSetBlocked(image, ICET_FALSE);
+    icetClearSparseImage(image);
 
-  /* The image is valid (as far as we can tell). */
     return image;
 }
 
-IceTBoolean icetSparseImageEqual(const IceTSparseImage image1,
-                                 const IceTSparseImage image2)
+static IceTSparseImage icetSparseBlockImageToRuns(const IceTSparseImage image,
+                                                  IceTEnum pname)
 {
-    return image1.opaque_internals == image2.opaque_internals;
+    IceTSizeType width = icetSparseImageGetWidth(image);
+    IceTSizeType height = icetSparseImageGetHeight(image);
+    IceTSparseImage runs;
+
+    runs = icetSparseImageRunScratch(pname, image, width, height);
+
+    icetTimingCompressBegin();
+    icetSparseBlockImageCopyPixels(image, 0, width*height, ICET_FALSE, runs);
+    icetTimingCompressEnd();
+
+    /* Runs do not depend on the dimensions, so restore those of the image. */
+    ICET_IMAGE_HEADER(runs)[ICET_IMAGE_WIDTH_INDEX] = (IceTInt)width;
+    ICET_IMAGE_HEADER(runs)[ICET_IMAGE_HEIGHT_INDEX] = (IceTInt)height;
+
+    return runs;
 }
 
-void icetSparseImageSwap(IceTSparseImage *image1, IceTSparseImage *image2)
+/* Copies the first num_pixels pixels of a blocked sparse image onto the image
+ * itself, as icetSparseImageSplit does with the first partition. */
+static void icetSparseBlockImageCopyPixelsInPlace(IceTSparseImage image,
+                                                  IceTSizeType num_pixels)
 {
-    IceTSparseImage old_image1 = *image1;
-    *image1 = *image2;
-    *image2 = old_image1;
+    IceTInt *header = ICET_IMAGE_HEADER(image);
+    IceTInt max_pixels = header[ICET_IMAGE_MAX_NUM_PIXELS_INDEX];
+    IceTSparseImage copy;
+
+    /* The copy needs at most a mask for each of its blocks in addition to the
+     * pixels of the image. */
+    copy.opaque_internals = icetGetStateBuffer(
+                     ICET_SPARSE_BLOCK_BUF_1,
+                       header[ICET_IMAGE_ACTUAL_BUFFER_SIZE_INDEX]
+                     + icetSparseBlockImageOverhead(num_pixels, 1));
+    memcpy(copy.opaque_internals,
+           header,
+           ICET_SPARSE_IMAGE_DATA_START_INDEX(image)*sizeof(IceTInt));
+    ICET_IMAGE_HEADER(copy)[ICET_IMAGE_MAX_NUM_PIXELS_INDEX]
+        = (IceTInt)num_pixels;
+
+    icetSparseBlockImageCopyPixels(image, 0, num_pixels, ICET_TRUE, copy);
+
+    memcpy(header,
+           ICET_IMAGE_HEADER(copy),
+           ICET_IMAGE_HEADER(copy)[ICET_IMAGE_ACTUAL_BUFFER_SIZE_INDEX]);
+    header[ICET_IMAGE_MAX_NUM_PIXELS_INDEX] = max_pixels;
+}
+
+/* Returns a blocked sparse image in ICET_SPARSE_BLOCK_BUF_1 with the pixels of
+ * image but the given dimensions, which must have the same number of
+ * pixels. */
+static IceTSparseImage icetSparseBlockImageReshape(const IceTSparseImage image,
+                                                   IceTSizeType width,
+                                                   IceTSizeType height)
+{
+    IceTSparseImage runs;
+    IceTSparseImage reshaped;
+
+    runs = icetSparseBlockImageToRuns(image, ICET_SPARSE_BLOCK_BUF_0);
+    ICET_IMAGE_HEADER(runs)[ICET_IMAGE_WIDTH_INDEX] = (IceTInt)width;
+    ICET_IMAGE_HEADER(runs)[ICET_IMAGE_HEIGHT_INDEX] = (IceTInt)height;
+
+    /* The pixels need at most a mask for each of the new blocks. */
+    reshaped.opaque_internals = icetGetStateBuffer(
+                     ICET_SPARSE_BLOCK_BUF_1,
+                       icetSparseImageGetCompressedBufferSize(image)
+                     + icetSparseBlockImageOverhead(width, height));
+    memcpy(reshaped.opaque_internals,
+           ICET_IMAGE_HEADER(image),
+           ICET_IMAGE_DATA_START_INDEX*sizeof(IceTInt));
+    ICET_IMAGE_HEADER(reshaped)[ICET_IMAGE_MAX_NUM_PIXELS_INDEX]
+        = (IceTInt)(width*height);
+
+    icetSparseBlockImageFromRuns(runs, reshaped);
+
+    return reshaped;
 }
 
 /* Given a pointer to a pixel in a sparse layered image, iterate over a given
  * number of consecutive pixels (must be in the same active run), counting their
- * fragments.
+ * fragments.  Each pixel starts with its number of fragments, which is stored
+ * with count_size bytes.
  */
 static void icetSparseLayeredImageScanFragments(const IceTVoid **in_data_p,
                                                 IceTSizeType pixels_to_skip,
                                                 IceTSizeType fragment_size,
+                                                IceTSizeType count_size,
                                                 IceTSizeType *num_fragments_p)
 {
     const IceTByte *in_data = *in_data_p;
@@ -2124,11 +4430,11 @@ static void icetSparseLayeredImageScanFragments(const IceTVoid **in_data_p,
 
     while (pixels_to_skip > 0) {
         /* Count fragments at this pixel. */
-        const IceTLayerCount pixel_frags = *(const IceTLayerCount *)in_data;
+        const IceTLayerCount pixel_frags = LAYER_COUNT_GET(in_data, count_size);
         num_fragments += pixel_frags;
 
         /* Skip pixel. */
-        in_data += sizeof(IceTLayerCount) + pixel_frags*fragment_size;
+        in_data += count_size + pixel_frags*fragment_size;
         --pixels_to_skip;
     }
 
@@ -2157,6 +4463,7 @@ static void icetSparseLayeredImageScanPixels(
     IceTVoid **last_in_run_length_p,
     IceTSizeType pixels_to_skip,
     IceTSizeType fragment_size,
+    IceTSizeType count_size,
     IceTVoid **out_data_p,
     IceTVoid **out_run_length_p)
 {
@@ -2164,6 +4471,164 @@ static void icetSparseLayeredImageScanPixels(
 #include "sparse_image_scan_body.h"
 }
 
+/* Returns the index of a sparse image or NULL if it has none. */
+static const IceTInt *icetSparseImageGetIndex(const IceTSparseImage image)
+{
+    const IceTInt *header = ICET_IMAGE_HEADER(image);
+    const IceTInt *index;
+    IceTSizeType index_offset;
+
+    if (!(header[ICET_IMAGE_MAGIC_NUM_INDEX] & ICET_IMAGE_FLAG_RUN_INDEX)) {
+        return NULL;
+    }
+
+    index_offset = header[ICET_IMAGE_ACTUAL_BUFFER_SIZE_INDEX];
+    index_offset += (  ICET_RUN_INDEX_ALIGNMENT
+                     - index_offset%ICET_RUN_INDEX_ALIGNMENT)
+                    % ICET_RUN_INDEX_ALIGNMENT;
+    index = (const IceTInt *)((const IceTByte *)header + index_offset);
+
+    /* The flag is dropped whenever the size changes, so this is a sanity
+       check. */
+    if (   index[ICET_RUN_INDEX_SIZE_INDEX]
+        != header[ICET_IMAGE_ACTUAL_BUFFER_SIZE_INDEX] ) {
+        icetRaiseError(ICET_SANITY_CHECK_FAIL, "Stale sparse image index.");
+        return NULL;
+    }
+
+    return index;
+}
+
+static void icetSparseImageBuildIndex(IceTSparseImage image)
+{
+    IceTInt *header = ICET_IMAGE_HEADER(image);
+    IceTEnum color_format, depth_format;
+    IceTSizeType pixel_size;
+    IceTSizeType num_pixels;
+    IceTSizeType actual_size;
+    IceTSizeType index_offset;
+    IceTSizeType max_entries;
+    IceTInt *index;
+    IceTInt *entry;
+    const IceTByte *data;
+    IceTSizeType pixel;
+    IceTSizeType run;
+
+    if (!icetIsEnabled(ICET_SPARSE_IMAGE_INDEX)) return;
+    if (icetSparseImageIsNull(image) || icetSparseImageIsLayered(image)) {
+        return;
+    }
+
+    color_format = icetSparseImageGetColorFormat(image);
+    depth_format = icetSparseImageGetDepthFormat(image);
+    pixel_size = colorPixelSize(color_format) + depthPixelSize(depth_format);
+    num_pixels = icetSparseImageGetNumPixels(image);
+    actual_size = header[ICET_IMAGE_ACTUAL_BUFFER_SIZE_INDEX];
+
+    /* The image may only use as much of its buffer as the largest image it was
+       created for can take up. */
+    index_offset = actual_size
+                 + (  ICET_RUN_INDEX_ALIGNMENT
+                    - actual_size%ICET_RUN_INDEX_ALIGNMENT)
+                   % ICET_RUN_INDEX_ALIGNMENT;
+    max_entries = (  icetSparseImageBufferSizeType(
+                                    color_format,
+                                    depth_format,
+                                    header[ICET_IMAGE_MAX_NUM_PIXELS_INDEX],
+                                    1)
+                   - index_offset
+                   - ICET_RUN_INDEX_ENTRIES_INDEX*(IceTSizeType)sizeof(IceTInt))
+                / (2*(IceTSizeType)sizeof(IceTInt));
+    if (max_entries < 1) return;
+
+    index = (IceTInt *)((IceTByte *)header + index_offset);
+    entry = index + ICET_RUN_INDEX_ENTRIES_INDEX;
+
+    data = ICET_SPARSE_IMAGE_DATA(image);
+    pixel = 0;
+    for (run = 0; pixel < num_pixels; run++) {
+        IceTSizeType num_active = ACTIVE_RUN_LENGTH(data);
+
+        if (run%ICET_RUN_INDEX_STRIDE == 0) {
+            if (run/ICET_RUN_INDEX_STRIDE == max_entries) return;
+            entry[0] = (IceTInt)pixel;
+            entry[1] = (IceTInt)(data - (const IceTByte *)header);
+            entry += 2;
+        }
+
+        pixel += INACTIVE_RUN_LENGTH(data) + num_active;
+        data += RUN_LENGTH_SIZE + num_active*pixel_size;
+    }
+
+    index[ICET_RUN_INDEX_SIZE_INDEX] = (IceTInt)actual_size;
+    index[ICET_RUN_INDEX_NUM_ENTRIES_INDEX]
+        = (IceTInt)((entry - index - ICET_RUN_INDEX_ENTRIES_INDEX)/2);
+    header[ICET_IMAGE_MAGIC_NUM_INDEX] |= ICET_IMAGE_FLAG_RUN_INDEX;
+}
+
+static IceTSizeType icetSparseImageSeekRun(const IceTSparseImage image,
+                                           IceTSizeType pixel,
+                                           const IceTVoid **data_p)
+{
+    const IceTInt *index = icetSparseImageGetIndex(image);
+    const IceTInt *entries;
+    IceTSizeType low, high;
+
+    if (index == NULL) {
+        *data_p = ICET_SPARSE_IMAGE_DATA(image);
+        return 0;
+    }
+
+    /* Binary search for the last entry starting at or before pixel.  The
+       first entry is always the start of the data. */
+    entries = index + ICET_RUN_INDEX_ENTRIES_INDEX;
+    low = 0;
+    high = index[ICET_RUN_INDEX_NUM_ENTRIES_INDEX];
+    while (high - low > 1) {
+        IceTSizeType middle = (low + high)/2;
+        if (entries[2*middle] <= pixel) {
+            low = middle;
+        } else {
+            high = middle;
+        }
+    }
+
+    *data_p = (const IceTByte *)ICET_IMAGE_HEADER(image) + entries[2*low + 1];
+    return entries[2*low];
+}
+
+static void icetSparseImageSkipPixels(const IceTSparseImage image,
+                                      IceTSizeType pixel,
+                                      const IceTVoid **in_data_p,
+                                      IceTSizeType *inactive_before_p,
+                                      IceTSizeType *active_till_next_runl_p,
+                                      IceTSizeType pixels_to_skip,
+                                      IceTSizeType pixel_size)
+{
+    const IceTVoid *run_data;
+    IceTSizeType run_pixel;
+
+    run_pixel = icetSparseImageSeekRun(image, pixel + pixels_to_skip, &run_data);
+
+    /* A run starting after pixel lies past the current position, so the scan
+       can continue from its run length. */
+    if (run_pixel > pixel) {
+        *in_data_p = run_data;
+        *inactive_before_p = 0;
+        *active_till_next_runl_p = 0;
+        pixels_to_skip -= run_pixel - pixel;
+    }
+
+    icetSparseImageScanPixels(in_data_p,
+                              inactive_before_p,
+                              active_till_next_runl_p,
+                              NULL,
+                              pixels_to_skip,
+                              pixel_size,
+                              NULL,
+                              NULL);
+}
+
 static void icetSparseImageCopyPixelsInternal(
                                           const IceTVoid **in_data_p,
                                           IceTSizeType *inactive_before_p,
@@ -2172,7 +4637,7 @@ static void icetSparseImageCopyPixelsInternal(
                                           IceTSizeType pixel_size,
                                           IceTSparseImage out_image)
 {
-    IceTVoid *out_data = ICET_IMAGE_DATA(out_image);
+    IceTVoid *out_data = ICET_SPARSE_IMAGE_DATA(out_image);
 
     icetSparseImageSetDimensions(out_image, pixels_to_copy, 1);
 
@@ -2195,9 +4660,10 @@ static void icetSparseLayeredImageCopyPixelsInternal(
     IceTSizeType *active_frags_till_next_runl_p,
     IceTSizeType pixels_to_copy,
     IceTSizeType pixel_size,
+    IceTSizeType count_size,
     IceTSparseImage out_image)
 {
-    IceTVoid *out_data = ICET_IMAGE_DATA(out_image);
+    IceTVoid *out_data = ICET_SPARSE_IMAGE_DATA(out_image);
 
     icetSparseImageSetDimensions(out_image, pixels_to_copy, 1);
 
@@ -2208,6 +4674,7 @@ static void icetSparseLayeredImageCopyPixelsInternal(
                                      NULL,
                                      pixels_to_copy,
                                      pixel_size,
+                                     count_size,
                                      &out_data,
                                      NULL);
 
@@ -2225,7 +4692,7 @@ static void icetSparseImageCopyPixelsInPlaceInternal(
     IceTVoid *last_run_length = NULL;
 
 #ifdef DEBUG
-    if (   (*in_data_p != ICET_IMAGE_DATA(out_image))
+    if (   (*in_data_p != ICET_SPARSE_IMAGE_DATA(out_image))
         || (*inactive_before_p != 0)
         || (*active_till_next_runl_p != 0) ) {
         icetRaiseError(ICET_SANITY_CHECK_FAIL,
@@ -2262,12 +4729,13 @@ static void icetSparseLayeredImageCopyPixelsInPlaceInternal(
                                     IceTSizeType *active_frags_till_next_runl_p,
                                     IceTSizeType pixels_to_copy,
                                     IceTSizeType pixel_size,
+                                    IceTSizeType count_size,
                                     IceTSparseImage out_image)
 {
     IceTVoid *last_run_length = NULL;
 
 #ifdef DEBUG
-    if (   (*in_data_p != ICET_IMAGE_DATA(out_image))
+    if (   (*in_data_p != ICET_SPARSE_IMAGE_DATA(out_image))
         || (*inactive_before_p != 0)
         || (*active_till_next_runl_p != 0)
         || (*active_frags_till_next_runl_p != 0)) {
@@ -2284,6 +4752,7 @@ static void icetSparseLayeredImageCopyPixelsInPlaceInternal(
                                      &last_run_length,
                                      pixels_to_copy,
                                      pixel_size,
+                                     count_size,
                                      NULL,
                                      NULL);
 
@@ -2309,7 +4778,9 @@ void icetSparseImageCopyPixels(const IceTSparseImage in_image,
     IceTEnum color_format;
     IceTEnum depth_format;
     IceTBoolean is_layered;
+    IceTBoolean single_fragment;
     IceTSizeType fragment_size;
+    IceTSizeType count_size;
 
     const IceTVoid *in_data;
     IceTSizeType start_inactive;
@@ -2354,17 +4825,42 @@ void icetSparseImageCopyPixels(const IceTSparseImage in_image,
 
         ICET_IMAGE_HEADER(out_image)[ICET_IMAGE_MAX_NUM_PIXELS_INDEX]
             = max_pixels;
+        /* The index after the data is not copied. */
+        ICET_IMAGE_HEADER(out_image)[ICET_IMAGE_MAGIC_NUM_INDEX]
+            &= ~ICET_IMAGE_FLAG_RUN_INDEX;
+
+        icetTimingCompressEnd();
+        return;
+    }
 
+    if (icetSparseImageIsBlocked(in_image)) {
+        icetSparseBlockImageCopyPixels(in_image,
+                                       in_offset,
+                                       num_pixels,
+                                       ICET_TRUE,
+                                       out_image);
         icetTimingCompressEnd();
         return;
     }
+    icetSparseImageSetBlocked(out_image, ICET_FALSE);
 
     fragment_size = colorPixelSize(color_format) + depthPixelSize(depth_format);
 
-    in_data = ICET_IMAGE_DATA(in_image);
+    /* Layered images with a single fragment per pixel share the format of
+     * non-layered ones, which the copy retains, as it does the size of the
+     * fragment counts. */
+    single_fragment = icetSparseImageIsSingleFragment(in_image);
+    count_size = icetSparseImageGetLayerCountSize(in_image);
+    icetSparseImageSetSingleFragment(out_image, single_fragment);
+    icetSparseImageSetLayerCountSize(out_image, count_size);
+    icetSparseImageSetMaxFragments(out_image,
+                                   icetSparseImageGetMaxFragments(in_image));
+    icetSparseImageCopyContributors(in_image, out_image);
+
+    in_data = ICET_SPARSE_IMAGE_DATA(in_image);
     start_inactive = start_active = 0;
 
-    if (is_layered) {
+    if (is_layered && !single_fragment) {
         IceTSizeType start_active_frags = 0;
 
         icetSparseLayeredImageScanPixels(&in_data,
@@ -2374,6 +4870,7 @@ void icetSparseImageCopyPixels(const IceTSparseImage in_image,
                                          NULL,
                                          in_offset,
                                          fragment_size,
+                                         count_size,
                                          NULL,
                                          NULL);
 
@@ -2383,16 +4880,16 @@ void icetSparseImageCopyPixels(const IceTSparseImage in_image,
                                                  &start_active_frags,
                                                  num_pixels,
                                                  fragment_size,
+                                                 count_size,
                                                  out_image);
     } else {
-        icetSparseImageScanPixels(&in_data,
+        icetSparseImageSkipPixels(in_image,
+                                  0,
+                                  &in_data,
                                   &start_inactive,
                                   &start_active,
-                                  NULL,
                                   in_offset,
-                                  fragment_size,
-                                  NULL,
-                                  NULL);
+                                  fragment_size);
 
         icetSparseImageCopyPixelsInternal(&in_data,
                                           &start_inactive,
@@ -2405,12 +4902,185 @@ void icetSparseImageCopyPixels(const IceTSparseImage in_image,
     icetTimingCompressEnd();
 }
 
+void icetSparseImageCountFragments(const IceTSparseImage image,
+                                   IceTSizeType bin_size,
+                                   IceTInt *counts)
+{
+    IceTSizeType num_pixels;
+    IceTSizeType fragment_size;
+    IceTSizeType count_size;
+    IceTBoolean is_layered;
+    const IceTByte *data;
+    IceTSizeType pixel;
+
+    num_pixels = icetSparseImageGetNumPixels(image);
+    fragment_size = colorPixelSize(icetSparseImageGetColorFormat(image))
+                  + depthPixelSize(icetSparseImageGetDepthFormat(image));
+    count_size = icetSparseImageGetLayerCountSize(image);
+    is_layered =    icetSparseImageIsLayered(image)
+                 && !icetSparseImageIsSingleFragment(image);
+    data = ICET_SPARSE_IMAGE_DATA(image);
+
+    memset(counts, 0, ((num_pixels + bin_size - 1)/bin_size)*sizeof(IceTInt));
+
+    if (icetSparseImageIsBlocked(image)) {
+        /* Count the active pixels of each block where they lie. */
+        IceTSparseBlockLayout layout;
+        IceTSizeType block;
+
+        icetSparseBlockLayoutInit(&layout,
+                                  icetSparseImageGetWidth(image),
+                                  icetSparseImageGetHeight(image));
+        data += layout.bitmap_size;
+        for (block = 0; block < layout.num_blocks; block++) {
+            IceTSizeType first_pixel;
+            IceTUInt mask[2];
+            IceTSizeType bit;
+
+            if (!ICET_SPARSE_BLOCK_BIT(ICET_SPARSE_IMAGE_DATA(image), block)) {
+                continue;
+            }
+            memcpy(mask, data, ICET_SPARSE_BLOCK_MASK_SIZE);
+            first_pixel
+                =  (block/layout.blocks_per_row)*layout.block_height
+                  *layout.width
+                 + (block%layout.blocks_per_row)*layout.block_width;
+            for (bit = 0; bit < ICET_SPARSE_BLOCK_NUM_PIXELS; bit++) {
+                if (ICET_SPARSE_BLOCK_BIT(mask, bit)) {
+                    pixel = first_pixel
+                          + (bit/layout.block_width)*layout.width
+                          + bit%layout.block_width;
+                    counts[pixel/bin_size]++;
+                }
+            }
+            data += ICET_SPARSE_BLOCK_MASK_SIZE
+                + icetSparseBlockCountBelow(mask, ICET_SPARSE_BLOCK_NUM_PIXELS)
+                  *fragment_size;
+        }
+        return;
+    }
+
+    pixel = 0;
+    while (pixel < num_pixels) {
+        IceTSizeType num_active;
+
+        pixel += INACTIVE_RUN_LENGTH(data);
+        num_active = ACTIVE_RUN_LENGTH(data);
+
+        if (is_layered) {
+            IceTSizeType num_fragments = ACTIVE_RUN_LENGTH_FRAGMENTS(data);
+            data += RUN_LENGTH_SIZE_LAYERED;
+
+            if (   (num_active > 0)
+                && (pixel/bin_size == (pixel + num_active - 1)/bin_size) ) {
+                /* The whole run falls into one bin, so skip it entirely. */
+                counts[pixel/bin_size] += num_fragments;
+                data += num_active*count_size + num_fragments*fragment_size;
+                pixel += num_active;
+            } else {
+                for (; num_active > 0; num_active--) {
+                    IceTLayerCount pixel_frags = LAYER_COUNT_GET(data,
+                                                                 count_size);
+                    counts[pixel/bin_size] += pixel_frags;
+                    data += count_size + pixel_frags*fragment_size;
+                    pixel++;
+                }
+            }
+        } else {
+            data += RUN_LENGTH_SIZE + num_active*fragment_size;
+
+            /* Flat and single fragment images have exactly one fragment per
+             * active pixel. */
+            while (num_active > 0) {
+                IceTSizeType bin = pixel/bin_size;
+                IceTSizeType in_bin = (bin + 1)*bin_size - pixel;
+                if (in_bin > num_active) in_bin = num_active;
+                counts[bin] += in_bin;
+                pixel += in_bin;
+                num_active -= in_bin;
+            }
+        }
+    }
+}
+
+/* Returns the first offset at which the weight accumulated in
+   ICET_SPLIT_FRAGMENT_WEIGHTS reaches the given value, interpolating linearly
+   within bins. */
+static IceTSizeType icetSparseImageSplitOffsetAt(const IceTDouble *weights,
+                                                 IceTSizeType num_bins,
+                                                 IceTSizeType bin_size,
+                                                 IceTDouble weight)
+{
+    IceTSizeType low = 0;
+    IceTSizeType high = num_bins;
+    IceTDouble bin_weight;
+
+    /* Find the first bin that ends beyond the requested weight. */
+    while (low < high) {
+        IceTSizeType middle = (low + high)/2;
+        if (weights[middle+1] > weight) {
+            high = middle;
+        } else {
+            low = middle + 1;
+        }
+    }
+
+    if (low >= num_bins) {
+        return num_bins*bin_size;
+    }
+
+    bin_weight = weights[low+1] - weights[low];
+    return low*bin_size
+        + (IceTSizeType)((weight - weights[low])*bin_size/bin_weight);
+}
+
+/* Fills ICET_SPLIT_PARTITION_OFFSETS with the offsets of num_partitions
+   partitions of the whole image holding equal shares of
+   ICET_SPLIT_FRAGMENT_WEIGHTS.  The last entry is the size of the image. */
+static void icetSparseImageSplitBuildPartitionTable(IceTInt num_partitions,
+                                                    IceTSizeType size)
+{
+    IceTSizeType num_bins;
+    IceTSizeType bin_size;
+    const IceTDouble *weights;
+    IceTInt *table;
+    IceTInt partition_idx;
+
+    num_bins = icetStateGetNumEntries(ICET_SPLIT_FRAGMENT_WEIGHTS) - 1;
+    icetGetIntegerv(ICET_SPLIT_WEIGHTS_BIN_SIZE, &bin_size);
+    weights = icetUnsafeStateGetDouble(ICET_SPLIT_FRAGMENT_WEIGHTS);
+
+    table = icetStateAllocateInteger(ICET_SPLIT_PARTITION_OFFSETS,
+                                     num_partitions + 1);
+    table[0] = 0;
+    for (partition_idx = 1; partition_idx < num_partitions; partition_idx++) {
+        IceTSizeType offset = icetSparseImageSplitOffsetAt(
+                       weights,
+                       num_bins,
+                       bin_size,
+                       weights[num_bins]*partition_idx/num_partitions);
+        if (offset < table[partition_idx-1]) {
+            offset = table[partition_idx-1];
+        }
+        if (offset > size) {
+            offset = size;
+        }
+        table[partition_idx] = offset;
+    }
+    table[num_partitions] = size;
+}
+
 IceTSizeType icetSparseImageSplitPartitionNumPixels(
                                                 IceTSizeType input_num_pixels,
                                                 IceTInt num_partitions,
                                                 IceTInt eventual_num_partitions)
 {
     IceTInt sub_partitions = eventual_num_partitions/num_partitions;
+    IceTSizeType equal_num_pixels;
+    IceTSizeType max_num_pixels;
+    IceTSizeType num_entries;
+    const IceTInt *table;
+    IceTSizeType entry;
 
 #ifdef DEBUG
     if (eventual_num_partitions%num_partitions != 0) {
@@ -2420,7 +5090,111 @@ IceTSizeType icetSparseImageSplitPartitionNumPixels(
     }
 #endif
 
-    return input_num_pixels/num_partitions + sub_partitions;
+    equal_num_pixels = input_num_pixels/num_partitions + sub_partitions;
+
+    num_entries = icetStateGetNumEntries(ICET_SPLIT_PARTITION_OFFSETS);
+    if (num_entries < 2) {
+        return equal_num_pixels;
+    }
+
+    /* Build the partition table now if splitting the whole image would. */
+    table = icetUnsafeStateGetInteger(ICET_SPLIT_PARTITION_OFFSETS);
+    if (   (input_num_pixels == table[num_entries-1])
+        && (eventual_num_partitions != num_entries-1) ) {
+        icetSparseImageSplitBuildPartitionTable(eventual_num_partitions,
+                                                input_num_pixels);
+        num_entries = eventual_num_partitions + 1;
+        table = icetUnsafeStateGetInteger(ICET_SPLIT_PARTITION_OFFSETS);
+    }
+    if ((num_entries - 1)%sub_partitions != 0) {
+        return input_num_pixels;
+    }
+
+    /* Partitions span sub_partitions aligned table entries, or are split
+       equally if the image is not found in the table. */
+    max_num_pixels = equal_num_pixels;
+    for (entry = 0; entry + sub_partitions < num_entries;
+         entry += sub_partitions) {
+        IceTSizeType partition_num_pixels
+            = table[entry + sub_partitions] - table[entry];
+        if (partition_num_pixels > max_num_pixels) {
+            max_num_pixels = partition_num_pixels;
+        }
+    }
+
+    if (max_num_pixels > input_num_pixels) {
+        return input_num_pixels;
+    }
+    return max_num_pixels;
+}
+
+/* Chooses partitions from ICET_SPLIT_PARTITION_OFFSETS, which holds the
+   partitions of the whole image balanced by fragment count.  The table is
+   rebuilt when the whole image is split into a different number of eventual
+   partitions.  Pieces of the image must be split along the same table to keep
+   partitions consistent between processes.  Returns false if the partitions
+   cannot be found in the table. */
+static IceTBoolean icetSparseImageSplitChooseBalancedPartitions(
+                                                IceTInt num_partitions,
+                                                IceTInt eventual_num_partitions,
+                                                IceTSizeType size,
+                                                IceTSizeType first_offset,
+                                                IceTSizeType *offsets)
+{
+    IceTSizeType num_entries;
+    const IceTInt *table;
+    IceTInt sub_partitions = eventual_num_partitions/num_partitions;
+    IceTSizeType low;
+    IceTSizeType high;
+    IceTInt partition_idx;
+
+    num_entries = icetStateGetNumEntries(ICET_SPLIT_PARTITION_OFFSETS);
+    if (num_entries < 2) {
+        return ICET_FALSE;
+    }
+    table = icetUnsafeStateGetInteger(ICET_SPLIT_PARTITION_OFFSETS);
+
+    if (   (first_offset == 0)
+        && (size == table[num_entries-1])
+        && (eventual_num_partitions != num_entries-1) ) {
+        icetSparseImageSplitBuildPartitionTable(eventual_num_partitions, size);
+        num_entries = eventual_num_partitions + 1;
+        table = icetUnsafeStateGetInteger(ICET_SPLIT_PARTITION_OFFSETS);
+    }
+
+    /* Find the first partition starting at first_offset. */
+    low = 0;
+    high = num_entries - 1;
+    while (low < high) {
+        IceTSizeType middle = (low + high)/2;
+        if (table[middle] < first_offset) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    /* Pieces of nested splits cover a run of eventual_num_partitions table
+       entries aligned to that number.  Empty partitions can make several
+       entries start at the same offset, so search for an aligned one. */
+    low = ((low + eventual_num_partitions - 1)/eventual_num_partitions)
+        * eventual_num_partitions;
+    while (   (low + eventual_num_partitions < num_entries)
+           && (table[low] == first_offset)
+           && (table[low + eventual_num_partitions] != first_offset + size) ) {
+        low += eventual_num_partitions;
+    }
+    if (   (low + eventual_num_partitions >= num_entries)
+        || (table[low] != first_offset)
+        || (table[low + eventual_num_partitions] != first_offset + size) ) {
+        return ICET_FALSE;
+    }
+
+    for (partition_idx = 0; partition_idx < num_partitions; partition_idx++) {
+        offsets[partition_idx] = table[low + partition_idx*sub_partitions];
+    }
+
+    return ICET_TRUE;
 }
 
 static void icetSparseImageSplitChoosePartitions(
@@ -2445,6 +5219,14 @@ static void icetSparseImageSplitChoosePartitions(
     }
 #endif
 
+    if (icetSparseImageSplitChooseBalancedPartitions(num_partitions,
+                                                     eventual_num_partitions,
+                                                     size,
+                                                     first_offset,
+                                                     offsets)) {
+        return;
+    }
+
     for (partition_idx = 0; partition_idx < num_partitions; partition_idx++) {
         offsets[partition_idx] = this_offset;
         this_offset += partition_lower_size;
@@ -2470,7 +5252,10 @@ void icetSparseImageSplit(const IceTSparseImage in_image,
     IceTEnum color_format;
     IceTEnum depth_format;
     IceTSizeType fragment_size;
+    IceTSizeType count_size;
     IceTBoolean is_layered;
+    IceTBoolean single_fragment;
+    IceTBoolean is_blocked;
 
     const IceTVoid *in_data;
     IceTSizeType start_inactive;
@@ -2495,8 +5280,11 @@ void icetSparseImageSplit(const IceTSparseImage in_image,
     depth_format = icetSparseImageGetDepthFormat(in_image);
     fragment_size = colorPixelSize(color_format) + depthPixelSize(depth_format);
     is_layered = icetSparseImageIsLayered(in_image);
+    single_fragment = icetSparseImageIsSingleFragment(in_image);
+    count_size = icetSparseImageGetLayerCountSize(in_image);
+    is_blocked = icetSparseImageIsBlocked(in_image);
 
-    in_data = ICET_IMAGE_DATA(in_image);
+    in_data = ICET_SPARSE_IMAGE_DATA(in_image);
     start_inactive = start_active = start_active_frags = 0;
 
     icetSparseImageSplitChoosePartitions(num_partitions,
@@ -2518,6 +5306,11 @@ void icetSparseImageSplit(const IceTSparseImage in_image,
             icetTimingCompressEnd();
             return;
         }
+        icetSparseImageSetSingleFragment(out_image, single_fragment);
+        icetSparseImageSetLayerCountSize(out_image, count_size);
+        icetSparseImageSetMaxFragments(
+                           out_image, icetSparseImageGetMaxFragments(in_image));
+        icetSparseImageCopyContributors(in_image, out_image);
 
         if (partition < num_partitions-1) {
             partition_num_pixels = offsets[partition+1] - offsets[partition];
@@ -2526,9 +5319,30 @@ void icetSparseImageSplit(const IceTSparseImage in_image,
                 = total_num_pixels + in_image_offset - offsets[partition];
         }
 
+        if (is_blocked) {
+            /* Blocks are copied by position, so a first partition in place
+             * is copied after the other partitions have read its image. */
+            if (icetSparseImageEqual(in_image, out_image)) {
+                if (partition != 0) {
+                    icetRaiseError(ICET_INVALID_VALUE,
+                                   "icetSparseImageSplit copy in place only"
+                                   " allowed in first partition.");
+                }
+            } else {
+                icetSparseBlockImageCopyPixels(
+                                            in_image,
+                                            offsets[partition] - in_image_offset,
+                                            partition_num_pixels,
+                                            ICET_TRUE,
+                                            out_image);
+            }
+            continue;
+        }
+        icetSparseImageSetBlocked(out_image, ICET_FALSE);
+
         if (icetSparseImageEqual(in_image, out_image)) {
             if (partition == 0) {
-                if (is_layered) {
+                if (is_layered && !single_fragment) {
                     icetSparseLayeredImageCopyPixelsInPlaceInternal(
                                                            &in_data,
                                                            &start_inactive,
@@ -2536,6 +5350,7 @@ void icetSparseImageSplit(const IceTSparseImage in_image,
                                                            &start_active_frags,
                                                            partition_num_pixels,
                                                            fragment_size,
+                                                           count_size,
                                                            out_image);
                 } else {
                     icetSparseImageCopyPixelsInPlaceInternal(
@@ -2552,13 +5367,14 @@ void icetSparseImageSplit(const IceTSparseImage in_image,
                                " in first partition.");
             }
         } else {
-            if (is_layered) {
+            if (is_layered && !single_fragment) {
                 icetSparseLayeredImageCopyPixelsInternal(&in_data,
                                                         &start_inactive,
                                                         &start_active,
                                                         &start_active_frags,
                                                         partition_num_pixels,
                                                         fragment_size,
+                                                        count_size,
                                                         out_image);
             } else {
                 icetSparseImageCopyPixelsInternal(&in_data,
@@ -2571,10 +5387,15 @@ void icetSparseImageSplit(const IceTSparseImage in_image,
         }
     }
 
+    if (is_blocked && icetSparseImageEqual(in_image, out_images[0])) {
+        icetSparseBlockImageCopyPixelsInPlace(out_images[0],
+                                              offsets[1] - offsets[0]);
+    }
+
 #ifdef DEBUG
     if (   (start_inactive != 0)
         || (start_active != 0)
-        || (is_layered && start_active_frags != 0) ) {
+        || (is_layered && !single_fragment && (start_active_frags != 0)) ) {
         icetRaiseError(ICET_SANITY_CHECK_FAIL, "Counting problem.");
     }
 #endif
@@ -2595,7 +5416,10 @@ void icetSparseImageSplitAlloc(const IceTSparseImage in_image,
     IceTEnum color_format;
     IceTEnum depth_format;
     IceTSizeType fragment_size;
+    IceTSizeType count_size;
     IceTBoolean is_layered;
+    IceTBoolean single_fragment;
+    IceTBoolean is_blocked;
 
     const IceTVoid *in_data;
     IceTByte *out_data;
@@ -2626,8 +5450,11 @@ void icetSparseImageSplitAlloc(const IceTSparseImage in_image,
     depth_format = icetSparseImageGetDepthFormat(in_image);
     fragment_size = colorPixelSize(color_format) + depthPixelSize(depth_format);
     is_layered = icetSparseImageIsLayered(in_image);
+    single_fragment = icetSparseImageIsSingleFragment(in_image);
+    count_size = icetSparseImageGetLayerCountSize(in_image);
+    is_blocked = icetSparseImageIsBlocked(in_image);
 
-    in_data = ICET_IMAGE_DATA(in_image);
+    in_data = ICET_SPARSE_IMAGE_DATA(in_image);
     start_inactive = start_active = start_active_frags = 0;
 
     icetSparseImageSplitChoosePartitions(num_partitions,
@@ -2641,19 +5468,36 @@ void icetSparseImageSplitAlloc(const IceTSparseImage in_image,
           /* Header of the first partition, all run lengths and pixels. */
           ICET_IMAGE_HEADER(in_image)[ICET_IMAGE_ACTUAL_BUFFER_SIZE_INDEX]
         +  (num_partitions - 1) /* For each additional partition: */
-          *(  ICET_IMAGE_DATA_START_INDEX*sizeof(IceTInt) /* Header. */
+          *(  ICET_SPARSE_IMAGE_DATA_START_INDEX(in_image)*sizeof(IceTInt)
+                                                          /* Header. */
             + RUN_LENGTH_SIZE_LAYERED ); /* Initial run lengths. */
+    if (is_blocked || icetIsEnabled(ICET_BLOCK_SPARSE_IMAGES)) {
+        /* Blocks cut at the partition boundaries need their own masks, and
+         * new images start with an empty bitmap. */
+        for (partition = 0; partition < num_partitions; partition++) {
+            out_buffer_size += icetSparseBlockImageOverhead(
+                (partition < num_partitions-1)
+                    ? offsets[partition+1] - offsets[partition]
+                    : total_num_pixels + in_image_offset - offsets[partition],
+                1);
+        }
+        partition = 0;
+    }
 
     /* Copy the first partition in place when possible. */
     out_image = out_images[0];
 
-    if (icetSparseImageEqual(in_image, out_image)) {
+    if (icetSparseImageEqual(in_image, out_image) && is_blocked) {
+        /* Blocks are copied by position, so the first partition is copied
+         * after the other partitions have read its image. */
+        ++partition;
+    } else if (icetSparseImageEqual(in_image, out_image)) {
         IceTSizeType partition_num_pixels;
 
         /* Safe, because num_partitions >= 2 at this point. */
         partition_num_pixels = offsets[1] - offsets[0];
 
-        if (is_layered) {
+        if (is_layered && !single_fragment) {
             icetSparseLayeredImageCopyPixelsInPlaceInternal(
                                                            &in_data,
                                                            &start_inactive,
@@ -2661,6 +5505,7 @@ void icetSparseImageSplitAlloc(const IceTSparseImage in_image,
                                                            &start_active_frags,
                                                            partition_num_pixels,
                                                            fragment_size,
+                                                           count_size,
                                                            out_image);
         } else {
             icetSparseImageCopyPixelsInPlaceInternal(&in_data,
@@ -2709,15 +5554,28 @@ void icetSparseImageSplitAlloc(const IceTSparseImage in_image,
         header = ICET_IMAGE_HEADER(out_image);
         header[ICET_IMAGE_COLOR_FORMAT_INDEX] = color_format;
         header[ICET_IMAGE_DEPTH_FORMAT_INDEX] = depth_format;
+        icetSparseImageSetSingleFragment(out_image, single_fragment);
+        icetSparseImageSetLayerCountSize(out_image, count_size);
+        icetSparseImageSetMaxFragments(
+                           out_image, icetSparseImageGetMaxFragments(in_image));
+        icetSparseImageCopyContributors(in_image, out_image);
+        icetSparseImageSetBlocked(out_image, ICET_FALSE);
 
         /* Copy data. */
-        if (is_layered) {
+        if (is_blocked) {
+            icetSparseBlockImageCopyPixels(in_image,
+                                           offsets[partition] - in_image_offset,
+                                           partition_num_pixels,
+                                           ICET_TRUE,
+                                           out_image);
+        } else if (is_layered && !single_fragment) {
             icetSparseLayeredImageCopyPixelsInternal(&in_data,
                                                     &start_inactive,
                                                     &start_active,
                                                     &start_active_frags,
                                                     partition_num_pixels,
                                                     fragment_size,
+                                                    count_size,
                                                     out_image);
         } else {
             icetSparseImageCopyPixelsInternal(&in_data,
@@ -2743,10 +5601,15 @@ void icetSparseImageSplitAlloc(const IceTSparseImage in_image,
 #endif
     }
 
+    if (is_blocked && icetSparseImageEqual(in_image, out_images[0])) {
+        icetSparseBlockImageCopyPixelsInPlace(out_images[0],
+                                              offsets[1] - offsets[0]);
+    }
+
 #ifdef DEBUG
     if (   (start_inactive != 0)
         || (start_active != 0)
-        || (is_layered && start_active_frags != 0) ) {
+        || (is_layered && !single_fragment && (start_active_frags != 0)) ) {
         icetRaiseError(ICET_SANITY_CHECK_FAIL, "Counting problem.");
     }
 #endif
@@ -2754,6 +5617,14 @@ void icetSparseImageSplitAlloc(const IceTSparseImage in_image,
     icetTimingCompressEnd();
 }
 
+IceTBoolean icetSparseImageInterlaceEnabled(void)
+{
+    /* Interlacing reorders the pixels the split weights refer to and assumes
+       partitions of equal size. */
+    return (   icetIsEnabled(ICET_INTERLACE_IMAGES)
+            && (icetStateGetNumEntries(ICET_SPLIT_FRAGMENT_WEIGHTS) == 0) );
+}
+
 void icetSparseImageInterlace(const IceTSparseImage in_image,
                               IceTInt eventual_num_partitions,
                               IceTEnum scratch_state_buffer,
@@ -2763,6 +5634,8 @@ void icetSparseImageInterlace(const IceTSparseImage in_image,
     IceTEnum color_format = icetSparseImageGetColorFormat(in_image);
     IceTEnum depth_format = icetSparseImageGetDepthFormat(in_image);
     IceTBoolean is_layered = icetSparseImageIsLayered(in_image);
+    IceTBoolean single_fragment = icetSparseImageIsSingleFragment(in_image);
+    IceTSizeType count_size = icetSparseImageGetLayerCountSize(in_image);
     IceTSizeType lower_partition_size = num_pixels/eventual_num_partitions;
     IceTSizeType remaining_pixels = num_pixels%eventual_num_partitions;
     IceTSizeType fragment_size;
@@ -2778,6 +5651,7 @@ void icetSparseImageInterlace(const IceTSparseImage in_image,
     IceTSizeType inactive_before;
     IceTSizeType active_till_next_runl;
     IceTSizeType active_frags_till_next_runl;
+    IceTSizeType partition_start;
     IceTVoid *last_run_length;
 
     /* Special case, nothing to do. */
@@ -2794,9 +5668,33 @@ void icetSparseImageInterlace(const IceTSparseImage in_image,
         return;
     }
 
+    if (icetSparseImageIsBlocked(in_image)) {
+        /* Interlace the pixels as runs and store the result as blocks. */
+        IceTSparseImage in_runs;
+        IceTSparseImage out_runs;
+
+        in_runs = icetSparseBlockImageToRuns(in_image, ICET_SPARSE_BLOCK_BUF_0);
+        out_runs = icetSparseImageRunScratch(ICET_SPARSE_BLOCK_BUF_1,
+                                             in_image,
+                                             icetSparseImageGetWidth(in_image),
+                                             icetSparseImageGetHeight(in_image));
+        icetSparseImageInterlace(in_runs,
+                                 eventual_num_partitions,
+                                 scratch_state_buffer,
+                                 out_runs);
+        icetSparseBlockImageFromRuns(out_runs, out_image);
+        return;
+    }
+
     icetTimingInterlaceBegin();
 
     fragment_size = colorPixelSize(color_format) + depthPixelSize(depth_format);
+    icetSparseImageSetBlocked(out_image, ICET_FALSE);
+    icetSparseImageSetSingleFragment(out_image, single_fragment);
+    icetSparseImageSetLayerCountSize(out_image, count_size);
+    icetSparseImageSetMaxFragments(out_image,
+                                   icetSparseImageGetMaxFragments(in_image));
+    icetSparseImageCopyContributors(in_image, out_image);
 
     {
         IceTByte *buffer;
@@ -2817,10 +5715,11 @@ void icetSparseImageInterlace(const IceTSparseImage in_image,
 
     /* Run through the input data and figure out where each interlaced
        partition needs to read from. */
-    in_data = ICET_IMAGE_DATA(in_image);
+    in_data = ICET_SPARSE_IMAGE_DATA(in_image);
     inactive_before = 0;
     active_till_next_runl = 0;
     active_frags_till_next_runl = 0;
+    partition_start = 0;
     for (original_partition_idx = 0;
          original_partition_idx < eventual_num_partitions;
          original_partition_idx++) {
@@ -2843,13 +5742,13 @@ void icetSparseImageInterlace(const IceTSparseImage in_image,
         active_till_next_runl_array[interlaced_partition_idx]
             = active_till_next_runl;
 
-        if (is_layered) {
+        if (is_layered && !single_fragment) {
             active_frags_till_next_runl_array[interlaced_partition_idx]
                 = active_frags_till_next_runl;
         }
 
         if (original_partition_idx < eventual_num_partitions-1) {
-            if (is_layered) {
+            if (is_layered && !single_fragment) {
                 icetSparseLayeredImageScanPixels((const IceTVoid**)&in_data,
                                                   &inactive_before,
                                                   &active_till_next_runl,
@@ -2857,32 +5756,33 @@ void icetSparseImageInterlace(const IceTSparseImage in_image,
                                                   NULL,
                                                   pixels_to_skip,
                                                   fragment_size,
+                                                  count_size,
                                                   NULL,
                                                   NULL);
             } else {
-                icetSparseImageScanPixels((const IceTVoid**)&in_data,
+                icetSparseImageSkipPixels(in_image,
+                                          partition_start,
+                                          (const IceTVoid**)&in_data,
                                           &inactive_before,
                                           &active_till_next_runl,
-                                          NULL,
                                           pixels_to_skip,
-                                          fragment_size,
-                                          NULL,
-                                          NULL);
+                                          fragment_size);
             }
         }
+        partition_start += pixels_to_skip;
     }
 
     /* Set up output image. */
     icetSparseImageSetDimensions(out_image,
                                  icetSparseImageGetWidth(in_image),
                                  icetSparseImageGetHeight(in_image));
-    out_data = ICET_IMAGE_DATA(out_image);
+    out_data = ICET_SPARSE_IMAGE_DATA(out_image);
     last_run_length = out_data;
 
     INACTIVE_RUN_LENGTH(out_data) = 0;
     ACTIVE_RUN_LENGTH(out_data) = 0;
 
-    if (is_layered) {
+    if (is_layered && !single_fragment) {
         ACTIVE_RUN_LENGTH_FRAGMENTS(out_data) = 0;
         out_data = (IceTByte*)out_data + RUN_LENGTH_SIZE_LAYERED;
     } else {
@@ -2904,7 +5804,7 @@ void icetSparseImageInterlace(const IceTSparseImage in_image,
         active_till_next_runl
             = active_till_next_runl_array[interlaced_partition_idx];
 
-        if (is_layered) {
+        if (is_layered && !single_fragment) {
             active_frags_till_next_runl
                 = active_frags_till_next_runl_array[interlaced_partition_idx];
 
@@ -2915,6 +5815,7 @@ void icetSparseImageInterlace(const IceTSparseImage in_image,
                                              NULL,
                                              pixels_left,
                                              fragment_size,
+                                             count_size,
                                              (IceTVoid **)&out_data,
                                              &last_run_length);
         } else {
@@ -2946,8 +5847,17 @@ IceTSparseImage icetSparseImageInterlaceAlloc(const IceTSparseImage in_image,
     IceTSizeType out_buffer_size =
           icetSparseImageGetCompressedBufferSize(in_image)
         + eventual_num_partitions*RUN_LENGTH_SIZE_LAYERED;
-    IceTVoid *out_buffer = icetGetStateBuffer(out_buffer_pname,
-                                              out_buffer_size);
+    IceTVoid *out_buffer;
+
+    if (   icetSparseImageIsBlocked(in_image)
+        || icetIsEnabled(ICET_BLOCK_SPARSE_IMAGES) ) {
+        /* Interlacing moves pixels into other blocks, which may all need a
+         * mask. */
+        out_buffer_size
+            += icetSparseBlockImageOverhead(icetSparseImageGetWidth(in_image),
+                                            icetSparseImageGetHeight(in_image));
+    }
+    out_buffer = icetGetStateBuffer(out_buffer_pname, out_buffer_size);
 
     /* Allocate result image. */
     if (icetSparseImageIsLayered(in_image)) {
@@ -3010,31 +5920,186 @@ IceTSizeType icetGetInterlaceOffset(IceTInt partition_index,
         IceTInt interlaced_partition_idx;
         IceTSizeType partition_size;
 
-        BIT_REVERSE(interlaced_partition_idx,
-                    original_partition_idx,
-                    eventual_num_partitions);
-        if (eventual_num_partitions <= interlaced_partition_idx) {
-            interlaced_partition_idx = original_partition_idx;
-        }
+        BIT_REVERSE(interlaced_partition_idx,
+                    original_partition_idx,
+                    eventual_num_partitions);
+        if (eventual_num_partitions <= interlaced_partition_idx) {
+            interlaced_partition_idx = original_partition_idx;
+        }
+
+        if (interlaced_partition_idx == partition_index) {
+            /* Found any partitions before this one. */
+            icetTimingInterlaceEnd();
+            return offset;
+        }
+
+        partition_size = lower_partition_size;
+        if (interlaced_partition_idx < remaining_pixels) {
+            partition_size += 1;
+        }
+
+        offset += partition_size;
+    }
+
+    /* Should never get here. */
+    icetRaiseError(ICET_SANITY_CHECK_FAIL, "Could not find partition index.");
+    icetTimingInterlaceEnd();
+    return 0;
+}
+
+/* Appends `count` inactive pixels to a sparse layered image being written,
+ * extending the last run if it has no active pixels yet.
+ */
+static void icetSparseLayeredImageStitchInactive(IceTByte **out_data_p,
+                                                 IceTVoid **last_run_length_p,
+                                                 IceTSizeType count)
+{
+    if (count <= 0) return;
+
+    if (ACTIVE_RUN_LENGTH(*last_run_length_p) > 0) {
+        *last_run_length_p = *out_data_p;
+        INACTIVE_RUN_LENGTH(*last_run_length_p) = 0;
+        ACTIVE_RUN_LENGTH(*last_run_length_p) = 0;
+        ACTIVE_RUN_LENGTH_FRAGMENTS(*last_run_length_p) = 0;
+        *out_data_p += RUN_LENGTH_SIZE_LAYERED;
+    }
+    INACTIVE_RUN_LENGTH(*last_run_length_p) += (IceTRunLengthType)count;
+}
+
+void icetSparseLayeredImageStitch(const IceTSparseImage *pieces,
+                                  const IceTSizeType *offsets,
+                                  IceTInt num_pieces,
+                                  IceTSparseImage out_image)
+{
+    IceTEnum color_format = icetSparseImageGetColorFormat(out_image);
+    IceTEnum depth_format = icetSparseImageGetDepthFormat(out_image);
+    IceTSizeType num_pixels = icetSparseImageGetNumPixels(out_image);
+    IceTLayerCount max_fragments;
+    IceTSizeType count_size;
+    IceTSizeType fragment_size;
+    IceTSizeType pixels_written;
+    IceTByte *out_data;
+    IceTVoid *last_run_length;
+    IceTInt piece_idx;
+
+    if (!icetSparseImageIsLayered(out_image)) {
+        icetRaiseError(ICET_INVALID_VALUE,
+                       "Only layered images can be stitched.");
+        return;
+    }
+
+    /* The pieces may store their fragment counts with different sizes, so the
+     * output uses the smallest one that holds the counts of all of them. */
+    max_fragments = 1;
+    for (piece_idx = 0; piece_idx < num_pieces; piece_idx++) {
+        if (icetSparseImageGetNumPixels(pieces[piece_idx]) == 0) continue;
+        max_fragments = MAX(max_fragments,
+                            icetSparseImageGetMaxFragments(pieces[piece_idx]));
+    }
+    count_size = icetSparseLayeredImageLayerCountSize(
+                                                 (IceTSizeType)max_fragments);
+
+    fragment_size = colorPixelSize(color_format) + depthPixelSize(depth_format);
+    icetSparseImageSetSingleFragment(out_image, ICET_FALSE);
+    icetSparseImageSetLayerCountSize(out_image, count_size);
+    icetSparseImageSetMaxFragments(out_image, max_fragments);
+
+    /* Start with an empty run, which the pieces extend. */
+    out_data = ICET_SPARSE_IMAGE_DATA(out_image);
+    last_run_length = out_data;
+    INACTIVE_RUN_LENGTH(last_run_length) = 0;
+    ACTIVE_RUN_LENGTH(last_run_length) = 0;
+    ACTIVE_RUN_LENGTH_FRAGMENTS(last_run_length) = 0;
+    out_data += RUN_LENGTH_SIZE_LAYERED;
+    pixels_written = 0;
+
+    for (piece_idx = 0; piece_idx < num_pieces; piece_idx++) {
+        const IceTSparseImage piece = pieces[piece_idx];
+        const IceTSizeType piece_pixels = icetSparseImageGetNumPixels(piece);
+        IceTBoolean single_fragment;
+        IceTSizeType piece_count_size;
+        const IceTByte *in_data;
+        IceTSizeType pixels_left;
 
-        if (interlaced_partition_idx == partition_index) {
-            /* Found any partitions before this one. */
-            icetTimingInterlaceEnd();
-            return offset;
+        if (piece_pixels == 0) continue;
+
+        single_fragment = icetSparseImageIsSingleFragment(piece);
+        piece_count_size = single_fragment
+                           ? 0 : icetSparseImageGetLayerCountSize(piece);
+        if (   !icetSparseImageIsLayered(piece)
+            || (icetSparseImageGetColorFormat(piece) != color_format)
+            || (icetSparseImageGetDepthFormat(piece) != depth_format) ) {
+            icetRaiseError(ICET_INVALID_VALUE,
+                           "Cannot stitch images with different formats.");
+            return;
+        }
+        if (   (offsets[piece_idx] < pixels_written)
+            || (offsets[piece_idx] + piece_pixels > num_pixels) ) {
+            icetRaiseError(ICET_INVALID_VALUE,
+                           "Stitched pieces overlap or exceed the image.");
+            return;
         }
 
-        partition_size = lower_partition_size;
-        if (interlaced_partition_idx < remaining_pixels) {
-            partition_size += 1;
+        icetSparseLayeredImageStitchInactive(&out_data,
+                                             &last_run_length,
+                                             offsets[piece_idx]-pixels_written);
+
+        /* Copy the runs of the piece, adding the fragment count to pixels
+         * stored without one. */
+        in_data = ICET_SPARSE_IMAGE_DATA(piece);
+        pixels_left = piece_pixels;
+        while (pixels_left > 0) {
+            IceTSizeType inactive = INACTIVE_RUN_LENGTH(in_data);
+            IceTSizeType active = ACTIVE_RUN_LENGTH(in_data);
+            IceTSizeType num_frags;
+
+            if (single_fragment) {
+                num_frags = active;
+                in_data += RUN_LENGTH_SIZE;
+            } else {
+                num_frags = ACTIVE_RUN_LENGTH_FRAGMENTS(in_data);
+                in_data += RUN_LENGTH_SIZE_LAYERED;
+            }
+
+            icetSparseLayeredImageStitchInactive(&out_data,
+                                                 &last_run_length,
+                                                 inactive);
+
+            ACTIVE_RUN_LENGTH(last_run_length) += (IceTRunLengthType)active;
+            ACTIVE_RUN_LENGTH_FRAGMENTS(last_run_length)
+                += (IceTRunLengthType)num_frags;
+            if (piece_count_size != count_size) {
+                IceTSizeType pixel;
+                for (pixel = 0; pixel < active; pixel++) {
+                    const IceTLayerCount pixel_frags = single_fragment
+                        ? 1 : LAYER_COUNT_GET(in_data, piece_count_size);
+                    const IceTSizeType pixel_size = pixel_frags*fragment_size;
+                    in_data += piece_count_size;
+                    LAYER_COUNT_SET(out_data, count_size, pixel_frags);
+                    out_data += count_size;
+                    memcpy(out_data, in_data, pixel_size);
+                    out_data += pixel_size;
+                    in_data += pixel_size;
+                }
+            } else {
+                IceTSizeType run_size =  active*count_size
+                                       + num_frags*fragment_size;
+                memcpy(out_data, in_data, run_size);
+                out_data += run_size;
+                in_data += run_size;
+            }
+
+            pixels_left -= inactive + active;
         }
 
-        offset += partition_size;
+        pixels_written = offsets[piece_idx] + piece_pixels;
     }
 
-    /* Should never get here. */
-    icetRaiseError(ICET_SANITY_CHECK_FAIL, "Could not find partition index.");
-    icetTimingInterlaceEnd();
-    return 0;
+    icetSparseLayeredImageStitchInactive(&out_data,
+                                         &last_run_length,
+                                         num_pixels - pixels_written);
+
+    icetSparseImageSetActualSize(out_image, out_data);
 }
 
 void icetClearImage(IceTImage image)
@@ -3053,18 +6118,34 @@ void icetClearSparseImage(IceTSparseImage image)
     if (icetSparseImageIsNull(image)) { return; }
 
     /* Use IceTByte for byte-based pointer arithmetic. */
-    data = ICET_IMAGE_DATA(image);
+    data = ICET_SPARSE_IMAGE_DATA(image);
+
+    if (icetSparseImageIsBlocked(image)) {
+        /* An empty bitmap with no blocks after it. */
+        IceTSparseBlockLayout layout;
+        icetSparseBlockLayoutInit(&layout,
+                                  icetSparseImageGetWidth(image),
+                                  icetSparseImageGetHeight(image));
+        memset(data, 0, layout.bitmap_size);
+        icetSparseImageSetActualSize(image, data + layout.bitmap_size);
+        return;
+    }
+
     INACTIVE_RUN_LENGTH(data) = icetSparseImageGetNumPixels(image);
     ACTIVE_RUN_LENGTH(data) = 0;
 
-    /* Layered images have an additional run length field. */
-    if (icetSparseImageIsLayered(image)) {
+    /* Layered images have an additional run length field, unless they hold a
+     * single fragment per pixel. */
+    if (   icetSparseImageIsLayered(image)
+        && !icetSparseImageIsSingleFragment(image) ) {
         ACTIVE_RUN_LENGTH_FRAGMENTS(data) = 0;
         data_end = data+RUN_LENGTH_SIZE_LAYERED;
     } else {
         data_end = data+RUN_LENGTH_SIZE;
     }
 
+    /* Like the size of the fragment counts, the bound for the number of
+     * fragments per pixel is kept, since it still holds for an empty image. */
     icetSparseImageSetActualSize(image, data_end);
 }
 
@@ -3085,6 +6166,7 @@ void icetSetColorFormat(IceTEnum color_format)
     if (   (color_format == ICET_IMAGE_COLOR_RGBA_UBYTE)
         || (color_format == ICET_IMAGE_COLOR_RGBA_FLOAT)
         || (color_format == ICET_IMAGE_COLOR_RGB_FLOAT)
+        || (color_format == ICET_IMAGE_COLOR_RGBA_HALF)
         || (color_format == ICET_IMAGE_COLOR_NONE) ) {
         icetStateSetInteger(ICET_COLOR_FORMAT, color_format);
     } else {
@@ -3107,6 +6189,7 @@ void icetSetDepthFormat(IceTEnum depth_format)
     }
 
     if (   (depth_format == ICET_IMAGE_DEPTH_FLOAT)
+        || (depth_format == ICET_IMAGE_DEPTH_USHORT)
         || (depth_format == ICET_IMAGE_DEPTH_NONE) ) {
         icetStateSetInteger(ICET_DEPTH_FORMAT, depth_format);
     } else {
@@ -3171,10 +6254,25 @@ static void getRenderedBufferImage(IceTImage rendered_image,
     icetTimingBufferReadEnd();
 }
 
+/* Records this process as the only contributor to a sparse layered image. */
+static void icetSparseImageSetLocalContributor(IceTSparseImage image)
+{
+    IceTInt *header = ICET_IMAGE_HEADER(image);
+    IceTInt rank;
+    if (!icetSparseImageIsLayered(image)) { return; }
+    icetGetIntegerv(ICET_RANK, &rank);
+    header[ICET_IMAGE_FIRST_CONTRIBUTOR_INDEX] =
+        icetProcessCompositePosition(rank);
+    header[ICET_IMAGE_LAST_CONTRIBUTOR_INDEX] =
+        icetProcessCompositePosition(rank);
+    header[ICET_IMAGE_NUM_CONTRIBUTORS_INDEX] = 1;
+}
+
 IceTSparseImage icetGetCompressedTileImage(IceTInt tile)
 {
     IceTInt screen_viewport[4], target_viewport[4];
     IceTImage raw_image;
+    IceTSparseImage sparse_image;
     const IceTInt *viewports;
     IceTSizeType width, height;
 
@@ -3186,15 +6284,48 @@ IceTSparseImage icetGetCompressedTileImage(IceTInt tile)
                              icetImageNull());
 
     if ((target_viewport[2] < 1) || (target_viewport[3] < 1)) {
-        /* Tile empty.  Just clear result. */
-        IceTSparseImage empty = icetGetStateBufferSparseImage(
+        /* Tile empty.  Just clear result.  The empty image must still match
+         * the format of the non-empty tile images it is composited with. */
+        IceTEnum composite_mode;
+        icetGetEnumv(ICET_COMPOSITE_MODE, &composite_mode);
+        if (   !icetImageIsNull(raw_image)
+            && icetImageIsLayered(raw_image)
+            && composite_mode == ICET_COMPOSITE_MODE_BLEND) {
+            sparse_image = icetGetStateBufferSparseLayeredImage(
+                    ICET_SPARSE_TILE_BUFFER, width, height, 1);
+        } else {
+            sparse_image = icetGetStateBufferSparseImage(
                     ICET_SPARSE_TILE_BUFFER, width, height);
-        icetClearSparseImage(empty);
-        return empty;
+        }
+        icetClearSparseImage(sparse_image);
+    } else {
+        sparse_image = getCompressedRenderedBufferImage(
+            raw_image, screen_viewport, target_viewport, width, height);
+    }
+
+    icetSparseImageSetLocalContributor(sparse_image);
+
+    return sparse_image;
+}
+
+IceTSparseImage icetCompressTileSubImage(const IceTImage tile_image,
+                                         IceTSizeType offset,
+                                         IceTSizeType num_pixels)
+{
+    IceTSparseImage sparse_image;
+
+    sparse_image = icetGetStateBufferSparseImage(ICET_SPARSE_TILE_BUFFER,
+                                                 num_pixels, 1);
+    if (num_pixels == icetImageGetNumPixels(tile_image)) {
+        /* Keep the dimensions of the tile like icetGetCompressedTileImage. */
+        icetCompressImage(tile_image, sparse_image);
+    } else {
+        icetCompressSubImage(tile_image, offset, num_pixels, sparse_image);
     }
 
-    return getCompressedRenderedBufferImage(
-        raw_image, screen_viewport, target_viewport, width, height);
+    icetSparseImageSetLocalContributor(sparse_image);
+
+    return sparse_image;
 }
 
 static IceTSparseImage getCompressedRenderedBufferImage(
@@ -3248,9 +6379,283 @@ static IceTSparseImage getCompressedRenderedBufferImage(
     return sparseImage;
 }
 
+/* Compression tests the pixels of a non-layered image for activity in blocks
+ * of this many pixels.  The tests of a block are summed without branches, so
+ * compilers can vectorize them, and whole blocks inside a run are skipped
+ * at once.  Only the block at the end of a run is tested pixel by pixel. */
+#define ICET_SCAN_BLOCK_SIZE    32
+
+/* Defines the body of a function that returns the number of pixels, at most
+ * max, at the start of a run of pixels that are active if active is true or
+ * inactive otherwise.  IS_ACTIVE(i) must be 1 if pixel i is active and 0 if
+ * not. */
+#define ICET_SCAN_RUN_BODY(IS_ACTIVE)                                          \
+{                                                                              \
+    IceTUInt block_match = active ? ICET_SCAN_BLOCK_SIZE : 0;                  \
+    IceTSizeType run = 0;                                                      \
+    while (run + ICET_SCAN_BLOCK_SIZE <= max) {                                \
+        IceTUInt num_active = 0;                                               \
+        int i;                                                                 \
+        for (i = 0; i < ICET_SCAN_BLOCK_SIZE; i++) {                           \
+            num_active += (IceTUInt)IS_ACTIVE(run + i);                        \
+        }                                                                      \
+        if (num_active != block_match) break;                                  \
+        run += ICET_SCAN_BLOCK_SIZE;                                           \
+    }                                                                          \
+    while ((run < max) && ((IceTBoolean)IS_ACTIVE(run) == active)) {           \
+        run++;                                                                 \
+    }                                                                          \
+    return run;                                                                \
+}
+
+static IceTSizeType icetScanRunDepthf(const IceTFloat *depth,
+                                      IceTSizeType max,
+                                      IceTBoolean active)
+#define ICET_DEPTH_ACTIVE(i)    (depth[i] < 1.0f)
+ICET_SCAN_RUN_BODY(ICET_DEPTH_ACTIVE)
+#undef ICET_DEPTH_ACTIVE
+
+static IceTSizeType icetScanRunAlphaub(const IceTUByte *color,
+                                       IceTSizeType max,
+                                       IceTBoolean active)
+#define ICET_ALPHA_ACTIVE(i)    (color[4*(i)+3] != 0x00)
+ICET_SCAN_RUN_BODY(ICET_ALPHA_ACTIVE)
+#undef ICET_ALPHA_ACTIVE
+
+static IceTSizeType icetScanRunAlphaf(const IceTFloat *color,
+                                      IceTSizeType max,
+                                      IceTBoolean active)
+#define ICET_ALPHA_ACTIVE(i)    (color[4*(i)+3] != 0.0f)
+ICET_SCAN_RUN_BODY(ICET_ALPHA_ACTIVE)
+#undef ICET_ALPHA_ACTIVE
+
+/* A half precision alpha is zero, with either sign, if all bits but the sign
+ * bit are clear. */
+static IceTSizeType icetScanRunAlphah(const IceTUShort *color,
+                                      IceTSizeType max,
+                                      IceTBoolean active)
+#define ICET_ALPHA_ACTIVE(i)    ((color[4*(i)+3] & 0x7FFF) != 0)
+ICET_SCAN_RUN_BODY(ICET_ALPHA_ACTIVE)
+#undef ICET_ALPHA_ACTIVE
+
+#undef ICET_SCAN_RUN_BODY
+
+#ifdef ICET_USE_OPENMP
+/* Images are only split among threads if each thread gets at least this many
+ * pixels.  Smaller pieces are not worth the cost of starting the threads. */
+#define ICET_THREAD_MIN_PIXELS  16384
+
+/* A contiguous range of pixels of a non-layered sparse image that one thread
+ * writes as a sparse image of its own. */
+typedef struct IceTThreadPiece {
+    IceTByte *buffer;
+    IceTSizeType offset;
+    IceTByte *first_run_length;
+    IceTByte *last_run_length;
+    IceTByte *end;
+    IceTSizeType skip;
+    IceTByte *out;
+} IceTThreadPiece;
+
+/* Returns the number of threads among which to split an image with the given
+ * number of pixels.  A result less than 2 means no threads should be used. */
+static IceTInt icetThreadPieceCount(IceTSizeType num_pixels)
+{
+    IceTInt num_threads;
+    icetGetIntegerv(ICET_NUM_THREADS, &num_threads);
+    return MIN(num_threads, num_pixels/ICET_THREAD_MIN_PIXELS);
+}
+
+/* Splits num_pixels pixels into num_pieces pieces allocated in the given state
+ * buffer.  Each piece is a sparse image with the header of out_image. */
+static IceTThreadPiece *icetThreadPiecesAllocate(IceTEnum pname,
+                                                 IceTInt num_pieces,
+                                                 IceTSizeType num_pixels,
+                                                 const IceTSparseImage out_image)
+{
+    IceTSizeType piece_pixels = (num_pixels + num_pieces - 1)/num_pieces;
+    IceTSizeType piece_buffer_size
+        = icetSparseImageBufferSizeType(
+                                   icetSparseImageGetColorFormat(out_image),
+                                   icetSparseImageGetDepthFormat(out_image),
+                                   piece_pixels,
+                                   1);
+    IceTThreadPiece *pieces;
+    IceTByte *piece_buffers;
+    IceTInt i;
+
+    pieces = icetGetStateBuffer(pname,
+                                  num_pieces*sizeof(IceTThreadPiece)
+                                + num_pieces*piece_buffer_size);
+    piece_buffers = (IceTByte *)(pieces + num_pieces);
+
+    for (i = 0; i < num_pieces; i++) {
+        IceTSizeType piece_count = MIN(piece_pixels, num_pixels - i*piece_pixels);
+        IceTInt *header;
+
+        pieces[i].buffer = piece_buffers + i*piece_buffer_size;
+        pieces[i].offset = i*piece_pixels;
+        header = (IceTInt *)pieces[i].buffer;
+        memcpy(header,
+               ICET_IMAGE_HEADER(out_image),
+               ICET_SPARSE_IMAGE_DATA_START_INDEX(out_image)*sizeof(IceTInt));
+        header[ICET_IMAGE_WIDTH_INDEX] = (IceTInt)piece_count;
+        header[ICET_IMAGE_HEIGHT_INDEX] = 1;
+        header[ICET_IMAGE_MAX_NUM_PIXELS_INDEX] = (IceTInt)piece_count;
+    }
+
+    return pieces;
+}
+
+/* Records the first and last run of a piece once its thread has written it.
+ * Safe to call from the thread that wrote the piece. */
+static void icetThreadPieceFindRuns(IceTThreadPiece *piece)
+{
+    IceTSparseImage image;
+    IceTSizeType pixel_size;
+    IceTByte *run_length;
+
+    image.opaque_internals = piece->buffer;
+    pixel_size = (  colorPixelSize(icetSparseImageGetColorFormat(image))
+                  + depthPixelSize(icetSparseImageGetDepthFormat(image)) );
+
+    piece->end = piece->buffer
+        + ICET_IMAGE_HEADER(image)[ICET_IMAGE_ACTUAL_BUFFER_SIZE_INDEX];
+    run_length = ICET_SPARSE_IMAGE_DATA(image);
+    piece->first_run_length = run_length;
+    piece->last_run_length = run_length;
+    while (run_length < piece->end) {
+        piece->last_run_length = run_length;
+        run_length += RUN_LENGTH_SIZE + ACTIVE_RUN_LENGTH(run_length)*pixel_size;
+    }
+}
+
+/* Concatenates the runs of the pieces into out_image.  The first run of each
+ * piece is merged into the last run before it wherever a single thread would
+ * have continued that run, that is if the run before has no active pixels or
+ * the piece starts with an active pixel.  The merged counts are written to the
+ * piece buffers, which are then copied to their final location in parallel. */
+static void icetThreadPiecesJoin(IceTThreadPiece *pieces,
+                                 IceTInt num_pieces,
+                                 IceTSparseImage out_image)
+{
+    IceTByte *out_data;
+    IceTVoid *open_run_length;
+    int i;
+
+    out_data = ICET_SPARSE_IMAGE_DATA(out_image);
+    open_run_length = NULL;
+    for (i = 0; i < num_pieces; i++) {
+        IceTByte *first_run_length = pieces[i].first_run_length;
+        pieces[i].skip = 0;
+        if (open_run_length != NULL) {
+            if (ACTIVE_RUN_LENGTH(open_run_length) == 0) {
+                INACTIVE_RUN_LENGTH(open_run_length)
+                    += INACTIVE_RUN_LENGTH(first_run_length);
+                ACTIVE_RUN_LENGTH(open_run_length)
+                    = ACTIVE_RUN_LENGTH(first_run_length);
+                pieces[i].skip = RUN_LENGTH_SIZE;
+            } else if (INACTIVE_RUN_LENGTH(first_run_length) == 0) {
+                ACTIVE_RUN_LENGTH(open_run_length)
+                    += ACTIVE_RUN_LENGTH(first_run_length);
+                pieces[i].skip = RUN_LENGTH_SIZE;
+            }
+        }
+        if (   (pieces[i].skip == 0)
+            || (pieces[i].last_run_length != first_run_length) ) {
+            open_run_length = pieces[i].last_run_length;
+        }
+
+        pieces[i].out = out_data;
+        out_data += (pieces[i].end - first_run_length) - pieces[i].skip;
+    }
+
+#pragma omp parallel for num_threads(num_pieces)
+    for (i = 0; i < num_pieces; i++) {
+        memcpy(pieces[i].out,
+               pieces[i].first_run_length + pieces[i].skip,
+               (pieces[i].end - pieces[i].first_run_length) - pieces[i].skip);
+    }
+
+    icetSparseImageSetActualSize(out_image, out_data);
+}
+
+static void icetCompressSubImageUntimed(const IceTImage image,
+                                        IceTSizeType offset,
+                                        IceTSizeType pixels,
+                                        IceTSparseImage compressed_image)
+{
+#define INPUT_IMAGE             image
+#define OUTPUT_SPARSE_IMAGE     compressed_image
+#define OFFSET                  offset
+#define PIXEL_COUNT             pixels
+#define UNTIMED
+#include "compress_func_body.h"
+}
+
+/* Compresses a range of pixels of a non-layered image with ICET_NUM_THREADS
+ * threads, each of which compresses a contiguous piece of the range.  The
+ * result is byte for byte the same as that of a serial compression.  Returns
+ * ICET_FALSE without touching compressed_image if the range should be
+ * compressed serially. */
+static IceTBoolean icetCompressSubImageThreaded(
+                                              const IceTImage image,
+                                              IceTSizeType offset,
+                                              IceTSizeType pixels,
+                                              IceTSparseImage compressed_image)
+{
+    IceTInt num_pieces;
+    IceTThreadPiece *pieces;
+    int i;
+
+    if (icetImageIsLayered(image) || icetSparseImageIsLayered(compressed_image)) {
+        return ICET_FALSE;
+    }
+
+    num_pieces = icetThreadPieceCount(pixels);
+    if (num_pieces < 2) return ICET_FALSE;
+
+    icetTimingCompressBegin();
+
+    pieces = icetThreadPiecesAllocate(ICET_THREAD_COMPRESS_BUF,
+                                      num_pieces,
+                                      pixels,
+                                      compressed_image);
+
+#pragma omp parallel for num_threads(num_pieces)
+    for (i = 0; i < num_pieces; i++) {
+        IceTSparseImage piece;
+        piece.opaque_internals = pieces[i].buffer;
+        icetCompressSubImageUntimed(image,
+                                    offset + pieces[i].offset,
+                                    icetSparseImageGetNumPixels(piece),
+                                    piece);
+        icetThreadPieceFindRuns(&pieces[i]);
+    }
+
+    icetThreadPiecesJoin(pieces, num_pieces, compressed_image);
+
+    icetTimingCompressEnd();
+
+    return ICET_TRUE;
+}
+#endif /*ICET_USE_OPENMP*/
+
 void icetCompressImage(const IceTImage image,
                        IceTSparseImage compressed_image)
 {
+    if (icetSparseImageIsBlocked(compressed_image)) {
+        /* Compress to runs and store them as blocks of the image's shape. */
+        IceTSparseImage runs
+            = icetSparseImageRunScratch(ICET_SPARSE_BLOCK_BUF_0,
+                                        compressed_image,
+                                        icetImageGetWidth(image),
+                                        icetImageGetHeight(image));
+        icetCompressImage(image, runs);
+        icetSparseBlockImageFromRuns(runs, compressed_image);
+        return;
+    }
+
     icetCompressSubImage(image, 0, icetImageGetNumPixels(image),
                          compressed_image);
 
@@ -3269,13 +6674,33 @@ void icetCompressSubImage(const IceTImage image,
     ICET_TEST_IMAGE_HEADER(image);
     ICET_TEST_SPARSE_IMAGE_HEADER(compressed_image);
 
+    if (icetSparseImageIsBlocked(compressed_image)) {
+        IceTSparseImage runs
+            = icetSparseImageRunScratch(ICET_SPARSE_BLOCK_BUF_0,
+                                        compressed_image,
+                                        pixels,
+                                        1);
+        icetCompressSubImage(image, offset, pixels, runs);
+        icetSparseBlockImageFromRuns(runs, compressed_image);
+        return;
+    }
+
     icetSparseImageSetDimensions(compressed_image, pixels, 1);
 
+#ifdef ICET_USE_OPENMP
+    if (icetCompressSubImageThreaded(image, offset, pixels, compressed_image)) {
+        icetSparseImageBuildIndex(compressed_image);
+        return;
+    }
+#endif
+
 #define INPUT_IMAGE             image
 #define OUTPUT_SPARSE_IMAGE     compressed_image
 #define OFFSET                  offset
 #define PIXEL_COUNT             pixels
 #include "compress_func_body.h"
+
+    icetSparseImageBuildIndex(compressed_image);
 }
 
 void icetCompressImageRegion(const IceTImage source_image,
@@ -3287,11 +6712,42 @@ void icetCompressImageRegion(const IceTImage source_image,
 {
     IceTSizeType space_left, space_right, space_bottom, space_top;
 
+    if (icetSparseImageIsBlocked(compressed_image)) {
+        IceTSparseImage runs
+            = icetSparseImageRunScratch(ICET_SPARSE_BLOCK_BUF_0,
+                                        compressed_image,
+                                        width,
+                                        height);
+        icetCompressImageRegion(source_image,
+                                source_viewport,
+                                target_viewport,
+                                width,
+                                height,
+                                runs);
+        icetSparseBlockImageFromRuns(runs, compressed_image);
+        return;
+    }
+
     space_left = target_viewport[0];
     space_right = width - target_viewport[2] - space_left;
     space_bottom = target_viewport[1];
     space_top = height - target_viewport[3] - space_bottom;
 
+#ifdef ICET_USE_OPENMP
+    /* Without padding, a region spanning whole rows is a contiguous range. */
+    if (   (space_left == 0) && (space_right == 0)
+        && (space_bottom == 0) && (space_top == 0)
+        && (source_viewport[0] == 0)
+        && (source_viewport[2] == icetImageGetWidth(source_image))
+        && icetCompressSubImageThreaded(source_image,
+                                        source_viewport[1]*source_viewport[2],
+                                        source_viewport[2]*source_viewport[3],
+                                        compressed_image) ) {
+        icetSparseImageBuildIndex(compressed_image);
+        return;
+    }
+#endif
+
 #define INPUT_IMAGE             source_image
 #define OUTPUT_SPARSE_IMAGE     compressed_image
 #define PADDING
@@ -3307,6 +6763,8 @@ void icetCompressImageRegion(const IceTImage source_image,
 #define REGION_WIDTH            source_viewport[2]
 #define REGION_HEIGHT           source_viewport[3]
 #include "compress_func_body.h"
+
+    icetSparseImageBuildIndex(compressed_image);
 }
 
 void icetDecompressImage(const IceTSparseImage compressed_image,
@@ -3323,6 +6781,14 @@ void icetDecompressSubImage(const IceTSparseImage compressed_image,
                             IceTSizeType offset,
                             IceTImage image)
 {
+    if (icetSparseImageIsBlocked(compressed_image)) {
+        icetDecompressSubImage(
+            icetSparseBlockImageToRuns(compressed_image, ICET_SPARSE_BLOCK_BUF_0),
+            offset,
+            image);
+        return;
+    }
+
     ICET_TEST_IMAGE_HEADER(image);
     ICET_TEST_SPARSE_IMAGE_HEADER(compressed_image);
 
@@ -3351,6 +6817,14 @@ void icetDecompressSubImageCorrectBackground(
 {
     IceTBoolean need_correction;
 
+    if (icetSparseImageIsBlocked(compressed_image)) {
+        icetDecompressSubImageCorrectBackground(
+            icetSparseBlockImageToRuns(compressed_image, ICET_SPARSE_BLOCK_BUF_0),
+            offset,
+            image);
+        return;
+    }
+
     icetGetBooleanv(ICET_NEED_BACKGROUND_CORRECTION, &need_correction);
     if (!need_correction) {
         /* Do a normal decompress. */
@@ -3369,6 +6843,182 @@ void icetDecompressSubImageCorrectBackground(
 #include "decompress_func_body.h"
 }
 
+/* The following kernels composite runs of contiguous non-layered pixels.  They
+ * have no branches so that compilers can vectorize them.  The depth kernels
+ * pick the front pixel with a bit mask, which copies the same bits as
+ * assigning it.  The blend kernels compute the same values as
+ * ICET_BLEND_UBYTE, ICET_BLEND_FLOAT and ICET_BLEND_HALF.  Colors are handled
+ * as 32-bit words, so float and half colors are passed as IceTUInt to the
+ * depth kernels. */
+#define ICET_SELECT_MASK(condition)     (0u - (IceTUInt)(condition))
+#define ICET_SELECT(mask, a, b)         (((a) & (mask)) | ((b) & ~(mask)))
+
+/* Keeps the src pixel wherever it is in front of the dest pixel.  The colors
+ * and depths of each image are stored in separate buffers. */
+static void icetZCompositeRunub(const IceTUInt *src_color,
+                                const IceTFloat *src_depth,
+                                IceTUInt *dest_color,
+                                IceTFloat *dest_depth,
+                                IceTSizeType count)
+{
+    IceTSizeType i;
+    for (i = 0; i < count; i++) {
+        IceTUInt mask = ICET_SELECT_MASK(src_depth[i] < dest_depth[i]);
+        dest_color[i] = ICET_SELECT(mask, src_color[i], dest_color[i]);
+        dest_depth[i] =
+            (src_depth[i] < dest_depth[i]) ? src_depth[i] : dest_depth[i];
+    }
+}
+
+static void icetZCompositeRunf(const IceTUInt *src_color,
+                               const IceTFloat *src_depth,
+                               IceTUInt *dest_color,
+                               IceTFloat *dest_depth,
+                               IceTSizeType count)
+{
+    IceTSizeType i;
+    for (i = 0; i < count; i++) {
+        const IceTUInt *src = src_color + 4*i;
+        IceTUInt *dest = dest_color + 4*i;
+        IceTUInt mask = ICET_SELECT_MASK(src_depth[i] < dest_depth[i]);
+        dest[0] = ICET_SELECT(mask, src[0], dest[0]);
+        dest[1] = ICET_SELECT(mask, src[1], dest[1]);
+        dest[2] = ICET_SELECT(mask, src[2], dest[2]);
+        dest[3] = ICET_SELECT(mask, src[3], dest[3]);
+        dest_depth[i] =
+            (src_depth[i] < dest_depth[i]) ? src_depth[i] : dest_depth[i];
+    }
+}
+
+/* Half precision colors are handled as two 32-bit words per pixel. */
+static void icetZCompositeRunh(const IceTUInt *src_color,
+                               const IceTFloat *src_depth,
+                               IceTUInt *dest_color,
+                               IceTFloat *dest_depth,
+                               IceTSizeType count)
+{
+    IceTSizeType i;
+    for (i = 0; i < count; i++) {
+        const IceTUInt *src = src_color + 2*i;
+        IceTUInt *dest = dest_color + 2*i;
+        IceTUInt mask = ICET_SELECT_MASK(src_depth[i] < dest_depth[i]);
+        dest[0] = ICET_SELECT(mask, src[0], dest[0]);
+        dest[1] = ICET_SELECT(mask, src[1], dest[1]);
+        dest_depth[i] =
+            (src_depth[i] < dest_depth[i]) ? src_depth[i] : dest_depth[i];
+    }
+}
+
+/* Writes the front of the src1 and src2 pixels to dest.  Each pixel is a
+ * color followed by a depth as stored in sparse images. */
+static void icetZCompositeSparseRunub(const IceTUInt *src1,
+                                      const IceTUInt *src2,
+                                      IceTUInt *dest,
+                                      IceTSizeType count)
+{
+    const IceTFloat *src1_depth = (const IceTFloat *)src1 + 1;
+    const IceTFloat *src2_depth = (const IceTFloat *)src2 + 1;
+    IceTSizeType i;
+    for (i = 0; i < count; i++) {
+        IceTUInt mask = ICET_SELECT_MASK(src1_depth[2*i] < src2_depth[2*i]);
+        dest[2*i+0] = ICET_SELECT(mask, src1[2*i+0], src2[2*i+0]);
+        dest[2*i+1] = ICET_SELECT(mask, src1[2*i+1], src2[2*i+1]);
+    }
+}
+
+static void icetZCompositeSparseRunf(const IceTUInt *src1,
+                                     const IceTUInt *src2,
+                                     IceTUInt *dest,
+                                     IceTSizeType count)
+{
+    const IceTFloat *src1_depth = (const IceTFloat *)src1 + 4;
+    const IceTFloat *src2_depth = (const IceTFloat *)src2 + 4;
+    IceTSizeType i;
+    for (i = 0; i < count; i++) {
+        IceTUInt mask = ICET_SELECT_MASK(src1_depth[5*i] < src2_depth[5*i]);
+        dest[5*i+0] = ICET_SELECT(mask, src1[5*i+0], src2[5*i+0]);
+        dest[5*i+1] = ICET_SELECT(mask, src1[5*i+1], src2[5*i+1]);
+        dest[5*i+2] = ICET_SELECT(mask, src1[5*i+2], src2[5*i+2]);
+        dest[5*i+3] = ICET_SELECT(mask, src1[5*i+3], src2[5*i+3]);
+        dest[5*i+4] = ICET_SELECT(mask, src1[5*i+4], src2[5*i+4]);
+    }
+}
+
+static void icetZCompositeSparseRunh(const IceTUInt *src1,
+                                     const IceTUInt *src2,
+                                     IceTUInt *dest,
+                                     IceTSizeType count)
+{
+    const IceTFloat *src1_depth = (const IceTFloat *)src1 + 2;
+    const IceTFloat *src2_depth = (const IceTFloat *)src2 + 2;
+    IceTSizeType i;
+    for (i = 0; i < count; i++) {
+        IceTUInt mask = ICET_SELECT_MASK(src1_depth[3*i] < src2_depth[3*i]);
+        dest[3*i+0] = ICET_SELECT(mask, src1[3*i+0], src2[3*i+0]);
+        dest[3*i+1] = ICET_SELECT(mask, src1[3*i+1], src2[3*i+1]);
+        dest[3*i+2] = ICET_SELECT(mask, src1[3*i+2], src2[3*i+2]);
+    }
+}
+
+#undef ICET_SELECT_MASK
+#undef ICET_SELECT
+
+/* Blends front over back into dest, which may be the same as either.  The
+ * channels of a pixel are blended two at a time in the 16-bit halves of a
+ * word.  The product of a channel and a factor fits in 16 bits, and dividing
+ * it by 255 is exact as (x + 1 + (x >> 8)) >> 8.  Sums are masked to 8 bits
+ * per channel, which wraps them like the conversion in ICET_BLEND_UBYTE. */
+#define ICET_CHANNEL_PAIRS      0x00FF00FFu
+#define ICET_DIVIDE_CHANNEL_PAIRS_255(x)                                       \
+    ((((x) + 0x00010001u + (((x) >> 8) & ICET_CHANNEL_PAIRS)) >> 8)            \
+     & ICET_CHANNEL_PAIRS)
+#define ICET_BLEND_CHANNEL_PAIRS(front, back, afactor)                         \
+    ((ICET_DIVIDE_CHANNEL_PAIRS_255((back)*(afactor)) + (front))               \
+     & ICET_CHANNEL_PAIRS)
+static void icetBlendRunub(const IceTUInt *front,
+                           const IceTUInt *back,
+                           IceTUInt *dest,
+                           IceTSizeType count)
+{
+    IceTSizeType i;
+    for (i = 0; i < count; i++) {
+        IceTUInt afactor = 255 - ((const IceTUByte *)(front + i))[3];
+        IceTUInt even_channels =
+            ICET_BLEND_CHANNEL_PAIRS(front[i] & ICET_CHANNEL_PAIRS,
+                                     back[i] & ICET_CHANNEL_PAIRS,
+                                     afactor);
+        IceTUInt odd_channels =
+            ICET_BLEND_CHANNEL_PAIRS((front[i] >> 8) & ICET_CHANNEL_PAIRS,
+                                     (back[i] >> 8) & ICET_CHANNEL_PAIRS,
+                                     afactor);
+        dest[i] = even_channels | (odd_channels << 8);
+    }
+}
+#undef ICET_DIVIDE_CHANNEL_PAIRS_255
+#undef ICET_BLEND_CHANNEL_PAIRS
+#undef ICET_CHANNEL_PAIRS
+
+static void icetBlendRunf(const IceTFloat *front,
+                          const IceTFloat *back,
+                          IceTFloat *dest,
+                          IceTSizeType count)
+{
+    IceTSizeType i;
+    for (i = 0; i < count; i++) {
+        ICET_BLEND_FLOAT(front + 4*i, back + 4*i, dest + 4*i);
+    }
+}
+
+static void icetBlendRunh(const IceTUShort *front,
+                          const IceTUShort *back,
+                          IceTUShort *dest,
+                          IceTSizeType count)
+{
+    IceTSizeType i;
+    for (i = 0; i < count; i++) {
+        ICET_BLEND_HALF(front + 4*i, back + 4*i, dest + 4*i);
+    }
+}
 
 void icetComposite(IceTImage destBuffer, const IceTImage srcBuffer,
                    int srcOnTop)
@@ -3414,24 +7064,25 @@ void icetComposite(IceTImage destBuffer, const IceTImage srcBuffer,
             if (color_format == ICET_IMAGE_COLOR_RGBA_UBYTE) {
                 const IceTUInt *srcColorBuffer=icetImageGetColorui(srcBuffer);
                 IceTUInt *destColorBuffer = icetImageGetColorui(destBuffer);
-                for (i = 0; i < pixels; i++) {
-                    if (srcDepthBuffer[i] < destDepthBuffer[i]) {
-                        destDepthBuffer[i] = srcDepthBuffer[i];
-                        destColorBuffer[i] = srcColorBuffer[i];
-                    }
-                }
+                icetZCompositeRunub(srcColorBuffer, srcDepthBuffer,
+                                    destColorBuffer, destDepthBuffer,
+                                    pixels);
             } else if (color_format == ICET_IMAGE_COLOR_RGBA_FLOAT) {
                 const IceTFloat *srcColorBuffer = icetImageGetColorf(srcBuffer);
                 IceTFloat *destColorBuffer = icetImageGetColorf(destBuffer);
-                for (i = 0; i < pixels; i++) {
-                    if (srcDepthBuffer[i] < destDepthBuffer[i]) {
-                        destDepthBuffer[i] = srcDepthBuffer[i];
-                        destColorBuffer[4*i+0] = srcColorBuffer[4*i+0];
-                        destColorBuffer[4*i+1] = srcColorBuffer[4*i+1];
-                        destColorBuffer[4*i+2] = srcColorBuffer[4*i+2];
-                        destColorBuffer[4*i+3] = srcColorBuffer[4*i+3];
-                    }
-                }
+                icetZCompositeRunf((const IceTUInt *)srcColorBuffer,
+                                   srcDepthBuffer,
+                                   (IceTUInt *)destColorBuffer,
+                                   destDepthBuffer,
+                                   pixels);
+            } else if (color_format == ICET_IMAGE_COLOR_RGBA_HALF) {
+                const IceTUInt *srcColorBuffer =
+                    icetImageGetColorConstVoid(srcBuffer, NULL);
+                IceTUInt *destColorBuffer =
+                    icetImageGetColorVoid(destBuffer, NULL);
+                icetZCompositeRunh(srcColorBuffer, srcDepthBuffer,
+                                   destColorBuffer, destDepthBuffer,
+                                   pixels);
             } else if (color_format == ICET_IMAGE_COLOR_RGB_FLOAT) {
                 const IceTFloat *srcColorBuffer = icetImageGetColorf(srcBuffer);
                 IceTFloat *destColorBuffer = icetImageGetColorf(destBuffer);
@@ -3470,32 +7121,36 @@ void icetComposite(IceTImage destBuffer, const IceTImage srcBuffer,
                              " operation.  Output z buffer meaningless.");
         }
         if (color_format == ICET_IMAGE_COLOR_RGBA_UBYTE) {
-            const IceTUByte *srcColorBuffer = icetImageGetColorcub(srcBuffer);
-            IceTUByte *destColorBuffer = icetImageGetColorub(destBuffer);
+            const IceTUInt *srcColorBuffer = icetImageGetColorcui(srcBuffer);
+            IceTUInt *destColorBuffer = icetImageGetColorui(destBuffer);
             if (srcOnTop) {
-                for (i = 0; i < pixels; i++) {
-                    ICET_OVER_UBYTE(srcColorBuffer + i*4,
-                                    destColorBuffer + i*4);
-                }
+                icetBlendRunub(srcColorBuffer, destColorBuffer,
+                               destColorBuffer, pixels);
             } else {
-                for (i = 0; i < pixels; i++) {
-                    ICET_UNDER_UBYTE(srcColorBuffer + i*4,
-                                     destColorBuffer + i*4);
-                }
+                icetBlendRunub(destColorBuffer, srcColorBuffer,
+                               destColorBuffer, pixels);
             }
         } else if (color_format == ICET_IMAGE_COLOR_RGBA_FLOAT) {
             const IceTFloat *srcColorBuffer = icetImageGetColorcf(srcBuffer);
             IceTFloat *destColorBuffer = icetImageGetColorf(destBuffer);
             if (srcOnTop) {
-                for (i = 0; i < pixels; i++) {
-                    ICET_OVER_FLOAT(srcColorBuffer + i*4,
-                                    destColorBuffer + i*4);
-                }
+                icetBlendRunf(srcColorBuffer, destColorBuffer,
+                              destColorBuffer, pixels);
             } else {
-                for (i = 0; i < pixels; i++) {
-                    ICET_UNDER_FLOAT(srcColorBuffer + i*4,
-                                     destColorBuffer + i*4);
-                }
+                icetBlendRunf(destColorBuffer, srcColorBuffer,
+                              destColorBuffer, pixels);
+            }
+        } else if (color_format == ICET_IMAGE_COLOR_RGBA_HALF) {
+            const IceTUShort *srcColorBuffer =
+                icetImageGetColorConstVoid(srcBuffer, NULL);
+            IceTUShort *destColorBuffer =
+                icetImageGetColorVoid(destBuffer, NULL);
+            if (srcOnTop) {
+                icetBlendRunh(srcColorBuffer, destColorBuffer,
+                              destColorBuffer, pixels);
+            } else {
+                icetBlendRunh(destColorBuffer, srcColorBuffer,
+                              destColorBuffer, pixels);
             }
         } else if (color_format == ICET_IMAGE_COLOR_RGB_FLOAT) {
             const IceTFloat *srcColorBuffer = icetImageGetColorf(srcBuffer);
@@ -3544,6 +7199,15 @@ void icetCompressedSubComposite(IceTImage destBuffer,
                                 const IceTSparseImage srcBuffer,
                                 int srcOnTop)
 {
+    if (icetSparseImageIsBlocked(srcBuffer)) {
+        icetCompressedSubComposite(
+            destBuffer,
+            offset,
+            icetSparseBlockImageToRuns(srcBuffer, ICET_SPARSE_BLOCK_BUF_0),
+            srcOnTop);
+        return;
+    }
+
     icetTimingBlendBegin();
 
     if (srcOnTop) {
@@ -3554,6 +7218,7 @@ void icetCompressedSubComposite(IceTImage destBuffer,
 #define COMPOSITE
 #define BLEND_RGBA_UBYTE        ICET_OVER_UBYTE
 #define BLEND_RGBA_FLOAT        ICET_OVER_FLOAT
+#define BLEND_RGBA_HALF         ICET_OVER_HALF
 #include "decompress_func_body.h"
     } else {
 #define INPUT_SPARSE_IMAGE      srcBuffer
@@ -3563,12 +7228,153 @@ void icetCompressedSubComposite(IceTImage destBuffer,
 #define COMPOSITE
 #define BLEND_RGBA_UBYTE        ICET_UNDER_UBYTE
 #define BLEND_RGBA_FLOAT        ICET_UNDER_FLOAT
+#define BLEND_RGBA_HALF         ICET_UNDER_HALF
 #include "decompress_func_body.h"
     }
 
     icetTimingBlendEnd();
 }
 
+#ifdef ICET_USE_OPENMP
+/* A position within the runs of a non-layered sparse image, in the form kept by
+ * cc_composite_template_body.h while it walks an image.  data points either to
+ * the next active pixel or, if there is none left in the run, to the next run
+ * length. */
+typedef struct IceTRunLengthCursor {
+    const IceTByte *data;
+    IceTSizeType num_inactive;
+    IceTSizeType num_active;
+} IceTRunLengthCursor;
+
+/* Fills cursors with the positions of the first pixel of each piece in a
+ * non-layered sparse image.  Only the run lengths are read, skipping the active
+ * pixels.  Returns ICET_FALSE if the image ends before the last piece. */
+static IceTBoolean icetSparseImageFindCursors(const IceTSparseImage image,
+                                              const IceTThreadPiece *pieces,
+                                              IceTInt num_pieces,
+                                              IceTRunLengthCursor *cursors)
+{
+    IceTSizeType pixel_size
+        = (  colorPixelSize(icetSparseImageGetColorFormat(image))
+           + depthPixelSize(icetSparseImageGetDepthFormat(image)) );
+    const IceTByte *run_length = ICET_SPARSE_IMAGE_DATA(image);
+    const IceTByte *end = (const IceTByte *)ICET_IMAGE_HEADER(image)
+        + icetSparseImageGetCompressedBufferSize(image);
+    IceTSizeType run_start = 0;
+    IceTInt i;
+
+    if (run_length >= end) return ICET_FALSE;
+
+    for (i = 0; i < num_pieces; i++) {
+        IceTSizeType pixel = pieces[i].offset;
+        IceTSizeType num_inactive;
+        IceTSizeType num_active;
+
+        /* Skip the runs that end before the pixel. */
+        while (run_start + (IceTSizeType)INACTIVE_RUN_LENGTH(run_length)
+                         + (IceTSizeType)ACTIVE_RUN_LENGTH(run_length)
+               <= pixel) {
+            run_start += INACTIVE_RUN_LENGTH(run_length);
+            run_start += ACTIVE_RUN_LENGTH(run_length);
+            run_length += RUN_LENGTH_SIZE
+                + ACTIVE_RUN_LENGTH(run_length)*pixel_size;
+            if (run_length >= end) return ICET_FALSE;
+        }
+
+        num_inactive = INACTIVE_RUN_LENGTH(run_length);
+        num_active = ACTIVE_RUN_LENGTH(run_length);
+        if (pixel < run_start + num_inactive) {
+            cursors[i].data = run_length + RUN_LENGTH_SIZE;
+            cursors[i].num_inactive = run_start + num_inactive - pixel;
+            cursors[i].num_active = num_active;
+        } else {
+            IceTSizeType skipped = pixel - run_start - num_inactive;
+            cursors[i].data = run_length + RUN_LENGTH_SIZE + skipped*pixel_size;
+            cursors[i].num_inactive = 0;
+            cursors[i].num_active = num_active - skipped;
+        }
+    }
+
+    return ICET_TRUE;
+}
+
+/* Composites two non-layered sparse images with ICET_NUM_THREADS threads.  The
+ * run lengths of both inputs are scanned for the positions of the same pixels,
+ * which split the images into pieces that are composited on separate threads
+ * and then concatenated.  Returns ICET_FALSE if the images should be
+ * composited serially. */
+static IceTBoolean icetCompressedCompressedCompositeThreaded(
+                                               const IceTSparseImage front_buffer,
+                                               const IceTSparseImage back_buffer,
+                                               IceTSparseImage dest_buffer)
+{
+    IceTSizeType num_pixels = icetSparseImageGetNumPixels(front_buffer);
+    IceTEnum color_format = icetSparseImageGetColorFormat(front_buffer);
+    IceTEnum depth_format = icetSparseImageGetDepthFormat(front_buffer);
+    IceTInt num_pieces;
+    IceTThreadPiece *pieces;
+    IceTRunLengthCursor *cursors;
+    int i;
+
+    /* Leave mismatched images to the serial path, which reports them. */
+    if (   icetSparseImageIsLayered(front_buffer)
+        || icetSparseImageIsLayered(back_buffer)
+        || icetSparseImageIsLayered(dest_buffer)
+        || icetSparseImageIsBlocked(front_buffer)
+        || icetSparseImageIsBlocked(back_buffer)
+        || (num_pixels != icetSparseImageGetNumPixels(back_buffer))
+        || (color_format != icetSparseImageGetColorFormat(back_buffer))
+        || (color_format != icetSparseImageGetColorFormat(dest_buffer))
+        || (depth_format != icetSparseImageGetDepthFormat(back_buffer))
+        || (depth_format != icetSparseImageGetDepthFormat(dest_buffer)) ) {
+        return ICET_FALSE;
+    }
+
+    num_pieces = icetThreadPieceCount(num_pixels);
+    if (num_pieces < 2) return ICET_FALSE;
+
+    icetSparseImageSetBlocked(dest_buffer, ICET_FALSE);
+    icetSparseImageSetDimensions(dest_buffer,
+                                 icetSparseImageGetWidth(front_buffer),
+                                 icetSparseImageGetHeight(back_buffer));
+    pieces = icetThreadPiecesAllocate(ICET_THREAD_COMPOSITE_BUF,
+                                      num_pieces,
+                                      num_pixels,
+                                      dest_buffer);
+    cursors = icetGetStateBuffer(ICET_THREAD_CURSOR_BUF,
+                                 2*num_pieces*sizeof(IceTRunLengthCursor));
+    if (   !icetSparseImageFindCursors(front_buffer, pieces, num_pieces,
+                                       cursors)
+        || !icetSparseImageFindCursors(back_buffer, pieces, num_pieces,
+                                       cursors + num_pieces) ) {
+        return ICET_FALSE;
+    }
+
+#pragma omp parallel for num_threads(num_pieces)
+    for (i = 0; i < num_pieces; i++) {
+        IceTSparseImage piece;
+        IceTRunLengthCursor front_start = cursors[i];
+        IceTRunLengthCursor back_start = cursors[num_pieces + i];
+        IceTSizeType piece_pixels;
+
+        piece.opaque_internals = pieces[i].buffer;
+        piece_pixels = icetSparseImageGetNumPixels(piece);
+#define FRONT_SPARSE_IMAGE front_buffer
+#define BACK_SPARSE_IMAGE back_buffer
+#define DEST_SPARSE_IMAGE piece
+#define FRONT_START front_start
+#define BACK_START back_start
+#define PIXEL_COUNT piece_pixels
+#include "cc_composite_func_body.h"
+        icetThreadPieceFindRuns(&pieces[i]);
+    }
+
+    icetThreadPiecesJoin(pieces, num_pieces, dest_buffer);
+
+    return ICET_TRUE;
+}
+#endif /*ICET_USE_OPENMP*/
+
 void icetCompressedCompressedComposite(const IceTSparseImage front_buffer,
                                        const IceTSparseImage back_buffer,
                                        IceTSparseImage dest_buffer)
@@ -3581,12 +7387,36 @@ void icetCompressedCompressedComposite(const IceTSparseImage front_buffer,
                        " compressed-compressed composite.");
     }
 
+    if (   icetSparseImageIsBlocked(front_buffer)
+        && icetSparseImageIsBlocked(back_buffer)
+        && (   icetSparseImageGetNumPixels(front_buffer)
+            == icetSparseImageGetNumPixels(back_buffer) )
+        && (   icetSparseImageGetWidth(front_buffer)
+            != icetSparseImageGetWidth(back_buffer) ) ) {
+        /* Blocks of images with different shapes hold different pixels. */
+        icetCompressedCompressedComposite(
+            front_buffer,
+            icetSparseBlockImageReshape(back_buffer,
+                                        icetSparseImageGetWidth(front_buffer),
+                                        icetSparseImageGetHeight(front_buffer)),
+            dest_buffer);
+        return;
+    }
+
     icetTimingBlendBegin();
 
+#ifdef ICET_USE_OPENMP
+    if (!icetCompressedCompressedCompositeThreaded(front_buffer,
+                                                   back_buffer,
+                                                   dest_buffer))
+#endif
+    {
 #define FRONT_SPARSE_IMAGE front_buffer
 #define BACK_SPARSE_IMAGE back_buffer
 #define DEST_SPARSE_IMAGE dest_buffer
 #include "cc_composite_func_body.h"
+    }
+    icetSparseImageMergeContributors(front_buffer, back_buffer, dest_buffer);
 
     icetTimingBlendEnd();
 }
@@ -3599,20 +7429,73 @@ IceTSparseImage icetCompressedCompressedCompositeAlloc(
     IceTVoid *dest_buffer;
     IceTSparseImage dest_image;
 
-    /* The largest possible image is one where the active pixels sets of the
-     * input images are disjoint. */
-    IceTSizeType dest_image_size =
-          icetSparseImageGetCompressedBufferSize(front_image)
-        + icetSparseImageGetCompressedBufferSize(back_image);
+    IceTSizeType front_size =
+        icetSparseImageGetCompressedBufferSize(front_image);
+    IceTSizeType back_size =
+        icetSparseImageGetCompressedBufferSize(back_image);
+    IceTSizeType dest_image_size;
+    IceTSizeType dest_count_size = 0;
+    IceTSizeType dest_height = icetSparseImageGetHeight(back_image);
 
     IceTBoolean is_layered = icetSparseImageIsLayered(front_image);
 
+    if (is_layered) {
+        /* Layered images with a single fragment per pixel are promoted to the
+         * general layered format, and ones with narrower fragment counts than
+         * the result are widened.  Both store more data per pixel. */
+        dest_count_size = icetSparseImageMergedLayerCountSize(front_image,
+                                                              back_image);
+        front_size = icetSparseLayeredImageConvertedBufferSize(front_image,
+                                                               dest_count_size);
+        back_size = icetSparseLayeredImageConvertedBufferSize(back_image,
+                                                              dest_count_size);
+    }
+
+    if (   icetSparseImageIsBlocked(back_image)
+        && (   icetSparseImageGetWidth(front_image)
+            != icetSparseImageGetWidth(back_image) ) ) {
+        /* The back image is reshaped to the blocks of the front image. */
+        back_size += icetSparseBlockImageOverhead(
+                                          icetSparseImageGetWidth(front_image),
+                                          icetSparseImageGetHeight(front_image));
+        dest_height = icetSparseImageGetHeight(front_image);
+    }
+
+    /* The largest possible image is one where the active pixels sets of the
+     * input images are disjoint. */
+    dest_image_size = front_size + back_size;
+
     if (! is_layered) {
         /* For flat images, overlapping active pixels are blended immediately,
          * so the images' extent can give a tighter upper bound. */
-        dest_image_size = MIN(dest_image_size, icetSparseImageBufferSize(
-                                        icetSparseImageGetWidth(front_image),
-                                        icetSparseImageGetHeight(front_image)));
+        IceTSizeType bound = icetSparseImageBufferSize(
+                                         icetSparseImageGetWidth(front_image),
+                                         icetSparseImageGetHeight(front_image));
+        if (   icetSparseImageIsBlocked(front_image)
+            && !icetIsEnabled(ICET_BLOCK_SPARSE_IMAGES) ) {
+            /* Blocks need their masks even if new images are not blocked. */
+            bound += icetSparseBlockImageOverhead(
+                                          icetSparseImageGetWidth(front_image),
+                                          icetSparseImageGetHeight(front_image));
+        }
+        dest_image_size = MIN(dest_image_size, bound);
+    } else {
+        /* Compression and compositing never produce more fragments per pixel
+         * than ICET_MAX_FRAGMENTS_PER_PIXEL, which bounds the size of layered
+         * images regardless of the number of merged images. */
+        IceTInt max_fragments;
+        icetGetIntegerv(ICET_MAX_FRAGMENTS_PER_PIXEL, &max_fragments);
+        if (   (max_fragments > 0)
+            && (   dest_count_size
+                <= icetLayerCountSizeForLayers((IceTLayerCount)max_fragments))) {
+            dest_image_size = MIN(dest_image_size,
+                                  icetSparseLayeredImageBufferSizeType(
+                                      icetSparseImageGetColorFormat(front_image),
+                                      icetSparseImageGetDepthFormat(front_image),
+                                      icetSparseImageGetWidth(front_image),
+                                      icetSparseImageGetHeight(front_image),
+                                      (IceTLayerCount)max_fragments));
+        }
     }
 
     /* Initialize the result image in a newly allocated buffer. */
@@ -3621,10 +7504,10 @@ IceTSparseImage icetCompressedCompressedCompositeAlloc(
             ? icetSparseLayeredImageAssignBuffer(
                                            dest_buffer,
                                            icetSparseImageGetWidth(front_image),
-                                           icetSparseImageGetHeight(back_image))
+                                           dest_height)
             : icetSparseImageAssignBuffer(dest_buffer,
                                           icetSparseImageGetWidth(front_image),
-                                          icetSparseImageGetHeight(back_image));
+                                          dest_height);
 
     /* Composite into the newly created image. */
     icetCompressedCompressedComposite(front_image, back_image, dest_image);
@@ -3680,6 +7563,21 @@ void icetImageCorrectBackground(IceTImage image)
             ICET_UNDER_FLOAT(background_color, color);
             color += 4;
         }
+    } else if (color_format == ICET_IMAGE_COLOR_RGBA_HALF) {
+        IceTUShort *color = icetImageGetColorVoid(image, NULL);
+        IceTFloat background_color_f[4];
+        IceTUShort background_color[4];
+        IceTSizeType p;
+
+        icetGetFloatv(ICET_TRUE_BACKGROUND_COLOR, background_color_f);
+        for (p = 0; p < 4; p++) {
+            background_color[p] = icetFloatToHalf(background_color_f[p]);
+        }
+
+        for (p = 0; p < num_fragments; p++) {
+            ICET_UNDER_HALF(background_color, color);
+            color += 4;
+        }
     } else if (color_format == ICET_IMAGE_COLOR_RGB_FLOAT) {
       /* Nothing to fix. */
     } else {
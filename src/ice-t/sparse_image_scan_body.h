@@ -93,11 +93,12 @@
             icetSparseLayeredImageScanFragments(&data,
                                                 pixels_left,
                                                 fragment_size,
+                                                count_size,
                                                 &frag_count);
             count = pixels_left;
         }
 
-        num_bytes = count*sizeof(IceTLayerCount) + frag_count*fragment_size;
+        num_bytes = count*count_size + frag_count*fragment_size;
 #else
         count = MIN(active_till_next_runl, pixels_left);
         num_bytes = count*pixel_size;
@@ -188,6 +188,50 @@ void icetStateSetDefaults(void)
         icetStateSetInteger(ICET_MAX_IMAGE_SPLIT, ICET_MAX_IMAGE_SPLIT_DEFAULT);
     }
 
+    if (icetGetEnv("ICET_LAYERED_OPACITY_CUTOFF", env_buffer, ENV_BUFFER_LEN)) {
+        IceTFloat opacity_cutoff = (IceTFloat)atof(env_buffer);
+        if ((opacity_cutoff >= 0.0f) && (opacity_cutoff <= 1.0f)) {
+            icetStateSetFloat(ICET_LAYERED_OPACITY_CUTOFF, opacity_cutoff);
+        } else {
+            icetRaiseError(ICET_INVALID_VALUE,
+                           "Environment variable ICET_LAYERED_OPACITY_CUTOFF"
+                           " must be set to a number between 0 and 1.");
+            icetStateSetFloat(ICET_LAYERED_OPACITY_CUTOFF, 0.0f);
+        }
+    } else {
+        icetStateSetFloat(ICET_LAYERED_OPACITY_CUTOFF, 0.0f);
+    }
+
+    if (icetGetEnv("ICET_MAX_FRAGMENTS_PER_PIXEL", env_buffer, ENV_BUFFER_LEN)) {
+        IceTInt max_fragments = atoi(env_buffer);
+        if (max_fragments >= 0) {
+            icetStateSetInteger(ICET_MAX_FRAGMENTS_PER_PIXEL, max_fragments);
+        } else {
+            icetRaiseError(ICET_INVALID_VALUE,
+                           "Environment variable ICET_MAX_FRAGMENTS_PER_PIXEL"
+                           " must be set to a non-negative integer.");
+            icetStateSetInteger(ICET_MAX_FRAGMENTS_PER_PIXEL, 0);
+        }
+    } else {
+        icetStateSetInteger(ICET_MAX_FRAGMENTS_PER_PIXEL, 0);
+    }
+
+    icetStateSetInteger(ICET_WIRE_CODEC, ICET_WIRE_CODEC_NONE);
+
+    if (icetGetEnv("ICET_NUM_THREADS", env_buffer, ENV_BUFFER_LEN)) {
+        IceTInt num_threads = atoi(env_buffer);
+        if (num_threads > 0) {
+            icetStateSetInteger(ICET_NUM_THREADS, num_threads);
+        } else {
+            icetRaiseError(ICET_INVALID_VALUE,
+                           "Environment variable ICET_NUM_THREADS must be"
+                           " set to an integer greater than 0.");
+            icetStateSetInteger(ICET_NUM_THREADS, 1);
+        }
+    } else {
+        icetStateSetInteger(ICET_NUM_THREADS, 1);
+    }
+
     icetStateSetPointer(ICET_DRAW_FUNCTION, NULL);
     icetStateSetPointer(ICET_RENDER_LAYER_DESTRUCTOR, NULL);
     icetStateSetBoolean(ICET_RENDER_LAYER_HOLDS_BUFFER, ICET_FALSE);
@@ -199,12 +243,31 @@ void icetStateSetDefaults(void)
     icetEnable(ICET_INTERLACE_IMAGES);
     icetEnable(ICET_COLLECT_IMAGES);
     icetDisable(ICET_RENDER_EMPTY_IMAGES);
+    icetDisable(ICET_SPLIT_BALANCE_FRAGMENTS);
+    icetDisable(ICET_SORT_INPUT_FRAGMENTS);
+    icetDisable(ICET_CONVEX_DATA);
+    icetDisable(ICET_COALESCE_FRAGMENTS);
+    icetDisable(ICET_QUANTIZE_WIRE_COLORS);
+    icetDisable(ICET_TEMPORAL_DELTA);
+    icetDisable(ICET_SPARSE_IMAGE_INDEX);
+    icetDisable(ICET_BLOCK_SPARSE_IMAGES);
 
     icetStateSetBoolean(ICET_IS_DRAWING_FRAME, ICET_FALSE);
+    icetStateSetBoolean(ICET_KEEP_DEEP_IMAGE, ICET_FALSE);
 
     icetStateSetInteger(ICET_VALID_PIXELS_TILE, -1);
     icetStateSetInteger(ICET_VALID_PIXELS_OFFSET, 0);
     icetStateSetInteger(ICET_VALID_PIXELS_NUM, 0);
+    icetStateSetInteger(ICET_CHANGED_PIXELS_OFFSET, 0);
+    icetStateSetInteger(ICET_CHANGED_PIXELS_NUM, 0);
+    icetStateSetInteger(ICET_CHANGED_PIXELS_NUM_RANGES, 0);
+    icetStateSetIntegerv(ICET_CHANGED_PIXELS_RANGES, 0, NULL);
+    icetStateSetIntegerv(ICET_TEMPORAL_DELTA_BASE, 0, NULL);
+
+    icetStateSetDoublev(ICET_SPLIT_FRAGMENT_WEIGHTS, 0, NULL);
+    icetStateSetInteger(ICET_SPLIT_WEIGHTS_BIN_SIZE, 0);
+    icetStateSetIntegerv(ICET_SPLIT_PARTITION_OFFSETS, 0, NULL);
+    icetStateSetDoublev(ICET_ALL_DEPTH_BOUNDS, 0, NULL);
 
     icetStateResetTiming();
 }
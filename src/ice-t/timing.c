@@ -44,6 +44,13 @@ void icetStateResetTiming(void)
     icetStateSetInteger(ICET_SUBFUNC_TIME_ID, 0);
 
     icetStateSetInteger(ICET_BYTES_SENT, 0);
+
+    icetStateSetDouble(ICET_ENCODE_TIME, 0.0);
+    icetStateSetDouble(ICET_DECODE_TIME, 0.0);
+    icetStateSetDouble(ICET_ENCODE_BYTES_IN, 0.0);
+    icetStateSetDouble(ICET_ENCODE_BYTES_OUT, 0.0);
+    icetStateSetDouble(ICET_ENCODE_RATIO, 1.0);
+    icetStateSetDouble(ICET_QUANTIZE_BYTES_SAVED, 0.0);
 }
 
 static void icetTimingBegin(IceTEnum start_pname,
@@ -212,6 +219,36 @@ void icetTimingCollectEnd(void)
                   "collect");
 }
 
+void icetTimingEncodeBegin(void)
+{
+    icetTimingBegin(ICET_SUBFUNC_START_TIME,
+                    ICET_SUBFUNC_TIME_ID,
+                    ICET_ENCODE_TIME,
+                    "encode");
+}
+void icetTimingEncodeEnd(void)
+{
+    icetTimingEnd(ICET_SUBFUNC_START_TIME,
+                  ICET_SUBFUNC_TIME_ID,
+                  ICET_ENCODE_TIME,
+                  "encode");
+}
+
+void icetTimingDecodeBegin(void)
+{
+    icetTimingBegin(ICET_SUBFUNC_START_TIME,
+                    ICET_SUBFUNC_TIME_ID,
+                    ICET_DECODE_TIME,
+                    "decode");
+}
+void icetTimingDecodeEnd(void)
+{
+    icetTimingEnd(ICET_SUBFUNC_START_TIME,
+                  ICET_SUBFUNC_TIME_ID,
+                  ICET_DECODE_TIME,
+                  "decode");
+}
+
 void icetTimingDrawFrameBegin(void)
 {
     icetTimingBegin(ICET_DRAW_START_TIME,
@@ -200,13 +200,16 @@ ICET_EXPORT int  icetAddTile(IceTInt x, IceTInt y,
 ICET_EXPORT void icetPhysicalRenderSize(IceTInt width, IceTInt height);
 
 typedef struct { IceTVoid *opaque_internals; } IceTImage;
+typedef struct { IceTVoid *opaque_internals; } IceTSparseImage;
 
 #define ICET_IMAGE_COLOR_RGBA_UBYTE     (IceTEnum)0xC001
 #define ICET_IMAGE_COLOR_RGBA_FLOAT     (IceTEnum)0xC002
 #define ICET_IMAGE_COLOR_RGB_FLOAT      (IceTEnum)0xC003
+#define ICET_IMAGE_COLOR_RGBA_HALF      (IceTEnum)0xC004
 #define ICET_IMAGE_COLOR_NONE           (IceTEnum)0xC000
 
 #define ICET_IMAGE_DEPTH_FLOAT          (IceTEnum)0xD001
+#define ICET_IMAGE_DEPTH_USHORT         (IceTEnum)0xD002
 #define ICET_IMAGE_DEPTH_NONE           (IceTEnum)0xD000
 
 ICET_EXPORT void icetSetColorFormat(IceTEnum color_format);
@@ -264,6 +267,16 @@ ICET_EXPORT void icetCompositeMode(IceTEnum mode);
 
 ICET_EXPORT void icetCompositeOrder(const IceTInt *process_ranks);
 
+#define ICET_WIRE_CODEC_NONE            (IceTEnum)0x0400
+#define ICET_WIRE_CODEC_BYTE_DELTA      (IceTEnum)0x0401
+ICET_EXPORT void icetWireCodec(IceTEnum codec);
+
+ICET_EXPORT void icetNumThreads(IceTInt num_threads);
+
+ICET_EXPORT void icetLayeredOpacityCutoff(IceTFloat cutoff);
+
+ICET_EXPORT void icetMaxFragmentsPerPixel(IceTInt max_fragments);
+
 ICET_EXPORT void icetDataReplicationGroup(IceTInt size,
                                           const IceTInt *processes);
 ICET_EXPORT void icetDataReplicationGroupColor(IceTInt color);
@@ -289,7 +302,8 @@ ICET_EXPORT IceTImage icetCompositeImage(const IceTVoid *color_buffer,
 
 /* Composite pre-rendered images with multiple color and depth values per pixel
  * into a regular 2D image.  Active (non-empty, non-background) fragments must
- * be sorted front to back per pixel.
+ * be sorted front to back per pixel unless ICET_SORT_INPUT_FRAGMENTS is
+ * enabled.
  */
 ICET_EXPORT IceTImage icetCompositeImageLayered(const IceTVoid *color_buffer,
                                                 const IceTVoid *depth_buffer,
@@ -299,6 +313,34 @@ ICET_EXPORT IceTImage icetCompositeImageLayered(const IceTVoid *color_buffer,
                                                 const IceTDouble *modelview_matrix,
                                                 const IceTFloat *background_color);
 
+/* Like icetCompositeImageLayered, but for layered images stored as one color
+ * and depth buffer per layer rather than with the fragments of each pixel
+ * stored contiguously.  color_layers and depth_layers each hold num_layers
+ * pointers to buffers of the size of a regular image.
+ */
+ICET_EXPORT IceTImage icetCompositeImageLayeredPlanar(const IceTVoid *const *color_layers,
+                                                      const IceTVoid *const *depth_layers,
+                                                      IceTInt num_layers,
+                                                      const IceTInt *valid_pixels_viewport,
+                                                      const IceTDouble *projection_matrix,
+                                                      const IceTDouble *modelview_matrix,
+                                                      const IceTFloat *background_color);
+
+/* Like icetCompositeImageLayered, but returns the merged fragments of each
+ * pixel as a sparse layered image rather than blending them, so no background
+ * color is needed.  The image is returned on the display node, or, if
+ * ICET_COLLECT_IMAGES is disabled, each process gets its piece of
+ * ICET_VALID_PIXELS_NUM pixels starting at ICET_VALID_PIXELS_OFFSET.  All other
+ * processes get a null image.  The image can be read with the functions in
+ * IceTDevImage.h and remains valid until the next frame.
+ */
+ICET_EXPORT IceTSparseImage icetCompositeImageLayeredDeep(const IceTVoid *color_buffer,
+                                                          const IceTVoid *depth_buffer,
+                                                          IceTInt num_layers,
+                                                          const IceTInt *valid_pixels_viewport,
+                                                          const IceTDouble *projection_matrix,
+                                                          const IceTDouble *modelview_matrix);
+
 #define ICET_DIAG_OFF           (IceTEnum)0x0000
 #define ICET_DIAG_ERRORS        (IceTEnum)0x0001
 #define ICET_DIAG_WARNINGS      (IceTEnum)0x0003
@@ -345,6 +387,10 @@ ICET_EXPORT void icetDiagnostics(IceTBitField mask);
 
 #define ICET_MAGIC_K            (ICET_STATE_ENGINE_START | (IceTEnum)0x0040)
 #define ICET_MAX_IMAGE_SPLIT    (ICET_STATE_ENGINE_START | (IceTEnum)0x0041)
+#define ICET_LAYERED_OPACITY_CUTOFF (ICET_STATE_ENGINE_START | (IceTEnum)0x0042)
+#define ICET_MAX_FRAGMENTS_PER_PIXEL (ICET_STATE_ENGINE_START | (IceTEnum)0x0043)
+#define ICET_WIRE_CODEC         (ICET_STATE_ENGINE_START | (IceTEnum)0x0044)
+#define ICET_NUM_THREADS        (ICET_STATE_ENGINE_START | (IceTEnum)0x0045)
 
 #define ICET_DRAW_FUNCTION      (ICET_STATE_ENGINE_START | (IceTEnum)0x0060)
 #define ICET_RENDER_LAYER_DESTRUCTOR (ICET_STATE_ENGINE_START|(IceTEnum)0x0061)
@@ -379,6 +425,16 @@ ICET_EXPORT void icetDiagnostics(IceTBitField mask);
 #define ICET_PRE_RENDERED       (ICET_STATE_FRAME_START | (IceTEnum)0x0022)
 #define ICET_TILE_PROJECTIONS   (ICET_STATE_FRAME_START | (IceTEnum)0x0023)
 #define ICET_SPARSE_TILE_BUFFER (ICET_STATE_FRAME_START | (IceTEnum)0x0024)
+#define ICET_SPLIT_FRAGMENT_WEIGHTS (ICET_STATE_FRAME_START | (IceTEnum)0x0025)
+#define ICET_SPLIT_WEIGHTS_BIN_SIZE (ICET_STATE_FRAME_START | (IceTEnum)0x0026)
+#define ICET_SPLIT_PARTITION_OFFSETS (ICET_STATE_FRAME_START | (IceTEnum)0x0027)
+#define ICET_ALL_DEPTH_BOUNDS   (ICET_STATE_FRAME_START | (IceTEnum)0x0028)
+#define ICET_KEEP_DEEP_IMAGE    (ICET_STATE_FRAME_START | (IceTEnum)0x0029)
+#define ICET_CHANGED_PIXELS_OFFSET (ICET_STATE_FRAME_START | (IceTEnum)0x002A)
+#define ICET_CHANGED_PIXELS_NUM (ICET_STATE_FRAME_START | (IceTEnum)0x002B)
+#define ICET_TEMPORAL_DELTA_BASE (ICET_STATE_FRAME_START | (IceTEnum)0x002C)
+#define ICET_CHANGED_PIXELS_NUM_RANGES (ICET_STATE_FRAME_START | (IceTEnum)0x002D)
+#define ICET_CHANGED_PIXELS_RANGES (ICET_STATE_FRAME_START | (IceTEnum)0x002E)
 
 #define ICET_STATE_TIMING_START (IceTEnum)0x000000C0
 
@@ -393,12 +449,19 @@ ICET_EXPORT void icetDiagnostics(IceTBitField mask);
 #define ICET_COLLECT_TIME       (ICET_STATE_TIMING_START | (IceTEnum)0x0008)
 #define ICET_TOTAL_DRAW_TIME    (ICET_STATE_TIMING_START | (IceTEnum)0x0009)
 #define ICET_BYTES_SENT         (ICET_STATE_TIMING_START | (IceTEnum)0x000A)
+#define ICET_ENCODE_TIME        (ICET_STATE_TIMING_START | (IceTEnum)0x000B)
+#define ICET_DECODE_TIME        (ICET_STATE_TIMING_START | (IceTEnum)0x000C)
+#define ICET_ENCODE_BYTES_IN    (ICET_STATE_TIMING_START | (IceTEnum)0x000D)
+#define ICET_ENCODE_BYTES_OUT   (ICET_STATE_TIMING_START | (IceTEnum)0x000E)
+#define ICET_ENCODE_RATIO       (ICET_STATE_TIMING_START | (IceTEnum)0x000F)
 
 #define ICET_DRAW_START_TIME    (ICET_STATE_TIMING_START | (IceTEnum)0x0010)
 #define ICET_DRAW_TIME_ID       (ICET_STATE_TIMING_START | (IceTEnum)0x0011)
 #define ICET_SUBFUNC_START_TIME (ICET_STATE_TIMING_START | (IceTEnum)0x0012)
 #define ICET_SUBFUNC_TIME_ID    (ICET_STATE_TIMING_START | (IceTEnum)0x0013)
 
+#define ICET_QUANTIZE_BYTES_SAVED (ICET_STATE_TIMING_START | (IceTEnum)0x0014)
+
 #define ICET_RENDER_LAYER_ID    (IceTEnum)0x000000FF
 
 /* This set of state variables are reserved for the rendering layer. */
@@ -415,6 +478,14 @@ ICET_EXPORT void icetDiagnostics(IceTBitField mask);
 #define ICET_INTERLACE_IMAGES   (ICET_STATE_ENABLE_START | (IceTEnum)0x0005)
 #define ICET_COLLECT_IMAGES     (ICET_STATE_ENABLE_START | (IceTEnum)0x0006)
 #define ICET_RENDER_EMPTY_IMAGES (ICET_STATE_ENABLE_START | (IceTEnum)0x0007)
+#define ICET_SPLIT_BALANCE_FRAGMENTS (ICET_STATE_ENABLE_START | (IceTEnum)0x0008)
+#define ICET_SORT_INPUT_FRAGMENTS (ICET_STATE_ENABLE_START | (IceTEnum)0x0009)
+#define ICET_CONVEX_DATA        (ICET_STATE_ENABLE_START | (IceTEnum)0x000A)
+#define ICET_COALESCE_FRAGMENTS (ICET_STATE_ENABLE_START | (IceTEnum)0x000B)
+#define ICET_QUANTIZE_WIRE_COLORS (ICET_STATE_ENABLE_START | (IceTEnum)0x000C)
+#define ICET_TEMPORAL_DELTA     (ICET_STATE_ENABLE_START | (IceTEnum)0x000D)
+#define ICET_SPARSE_IMAGE_INDEX (ICET_STATE_ENABLE_START | (IceTEnum)0x000E)
+#define ICET_BLOCK_SPARSE_IMAGES (ICET_STATE_ENABLE_START | (IceTEnum)0x000F)
 
 /* This set of enable state variables are reserved for the rendering layer. */
 #define ICET_RENDER_LAYER_ENABLE_START (ICET_STATE_ENABLE_START | (IceTEnum)0x0030)
@@ -436,6 +507,13 @@ ICET_EXPORT void icetDiagnostics(IceTBitField mask);
 #define ICET_STRATEGY_COMMON_BUF_0 (ICET_CORE_BUFFER_START | (IceTEnum)0x0006)
 #define ICET_STRATEGY_COMMON_BUF_1 (ICET_CORE_BUFFER_START | (IceTEnum)0x0007)
 #define ICET_STRATEGY_COMMON_BUF_2 (ICET_CORE_BUFFER_START | (IceTEnum)0x0008)
+#define ICET_SORT_FRAGMENTS_BUF (ICET_CORE_BUFFER_START | (IceTEnum)0x0009)
+#define ICET_LAYER_POINTERS_BUF (ICET_CORE_BUFFER_START | (IceTEnum)0x000A)
+#define ICET_COALESCE_DEPTHS_BUF (ICET_CORE_BUFFER_START | (IceTEnum)0x000B)
+#define ICET_DEEP_IMAGE_BUF     (ICET_CORE_BUFFER_START | (IceTEnum)0x000C)
+#define ICET_DEEP_COLLECT_BUF   (ICET_CORE_BUFFER_START | (IceTEnum)0x000D)
+#define ICET_WIRE_ENCODE_BUF    (ICET_CORE_BUFFER_START | (IceTEnum)0x000E)
+#define ICET_WIRE_DECODE_BUF    (ICET_CORE_BUFFER_START | (IceTEnum)0x000F)
 
 #define ICET_RENDER_LAYER_BUFFER_START (ICET_STATE_BUFFER_START | (IceTEnum)0x0010)
 #define ICET_RENDER_LAYER_BUFFER_END   (ICET_STATE_BUFFER_START | (IceTEnum)0x0020)
@@ -483,6 +561,19 @@ ICET_EXPORT void icetDiagnostics(IceTBitField mask);
 #define ICET_COMMUNICATION_LAYER_START (ICET_STATE_BUFFER_START | (IceTEnum)0x0040)
 #define ICET_COMMUNICATION_LAYER_END  (ICET_STATE_BUFFER_START | (IceTEnum)0x0050)
 
+#define ICET_THREAD_BUFFER_START (ICET_STATE_BUFFER_START | (IceTEnum)0x0050)
+#define ICET_THREAD_BUFFER_END  (ICET_STATE_BUFFER_START | (IceTEnum)0x0060)
+#define ICET_THREAD_COMPRESS_BUF (ICET_THREAD_BUFFER_START | (IceTEnum)0x0000)
+#define ICET_THREAD_COMPOSITE_BUF (ICET_THREAD_BUFFER_START | (IceTEnum)0x0001)
+#define ICET_THREAD_CURSOR_BUF  (ICET_THREAD_BUFFER_START | (IceTEnum)0x0002)
+
+#define ICET_SPARSE_BLOCK_BUFFER_START (ICET_STATE_BUFFER_START | (IceTEnum)0x0060)
+#define ICET_SPARSE_BLOCK_BUFFER_END  (ICET_STATE_BUFFER_START | (IceTEnum)0x0070)
+#define ICET_SPARSE_BLOCK_BUF_0 (ICET_SPARSE_BLOCK_BUFFER_START | (IceTEnum)0x0000)
+#define ICET_SPARSE_BLOCK_BUF_1 (ICET_SPARSE_BLOCK_BUFFER_START | (IceTEnum)0x0001)
+#define ICET_SPARSE_BLOCK_ROW_BUF (ICET_SPARSE_BLOCK_BUFFER_START | (IceTEnum)0x0002)
+#define ICET_SPARSE_BLOCK_BITMAP_BUF (ICET_SPARSE_BLOCK_BUFFER_START | (IceTEnum)0x0003)
+
 #define ICET_STATE_SIZE         (IceTEnum)0x00000200
 #define ICET_STATE_ENGINE_END   (ICET_STATE_ENGINE_START + ICET_STATE_SIZE)
 
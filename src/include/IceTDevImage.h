@@ -79,10 +79,42 @@ ICET_EXPORT IceTImage icetLayeredImagePointerAssignBuffer(IceTVoid *buffer,
                                                           const IceTVoid *color_buffer,
                                                           const IceTVoid *deoth_buffer);
 
+/* Like `icetGetStatePointerLayeredImage`, but for a layered image stored in a
+ * separate color and depth buffer per layer, as produced for example by depth
+ * peeling.  `color_layers` and `depth_layers` each point to `num_layers`
+ * buffers with one fragment per pixel.  Planar layered images can only be
+ * compressed.
+ */
+ICET_EXPORT IceTImage icetGetStatePlanarLayeredImage(IceTEnum pname,
+                                                     IceTSizeType width,
+                                                     IceTSizeType height,
+                                                     IceTLayerCount num_layers,
+                                                     const IceTVoid *const *color_layers,
+                                                     const IceTVoid *const *depth_layers);
+ICET_EXPORT IceTImage icetLayeredImagePlanarAssignBuffer(IceTVoid *buffer,
+                                                         IceTSizeType width,
+                                                         IceTSizeType height,
+                                                         IceTLayerCount num_layers,
+                                                         const IceTVoid *const *color_layers,
+                                                         const IceTVoid *const *depth_layers);
+
 /* Check whether an `IceTImage` is layered, meaning that it may have multiple
  * fragments per pixel, with each fragment consisting of a color and a depth.
  */
 ICET_EXPORT IceTBoolean icetImageIsLayered(const IceTImage image);
+/* Get the number of fragments per pixel in a layered `IceTImage`.  Flat images
+ * have a single layer.
+ */
+ICET_EXPORT IceTLayerCount icetImageGetNumLayers(const IceTImage image);
+/* Check whether a layered `IceTImage` stores a separate buffer per layer.  If
+ * so, the buffers of its layers can be retrieved with the functions below
+ * rather than `icetImageGetColorConstVoid` and `icetImageGetDepthConstVoid`.
+ */
+ICET_EXPORT IceTBoolean icetLayeredImageIsPlanar(const IceTImage image);
+ICET_EXPORT const IceTVoid *const *icetLayeredImageGetColorLayersConst(
+                                                        const IceTImage image);
+ICET_EXPORT const IceTVoid *const *icetLayeredImageGetDepthLayersConst(
+                                                        const IceTImage image);
 
 ICET_EXPORT void icetImageAdjustForOutput(IceTImage image);
 ICET_EXPORT void icetImageAdjustForInput(IceTImage image);
@@ -121,8 +153,6 @@ ICET_EXPORT void icetImagePackageForSend(IceTImage image,
                                          IceTSizeType *size);
 ICET_EXPORT IceTImage icetImageUnpackageFromReceive(IceTVoid *buffer);
 
-typedef struct { IceTVoid *opaque_internals; } IceTSparseImage;
-
 ICET_EXPORT IceTSizeType icetSparseImageBufferSize(IceTSizeType width,
                                                    IceTSizeType height);
 ICET_EXPORT IceTSizeType icetSparseImageBufferSizeType(IceTEnum color_format,
@@ -142,9 +172,59 @@ ICET_EXPORT IceTSizeType icetSparseLayeredImageBufferSizeType(IceTEnum color_for
                                                               IceTSizeType height,
                                                               IceTLayerCount num_layers);
 
+/* Calculate an upper bound for the size in bytes of a layered `IceTSparseImage`
+ * with a buffer of `compressed_size` bytes once it is composited.  This is
+ * larger than `compressed_size` itself since images with a single fragment per
+ * pixel are promoted to the general layered format and fragment counts may be
+ * widened.
+ */
+ICET_EXPORT IceTSizeType icetSparseLayeredImagePromotedBufferSize(
+                                                IceTSizeType compressed_size);
+
+/* Retrieve how a sparse layered image stores the number of fragments of each
+ * pixel: `count_size` is the number of bytes of each count, or 0 if the image
+ * holds a single fragment per pixel and stores no counts, and `max_fragments`
+ * bounds the number of fragments of any pixel.  Strategies send these ahead of
+ * an image so that the receiver can size its buffers before the image arrives.
+ */
+ICET_EXPORT void icetSparseLayeredImageGetFragmentCounts(
+                                                const IceTSparseImage image,
+                                                IceTSizeType *count_size,
+                                                IceTLayerCount *max_fragments);
+
+/* Returns the number of bytes with which the result of compositing several
+ * sparse layered images, in any order, stores the number of fragments of each
+ * pixel.  `largest_max_fragments` is the largest and `total_max_fragments` the
+ * sum of the `max_fragments` of the images.
+ */
+ICET_EXPORT IceTSizeType icetSparseLayeredImageCompositeCountSize(
+                                        IceTLayerCount largest_max_fragments,
+                                        IceTLayerCount total_max_fragments);
+
+/* Calculate an upper bound for the size in bytes of a layered `IceTSparseImage`
+ * with a buffer of `compressed_size` bytes and fragment counts of `count_size`
+ * bytes once it is composited into an image with counts of
+ * `composite_count_size` bytes.  Unlike
+ * `icetSparseLayeredImagePromotedBufferSize`, this only leaves room for
+ * promoting images that hold a single fragment per pixel (`count_size` of 0)
+ * and for widening counts as far as needed.
+ */
+ICET_EXPORT IceTSizeType icetSparseLayeredImageCompositeBufferSize(
+                                        IceTSizeType compressed_size,
+                                        IceTSizeType count_size,
+                                        IceTSizeType composite_count_size);
+
+/* Returns the smallest number of bytes (1, 2 or 4) that can store the number of
+ * fragments of a pixel in a sparse layered image if no pixel holds more than
+ * `max_fragments` of them.
+ */
+ICET_EXPORT IceTSizeType icetSparseLayeredImageLayerCountSize(
+                                                IceTSizeType max_fragments);
+
 ICET_EXPORT IceTSparseImage icetGetStateBufferSparseImage(IceTEnum pname,
                                                           IceTSizeType width,
                                                           IceTSizeType height);
+ICET_EXPORT IceTSparseImage icetRetrieveStateSparseImage(IceTEnum pname);
 ICET_EXPORT IceTSparseImage icetSparseImageAssignBuffer(IceTVoid *buffer,
                                                         IceTSizeType width,
                                                         IceTSizeType height);
@@ -170,6 +250,20 @@ ICET_EXPORT IceTBoolean icetSparseImageIsNull(const IceTSparseImage image);
  */
 ICET_EXPORT IceTBoolean icetSparseImageIsLayered(const IceTSparseImage image);
 
+/* Check whether a sparse layered image holds exactly one fragment per active
+ * pixel, as produced by processes with ICET_CONVEX_DATA enabled.  Such images
+ * are stored like non-layered images, without the number of fragments of each
+ * pixel, and are promoted to the general layered format when composited.
+ */
+ICET_EXPORT IceTBoolean icetSparseImageIsSingleFragment(
+                                                const IceTSparseImage image);
+
+/* Check whether a non-layered sparse image stores its pixels in 2D blocks
+ * rather than runs, as do sparse images assigned while
+ * ICET_BLOCK_SPARSE_IMAGES is enabled.
+ */
+ICET_EXPORT IceTBoolean icetSparseImageIsBlocked(const IceTSparseImage image);
+
 ICET_EXPORT IceTEnum icetSparseImageGetColorFormat(const IceTSparseImage image);
 ICET_EXPORT IceTEnum icetSparseImageGetDepthFormat(const IceTSparseImage image);
 ICET_EXPORT IceTSizeType icetSparseImageGetWidth(const IceTSparseImage image);
@@ -187,6 +281,37 @@ ICET_EXPORT void icetSparseImagePackageForSend(IceTSparseImage image,
                                                IceTSizeType *size);
 ICET_EXPORT IceTSparseImage icetSparseImageUnpackageFromReceive(
                                                               IceTVoid *buffer);
+/* Returns true if icetSparseImageEncodeForSend may encode images, i.e. if a
+ * wire codec is selected or ICET_QUANTIZE_WIRE_COLORS is enabled. */
+ICET_EXPORT IceTBoolean icetSparseImageWireEncodingEnabled(void);
+/* Returns the number of bytes icetSparseImageEncodeForSend needs in its
+ * encode_buffer to encode the given image. */
+ICET_EXPORT IceTSizeType icetSparseImageEncodeBufferSize(
+                                                   const IceTSparseImage image);
+/* Packages a sparse image like icetSparseImagePackageForSend and encodes it
+ * with the codec selected by icetWireCodec.  If ICET_QUANTIZE_WIRE_COLORS is
+ * enabled, RGBA float colors are also quantized to 8 bits per channel.
+ * encode_buffer must hold icetSparseImageEncodeBufferSize bytes and is where
+ * the encoded image is placed.  If encoding does not make the image smaller,
+ * buffer and size describe the packaged image instead.  The codec and
+ * quantization must be the same on all processes. */
+ICET_EXPORT void icetSparseImageEncodeForSend(IceTSparseImage image,
+                                              IceTVoid *encode_buffer,
+                                              IceTVoid **buffer,
+                                              IceTSizeType *size);
+/* Returns the size of the image encoded in a buffer received from
+ * icetSparseImageEncodeForSend, which is the size of the packaged image before
+ * encoding, or 0 if the buffer holds an image that was sent as it is. */
+ICET_EXPORT IceTSizeType icetSparseImageDecodedBufferSize(
+                                                        const IceTVoid *buffer);
+/* Decodes a buffer received from icetSparseImageEncodeForSend into
+ * decode_buffer, which must hold icetSparseImageDecodedBufferSize bytes, and
+ * returns the image it holds.  Quantized colors are restored to their original
+ * format.  Images that were sent as they are are unpackaged in place, and
+ * decode_buffer may be NULL for them. */
+ICET_EXPORT IceTSparseImage icetSparseImageDecodeFromReceive(
+                                                      IceTVoid *buffer,
+                                                      IceTVoid *decode_buffer);
 
 ICET_EXPORT IceTBoolean icetSparseImageEqual(const IceTSparseImage image1,
                                              const IceTSparseImage image2);
@@ -199,6 +324,14 @@ ICET_EXPORT void icetSparseImageCopyPixels(const IceTSparseImage in_image,
                                            IceTSizeType num_pixels,
                                            IceTSparseImage out_image);
 
+/* Counts the active fragments of an image in consecutive bins of bin_size
+ * pixels and stores them in counts, which must have room for one entry per
+ * bin.  Flat images have one fragment per active pixel.
+ */
+ICET_EXPORT void icetSparseImageCountFragments(const IceTSparseImage image,
+                                               IceTSizeType bin_size,
+                                               IceTInt *counts);
+
 ICET_EXPORT void icetSparseImageSplit(const IceTSparseImage in_image,
                                       IceTSizeType in_image_offset,
                                       IceTInt num_partitions,
@@ -221,6 +354,11 @@ ICET_EXPORT IceTSizeType icetSparseImageSplitPartitionNumPixels(
                                                IceTInt num_partitions,
                                                IceTInt eventual_num_partitions);
 
+/* Returns true if single-image strategies should interlace their images, which
+ * is when ICET_INTERLACE_IMAGES is enabled and images are not split by their
+ * fragment weights (see ICET_SPLIT_BALANCE_FRAGMENTS).
+ */
+ICET_EXPORT IceTBoolean icetSparseImageInterlaceEnabled(void);
 ICET_EXPORT void icetSparseImageInterlace(const IceTSparseImage in_image,
                                           IceTInt eventual_num_partitions,
                                           IceTEnum scratch_state_buffer,
@@ -239,6 +377,18 @@ ICET_EXPORT IceTSizeType icetGetInterlaceOffset(
                                               IceTInt eventual_num_partitions,
                                               IceTSizeType original_image_size);
 
+/* Concatenate the pixels of several pieces of a sparse layered image into
+ * `out_image`, which must already have the size of the whole image.  The pixels
+ * of `pieces[i]` are placed starting at pixel `offsets[i]`, and pixels not
+ * covered by any piece are inactive.  Pieces must be sorted by their offsets
+ * and must not overlap.  Pieces stored with a single fragment per pixel are
+ * promoted, so the output always holds the fragment count of each pixel.
+ */
+ICET_EXPORT void icetSparseLayeredImageStitch(const IceTSparseImage *pieces,
+                                              const IceTSizeType *offsets,
+                                              IceTInt num_pieces,
+                                              IceTSparseImage out_image);
+
 ICET_EXPORT void icetClearImage(IceTImage image);
 ICET_EXPORT void icetClearSparseImage(IceTSparseImage image);
 
@@ -250,6 +400,13 @@ typedef void (*IceTGetRenderedBufferImage)(IceTImage target_image,
 
 ICET_EXPORT IceTSparseImage icetGetCompressedTileImage(IceTInt tile);
 
+/* Compresses num_pixels pixels of a tile image read with icetGetTileImage,
+ * starting at offset, into the same buffer used by icetGetCompressedTileImage.
+ * As there, the local process is recorded as the only contributor. */
+ICET_EXPORT IceTSparseImage icetCompressTileSubImage(const IceTImage tile_image,
+                                                     IceTSizeType offset,
+                                                     IceTSizeType num_pixels);
+
 typedef IceTSparseImage (*IceTGetCompressedRenderedBufferImage)(
     IceTInt *rendered_viewport,
     IceTInt *target_viewport,
@@ -336,6 +493,31 @@ ICET_EXPORT void icetClearImageTrueBackground(IceTImage image);
 #define ICET_OVER_FLOAT(src, dest)  ICET_BLEND_FLOAT(src, dest, dest)
 #define ICET_UNDER_FLOAT(src, dest) ICET_BLEND_FLOAT(dest, src, dest)
 
+/* Convert between single precision floats and the IEEE 754 half precision
+ * floats stored in ICET_IMAGE_COLOR_RGBA_HALF images.  Conversion to half
+ * precision rounds to the nearest representable value.
+ */
+ICET_EXPORT IceTFloat icetHalfToFloat(IceTUShort half);
+ICET_EXPORT IceTUShort icetFloatToHalf(IceTFloat value);
+
+/* Half precision colors are blended in single precision. */
+#define ICET_BLEND_HALF(front, back, dest)                              \
+{                                                                       \
+    IceTFloat front_f[4], back_f[4];                                    \
+    int channel_h;                                                      \
+    for (channel_h = 0; channel_h < 4; channel_h++) {                   \
+        front_f[channel_h] = icetHalfToFloat((front)[channel_h]);       \
+        back_f[channel_h] = icetHalfToFloat((back)[channel_h]);         \
+    }                                                                   \
+    ICET_BLEND_FLOAT(front_f, back_f, back_f);                          \
+    for (channel_h = 0; channel_h < 4; channel_h++) {                   \
+        (dest)[channel_h] = icetFloatToHalf(back_f[channel_h]);         \
+    }                                                                   \
+}
+
+#define ICET_OVER_HALF(src, dest)   ICET_BLEND_HALF(src, dest, dest)
+#define ICET_UNDER_HALF(src, dest)  ICET_BLEND_HALF(dest, src, dest)
+
 #ifdef __cplusplus
 }
 #endif
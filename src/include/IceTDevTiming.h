@@ -41,6 +41,12 @@ ICET_EXPORT void icetTimingBlendEnd(void);
 ICET_EXPORT void icetTimingCollectBegin(void);
 ICET_EXPORT void icetTimingCollectEnd(void);
 
+ICET_EXPORT void icetTimingEncodeBegin(void);
+ICET_EXPORT void icetTimingEncodeEnd(void);
+
+ICET_EXPORT void icetTimingDecodeBegin(void);
+ICET_EXPORT void icetTimingDecodeEnd(void);
+
 ICET_EXPORT void icetTimingDrawFrameBegin(void);
 ICET_EXPORT void icetTimingDrawFrameEnd(void);
 
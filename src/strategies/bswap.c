@@ -21,6 +21,8 @@
 #define BSWAP_IMAGE_ARRAY               ICET_SI_STRATEGY_BUFFER_3
 #define BSWAP_DUMMY_ARRAY               ICET_SI_STRATEGY_BUFFER_4
 #define BSWAP_COMPOSE_GROUP_BUFFER      ICET_SI_STRATEGY_BUFFER_5
+#define BSWAP_WIRE_ENCODE_BUFFER        ICET_SI_STRATEGY_BUFFER_6
+#define BSWAP_WIRE_DECODE_BUFFER        ICET_SI_STRATEGY_BUFFER_7
 
 #define BSWAP_SWAP_IMAGES 21
 #define BSWAP_TELESCOPE 22
@@ -38,6 +40,35 @@
     }                                                                         \
 }
 
+/* Packages an image for sending and encodes it for the wire, if enabled. */
+static void bswapPackageImage(IceTSparseImage image,
+                              IceTVoid **buffer,
+                              IceTSizeType *size)
+{
+    IceTVoid *encode_buffer = NULL;
+
+    if (icetSparseImageWireEncodingEnabled()) {
+        encode_buffer = icetGetStateBuffer(
+                                    BSWAP_WIRE_ENCODE_BUFFER,
+                                    icetSparseImageEncodeBufferSize(image));
+    }
+    icetSparseImageEncodeForSend(image, encode_buffer, buffer, size);
+}
+
+/* Reverses bswapPackageImage.  The image is valid until the next one is
+ * received. */
+static IceTSparseImage bswapUnpackageImage(IceTVoid *buffer)
+{
+    IceTSizeType decoded_size = icetSparseImageDecodedBufferSize(buffer);
+    IceTVoid *decode_buffer = NULL;
+
+    if (decoded_size > 0) {
+        decode_buffer = icetGetStateBuffer(BSWAP_WIRE_DECODE_BUFFER,
+                                           decoded_size);
+    }
+    return icetSparseImageDecodeFromReceive(buffer, decode_buffer);
+}
+
 /* Finds the largest power of 2 equal to or smaller than x. */
 static IceTInt bswapFindPower2(IceTInt x)
 {
@@ -222,6 +253,7 @@ static void bswapSendFromUpperGroup(const IceTInt *lower_group,
                                     IceTInt upper_group_size,
                                     IceTInt largest_group_size,
                                     IceTSparseImage working_image,
+                                    IceTSizeType piece_offset,
                                     IceTEnum scratch_buffer)
 {
     IceTInt num_pieces = lower_group_size/upper_group_size;
@@ -246,7 +278,7 @@ static void bswapSendFromUpperGroup(const IceTInt *lower_group,
             image_partitions[piece] = icetSparseImageNull();
         }
         icetSparseImageSplitAlloc(working_image,
-                                  0,
+                                  piece_offset,
                                   num_pieces,
                                   eventual_num_pieces,
                                   scratch_buffer,
@@ -271,8 +303,8 @@ static void bswapSendFromUpperGroup(const IceTInt *lower_group,
         dest_rank = dest_rank*upper_group_size + upper_group_rank;
         icetRaiseDebug("Sending piece %d to %d", piece, dest_rank);
 
-        icetSparseImagePackageForSend(image_partitions[piece],
-                                      &package_buffer, &package_size);
+        bswapPackageImage(image_partitions[piece],
+                          &package_buffer, &package_size);
         /* Send to processor in lower "half" that has same part of image. */
         icetCommSend(package_buffer,
                      package_size,
@@ -322,7 +354,7 @@ static void bswapReceiveFromUpperGroup(const IceTInt *lower_group,
                                             ICET_BYTE,
                                             upper_group[src],
                                             BSWAP_TELESCOPE);
-        in_image = icetSparseImageUnpackageFromReceive(in_image_buffer);
+        in_image = bswapUnpackageImage(in_image_buffer);
 
         {
             IceTEnum old_working_buffer = *working_buffer_p;
@@ -429,9 +461,7 @@ static void bswapComposePow2(const IceTInt *compose_group,
             IceTVoid *in_image_buffer;
             IceTSparseImage in_image;
 
-            icetSparseImagePackageForSend(send_image,
-                                          &package_buffer,
-                                          &package_size);
+            bswapPackageImage(send_image, &package_buffer, &package_size);
 
             in_image_buffer = icetCommSendrecvAlloc(
                                                    package_buffer,
@@ -444,8 +474,7 @@ static void bswapComposePow2(const IceTInt *compose_group,
                                                    compose_group[pair],
                                                    BSWAP_SWAP_IMAGES);
 
-            in_image
-                = icetSparseImageUnpackageFromReceive(in_image_buffer);
+            in_image = bswapUnpackageImage(in_image_buffer);
 
             if (inOnTop) {
                 image_data = icetCompressedCompressedCompositeAlloc(
@@ -526,6 +555,7 @@ static void bswapComposeNoCombine(const IceTInt *compose_group,
                                     extra_pow2size,
                                     largest_group_size,
                                     working_image,
+                                    *piece_offset,
                                     spare_buffer);
         }
         /* Report I have no image. */
@@ -537,7 +567,7 @@ static void bswapComposeNoCombine(const IceTInt *compose_group,
             = icetSparseImageGetNumPixels(working_image);
 
         use_interlace
-            = (largest_group_size > 2) && icetIsEnabled(ICET_INTERLACE_IMAGES);
+            = (largest_group_size > 2) && icetSparseImageInterlaceEnabled();
         if (use_interlace) {
             IceTEnum old_working_buffer = working_buffer;
             working_image = icetSparseImageInterlaceAlloc(working_image,
@@ -644,7 +674,7 @@ void icetBswapFoldingCompose(const IceTInt *compose_group,
     }
 
     /* Interlace images when requested. */
-    use_interlace = (pow2size > 2) && icetIsEnabled(ICET_INTERLACE_IMAGES);
+    use_interlace = (pow2size > 2) && icetSparseImageInterlaceEnabled();
     if (use_interlace) {
         working_image = icetSparseImageInterlaceAlloc(input_image,
                                                       pow2size,
@@ -674,7 +704,7 @@ void icetBswapFoldingCompose(const IceTInt *compose_group,
                                              ICET_BYTE,
                                              compose_group[whole_group_index+1],
                                              BSWAP_FOLD);
-                in_image = icetSparseImageUnpackageFromReceive(in_data);
+                in_image = bswapUnpackageImage(in_data);
 
                 working_image = icetCompressedCompressedCompositeAlloc(
                                                                   working_image,
@@ -687,8 +717,8 @@ void icetBswapFoldingCompose(const IceTInt *compose_group,
                 IceTVoid *package_buffer;
                 IceTSizeType package_size;
 
-                icetSparseImagePackageForSend(working_image,
-                                              &package_buffer, &package_size);
+                bswapPackageImage(working_image,
+                                  &package_buffer, &package_size);
 
                 icetCommSend(package_buffer,
                              package_size,
@@ -22,6 +22,45 @@
 #define FULL_IMAGE_DATA 20
 
 #define LARGE_MESSAGE 23
+#define SPLIT_WEIGHTS_DATA 24
+
+/* Packages a tile image for icetSendRecvLargeMessages and encodes it for the
+   wire, if wire encoding is enabled and the image is not sent to this process.
+   Only one message is sent at a time, so all images can be encoded into the
+   same buffer. */
+static IceTVoid *rtPackageTileImage(IceTSparseImage image,
+                                    IceTInt dest,
+                                    IceTSizeType *size)
+{
+    IceTVoid *buffer;
+    IceTVoid *encode_buffer = NULL;
+    IceTInt rank;
+
+    icetGetIntegerv(ICET_RANK, &rank);
+    if (dest == rank) {
+        icetSparseImagePackageForSend(image, &buffer, size);
+        return buffer;
+    }
+    if (icetSparseImageWireEncodingEnabled()) {
+        encode_buffer = icetGetStateBuffer(
+                                ICET_WIRE_ENCODE_BUF,
+                                icetSparseImageEncodeBufferSize(image));
+    }
+    icetSparseImageEncodeForSend(image, encode_buffer, &buffer, size);
+    return buffer;
+}
+/* Reverses rtPackageTileImage.  The image is valid until the next one is
+   received. */
+static IceTSparseImage rtUnpackageTileImage(IceTVoid *buffer)
+{
+    IceTSizeType decoded_size = icetSparseImageDecodedBufferSize(buffer);
+    IceTVoid *decode_buffer = NULL;
+
+    if (decoded_size > 0) {
+        decode_buffer = icetGetStateBuffer(ICET_WIRE_DECODE_BUF, decoded_size);
+    }
+    return icetSparseImageDecodeFromReceive(buffer, decode_buffer);
+}
 
 static IceTImage rtfi_image;
 static IceTBoolean rtfi_first;
@@ -31,7 +70,6 @@ static IceTVoid *rtfi_generateDataFunc(IceTInt id, IceTInt dest,
     const IceTInt *tile_list
         = icetUnsafeStateGetInteger(ICET_CONTAINED_TILES_LIST);
     IceTSparseImage outSparseImage;
-    IceTVoid *outBuffer;
 
     icetGetIntegerv(ICET_RANK, &rank);
     if (dest == rank) {
@@ -42,8 +80,7 @@ static IceTVoid *rtfi_generateDataFunc(IceTInt id, IceTInt dest,
         return NULL;
     }
     outSparseImage = icetGetCompressedTileImage(tile_list[id]);
-    icetSparseImagePackageForSend(outSparseImage, &outBuffer, size);
-    return outBuffer;
+    return rtPackageTileImage(outSparseImage, dest, size);
 }
 static void rtfi_handleDataFunc(void *inSparseImageBuffer, IceTInt src) {
     if (inSparseImageBuffer == NULL) {
@@ -55,7 +92,7 @@ static void rtfi_handleDataFunc(void *inSparseImageBuffer, IceTInt src) {
         }
     } else {
         IceTSparseImage inSparseImage
-            = icetSparseImageUnpackageFromReceive(inSparseImageBuffer);
+            = rtUnpackageTileImage(inSparseImageBuffer);
         if (rtfi_first) {
             icetDecompressImage(inSparseImage, rtfi_image);
         } else {
@@ -109,22 +146,20 @@ void icetRenderTransferFullImages(IceTImage image,
 
 static IceTSparseImage rtsi_workingImage;
 static IceTSparseImage rtsi_availableImage;
+static IceTEnum rtsi_workingBuffer;
+static IceTEnum rtsi_availableBuffer;
 static IceTBoolean rtsi_first;
 static IceTVoid *rtsi_generateDataFunc(IceTInt id, IceTInt dest,
                                        IceTSizeType *size) {
     const IceTInt *tile_list
         = icetUnsafeStateGetInteger(ICET_CONTAINED_TILES_LIST);
     IceTSparseImage outSparseImage;
-    IceTVoid *outBuffer;
-    (void)dest; /* Unused */
 
     outSparseImage = icetGetCompressedTileImage(tile_list[id]);
-    icetSparseImagePackageForSend(outSparseImage, &outBuffer, size);
-    return outBuffer;
+    return rtPackageTileImage(outSparseImage, dest, size);
 }
 static void rtsi_handleDataFunc(void *inSparseImageBuffer, IceTInt src) {
-    IceTSparseImage inSparseImage
-        = icetSparseImageUnpackageFromReceive(inSparseImageBuffer);
+    IceTSparseImage inSparseImage = rtUnpackageTileImage(inSparseImageBuffer);
     if (rtsi_first) {
         IceTSizeType num_pixels
             = icetSparseImageGetNumPixels(inSparseImage);
@@ -155,27 +190,63 @@ static void rtsi_handleDataFunc(void *inSparseImageBuffer, IceTInt src) {
     }
     rtsi_first = ICET_FALSE;
 }
-IceTSparseImage icetRenderTransferSparseImages(IceTSparseImage compositeImage1,
-                                               IceTSparseImage compositeImage2,
-                                               IceTVoid *inImageBuffer,
-                                               IceTInt *tile_image_dest)
+static void rtsi_handleLayeredDataFunc(void *inSparseImageBuffer, IceTInt src){
+    IceTSparseImage inSparseImage = rtUnpackageTileImage(inSparseImageBuffer);
+    if (rtsi_first) {
+      /* The incoming buffer is reused for the next message, so copy the image
+         to a buffer of its own. */
+        IceTVoid *buffer = icetGetStateBuffer(
+                        rtsi_workingBuffer,
+                        icetSparseImageGetCompressedBufferSize(inSparseImage));
+        rtsi_workingImage = icetSparseLayeredImageAssignBuffer(
+                                        buffer,
+                                        icetSparseImageGetWidth(inSparseImage),
+                                        icetSparseImageGetHeight(inSparseImage));
+        icetSparseImageCopyPixels(inSparseImage,
+                                  0,
+                                  icetSparseImageGetNumPixels(inSparseImage),
+                                  rtsi_workingImage);
+    } else {
+        IceTInt rank;
+        const IceTInt *process_orders;
+        IceTEnum old_workingBuffer;
+
+        icetGetIntegerv(ICET_RANK, &rank);
+        process_orders = icetUnsafeStateGetInteger(ICET_PROCESS_ORDERS);
+      /* Layered images grow with every composite, so the result is placed in
+         a buffer sized to fit it. */
+        if (process_orders[src] < process_orders[rank]) {
+            rtsi_workingImage = icetCompressedCompressedCompositeAlloc(
+                                                         inSparseImage,
+                                                         rtsi_workingImage,
+                                                         rtsi_availableBuffer);
+        } else {
+            rtsi_workingImage = icetCompressedCompressedCompositeAlloc(
+                                                         rtsi_workingImage,
+                                                         inSparseImage,
+                                                         rtsi_availableBuffer);
+        }
+
+        old_workingBuffer = rtsi_workingBuffer;
+        rtsi_workingBuffer = rtsi_availableBuffer;
+        rtsi_availableBuffer = old_workingBuffer;
+    }
+    rtsi_first = ICET_FALSE;
+}
+static void rtsiSendRecvTileImages(IceTHandleData handleDataFunc,
+                                   IceTVoid *inImageBuffer,
+                                   IceTSizeType inImageBufferSize,
+                                   IceTInt *tile_image_dest)
 {
     IceTInt num_sending;
     const IceTInt *tile_list;
     IceTInt num_tiles;
-    IceTInt width, height;
     IceTInt *imageDestinations;
 
     IceTInt i;
 
-    rtsi_workingImage = compositeImage1;
-    rtsi_availableImage = compositeImage2;
-    rtsi_first = ICET_TRUE;
-
     icetGetIntegerv(ICET_NUM_CONTAINED_TILES, &num_sending);
     tile_list = icetUnsafeStateGetInteger(ICET_CONTAINED_TILES_LIST);
-    icetGetIntegerv(ICET_TILE_MAX_WIDTH, &width);
-    icetGetIntegerv(ICET_TILE_MAX_HEIGHT, &height);
     icetGetIntegerv(ICET_NUM_TILES, &num_tiles);
 
     imageDestinations = malloc(num_tiles * sizeof(IceTInt));
@@ -188,11 +259,118 @@ IceTSparseImage icetRenderTransferSparseImages(IceTSparseImage compositeImage1,
 
     icetSendRecvLargeMessages(num_sending, imageDestinations,
                               icetIsEnabled(ICET_ORDERED_COMPOSITE),
-                              rtsi_generateDataFunc, rtsi_handleDataFunc,
+                              rtsi_generateDataFunc, handleDataFunc,
                               inImageBuffer,
-                              icetSparseImageBufferSize(width, height));
+                              inImageBufferSize);
 
     free(imageDestinations);
+}
+IceTSparseImage icetRenderTransferSparseImages(IceTSparseImage compositeImage1,
+                                               IceTSparseImage compositeImage2,
+                                               IceTVoid *inImageBuffer,
+                                               IceTInt *tile_image_dest)
+{
+    IceTInt width, height;
+
+    rtsi_workingImage = compositeImage1;
+    rtsi_availableImage = compositeImage2;
+    rtsi_first = ICET_TRUE;
+
+    icetGetIntegerv(ICET_TILE_MAX_WIDTH, &width);
+    icetGetIntegerv(ICET_TILE_MAX_HEIGHT, &height);
+
+    rtsiSendRecvTileImages(rtsi_handleDataFunc,
+                           inImageBuffer,
+                           icetSparseImageBufferSize(width, height),
+                           tile_image_dest);
+
+    return rtsi_workingImage;
+}
+
+#define ICET_RENDER_TRANSFER_LAYERS_BUF         ICET_STRATEGY_COMMON_BUF_0
+
+/* Returns the largest number of layers in the pre-rendered layered images of
+   all processes, or 0 if the images are not composited as layered images. */
+static IceTLayerCount rtsiMaxNumLayers(void)
+{
+    IceTBoolean use_prerender;
+    IceTEnum composite_mode;
+    IceTImage render_image;
+    IceTInt num_proc;
+    IceTInt num_layers;
+    IceTInt *all_num_layers;
+    IceTInt max_num_layers;
+    IceTInt i;
+
+    icetGetBooleanv(ICET_PRE_RENDERED, &use_prerender);
+    icetGetEnumv(ICET_COMPOSITE_MODE, &composite_mode);
+    if (!use_prerender || (composite_mode != ICET_COMPOSITE_MODE_BLEND)) {
+        return 0;
+    }
+
+    render_image = icetRetrieveStateImage(ICET_RENDER_BUFFER);
+    if (icetImageIsNull(render_image) || !icetImageIsLayered(render_image)) {
+        return 0;
+    }
+
+    /* Each process may have a different number of layers, and the incoming
+       buffer must be able to hold the largest image sent to this process. */
+    icetGetIntegerv(ICET_NUM_PROCESSES, &num_proc);
+    all_num_layers = icetGetStateBuffer(ICET_RENDER_TRANSFER_LAYERS_BUF,
+                                        num_proc * sizeof(IceTInt));
+    num_layers = icetImageGetNumLayers(render_image);
+    icetCommAllgather(&num_layers, 1, ICET_INT, all_num_layers);
+
+    max_num_layers = 0;
+    for (i = 0; i < num_proc; i++) {
+        if (all_num_layers[i] > max_num_layers) {
+            max_num_layers = all_num_layers[i];
+        }
+    }
+    return (IceTLayerCount)max_num_layers;
+}
+
+IceTSparseImage icetRenderTransferSparseImagesAlloc(
+                                                 IceTEnum composite_buffer_1,
+                                                 IceTEnum composite_buffer_2,
+                                                 IceTEnum in_image_buffer,
+                                                 IceTInt *tile_image_dest)
+{
+    IceTInt width, height;
+    IceTLayerCount num_layers;
+    IceTSizeType sparse_image_size;
+    IceTVoid *inImageBuffer;
+
+    icetGetIntegerv(ICET_TILE_MAX_WIDTH, &width);
+    icetGetIntegerv(ICET_TILE_MAX_HEIGHT, &height);
+
+    num_layers = rtsiMaxNumLayers();
+
+    if (num_layers == 0) {
+        sparse_image_size = icetSparseImageBufferSize(width, height);
+        inImageBuffer = icetGetStateBuffer(in_image_buffer, sparse_image_size);
+        return icetRenderTransferSparseImages(
+                       icetGetStateBufferSparseImage(composite_buffer_1,
+                                                     width, height),
+                       icetGetStateBufferSparseImage(composite_buffer_2,
+                                                     width, height),
+                       inImageBuffer,
+                       tile_image_dest);
+    }
+
+    sparse_image_size
+        = icetSparseLayeredImageBufferSize(width, height, num_layers);
+    inImageBuffer = icetGetStateBuffer(in_image_buffer, sparse_image_size);
+
+    rtsi_workingImage = icetSparseImageNull();
+    rtsi_workingBuffer = composite_buffer_1;
+    rtsi_availableBuffer = composite_buffer_2;
+    rtsi_first = ICET_TRUE;
+
+    rtsiSendRecvTileImages(rtsi_handleLayeredDataFunc,
+                           inImageBuffer,
+                           sparse_image_size,
+                           tile_image_dest);
 
     return rtsi_workingImage;
 }
@@ -532,7 +710,7 @@ static void icetDoSendRecvLarge(const IceTInt *sendIds,
                 if (messagesInOrder) {
                     src_rank = composite_order[recv_order_idx];
                 } else {
-                    src_rank = recv_iter_state;
+                    src_rank = recv_order_idx;
                 }
                 (*handleDataFunc)(incomingBuffer, src_rank);
             }
@@ -568,6 +746,109 @@ void icetSendRecvLargeMessages(IceTInt numMessagesSending,
                         bufferSize);
 }
 
+#define SPLIT_WEIGHTS_NUM_BINS          4096
+#define ICET_SPLIT_WEIGHTS_COUNT_BUF    ICET_STRATEGY_COMMON_BUF_0
+#define ICET_SPLIT_WEIGHTS_INCOMING_BUF ICET_STRATEGY_COMMON_BUF_1
+
+/* Sums the fragments in the input images of all processes in the group and
+   stores their accumulated distribution over the pixels in
+   ICET_SPLIT_FRAGMENT_WEIGHTS.  While set, images are split into partitions
+   holding equal shares of the fragments rather than equal numbers of pixels
+   (see ICET_SPLIT_PARTITION_OFFSETS) and are not interlaced.
+   Every pixel counts as one additional fragment to account for its run
+   length and to keep empty regions from collapsing into a single partition.
+   The fragments are counted in a fixed number of bins, which are summed up a
+   binomial tree to the first process of the group and the sums sent back down
+   the same tree, so every process sends and receives O(log(group_size))
+   messages of constant size.  Only point-to-point messages are used, because
+   the group may be a subset of all processes. */
+static void icetSingleImageSetSplitWeights(const IceTInt *compose_group,
+                                           IceTInt group_size,
+                                           const IceTSparseImage input_image)
+{
+    IceTInt group_rank;
+    IceTInt mask;
+    IceTSizeType num_pixels;
+    IceTSizeType bin_size;
+    IceTSizeType num_bins;
+    IceTInt *counts;
+    IceTInt *incoming;
+    IceTDouble *weights;
+    IceTSizeType bin;
+
+    group_rank = icetFindMyRankInGroup(compose_group, group_size);
+
+    num_pixels = icetSparseImageGetNumPixels(input_image);
+    bin_size = (num_pixels + SPLIT_WEIGHTS_NUM_BINS - 1)/SPLIT_WEIGHTS_NUM_BINS;
+    if (bin_size < 1) bin_size = 1;
+    num_bins = (num_pixels + bin_size - 1)/bin_size;
+
+    counts = icetGetStateBuffer(ICET_SPLIT_WEIGHTS_COUNT_BUF,
+                                num_bins*sizeof(IceTInt));
+    incoming = icetGetStateBuffer(ICET_SPLIT_WEIGHTS_INCOMING_BUF,
+                                  num_bins*sizeof(IceTInt));
+    icetSparseImageCountFragments(input_image, bin_size, counts);
+
+    /* Reduce the counts to group rank 0.  A process receives from the
+       processes whose group rank differs only in bits below its lowest set
+       bit and then sends its sum to the process with that bit cleared. */
+    for (mask = 1; mask < group_size; mask <<= 1) {
+        if ((group_rank & mask) != 0) {
+            icetCommSend(counts,
+                         num_bins,
+                         ICET_INT,
+                         compose_group[group_rank - mask],
+                         SPLIT_WEIGHTS_DATA);
+            break;
+        } else if (group_rank + mask < group_size) {
+            icetCommRecv(incoming,
+                         num_bins,
+                         ICET_INT,
+                         compose_group[group_rank + mask],
+                         SPLIT_WEIGHTS_DATA);
+            for (bin = 0; bin < num_bins; bin++) {
+                counts[bin] += incoming[bin];
+            }
+        }
+    }
+
+    /* Broadcast the sums back down the same tree. */
+    if (group_rank != 0) {
+        icetCommRecv(counts,
+                     num_bins,
+                     ICET_INT,
+                     compose_group[group_rank - mask],
+                     SPLIT_WEIGHTS_DATA);
+    }
+    for (mask >>= 1; mask > 0; mask >>= 1) {
+        if (group_rank + mask < group_size) {
+            icetCommSend(counts,
+                         num_bins,
+                         ICET_INT,
+                         compose_group[group_rank + mask],
+                         SPLIT_WEIGHTS_DATA);
+        }
+    }
+
+    weights = icetStateAllocateDouble(ICET_SPLIT_FRAGMENT_WEIGHTS, num_bins+1);
+    icetStateSetInteger(ICET_SPLIT_WEIGHTS_BIN_SIZE, bin_size);
+
+    weights[0] = 0.0;
+    for (bin = 0; bin < num_bins; bin++) {
+        IceTSizeType bin_pixels = num_pixels - bin*bin_size;
+        if (bin_pixels > bin_size) bin_pixels = bin_size;
+        weights[bin+1] = weights[bin] + counts[bin] + bin_pixels;
+    }
+
+    /* The partition table is built on the first split of the whole image. */
+    {
+        IceTInt whole_image[2];
+        whole_image[0] = 0;
+        whole_image[1] = num_pixels;
+        icetStateSetIntegerv(ICET_SPLIT_PARTITION_OFFSETS, 2, whole_image);
+    }
+}
+
 void icetSingleImageCompose(const IceTInt *compose_group,
                             IceTInt group_size,
                             IceTInt image_dest,
@@ -576,8 +857,18 @@ void icetSingleImageCompose(const IceTInt *compose_group,
                             IceTSizeType *piece_offset)
 {
     IceTEnum strategy;
+    IceTBoolean balance_split;
 
     icetGetEnumv(ICET_SINGLE_IMAGE_STRATEGY, &strategy);
+
+    balance_split = (   icetIsEnabled(ICET_SPLIT_BALANCE_FRAGMENTS)
+                     && (strategy != ICET_SINGLE_IMAGE_STRATEGY_TREE)
+                     && (group_size > 1) );
+
+    if (balance_split) {
+        icetSingleImageSetSplitWeights(compose_group, group_size, input_image);
+    }
+
     icetInvokeSingleImageStrategy(strategy,
                                   compose_group,
                                   group_size,
@@ -585,6 +876,11 @@ void icetSingleImageCompose(const IceTInt *compose_group,
                                   input_image,
                                   result_image,
                                   piece_offset);
+
+    if (balance_split) {
+        icetStateSetDoublev(ICET_SPLIT_FRAGMENT_WEIGHTS, 0, NULL);
+        icetStateSetIntegerv(ICET_SPLIT_PARTITION_OFFSETS, 0, NULL);
+    }
 }
 
 #define ICET_IMAGE_COLLECT_OFFSET_BUF ICET_STRATEGY_COMMON_BUF_0
@@ -747,3 +1043,145 @@ void icetSingleImageCollect(const IceTSparseImage input_image,
 
     icetTimingCollectEnd();
 }
+
+#define ICET_DEEP_COLLECT_PIECES_BUF ICET_STRATEGY_COMMON_BUF_2
+
+typedef struct {
+    IceTSizeType offset;
+    IceTSparseImage image;
+} IceTDeepPiece;
+
+static int icetCompareDeepPieces(const void *a, const void *b)
+{
+    IceTSizeType offset_a = ((const IceTDeepPiece *)a)->offset;
+    IceTSizeType offset_b = ((const IceTDeepPiece *)b)->offset;
+    return (offset_a > offset_b) - (offset_a < offset_b);
+}
+
+IceTSparseImage icetSingleImageCollectLayered(const IceTSparseImage input_image,
+                                              IceTInt dest,
+                                              IceTSizeType piece_offset,
+                                              IceTSizeType width,
+                                              IceTSizeType height)
+{
+    IceTSizeType *offsets;
+    IceTSizeType *sizes;
+    IceTInt rank;
+    IceTInt numproc;
+    IceTSparseImage package_image = input_image;
+    IceTVoid *package;
+    IceTSizeType package_size;
+    IceTDeepPiece *pieces;
+    IceTSparseImage *piece_images;
+    IceTSizeType *displacements;
+    IceTByte *received;
+    IceTSizeType out_size;
+    IceTSparseImage result_image;
+    IceTInt num_pieces;
+    IceTInt proc;
+
+    rank = icetCommRank();
+    numproc = icetCommSize();
+
+    /* Pieces are sent packaged, so empty ones cost nothing. */
+    if (icetSparseImageGetNumPixels(input_image) > 0) {
+        icetSparseImagePackageForSend(package_image, &package, &package_size);
+    } else {
+        package = NULL;
+        package_size = 0;
+    }
+
+    if (rank == dest) {
+        offsets = icetGetStateBuffer(ICET_IMAGE_COLLECT_OFFSET_BUF,
+                                     sizeof(IceTSizeType)*numproc);
+        sizes = icetGetStateBuffer(ICET_IMAGE_COLLECT_SIZE_BUF,
+                                   sizeof(IceTSizeType)*numproc);
+    } else {
+        offsets = NULL;
+        sizes = NULL;
+    }
+    icetCommGather(&piece_offset, 1, ICET_SIZE_TYPE, offsets, dest);
+    icetCommGather(&package_size, 1, ICET_SIZE_TYPE, sizes, dest);
+
+    icetTimingCollectBegin();
+
+    if (rank != dest) {
+        icetCommGatherv(package, package_size, ICET_BYTE,
+                        NULL, NULL, NULL, dest);
+        icetTimingCollectEnd();
+        return icetSparseImageNull();
+    }
+
+    {
+        IceTByte *buffer = icetGetStateBuffer(
+                                   ICET_DEEP_COLLECT_PIECES_BUF,
+                                     numproc*sizeof(IceTDeepPiece)
+                                   + numproc*sizeof(IceTSparseImage)
+                                   + numproc*sizeof(IceTSizeType));
+        pieces = (IceTDeepPiece *)buffer;
+        piece_images = (IceTSparseImage *)(pieces + numproc);
+        displacements = (IceTSizeType *)(piece_images + numproc);
+    }
+
+    /* Each piece grows by at most its promotion to the general layered
+       format.  The header of each piece is not copied, which leaves room for
+       the runs of inactive pixels inserted between pieces. */
+    out_size = icetSparseLayeredImageBufferSize(0, 0, 1);
+    for (proc = 0; proc < numproc; proc++) {
+        displacements[proc] = (proc > 0)
+                              ? displacements[proc-1] + sizes[proc-1] : 0;
+        if (sizes[proc] > 0) {
+            out_size += icetSparseLayeredImagePromotedBufferSize(sizes[proc]);
+        }
+    }
+
+    received = icetGetStateBuffer(ICET_DEEP_COLLECT_BUF,
+                                    displacements[numproc-1]
+                                  + sizes[numproc-1]);
+    icetCommGatherv(package, package_size, ICET_BYTE,
+                    received, sizes, displacements, dest);
+
+    /* Stitch the pieces together in the order of their pixels. */
+    num_pieces = 0;
+    for (proc = 0; proc < numproc; proc++) {
+        if (sizes[proc] > 0) {
+            pieces[num_pieces].offset = offsets[proc];
+            pieces[num_pieces].image = icetSparseImageUnpackageFromReceive(
+                                               received + displacements[proc]);
+            num_pieces++;
+        }
+    }
+    qsort(pieces, num_pieces, sizeof(IceTDeepPiece), icetCompareDeepPieces);
+    for (proc = 0; proc < num_pieces; proc++) {
+        offsets[proc] = pieces[proc].offset;
+        piece_images[proc] = pieces[proc].image;
+    }
+
+    result_image = icetSparseLayeredImageAssignBuffer(
+                        icetGetStateBuffer(ICET_DEEP_IMAGE_BUF, out_size),
+                        width, height);
+    icetSparseLayeredImageStitch(piece_images, offsets, num_pieces,
+                                 result_image);
+
+    icetTimingCollectEnd();
+
+    return result_image;
+}
+
+IceTSparseImage icetSingleImageKeepLayered(const IceTSparseImage input_image)
+{
+    IceTSizeType offset = 0;
+    IceTSparseImage result_image;
+
+    result_image = icetSparseLayeredImageAssignBuffer(
+                       icetGetStateBuffer(
+                           ICET_DEEP_IMAGE_BUF,
+                           icetSparseLayeredImagePromotedBufferSize(
+                               icetSparseImageGetCompressedBufferSize(
+                                                              input_image))),
+                       icetSparseImageGetWidth(input_image),
+                       icetSparseImageGetHeight(input_image));
+    icetSparseLayeredImageStitch(&input_image, &offset, 1, result_image);
+
+    return result_image;
+}
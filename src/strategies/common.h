@@ -66,6 +66,28 @@ IceTSparseImage icetRenderTransferSparseImages(IceTSparseImage compositeImage1,
                                                IceTVoid *inImageBuffer,
                                                IceTInt *tile_image_dest);
 
+/* icetRenderTransferSparseImagesAlloc
+
+   Same as icetRenderTransferSparseImages except that the buffers are allocated
+   in the given state variables.  This variant also transfers layered images,
+   for which the size of the composited image is not known in advance.
+
+   composite_buffer_1, composite_buffer_2 - State buffers used to store
+        composite results.
+   in_image_buffer - State buffer used to receive incoming images.
+   tile_image_dest - if tile t is in ICET_CONTAINED_TILES, then the
+        rendered image for tile t is sent to tile_image_dest[t].
+
+   Returns the composited image sent to this process, which resides in one of
+   the composite buffers.  If nothing is sent to this process, the contents are
+   undefined for flat images and a null image is returned for layered ones.
+*/
+IceTSparseImage icetRenderTransferSparseImagesAlloc(
+                                                 IceTEnum composite_buffer_1,
+                                                 IceTEnum composite_buffer_2,
+                                                 IceTEnum in_image_buffer,
+                                                 IceTInt *tile_image_dest);
+
 
 /* icetSendRecvLargeMessages
 
@@ -183,4 +205,25 @@ void icetSingleImageCollect(const IceTSparseImage input_image,
                             IceTSizeType piece_offset,
                             IceTImage result_image);
 
+/* icetSingleImageCollectLayered
+
+   Like icetSingleImageCollect, but collects the pieces of a layered image
+   without blending their fragments.  The pieces are stitched into a sparse
+   layered image of width by height pixels, which is placed in the
+   ICET_DEEP_IMAGE_BUF state buffer of the dest process and returned.  All
+   other processes get a null image.  */
+IceTSparseImage icetSingleImageCollectLayered(const IceTSparseImage input_image,
+                                              IceTInt dest,
+                                              IceTSizeType piece_offset,
+                                              IceTSizeType width,
+                                              IceTSizeType height);
+
+/* icetSingleImageKeepLayered
+
+   Stores the piece of a layered image left on this process by
+   icetSingleImageCompose in the ICET_DEEP_IMAGE_BUF state buffer without
+   blending its fragments.  Used in place of icetSingleImageCollectLayered when
+   images are not collected.  */
+IceTSparseImage icetSingleImageKeepLayered(const IceTSparseImage input_image);
+
 #endif /*_ICET_STRATEGY_COMMON_H_*/
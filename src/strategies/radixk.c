@@ -35,6 +35,7 @@
 
 #define RADIXK_SWAP_IMAGE_TAG_START     2200
 #define RADIXK_TELESCOPE_IMAGE_TAG      2300
+#define RADIXK_SIZE_TAG_START           2400
 
 #define RADIXK_RECEIVE_BUFFER                   ICET_SI_STRATEGY_BUFFER_0
 #define RADIXK_SEND_BUFFER                      ICET_SI_STRATEGY_BUFFER_1
@@ -47,6 +48,14 @@
 #define RADIXK_SPLIT_OFFSET_ARRAY_BUFFER        ICET_SI_STRATEGY_BUFFER_8
 #define RADIXK_SPLIT_IMAGE_ARRAY_BUFFER         ICET_SI_STRATEGY_BUFFER_9
 #define RADIXK_RANK_LIST_BUFFER                 ICET_SI_STRATEGY_BUFFER_10
+#define RADIXK_WIRE_SEND_BUFFER                 ICET_SI_STRATEGY_BUFFER_11
+#define RADIXK_WIRE_RECEIVE_BUFFER              ICET_SI_STRATEGY_BUFFER_12
+#define RADIXK_SIZE_BUFFER                      ICET_SI_STRATEGY_BUFFER_13
+
+/* Images sent ahead of their size are preceded by a message of this many
+   IceTInts: the decoded size, the encoded size and, for layered images, the
+   fragment count size and maximum number of fragments per pixel. */
+#define RADIXK_SIZE_MESSAGE_LENGTH      4
 
 typedef struct radixkRoundInfoStruct {
     IceTInt k; /* k value for this round. */
@@ -67,6 +76,11 @@ typedef struct radixkPartnerInfoStruct {
     IceTSizeType offset; /* Offset of partner's partition in image. */
     IceTSizeType receiveCount; /* Number of bytes to receive from partner. */
     IceTVoid *receiveBuffer; /* A buffer for receiving data from partner. */
+    IceTSizeType wireCount; /* Number of bytes partner sends (encoded). */
+    IceTVoid *wireBuffer; /* Where data from partner arrives (encoded). */
+    IceTSizeType countSize; /* Fragment count size of partner's layered image. */
+    IceTLayerCount maxFragments; /* Max fragments per pixel of layered image. */
+    IceTSizeType sliceSize; /* Bytes reserved in receive and spare buffers. */
     IceTSparseImage sendImage; /* A buffer to hold data being sent to partner. */
     IceTSparseImage receiveImage; /* Hold for received non-composited image. */
     IceTSparseImage spareImage; /* Destination for compositing received images. */
@@ -427,6 +441,11 @@ static radixkPartnerInfo *radixkGetPartners(const radixkRoundInfo *round_info,
         p->offset = -1;
         p->receiveCount = -1;
         p->receiveBuffer = NULL;
+        p->wireCount = -1;
+        p->wireBuffer = NULL;
+        p->countSize = 0;
+        p->maxFragments = 0;
+        p->sliceSize = -1;
         p->sendImage = icetSparseImageNull();
         p->receiveImage = icetSparseImageNull();
         p->spareImage = icetSparseImageNull();
@@ -435,6 +454,32 @@ static radixkPartnerInfo *radixkGetPartners(const radixkRoundInfo *round_info,
     return partners;
 }
 
+/* Returns the number of bytes reserved for a partner's image in the receive and
+   spare buffers.  Layered images grow when composited if they hold a single
+   fragment per pixel or their fragment counts are widened to
+   composite_count_size, so they get as much extra room as that takes.  Spare
+   images are cleared when assigned, which writes a run length even if the
+   received image has no pixels and consists of its header only. */
+static IceTSizeType radixkImageSliceSize(const radixkPartnerInfo *p,
+                                         IceTBoolean layered_images,
+                                         IceTSizeType composite_count_size)
+{
+    IceTSizeType size;
+    IceTSizeType empty_size;
+
+    if (layered_images) {
+        size = icetSparseLayeredImageCompositeBufferSize(p->receiveCount,
+                                                         p->countSize,
+                                                         composite_count_size);
+        empty_size = icetSparseLayeredImageBufferSize(0, 0, 1);
+    } else {
+        size = p->receiveCount;
+        empty_size = icetSparseImageBufferSize(0, 0);
+    }
+
+    return (size < empty_size) ? empty_size : size;
+}
+
 /* As applicable, posts an asynchronous receive for each process from which
    we are receiving an image piece.  Must be called after radixkPostSends. */
 static IceTCommRequest *radixkPostReceives(radixkPartnerInfo *partners,
@@ -450,9 +495,16 @@ static IceTCommRequest *radixkPostReceives(radixkPartnerInfo *partners,
     IceTByte *recv_buffer;
     /* Start of the next partner's spare buffer to composite into. */
     IceTByte *spare_buffer;
+    /* Combined size of all received images that arrive encoded. */
+    IceTSizeType wire_size;
+    /* Start of the next partner's encoded image. */
+    IceTByte *wire_buffer = NULL;
     /* Number of pixels in each image this process receives. */
     IceTSizeType partition_num_pixels = -1;
+    /* Fragment count size of the layered images composited this round. */
+    IceTSizeType composite_count_size = 0;
     IceTBoolean layered_images = icetSparseImageIsLayered(my_image);
+    IceTBoolean wire_encoding = icetSparseImageWireEncodingEnabled();
 
     /* If not collecting any image partition, post no receives. */
     if (!round_info->has_image) { return NULL; }
@@ -463,6 +515,7 @@ static IceTCommRequest *radixkPostReceives(radixkPartnerInfo *partners,
     /* Probe incoming messages and accumulate their sizes. */
     tag = RADIXK_SWAP_IMAGE_TAG_START + current_round;
     total_size = 0;
+    wire_size = 0;
 
     for (IceTInt i = 0; i < round_info->k; i++) {
         radixkPartnerInfo *p = &partners[i];
@@ -472,16 +525,74 @@ static IceTCommRequest *radixkPostReceives(radixkPartnerInfo *partners,
             icetSparseImagePackageForSend(p->sendImage,
                                           &p->receiveBuffer,
                                           &p->receiveCount);
+            p->wireCount = p->receiveCount;
             partition_num_pixels = icetSparseImageGetNumPixels(p->sendImage);
+            if (layered_images) {
+                icetSparseLayeredImageGetFragmentCounts(p->sendImage,
+                                                        &p->countSize,
+                                                        &p->maxFragments);
+            }
+        } else if (wire_encoding || layered_images) {
+            /* Encoded images are preceded by their decoded and encoded size,
+               since the buffers must fit the decoded image.  Layered images
+               are preceded by how they count fragments, which decides how much
+               they grow when composited. */
+            IceTInt sizes[RADIXK_SIZE_MESSAGE_LENGTH];
+            icetCommRecv(sizes,
+                         RADIXK_SIZE_MESSAGE_LENGTH,
+                         ICET_INT,
+                         p->rank,
+                         RADIXK_SIZE_TAG_START + current_round);
+            p->receiveCount = sizes[0];
+            p->wireCount = sizes[1];
+            p->countSize = sizes[2];
+            p->maxFragments = (IceTLayerCount)sizes[3];
+            if (p->wireCount != p->receiveCount) {
+                wire_size += p->wireCount;
+            }
         } else {
             /* Wait for the partner to initiate the send and store its size. */
             IceTCommRecvInfo recvinfo;
             icetCommProbe(ICET_BYTE, p->rank, tag, &recvinfo);
             p->receiveCount = recvinfo.count;
+            p->wireCount = p->receiveCount;
+        }
+    }
+
+    /* Merging the layered images may widen their fragment counts as far as
+       needed for the fragments of all of them. */
+    if (layered_images) {
+        IceTLayerCount largest_max_fragments = 0;
+        IceTLayerCount total_max_fragments = 0;
+        for (IceTInt i = 0; i < round_info->k; i++) {
+            IceTLayerCount max_fragments = partners[i].maxFragments;
+            if (max_fragments > largest_max_fragments) {
+                largest_max_fragments = max_fragments;
+            }
+            /* Stop at the largest count, which keeps the sum from
+               overflowing. */
+            if (total_max_fragments < 0x7FFFFFFF - max_fragments) {
+                total_max_fragments += max_fragments;
+            } else {
+                total_max_fragments = 0x7FFFFFFF;
+            }
         }
+        composite_count_size = icetSparseLayeredImageCompositeCountSize(
+                                                        largest_max_fragments,
+                                                        total_max_fragments);
+    }
+
+    /* Accumulate message sizes. */
+    for (IceTInt i = 0; i < round_info->k; i++) {
+        radixkPartnerInfo *p = &partners[i];
+        p->sliceSize = radixkImageSliceSize(p,
+                                            layered_images,
+                                            composite_count_size);
+        total_size += p->sliceSize;
+    }
 
-        /* Accumulate message sizes. */
-        total_size += p->receiveCount;
+    if (wire_size > 0) {
+        wire_buffer = icetGetStateBuffer(RADIXK_WIRE_RECEIVE_BUFFER, wire_size);
     }
 
     /* Allocate receive and spare buffer. */
@@ -503,11 +614,15 @@ static IceTCommRequest *radixkPostReceives(radixkPartnerInfo *partners,
      * images are placed in the unused RADIXK_SEND_BUFFER instead.
      */
     if (!round_info->split) {
-        if (   my_image_buffer
-            == icetUnsafeStateGetBuffer(RADIXK_RECEIVE_BUFFER)) {
+        /* Buffers that were never allocated cannot hold the image (and must
+         * not be queried). */
+        if (   (icetStateGetType(RADIXK_RECEIVE_BUFFER) == ICET_VOID)
+            && (   my_image_buffer
+                == icetUnsafeStateGetBuffer(RADIXK_RECEIVE_BUFFER)) ) {
             receive_buffer_pname = RADIXK_SEND_BUFFER;
-        } else if (   my_image_buffer
-                   == icetUnsafeStateGetBuffer(RADIXK_SPARE_BUFFER)) {
+        } else if (   (icetStateGetType(RADIXK_SPARE_BUFFER) == ICET_VOID)
+                   && (   my_image_buffer
+                       == icetUnsafeStateGetBuffer(RADIXK_SPARE_BUFFER)) ) {
             spare_buffer_pname = RADIXK_SEND_BUFFER;
         }
     }
@@ -535,10 +650,19 @@ static IceTCommRequest *radixkPostReceives(radixkPartnerInfo *partners,
                                           partition_num_pixels,
                                           1);
 
+        /* Images that are not encoded arrive directly in the receive buffer.
+           Encoded images are decoded into it once they arrive. */
+        if (p->wireCount != p->receiveCount) {
+            p->wireBuffer = wire_buffer;
+            wire_buffer += p->wireCount;
+        } else {
+            p->wireBuffer = recv_buffer;
+        }
+
         /* Begin asynchronous receive. */
         if (i != round_info->partition_index) {
-            receive_requests[i] = icetCommIrecv(recv_buffer,
-                                                p->receiveCount,
+            receive_requests[i] = icetCommIrecv(p->wireBuffer,
+                                                p->wireCount,
                                                 ICET_BYTE,
                                                 p->rank,
                                                 tag);
@@ -549,15 +673,70 @@ static IceTCommRequest *radixkPostReceives(radixkPartnerInfo *partners,
         }
 
         /* The next partner's images come directly after this one's. */
-        recv_buffer += p->receiveCount;
-        spare_buffer += p->receiveCount;
+        recv_buffer += p->sliceSize;
+        spare_buffer += p->sliceSize;
     }
 
     return receive_requests;
 }
 
+/* Posts an asynchronous send of an image to the process of the given rank.
+   If wire encoding is enabled, the image is encoded into *wire_buffer, which is
+   advanced past it.  Otherwise, wire_buffer points to NULL.  If image_sizes is
+   not NULL, the sizes of the image are sent in it ahead of the image (see
+   RADIXK_SIZE_MESSAGE_LENGTH).  Otherwise, size_request is set to null. */
+static IceTCommRequest radixkSendImage(const IceTSparseImage image,
+                                       IceTInt rank,
+                                       IceTInt current_round,
+                                       IceTByte **wire_buffer,
+                                       IceTInt *image_sizes,
+                                       IceTCommRequest *size_request)
+{
+    IceTVoid *package_buffer;
+    IceTSizeType package_size;
+
+    if (*wire_buffer != NULL) {
+        icetSparseImageEncodeForSend(image,
+                                     *wire_buffer,
+                                     &package_buffer,
+                                     &package_size);
+        *wire_buffer += icetSparseImageEncodeBufferSize(image);
+    } else {
+        icetSparseImagePackageForSend(image, &package_buffer, &package_size);
+    }
+
+    if (image_sizes != NULL) {
+        IceTSizeType count_size = 0;
+        IceTLayerCount max_fragments = 0;
+        if (icetSparseImageIsLayered(image)) {
+            icetSparseLayeredImageGetFragmentCounts(image,
+                                                    &count_size,
+                                                    &max_fragments);
+        }
+        image_sizes[0] = icetSparseImageGetCompressedBufferSize(image);
+        image_sizes[1] = package_size;
+        image_sizes[2] = count_size;
+        image_sizes[3] = (IceTInt)max_fragments;
+        *size_request = icetCommIsend(image_sizes,
+                                      RADIXK_SIZE_MESSAGE_LENGTH,
+                                      ICET_INT,
+                                      rank,
+                                      RADIXK_SIZE_TAG_START + current_round);
+    } else {
+        *size_request = ICET_COMM_REQUEST_NULL;
+    }
+
+    return icetCommIsend(package_buffer,
+                         package_size,
+                         ICET_BYTE,
+                         rank,
+                         RADIXK_SWAP_IMAGE_TAG_START + current_round);
+}
+
 /* As applicable, posts an asynchronous send for each process to which we are
-   sending an image piece. */
+   sending an image piece.  Returns an array of twice as many requests as there
+   are partners, the second half for the sizes sent ahead of encoded and layered
+   images. */
 static IceTCommRequest *radixkPostSends(radixkPartnerInfo *partners,
                                         const radixkRoundInfo *round_info,
                                         IceTInt current_round,
@@ -568,14 +747,17 @@ static IceTCommRequest *radixkPostSends(radixkPartnerInfo *partners,
     IceTCommRequest *send_requests;
     IceTInt *piece_offsets;
     IceTSparseImage *image_pieces;
-    IceTInt tag;
+    IceTByte *wire_buffer = NULL;
+    IceTInt *image_sizes = NULL;
+    IceTBoolean wire_encoding = icetSparseImageWireEncodingEnabled();
+    IceTBoolean size_messages =
+        wire_encoding || icetSparseImageIsLayered(image);
     IceTInt i;
 
-    tag = RADIXK_SWAP_IMAGE_TAG_START + current_round;
-
     if (round_info->split) {
-        send_requests=icetGetStateBuffer(RADIXK_SEND_REQUEST_BUFFER,
-                                         round_info->k*sizeof(IceTCommRequest));
+        send_requests = icetGetStateBuffer(
+                                    RADIXK_SEND_REQUEST_BUFFER,
+                                    2*round_info->k*sizeof(IceTCommRequest));
 
         piece_offsets = icetGetStateBuffer(RADIXK_SPLIT_OFFSET_ARRAY_BUFFER,
                                            round_info->k * sizeof(IceTInt));
@@ -592,6 +774,22 @@ static IceTCommRequest *radixkPostSends(radixkPartnerInfo *partners,
                                   image_pieces,
                                   piece_offsets);
 
+        if (wire_encoding) {
+            IceTSizeType wire_size = 0;
+            for (i = 0; i < round_info->k; i++) {
+                if (i == round_info->partition_index) { continue; }
+                wire_size +=
+                    icetSparseImageEncodeBufferSize(image_pieces[i]);
+            }
+            wire_buffer = icetGetStateBuffer(RADIXK_WIRE_SEND_BUFFER,
+                                             wire_size);
+        }
+        if (size_messages) {
+            image_sizes = icetGetStateBuffer(
+                      RADIXK_SIZE_BUFFER,
+                      RADIXK_SIZE_MESSAGE_LENGTH*round_info->k*sizeof(IceTInt));
+        }
+
         /* The pivot for loop arranges the sends to happen in an order such that
            those to be composited first in their destinations will be sent
            first.  This serves little purpose other than to try to stagger the
@@ -602,20 +800,20 @@ static IceTCommRequest *radixkPostSends(radixkPartnerInfo *partners,
             p->offset = piece_offsets[i];
             p->sendImage = image_pieces[i];
             if (i != round_info->partition_index) {
-                IceTVoid *package_buffer;
-                IceTSizeType package_size;
-
-                icetSparseImagePackageForSend(image_pieces[i],
-                                              &package_buffer, &package_size);
-
-                send_requests[i] = icetCommIsend(package_buffer,
-                                                 package_size,
-                                                 ICET_BYTE,
-                                                 p->rank,
-                                                 tag);
+                send_requests[i] = radixkSendImage(
+                                            image_pieces[i],
+                                            p->rank,
+                                            current_round,
+                                            &wire_buffer,
+                                            (image_sizes != NULL)
+                                            ? image_sizes
+                                              + RADIXK_SIZE_MESSAGE_LENGTH*i
+                                            : NULL,
+                                            &send_requests[round_info->k + i]);
             } else {
                 /* Implicitly send to myself. */
                 send_requests[i] = ICET_COMM_REQUEST_NULL;
+                send_requests[round_info->k + i] = ICET_COMM_REQUEST_NULL;
                 p->receiveImage = p->sendImage;
                 p->compositeLevel = 0;
             }
@@ -623,24 +821,31 @@ static IceTCommRequest *radixkPostSends(radixkPartnerInfo *partners,
     } else { /* !round_info->split */
         radixkPartnerInfo *p = &partners[round_info->partition_index];
         send_requests = icetGetStateBuffer(RADIXK_SEND_REQUEST_BUFFER,
-                                           sizeof(IceTCommRequest));
+                                           2*sizeof(IceTCommRequest));
         if (round_info->has_image) {
             send_requests[0] = ICET_COMM_REQUEST_NULL;
+            send_requests[1] = ICET_COMM_REQUEST_NULL;
             p->receiveImage = p->sendImage = image;
             p->offset = start_offset;
             p->compositeLevel = 0;
         } else {
-            IceTVoid *package_buffer;
-            IceTSizeType package_size;
-            IceTInt recv_rank = partners[0].rank;
-
-            icetSparseImagePackageForSend(image,&package_buffer,&package_size);
+            if (wire_encoding) {
+                wire_buffer = icetGetStateBuffer(
+                                RADIXK_WIRE_SEND_BUFFER,
+                                icetSparseImageEncodeBufferSize(image));
+            }
+            if (size_messages) {
+                image_sizes = icetGetStateBuffer(
+                                RADIXK_SIZE_BUFFER,
+                                RADIXK_SIZE_MESSAGE_LENGTH*sizeof(IceTInt));
+            }
 
-            send_requests[0] = icetCommIsend(package_buffer,
-                                             package_size,
-                                             ICET_BYTE,
-                                             recv_rank,
-                                             tag);
+            send_requests[0] = radixkSendImage(image,
+                                               partners[0].rank,
+                                               current_round,
+                                               &wire_buffer,
+                                               image_sizes,
+                                               &send_requests[1]);
 
             p->offset = 0;
         }
@@ -789,7 +994,8 @@ static void radixkCompositeIncomingImages(radixkPartnerInfo *partners,
         receiver = &partners[receive_idx];
         receiver->compositeLevel = 0;
         receiver->receiveImage
-            = icetSparseImageUnpackageFromReceive(receiver->receiveBuffer);
+            = icetSparseImageDecodeFromReceive(receiver->wireBuffer,
+                                               receiver->receiveBuffer);
         if (   (icetSparseImageGetWidth(receiver->receiveImage) != width)
             || (icetSparseImageGetHeight(receiver->receiveImage) != height) ) {
             icetRaiseError(ICET_SANITY_CHECK_FAIL,
@@ -877,9 +1083,9 @@ static void icetRadixkBasicCompose(const radixkInfo *info,
 
         /* Wait until all of our sends have completed. */
         if (round_info->split) {
-            icetCommWaitall(round_info->k, send_requests);
+            icetCommWaitall(2*round_info->k, send_requests);
         } else {
-            icetCommWait(&send_requests[0]);
+            icetCommWaitall(2, send_requests);
         }
 
         my_offset = partners[round_info->partition_index].offset;
@@ -1254,7 +1460,7 @@ static void icetRadixkTelescopeCompose(const IceTInt *compose_group,
        place to interlace the image (and then later adjust the offset. */
     {
         IceTInt magic_k;
-        use_interlace = icetIsEnabled(ICET_INTERLACE_IMAGES);
+        use_interlace = icetSparseImageInterlaceEnabled();
 
         icetGetIntegerv(ICET_MAGIC_K, &magic_k);
         use_interlace &= (total_num_partitions > magic_k);
@@ -1351,7 +1557,7 @@ void icetRadixkCompose(const IceTInt *compose_group,
     IceTInt group_rank = icetFindMyRankInGroup(compose_group, group_size);
     radixkInfo info = radixkGetK(group_size, group_rank);
     IceTInt total_num_partitions = radixkGetTotalNumPartitions(&info);
-    IceTBoolean use_interlace = icetIsEnabled(ICET_INTERLACE_IMAGES);
+    IceTBoolean use_interlace = icetSparseImageInterlaceEnabled();
     IceTSparseImage working_image = input_image;
     IceTSizeType original_image_size = icetSparseImageGetNumPixels(input_image);
 
@@ -34,6 +34,7 @@
 #include <IceTDevImage.h>
 
 #define RADIXKR_SWAP_IMAGE_TAG_START     2200
+#define RADIXKR_SIZE_TAG_START           2400
 
 #define RADIXKR_RECEIVE_BUFFER                   ICET_SI_STRATEGY_BUFFER_0
 #define RADIXKR_SEND_BUFFER                      ICET_SI_STRATEGY_BUFFER_1
@@ -45,6 +46,14 @@
 #define RADIXKR_FACTORS_ARRAY_BUFFER             ICET_SI_STRATEGY_BUFFER_7
 #define RADIXKR_SPLIT_OFFSET_ARRAY_BUFFER        ICET_SI_STRATEGY_BUFFER_8
 #define RADIXKR_SPLIT_IMAGE_ARRAY_BUFFER         ICET_SI_STRATEGY_BUFFER_9
+#define RADIXKR_WIRE_SEND_BUFFER                 ICET_SI_STRATEGY_BUFFER_10
+#define RADIXKR_WIRE_RECEIVE_BUFFER              ICET_SI_STRATEGY_BUFFER_11
+#define RADIXKR_SIZE_BUFFER                      ICET_SI_STRATEGY_BUFFER_12
+
+/* Images sent ahead of their size are preceded by a message of this many
+   IceTInts: the decoded size, the encoded size and, for layered images, the
+   fragment count size and maximum number of fragments per pixel. */
+#define RADIXKR_SIZE_MESSAGE_LENGTH      4
 
 typedef struct radixkrRoundInfoStruct {
     IceTInt k; /* k value for this round. */
@@ -65,9 +74,16 @@ typedef struct radixkrInfoStruct {
 typedef struct radixkrPartnerInfoStruct {
     IceTInt rank; /* Rank of partner. */
     IceTSizeType offset; /* Offset of partner's partition in image. */
+    IceTSizeType receiveCount; /* Number of bytes to receive from partner. */
     IceTVoid *receiveBuffer; /* A buffer for receiving data from partner. */
+    IceTSizeType wireCount; /* Number of bytes partner sends (encoded). */
+    IceTVoid *wireBuffer; /* Where data from partner arrives (encoded). */
+    IceTSizeType countSize; /* Fragment count size of partner's layered image. */
+    IceTLayerCount maxFragments; /* Max fragments per pixel of layered image. */
+    IceTSizeType sliceSize; /* Bytes reserved in receive and spare buffers. */
     IceTSparseImage sendImage; /* A buffer to hold data being sent to partner */
     IceTSparseImage receiveImage; /* Hold for received non-composited image. */
+    IceTSparseImage spareImage; /* Destination for compositing received images. */
     IceTInt compositeLevel; /* Level in compositing tree for round. */
 } radixkrPartnerInfo;
 
@@ -375,12 +391,8 @@ static IceTInt radixkrGetGroupRankForFinalPartitionIndex(
 
    inputs:
     round_info: structure with information on the current round
-    remaining_partitions: Number of pieces the image will be split into by
-        the end of the algorithm.
     compose_group: array of world ranks representing the group of processes
         participating in compositing (passed into icetRadixkrCompose)
-    group_rank: Index in compose_group that represents me
-    start_size: Size of image partition that is being divided in current_round
 
    output:
     partner_group: Structure of information about the group of processes that
@@ -388,22 +400,13 @@ static IceTInt radixkrGetGroupRankForFinalPartitionIndex(
 */
 static radixkrPartnerGroupInfo radixkrGetPartners(
         const radixkrRoundInfo *round_info,
-        IceTInt remaining_partitions,
-        const IceTInt *compose_group,
-        IceTSizeType start_size)
+        const IceTInt *compose_group)
 {
     const IceTInt current_k = round_info->k;
     const IceTInt current_r = round_info->r;
-    const IceTInt split_factor = round_info->split_factor;
     const IceTInt step = round_info->step;
     radixkrPartnerGroupInfo p_group;
     IceTInt num_partners;
-    IceTBoolean receiving_data;
-    IceTBoolean sending_data;
-    IceTVoid *recv_buf_pool;
-    IceTVoid *send_buf_pool;
-    IceTSizeType partition_num_pixels;
-    IceTSizeType sparse_image_size;
     IceTInt i;
 
     num_partners = current_k;
@@ -416,35 +419,6 @@ static radixkrPartnerGroupInfo radixkrGetPartners(
                 sizeof(radixkrPartnerInfo) * num_partners);
     p_group.num_partners = num_partners;
 
-    /* Allocate arrays that can be used as send/receive buffers. */
-    receiving_data = round_info->has_image;
-    if (split_factor > 1) {
-        partition_num_pixels
-            = icetSparseImageSplitPartitionNumPixels(start_size,
-                                                     split_factor,
-                                                     remaining_partitions);
-        sending_data = ICET_TRUE;
-    } else {
-        /* Not really splitting image, and the receiver does not need to send
-         * at all. */
-        partition_num_pixels = start_size;
-        sending_data = !receiving_data;
-    }
-    sparse_image_size = icetSparseImageBufferSize(partition_num_pixels, 1);
-    if (receiving_data) {
-        recv_buf_pool = icetGetStateBuffer(RADIXKR_RECEIVE_BUFFER,
-                                           sparse_image_size * num_partners);
-    } else {
-        recv_buf_pool = NULL;
-    }
-    if (sending_data) {
-        /* Only need send buff when splitting, always need when splitting. */
-        send_buf_pool = icetGetStateBuffer(RADIXKR_SEND_BUFFER,
-                                           sparse_image_size * split_factor);
-    } else {
-        send_buf_pool = NULL;
-    }
-
     for (i = 0; i < num_partners; i++) {
         radixkrPartnerInfo *p = &p_group.partners[i];
         IceTInt partner_group_rank = round_info->first_rank + i*step;
@@ -453,23 +427,16 @@ static radixkrPartnerGroupInfo radixkrGetPartners(
 
         /* To be filled later. */
         p->offset = -1;
-
-        if (receiving_data) {
-            p->receiveBuffer = ((IceTByte*)recv_buf_pool + i*sparse_image_size);
-        } else {
-            p->receiveBuffer = NULL;
-        }
-
-        if (sending_data && (i < split_factor)) {
-            IceTVoid *send_buffer
-                    = ((IceTByte*)send_buf_pool + i*sparse_image_size);
-            p->sendImage = icetSparseImageAssignBuffer(send_buffer,
-                                                       partition_num_pixels, 1);
-        } else {
-            p->sendImage = icetSparseImageNull();
-        }
-
+        p->receiveCount = -1;
+        p->receiveBuffer = NULL;
+        p->wireCount = -1;
+        p->wireBuffer = NULL;
+        p->countSize = 0;
+        p->maxFragments = 0;
+        p->sliceSize = -1;
+        p->sendImage = icetSparseImageNull();
         p->receiveImage = icetSparseImageNull();
+        p->spareImage = icetSparseImageNull();
 
         p->compositeLevel = -1;
     }
@@ -477,44 +444,219 @@ static radixkrPartnerGroupInfo radixkrGetPartners(
     return p_group;
 }
 
+/* Returns the number of bytes reserved for a partner's image in the receive and
+   spare buffers.  Layered images grow when composited if they hold a single
+   fragment per pixel or their fragment counts are widened to
+   composite_count_size, so they get as much extra room as that takes.  Spare
+   images are cleared when assigned, which writes a run length even if the
+   received image has no pixels and consists of its header only. */
+static IceTSizeType radixkrImageSliceSize(const radixkrPartnerInfo *p,
+                                          IceTBoolean layered_images,
+                                          IceTSizeType composite_count_size)
+{
+    IceTSizeType size;
+    IceTSizeType empty_size;
+
+    if (layered_images) {
+        size = icetSparseLayeredImageCompositeBufferSize(p->receiveCount,
+                                                         p->countSize,
+                                                         composite_count_size);
+        empty_size = icetSparseLayeredImageBufferSize(0, 0, 1);
+    } else {
+        size = p->receiveCount;
+        empty_size = icetSparseImageBufferSize(0, 0);
+    }
+
+    return (size < empty_size) ? empty_size : size;
+}
+
 /* As applicable, posts an asynchronous receive for each process from which
-   we are receiving an image piece. */
+   we are receiving an image piece.  Must be called after radixkrPostSends. */
 static IceTCommRequest *radixkrPostReceives(radixkrPartnerGroupInfo p_group,
                                             const radixkrRoundInfo *round_info,
                                             IceTInt current_round,
-                                            IceTInt remaining_partitions,
-                                            IceTSizeType start_size)
+                                            IceTSparseImage my_image)
 {
     IceTCommRequest *receive_requests;
-    IceTSizeType partition_num_pixels;
-    IceTSizeType sparse_image_size;
     IceTInt tag;
+    /* Combined size of all received images. */
+    IceTSizeType total_size;
+    /* Start of the next partner's receive buffer. */
+    IceTByte *recv_buffer;
+    /* Start of the next partner's spare buffer to composite into. */
+    IceTByte *spare_buffer;
+    /* Combined size of all received images that arrive encoded. */
+    IceTSizeType wire_size;
+    /* Start of the next partner's encoded image. */
+    IceTByte *wire_buffer = NULL;
+    /* Number of pixels in each image this process receives. */
+    IceTSizeType partition_num_pixels = -1;
+    /* Fragment count size of the layered images composited this round. */
+    IceTSizeType composite_count_size = 0;
+    IceTBoolean layered_images = icetSparseImageIsLayered(my_image);
+    IceTBoolean wire_encoding = icetSparseImageWireEncodingEnabled();
     IceTInt i;
 
     /* If not collecting any image partition, post no receives. */
     if (!round_info->has_image) { return NULL; }
 
-    receive_requests =icetGetStateBuffer(
+    receive_requests = icetGetStateBuffer(
                 RADIXKR_RECEIVE_REQUEST_BUFFER,
                 p_group.num_partners * sizeof(IceTCommRequest));
 
-    if (round_info->split_factor) {
-        partition_num_pixels
-            = icetSparseImageSplitPartitionNumPixels(start_size,
-                                                     round_info->split_factor,
-                                                     remaining_partitions);
-    } else {
-        partition_num_pixels = start_size;
+    /* Probe incoming messages and accumulate their sizes.  The size of sparse
+       images, and layered images in particular, is not known in advance. */
+    tag = RADIXKR_SWAP_IMAGE_TAG_START + current_round;
+    total_size = 0;
+    wire_size = 0;
+
+    for (i = 0; i < p_group.num_partners; i++) {
+        radixkrPartnerInfo *p = &p_group.partners[i];
+
+        if (i == round_info->partition_index) {
+            /* Implicit send-to-self without copy. */
+            icetSparseImagePackageForSend(p->sendImage,
+                                          &p->receiveBuffer,
+                                          &p->receiveCount);
+            p->wireCount = p->receiveCount;
+            partition_num_pixels = icetSparseImageGetNumPixels(p->sendImage);
+            if (layered_images) {
+                icetSparseLayeredImageGetFragmentCounts(p->sendImage,
+                                                        &p->countSize,
+                                                        &p->maxFragments);
+            }
+        } else if (wire_encoding || layered_images) {
+            /* Encoded images are preceded by their decoded and encoded size,
+               since the buffers must fit the decoded image.  Layered images
+               are preceded by how they count fragments, which decides how much
+               they grow when composited. */
+            IceTInt sizes[RADIXKR_SIZE_MESSAGE_LENGTH];
+            icetCommRecv(sizes,
+                         RADIXKR_SIZE_MESSAGE_LENGTH,
+                         ICET_INT,
+                         p->rank,
+                         RADIXKR_SIZE_TAG_START + current_round);
+            p->receiveCount = sizes[0];
+            p->wireCount = sizes[1];
+            p->countSize = sizes[2];
+            p->maxFragments = (IceTLayerCount)sizes[3];
+            if (p->wireCount != p->receiveCount) {
+                wire_size += p->wireCount;
+            }
+        } else {
+            /* Wait for the partner to initiate the send and store its size. */
+            IceTCommRecvInfo recvinfo;
+            icetCommProbe(ICET_BYTE, p->rank, tag, &recvinfo);
+            p->receiveCount = recvinfo.count;
+            p->wireCount = p->receiveCount;
+        }
     }
-    sparse_image_size = icetSparseImageBufferSize(partition_num_pixels, 1);
 
-    tag = RADIXKR_SWAP_IMAGE_TAG_START + current_round;
+    /* Merging the layered images may widen their fragment counts as far as
+       needed for the fragments of all of them. */
+    if (layered_images) {
+        IceTLayerCount largest_max_fragments = 0;
+        IceTLayerCount total_max_fragments = 0;
+        for (i = 0; i < p_group.num_partners; i++) {
+            IceTLayerCount max_fragments = p_group.partners[i].maxFragments;
+            if (max_fragments > largest_max_fragments) {
+                largest_max_fragments = max_fragments;
+            }
+            /* Stop at the largest count, which keeps the sum from
+               overflowing. */
+            if (total_max_fragments < 0x7FFFFFFF - max_fragments) {
+                total_max_fragments += max_fragments;
+            } else {
+                total_max_fragments = 0x7FFFFFFF;
+            }
+        }
+        composite_count_size = icetSparseLayeredImageCompositeCountSize(
+                                                        largest_max_fragments,
+                                                        total_max_fragments);
+    }
 
+    /* Accumulate message sizes. */
     for (i = 0; i < p_group.num_partners; i++) {
         radixkrPartnerInfo *p = &p_group.partners[i];
+        p->sliceSize = radixkrImageSliceSize(p,
+                                             layered_images,
+                                             composite_count_size);
+        total_size += p->sliceSize;
+    }
+
+    if (wire_size > 0) {
+        wire_buffer = icetGetStateBuffer(RADIXKR_WIRE_RECEIVE_BUFFER,
+                                         wire_size);
+    }
+
+    /* Allocate receive and spare buffer. */
+    {
+    /* By default, use the appropriate state variable for each buffer. */
+    IceTEnum receive_buffer_pname = RADIXKR_RECEIVE_BUFFER;
+    IceTEnum spare_buffer_pname = RADIXKR_SPARE_BUFFER;
+
+    /* Get the address of the image data received last round. */
+    IceTVoid *my_image_buffer = NULL;
+    IceTSizeType _size;
+    icetSparseImagePackageForSend(my_image, &my_image_buffer, &_size);
+
+    /* The data we send to ourself is read directly from the send image, which
+     * is usually stored in RADIXKR_SEND_BUFFER.  If the image is not split,
+     * however, our send image is simply the result of the previous round,
+     * which may be stored in RADIXKR_RECEIVE_BUFFER or RADIXKR_SPARE_BUFFER.
+     * That buffer cannot be used this round, so the receive images or spare
+     * images are placed in the unused RADIXKR_SEND_BUFFER instead.
+     */
+    if (round_info->split_factor == 1) {
+        /* Buffers that were never allocated cannot hold the image (and must
+         * not be queried). */
+        if (   (icetStateGetType(RADIXKR_RECEIVE_BUFFER) == ICET_VOID)
+            && (   my_image_buffer
+                == icetUnsafeStateGetBuffer(RADIXKR_RECEIVE_BUFFER)) ) {
+            receive_buffer_pname = RADIXKR_SEND_BUFFER;
+        } else if (   (icetStateGetType(RADIXKR_SPARE_BUFFER) == ICET_VOID)
+                   && (   my_image_buffer
+                       == icetUnsafeStateGetBuffer(RADIXKR_SPARE_BUFFER)) ) {
+            spare_buffer_pname = RADIXKR_SEND_BUFFER;
+        }
+    }
+
+    /* In all rounds after the first one, my_image is backed by the previous
+     * round's receive buffer.  Reallocating the buffer invalidates the image.
+     */
+    my_image = icetSparseImageNull();
+
+    recv_buffer = icetGetStateBuffer(receive_buffer_pname, total_size);
+    spare_buffer = icetGetStateBuffer(spare_buffer_pname, total_size);
+    }
+
+    /* Assign buffers and post receives for each partner. */
+    for (i = 0; i < p_group.num_partners; i++) {
+        radixkrPartnerInfo *p = &p_group.partners[i];
+
+        /* Assign receive buffer and create spare image. */
+        p->receiveBuffer = recv_buffer;
+        p->spareImage = layered_images
+            ? icetSparseLayeredImageAssignBuffer(spare_buffer,
+                                                 partition_num_pixels,
+                                                 1)
+            : icetSparseImageAssignBuffer(spare_buffer,
+                                          partition_num_pixels,
+                                          1);
+
+        /* Images that are not encoded arrive directly in the receive buffer.
+           Encoded images are decoded into it once they arrive. */
+        if (p->wireCount != p->receiveCount) {
+            p->wireBuffer = wire_buffer;
+            wire_buffer += p->wireCount;
+        } else {
+            p->wireBuffer = recv_buffer;
+        }
+
+        /* Begin asynchronous receive. */
         if (i != round_info->partition_index) {
-            receive_requests[i] = icetCommIrecv(p->receiveBuffer,
-                                                sparse_image_size,
+            receive_requests[i] = icetCommIrecv(p->wireBuffer,
+                                                p->wireCount,
                                                 ICET_BYTE,
                                                 p->rank,
                                                 tag);
@@ -523,13 +665,72 @@ static IceTCommRequest *radixkrPostReceives(radixkrPartnerGroupInfo p_group,
             /* No need to send to myself. */
             receive_requests[i] = ICET_COMM_REQUEST_NULL;
         }
+
+        /* The next partner's images come directly after this one's. */
+        recv_buffer += p->sliceSize;
+        spare_buffer += p->sliceSize;
     }
 
     return receive_requests;
 }
 
+/* Posts an asynchronous send of an image to the process of the given rank.
+   If wire encoding is enabled, the image is encoded into *wire_buffer, which is
+   advanced past it.  Otherwise, wire_buffer points to NULL.  If image_sizes is
+   not NULL, the sizes of the image are sent in it ahead of the image (see
+   RADIXKR_SIZE_MESSAGE_LENGTH).  Otherwise, size_request is set to null. */
+static IceTCommRequest radixkrSendImage(const IceTSparseImage image,
+                                        IceTInt rank,
+                                        IceTInt current_round,
+                                        IceTByte **wire_buffer,
+                                        IceTInt *image_sizes,
+                                        IceTCommRequest *size_request)
+{
+    IceTVoid *package_buffer;
+    IceTSizeType package_size;
+
+    if (*wire_buffer != NULL) {
+        icetSparseImageEncodeForSend(image,
+                                     *wire_buffer,
+                                     &package_buffer,
+                                     &package_size);
+        *wire_buffer += icetSparseImageEncodeBufferSize(image);
+    } else {
+        icetSparseImagePackageForSend(image, &package_buffer, &package_size);
+    }
+
+    if (image_sizes != NULL) {
+        IceTSizeType count_size = 0;
+        IceTLayerCount max_fragments = 0;
+        if (icetSparseImageIsLayered(image)) {
+            icetSparseLayeredImageGetFragmentCounts(image,
+                                                    &count_size,
+                                                    &max_fragments);
+        }
+        image_sizes[0] = icetSparseImageGetCompressedBufferSize(image);
+        image_sizes[1] = package_size;
+        image_sizes[2] = count_size;
+        image_sizes[3] = (IceTInt)max_fragments;
+        *size_request = icetCommIsend(image_sizes,
+                                      RADIXKR_SIZE_MESSAGE_LENGTH,
+                                      ICET_INT,
+                                      rank,
+                                      RADIXKR_SIZE_TAG_START + current_round);
+    } else {
+        *size_request = ICET_COMM_REQUEST_NULL;
+    }
+
+    return icetCommIsend(package_buffer,
+                         package_size,
+                         ICET_BYTE,
+                         rank,
+                         RADIXKR_SWAP_IMAGE_TAG_START + current_round);
+}
+
 /* As applicable, posts an asynchronous send for each process to which we are
-   sending an image piece. */
+   sending an image piece.  Returns an array of twice as many requests as there
+   are pieces, the second half for the sizes sent ahead of encoded and layered
+   images. */
 static IceTCommRequest *radixkrPostSends(radixkrPartnerGroupInfo p_group,
                                          const radixkrRoundInfo *round_info,
                                          IceTInt current_round,
@@ -540,15 +741,17 @@ static IceTCommRequest *radixkrPostSends(radixkrPartnerGroupInfo p_group,
     IceTCommRequest *send_requests;
     IceTInt *piece_offsets;
     IceTSparseImage *image_pieces;
-    IceTInt tag;
+    IceTByte *wire_buffer = NULL;
+    IceTInt *image_sizes = NULL;
+    IceTBoolean wire_encoding = icetSparseImageWireEncodingEnabled();
+    IceTBoolean size_messages =
+        wire_encoding || icetSparseImageIsLayered(image);
     IceTInt i;
 
-    tag = RADIXKR_SWAP_IMAGE_TAG_START + current_round;
-
     if (round_info->split_factor > 1) {
         send_requests=icetGetStateBuffer(
                     RADIXKR_SEND_REQUEST_BUFFER,
-                    round_info->split_factor * sizeof(IceTCommRequest));
+                    2 * round_info->split_factor * sizeof(IceTCommRequest));
 
         piece_offsets = icetGetStateBuffer(
                     RADIXKR_SPLIT_OFFSET_ARRAY_BUFFER,
@@ -557,14 +760,32 @@ static IceTCommRequest *radixkrPostSends(radixkrPartnerGroupInfo p_group,
                     RADIXKR_SPLIT_IMAGE_ARRAY_BUFFER,
                     round_info->split_factor * sizeof(IceTSparseImage));
         for (i = 0; i < round_info->split_factor; i++) {
-            image_pieces[i] = p_group.partners[i].sendImage;
+            image_pieces[i] = icetSparseImageNull();
+        }
+        icetSparseImageSplitAlloc(image,
+                                  start_offset,
+                                  round_info->split_factor,
+                                  remaining_partitions,
+                                  RADIXKR_SEND_BUFFER,
+                                  image_pieces,
+                                  piece_offsets);
+
+        if (wire_encoding) {
+            IceTSizeType wire_size = 0;
+            for (i = 0; i < round_info->split_factor; i++) {
+                if (i == round_info->partition_index) { continue; }
+                wire_size +=
+                    icetSparseImageEncodeBufferSize(image_pieces[i]);
+            }
+            wire_buffer = icetGetStateBuffer(RADIXKR_WIRE_SEND_BUFFER,
+                                             wire_size);
+        }
+        if (size_messages) {
+            image_sizes = icetGetStateBuffer(
+                                RADIXKR_SIZE_BUFFER,
+                                  RADIXKR_SIZE_MESSAGE_LENGTH
+                                * round_info->split_factor * sizeof(IceTInt));
         }
-        icetSparseImageSplit(image,
-                             start_offset,
-                             round_info->split_factor,
-                             remaining_partitions,
-                             image_pieces,
-                             piece_offsets);
 
         /* The pivot for loop arranges the sends to happen in an order such that
            those to be composited first in their destinations will be sent
@@ -577,21 +798,22 @@ static IceTCommRequest *radixkrPostSends(radixkrPartnerGroupInfo p_group,
                         round_info->split_factor) {
             radixkrPartnerInfo *p = &p_group.partners[i];
             p->offset = piece_offsets[i];
+            p->sendImage = image_pieces[i];
             if (i != round_info->partition_index) {
-                IceTVoid *package_buffer;
-                IceTSizeType package_size;
-
-                icetSparseImagePackageForSend(image_pieces[i],
-                                              &package_buffer, &package_size);
-
-                send_requests[i] = icetCommIsend(package_buffer,
-                                                 package_size,
-                                                 ICET_BYTE,
-                                                 p->rank,
-                                                 tag);
+                send_requests[i] = radixkrSendImage(
+                                image_pieces[i],
+                                p->rank,
+                                current_round,
+                                &wire_buffer,
+                                (image_sizes != NULL)
+                                ? image_sizes + RADIXKR_SIZE_MESSAGE_LENGTH*i
+                                : NULL,
+                                &send_requests[round_info->split_factor + i]);
             } else {
                 /* Implicitly send to myself. */
                 send_requests[i] = ICET_COMM_REQUEST_NULL;
+                send_requests[round_info->split_factor + i]
+                    = ICET_COMM_REQUEST_NULL;
                 p->receiveImage = p->sendImage;
                 p->compositeLevel = 0;
             }
@@ -599,24 +821,31 @@ static IceTCommRequest *radixkrPostSends(radixkrPartnerGroupInfo p_group,
     } else { /* round_info->split_factor == 1 */
         radixkrPartnerInfo *p = &p_group.partners[round_info->partition_index];
         send_requests = icetGetStateBuffer(RADIXKR_SEND_REQUEST_BUFFER,
-                                           sizeof(IceTCommRequest));
+                                           2 * sizeof(IceTCommRequest));
         if (round_info->has_image) {
             send_requests[0] = ICET_COMM_REQUEST_NULL;
+            send_requests[1] = ICET_COMM_REQUEST_NULL;
             p->receiveImage = p->sendImage = image;
             p->offset = start_offset;
             p->compositeLevel = 0;
         } else {
-            IceTVoid *package_buffer;
-            IceTSizeType package_size;
-            IceTInt recv_rank = p_group.partners[0].rank;
-
-            icetSparseImagePackageForSend(image,&package_buffer,&package_size);
+            if (wire_encoding) {
+                wire_buffer = icetGetStateBuffer(
+                                RADIXKR_WIRE_SEND_BUFFER,
+                                icetSparseImageEncodeBufferSize(image));
+            }
+            if (size_messages) {
+                image_sizes = icetGetStateBuffer(
+                                RADIXKR_SIZE_BUFFER,
+                                RADIXKR_SIZE_MESSAGE_LENGTH * sizeof(IceTInt));
+            }
 
-            send_requests[0] = icetCommIsend(package_buffer,
-                                             package_size,
-                                             ICET_BYTE,
-                                             recv_rank,
-                                             tag);
+            send_requests[0] = radixkrSendImage(image,
+                                                p_group.partners[0].rank,
+                                                current_round,
+                                                &wire_buffer,
+                                                image_sizes,
+                                                &send_requests[1]);
 
             p->offset = 0;
         }
@@ -627,16 +856,14 @@ static IceTCommRequest *radixkrPostSends(radixkrPartnerGroupInfo p_group,
 
 /* When compositing incoming images, we pair up the images and composite in
    a tree.  This minimizes the amount of times non-overlapping pixels need
-   to be copied.  Returns true when all images are composited */
+   to be copied.  Returns true when all images are composited, at which point
+   the result will be located in partners[0].receiveImage. */
 static IceTBoolean radixkrTryCompositeIncoming(
         radixkrPartnerGroupInfo p_group,
-        IceTInt incoming_index,
-        IceTSparseImage *spare_image_p,
-        IceTSparseImage final_image)
+        IceTInt incoming_index)
 {
     const IceTInt num_partners = p_group.num_partners;
     radixkrPartnerInfo *partners = p_group.partners;
-    IceTSparseImage spare_image = *spare_image_p;
     IceTInt to_composite_index = incoming_index;
 
     while (ICET_TRUE) {
@@ -645,6 +872,7 @@ static IceTBoolean radixkrTryCompositeIncoming(
         IceTInt subtree_size = (dist_to_sibling << 1);
         IceTInt front_index;
         IceTInt back_index;
+        IceTSparseImage dest_image;
 
         if (to_composite_index%subtree_size == 0) {
             front_index = to_composite_index;
@@ -673,41 +901,60 @@ static IceTBoolean radixkrTryCompositeIncoming(
             break;
         }
 
-        if ((front_index == 0) && (subtree_size >= num_partners)) {
-            /* This will be the last image composited.  Composite to final
-               location. */
-            spare_image = final_image;
-        }
+        /* Memory is reused through ping-pong buffering as in radix-k: each
+         * partner owns a slice of the receive and the spare buffer sized to
+         * its incoming message.  The composited image is written to the front
+         * partner's spareImage, which then takes over the combined slices of
+         * both partners.  The result cannot be larger than the sum of its
+         * sources, so it always fits. */
+        dest_image = partners[front_index].spareImage;
         icetCompressedCompressedComposite(partners[front_index].receiveImage,
                                           partners[back_index].receiveImage,
-                                          spare_image);
-        icetSparseImageSwap(&partners[front_index].receiveImage, &spare_image);
-        if (icetSparseImageEqual(spare_image, final_image)) {
-            /* Special case, front image was sharing buffer with final.
-               Use back image for next spare. */
-            spare_image = partners[back_index].receiveImage;
-            partners[back_index].receiveImage = icetSparseImageNull();
+                                          dest_image);
+
+        /* Switch the front partner's receiveImage and spareImage for ping-pong
+         * buffering. */
+        if (icetSparseImageEqual(partners[front_index].receiveImage,
+                                 partners[front_index].sendImage)) {
+            /* Special case: The image we send to ourself is not stored in the
+             * receive buffer.  To keep the ping-pong buffering intact, space
+             * is still reserved in the receive buffer as usual, but it must be
+             * explicitely assigned to the spareImage. */
+            IceTSizeType width = icetSparseImageGetWidth(dest_image);
+            IceTSizeType height = icetSparseImageGetHeight(dest_image);
+
+            partners[front_index].spareImage =
+                                            icetSparseImageIsLayered(dest_image)
+                ? icetSparseLayeredImageAssignBuffer(
+                                            partners[front_index].receiveBuffer,
+                                            width,
+                                            height)
+                : icetSparseImageAssignBuffer(
+                                            partners[front_index].receiveBuffer,
+                                            width,
+                                            height);
+        } else {
+            partners[front_index].spareImage =
+                                             partners[front_index].receiveImage;
         }
+
+        partners[front_index].receiveImage = dest_image;
+
         partners[front_index].compositeLevel++;
         to_composite_index = front_index;
     }
 
-    *spare_image_p = spare_image;
     return ((1 << partners[0].compositeLevel) >= num_partners);
 }
 
 static void radixkrCompositeIncomingImages(radixkrPartnerGroupInfo p_group,
                                           IceTCommRequest *receive_requests,
-                                          const radixkrRoundInfo *round_info,
-                                          IceTSparseImage image)
+                                          const radixkrRoundInfo *round_info)
 {
     radixkrPartnerInfo *partners = p_group.partners;
     IceTInt num_partners = p_group.num_partners;
     radixkrPartnerInfo *me = &partners[round_info->partition_index];
 
-    IceTSparseImage spare_image;
-    IceTInt total_composites;
-
     IceTSizeType width;
     IceTSizeType height;
 
@@ -718,43 +965,14 @@ static void radixkrCompositeIncomingImages(radixkrPartnerGroupInfo p_group,
         return;
     }
 
-    /* Regardless of order, there are num_partners-1 composite operations to
-       perform. */
-    total_composites = num_partners - 1;
-
-    /* We will be reusing buffers like crazy, but we'll need at least one more
-       for the first composite, assuming we have at least two composites. */
-    width = icetSparseImageGetWidth(me->receiveImage);
-    height = icetSparseImageGetHeight(me->receiveImage);
-    if (total_composites >= 2) {
-        spare_image = icetGetStateBufferSparseImage(RADIXKR_SPARE_BUFFER,
-                                                    width,
-                                                    height);
-    } else {
-        spare_image = icetSparseImageNull();
-    }
-
-    /* Grumble.  Stupid special case where there is only one composite and we
-       want the result to go in the same image as my receive image (which can
-       happen when not splitting). */
-    if (icetSparseImageEqual(me->receiveImage,image) && (total_composites < 2)){
-        spare_image = icetGetStateBufferSparseImage(RADIXKR_SPARE_BUFFER,
-                                                    width,
-                                                    height);
-        icetSparseImageCopyPixels(me->receiveImage,
-                                  0,
-                                  width*height,
-                                  spare_image);
-        me->receiveImage = spare_image;
-    }
+    width = icetSparseImageGetWidth(me->sendImage);
+    height = icetSparseImageGetHeight(me->sendImage);
 
     /* Start by trying to composite the implicit receive from myself.  It won't
        actually composite anything, but it may change the composite level.  It
        will also defensively set composites_done correctly. */
     composites_done = radixkrTryCompositeIncoming(p_group,
-                                                  round_info->partition_index,
-                                                  &spare_image,
-                                                  image);
+                                                  round_info->partition_index);
 
     while (!composites_done) {
         IceTInt receive_idx;
@@ -765,7 +983,8 @@ static void radixkrCompositeIncomingImages(radixkrPartnerGroupInfo p_group,
         receiver = &partners[receive_idx];
         receiver->compositeLevel = 0;
         receiver->receiveImage
-            = icetSparseImageUnpackageFromReceive(receiver->receiveBuffer);
+            = icetSparseImageDecodeFromReceive(receiver->wireBuffer,
+                                               receiver->receiveBuffer);
         if (   (icetSparseImageGetWidth(receiver->receiveImage) != width)
             || (icetSparseImageGetHeight(receiver->receiveImage) != height) ) {
             icetRaiseError(ICET_SANITY_CHECK_FAIL,
@@ -773,10 +992,7 @@ static void radixkrCompositeIncomingImages(radixkrPartnerGroupInfo p_group,
         }
 
         /* Try to composite that image. */
-        composites_done = radixkrTryCompositeIncoming(p_group,
-                                                      receive_idx,
-                                                      &spare_image,
-                                                      image);
+        composites_done = radixkrTryCompositeIncoming(p_group, receive_idx);
     }
 }
 
@@ -836,19 +1052,15 @@ void icetRadixkrCompose(const IceTInt *compose_group,
 
     /* Now that we know the total number of partitions, we can interlace the
        input image to improve load balancing. */
-    use_interlace = icetIsEnabled(ICET_INTERLACE_IMAGES);
+    use_interlace = icetSparseImageInterlaceEnabled();
     use_interlace &= (info.num_rounds > 1);
 
     if (use_interlace) {
-        IceTSparseImage interlaced_image = icetGetStateBufferSparseImage(
-                                       RADIXKR_INTERLACED_IMAGE_BUFFER,
-                                       icetSparseImageGetWidth(working_image),
-                                       icetSparseImageGetHeight(working_image));
-        icetSparseImageInterlace(working_image,
-                                 total_num_partitions,
-                                 RADIXKR_SPLIT_OFFSET_ARRAY_BUFFER,
-                                 interlaced_image);
-        working_image = interlaced_image;
+        working_image = icetSparseImageInterlaceAlloc(
+                                              working_image,
+                                              total_num_partitions,
+                                              RADIXKR_SPLIT_OFFSET_ARRAY_BUFFER,
+                                              RADIXKR_INTERLACED_IMAGE_BUFFER);
     }
 
     /* Any peer we communicate with in round i starts that round with a block of
@@ -859,22 +1071,13 @@ void icetRadixkrCompose(const IceTInt *compose_group,
     remaining_partitions = total_num_partitions;
 
     for (current_round = 0; current_round < info.num_rounds; current_round++) {
-        IceTSizeType my_size = icetSparseImageGetNumPixels(working_image);
         const radixkrRoundInfo *round_info = &info.rounds[current_round];
         radixkrPartnerGroupInfo p_group
-                = radixkrGetPartners(round_info,
-                                     remaining_partitions,
-                                     compose_group,
-                                     my_size);
+                = radixkrGetPartners(round_info, compose_group);
         IceTCommRequest *receive_requests;
         IceTCommRequest *send_requests;
 
-        receive_requests = radixkrPostReceives(p_group,
-                                               round_info,
-                                               current_round,
-                                               remaining_partitions,
-                                               my_size);
-
+        /* Begin asynchronous sends. */
         send_requests = radixkrPostSends(p_group,
                                          round_info,
                                          current_round,
@@ -882,25 +1085,37 @@ void icetRadixkrCompose(const IceTInt *compose_group,
                                          my_offset,
                                          working_image);
 
+        /* Allocate memory, then begin asynchronous receives. */
+        receive_requests = radixkrPostReceives(p_group,
+                                               round_info,
+                                               current_round,
+                                               working_image);
+
+        /* Composite images as they arrive until we are done. */
         radixkrCompositeIncomingImages(p_group,
                                        receive_requests,
-                                       round_info,
-                                       working_image);
+                                       round_info);
+        working_image = p_group.partners[0].receiveImage;
 
-        icetCommWaitall(round_info->split_factor, send_requests);
+        /* Wait until all of our sends have completed. */
+        if (round_info->split_factor > 1) {
+            icetCommWaitall(2 * round_info->split_factor, send_requests);
+        } else {
+            icetCommWaitall(2, send_requests);
+        }
 
         my_offset = p_group.partners[round_info->partition_index].offset;
         if (round_info->has_image) {
             remaining_partitions /= round_info->split_factor;
         } else {
-            icetSparseImageSetDimensions(working_image, 0, 0);
+            working_image = icetSparseImageNull();
             break;
         }
     } /* for all rounds */
 
     /* If we interlaced the image and are actually returning something,
        correct the offset. */
-    if (use_interlace && (icetSparseImageGetNumPixels(working_image) > 0)) {
+    if (use_interlace && !icetSparseImageIsNull(working_image)) {
         IceTInt partition_index = radixkrGetFinalPartitionIndex(&info);
         *piece_offset = icetGetInterlaceOffset(partition_index,
                                                total_num_partitions,
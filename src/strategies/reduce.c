@@ -41,6 +41,10 @@ static IceTImage reduceCollect(const IceTSparseImage composited_image,
                                IceTInt compose_tile,
                                IceTInt piece_offset);
 
+static void reduceCollectLayered(const IceTSparseImage composited_image,
+                                 IceTInt compose_tile,
+                                 IceTInt piece_offset);
+
 
 IceTImage icetReduceCompose(void)
 {
@@ -61,33 +65,11 @@ IceTImage icetReduceCompose(void)
                                   &group_image_dest);
 
     /* Render images and transfer to appropriate process. */
-    {
-        IceTInt max_width;
-        IceTInt max_height;
-
-        IceTSizeType sparse_image_size;
-        IceTVoid *inImageBuffer;
-        IceTSparseImage composite_image1;
-        IceTSparseImage composite_image2;
-
-        icetGetIntegerv(ICET_TILE_MAX_WIDTH, &max_width);
-        icetGetIntegerv(ICET_TILE_MAX_HEIGHT, &max_height);
-
-        sparse_image_size = icetSparseImageBufferSize(max_width, max_height);
-        inImageBuffer  = icetGetStateBuffer(REDUCE_IN_IMAGE_BUFFER,
-                                            sparse_image_size);
-        composite_image1 = icetGetStateBufferSparseImage(
+    rendered_image = icetRenderTransferSparseImagesAlloc(
                                                 REDUCE_COMPOSITE_IMAGE_BUFFER_1,
-                                                max_width, max_height);
-        composite_image2 = icetGetStateBufferSparseImage(
                                                 REDUCE_COMPOSITE_IMAGE_BUFFER_2,
-                                                max_width, max_height);
-
-        rendered_image = icetRenderTransferSparseImages(composite_image1,
-                                                        composite_image2,
-                                                        inImageBuffer,
-                                                        tile_image_dest);
-    }
+                                                REDUCE_IN_IMAGE_BUFFER,
+                                                tile_image_dest);
 
     if (compose_tile >= 0) {
         icetSingleImageCompose(compose_group,
@@ -103,7 +85,10 @@ IceTImage icetReduceCompose(void)
         piece_offset = 0;
     }
 
-    if (icetIsEnabled(ICET_COLLECT_IMAGES)) {
+    if (*icetUnsafeStateGetBoolean(ICET_KEEP_DEEP_IMAGE)) {
+        reduceCollectLayered(composited_image, compose_tile, piece_offset);
+        result_image = icetImageNull();
+    } else if (icetIsEnabled(ICET_COLLECT_IMAGES)) {
         result_image = reduceCollect(composited_image,
                                      compose_tile,
                                      piece_offset);
@@ -519,3 +504,50 @@ IceTImage reduceCollect(const IceTSparseImage composited_image,
 
     return result_image;
 }
+
+/* Like reduceCollect, but leaves the fragments unblended for
+   icetCompositeImageLayeredDeep, which finds the result in
+   ICET_DEEP_IMAGE_BUF. */
+static void reduceCollectLayered(const IceTSparseImage composited_image,
+                                 IceTInt compose_tile,
+                                 IceTInt piece_offset)
+{
+    IceTInt num_tiles;
+    const IceTInt *tile_viewports;
+    const IceTInt *tile_display_nodes;
+    IceTInt tile_idx;
+
+    if (!icetIsEnabled(ICET_COLLECT_IMAGES)) {
+        IceTSizeType piece_size = icetSparseImageGetNumPixels(composited_image);
+        if (piece_size > 0) {
+            icetSingleImageKeepLayered(composited_image);
+            icetStateSetInteger(ICET_VALID_PIXELS_TILE, compose_tile);
+            icetStateSetInteger(ICET_VALID_PIXELS_OFFSET, piece_offset);
+            icetStateSetInteger(ICET_VALID_PIXELS_NUM, piece_size);
+        } else {
+            icetStateSetInteger(ICET_VALID_PIXELS_TILE, -1);
+            icetStateSetInteger(ICET_VALID_PIXELS_OFFSET, 0);
+            icetStateSetInteger(ICET_VALID_PIXELS_NUM, 0);
+        }
+        return;
+    }
+
+    icetGetIntegerv(ICET_NUM_TILES, &num_tiles);
+    tile_viewports = icetUnsafeStateGetInteger(ICET_TILE_VIEWPORTS);
+    tile_display_nodes = icetUnsafeStateGetInteger(ICET_DISPLAY_NODES);
+
+    /* As with reduceCollect, all processes take part in collecting each tile.
+       Display processes of tiles without any data get an image without active
+       pixels. */
+    for (tile_idx = 0; tile_idx < num_tiles; tile_idx++) {
+        const IceTInt *collect_tile_viewport = tile_viewports + 4*tile_idx;
+
+        icetSingleImageCollectLayered(
+            (tile_idx == compose_tile) ? composited_image
+                                       : icetSparseImageNull(),
+            tile_display_nodes[tile_idx],
+            (tile_idx == compose_tile) ? piece_offset : 0,
+            collect_tile_viewport[2],
+            collect_tile_viewport[3]);
+    }
+}
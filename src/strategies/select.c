@@ -120,7 +120,7 @@ IceTBoolean icetStrategySupportsLayeredImages(IceTEnum strategy)
       case ICET_STRATEGY_DIRECT:        return ICET_FALSE;
       case ICET_STRATEGY_SEQUENTIAL:    return ICET_TRUE;
       case ICET_STRATEGY_SPLIT:         return ICET_FALSE;
-      case ICET_STRATEGY_REDUCE:        return ICET_FALSE;
+      case ICET_STRATEGY_REDUCE:        return ICET_TRUE;
       case ICET_STRATEGY_VTREE:         return ICET_FALSE;
       case ICET_STRATEGY_UNDEFINED:
           icetRaiseError(ICET_INVALID_ENUM,
@@ -195,9 +195,9 @@ IceTBoolean icetSingleImageStrategySupportsLayeredImages(IceTEnum strategy)
       case ICET_SINGLE_IMAGE_STRATEGY_BSWAP:
       case ICET_SINGLE_IMAGE_STRATEGY_BSWAP_FOLDING:
       case ICET_SINGLE_IMAGE_STRATEGY_RADIXK:
-          return ICET_TRUE;
       case ICET_SINGLE_IMAGE_STRATEGY_RADIXKR:
       case ICET_SINGLE_IMAGE_STRATEGY_TREE:
+          return ICET_TRUE;
       default:
           return ICET_FALSE;
     }
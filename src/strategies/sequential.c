@@ -9,15 +9,386 @@
 
 #include <IceT.h>
 
+#include <IceTDevCommunication.h>
 #include <IceTDevImage.h>
 #include <IceTDevState.h>
 #include <IceTDevDiagnostics.h>
+#include <IceTDevTiming.h>
 #include "common.h"
 
+#include <stdlib.h>
+#include <string.h>
+
 #define SEQUENTIAL_IMAGE_BUFFER                 ICET_STRATEGY_BUFFER_0
 #define SEQUENTIAL_FINAL_IMAGE_BUFFER           ICET_STRATEGY_BUFFER_1
 #define SEQUENTIAL_INTERMEDIATE_IMAGE_BUFFER    ICET_STRATEGY_BUFFER_2
 #define SEQUENTIAL_COMPOSE_GROUP_BUFFER         ICET_STRATEGY_BUFFER_3
+#define SEQUENTIAL_CHANGED_RANGES_BUFFER        ICET_STRATEGY_BUFFER_4
+#define SEQUENTIAL_TILE_IMAGE_BUFFER_EVEN       ICET_STRATEGY_BUFFER_5
+#define SEQUENTIAL_TILE_IMAGE_BUFFER_ODD        ICET_STRATEGY_BUFFER_6
+#define SEQUENTIAL_PACKED_IMAGE_BUFFER          ICET_STRATEGY_BUFFER_7
+
+/* The most ranges of changed pixels that are composited.  Each row with changed
+   pixels starts as a range of its own.  Beyond this many, the two ranges
+   closest to each other are joined, which also composites the pixels between
+   them. */
+#define SEQUENTIAL_MAX_CHANGED_RANGES           16
+
+/* Returns true if the images kept by the last frame can be patched in this
+   one, which requires that the last frame also kept its images and that
+   nothing changed since that affects the composited color of pixels whose
+   rendered values are the same. */
+static IceTBoolean sequentialDeltaBaseValid(IceTInt frame_count)
+{
+    const IceTInt *base;
+    IceTInt background_color_word;
+    IceTTimeStamp base_time;
+
+    if (icetStateGetNumEntries(ICET_TEMPORAL_DELTA_BASE) != 2) {
+        return ICET_FALSE;
+    }
+    base = icetUnsafeStateGetInteger(ICET_TEMPORAL_DELTA_BASE);
+    icetGetIntegerv(ICET_TRUE_BACKGROUND_COLOR_WORD, &background_color_word);
+    if (   (base[0] != frame_count - 1)
+        || (base[1] != background_color_word) ) {
+        return ICET_FALSE;
+    }
+
+    base_time = icetStateGetTime(ICET_TEMPORAL_DELTA_BASE);
+    return (   (icetStateGetTime(ICET_TILE_VIEWPORTS) < base_time)
+            && (icetStateGetTime(ICET_COLOR_FORMAT) < base_time)
+            && (icetStateGetTime(ICET_DEPTH_FORMAT) < base_time)
+            && (icetStateGetTime(ICET_COMPOSITE_MODE) < base_time)
+            && (icetStateGetTime(ICET_COMPOSITE_ORDER) < base_time)
+            && (icetStateGetTime(ICET_ORDERED_COMPOSITE) < base_time)
+            && (icetStateGetTime(ICET_CORRECT_COLORED_BACKGROUND) < base_time)
+            && (icetStateGetTime(ICET_COMPOSITE_ONE_BUFFER) < base_time) );
+}
+
+/* Appends the range of pixels [begin, end) to the list of *num_ranges ranges,
+   which holds the begin and end of each range.  The ranges must be added in
+   order of their begin.  A range is joined with the last one if they overlap or
+   touch.  If the list then holds more than SEQUENTIAL_MAX_CHANGED_RANGES ranges,
+   the two closest to each other are joined, so ranges must have room for one
+   more range than that. */
+static void sequentialAddChangedRange(IceTInt *ranges,
+                                      IceTInt *num_ranges,
+                                      IceTInt begin,
+                                      IceTInt end)
+{
+    IceTInt closest;
+    IceTInt i;
+
+    if (begin >= end) return;
+
+    if ((*num_ranges > 0) && (begin <= ranges[2*(*num_ranges) - 1])) {
+        if (end > ranges[2*(*num_ranges) - 1]) {
+            ranges[2*(*num_ranges) - 1] = end;
+        }
+        return;
+    }
+
+    ranges[2*(*num_ranges) + 0] = begin;
+    ranges[2*(*num_ranges) + 1] = end;
+    (*num_ranges)++;
+    if (*num_ranges <= SEQUENTIAL_MAX_CHANGED_RANGES) return;
+
+    closest = 0;
+    for (i = 1; i < *num_ranges - 1; i++) {
+        if (  ranges[2*i + 2] - ranges[2*i + 1]
+            < ranges[2*closest + 2] - ranges[2*closest + 1]) {
+            closest = i;
+        }
+    }
+    ranges[2*closest + 1] = ranges[2*closest + 3];
+    memmove(ranges + 2*closest + 2,
+            ranges + 2*closest + 4,
+            2*(*num_ranges - closest - 2)*sizeof(IceTInt));
+    (*num_ranges)--;
+}
+
+/* Finds the ranges of pixels outside of which image and old_image are equal,
+   one for each row with changed pixels until there are too many (see
+   sequentialAddChangedRange).  ranges must hold 2*SEQUENTIAL_MAX_CHANGED_RANGES
+   + 2 values.  There are no ranges if the images are equal. */
+static void sequentialFindChangedPixels(const IceTImage image,
+                                        const IceTImage old_image,
+                                        IceTInt *ranges,
+                                        IceTInt *num_ranges)
+{
+    const IceTByte *color;
+    const IceTByte *old_color;
+    const IceTByte *depth;
+    const IceTByte *old_depth;
+    IceTSizeType color_size;
+    IceTSizeType depth_size;
+    IceTSizeType width;
+    IceTSizeType height;
+    IceTSizeType y;
+
+    *num_ranges = 0;
+
+    width = icetImageGetWidth(image);
+    height = icetImageGetHeight(image);
+    if (   (icetImageGetWidth(old_image) != width)
+        || (icetImageGetHeight(old_image) != height)
+        || (   icetImageGetColorFormat(old_image)
+            != icetImageGetColorFormat(image))
+        || (   icetImageGetDepthFormat(old_image)
+            != icetImageGetDepthFormat(image)) ) {
+        sequentialAddChangedRange(ranges, num_ranges, 0, width*height);
+        return;
+    }
+
+    icetTimingCompressBegin();
+
+    color = icetImageGetColorConstVoid(image, &color_size);
+    old_color = icetImageGetColorConstVoid(old_image, NULL);
+    depth = icetImageGetDepthConstVoid(image, &depth_size);
+    old_depth = icetImageGetDepthConstVoid(old_image, NULL);
+
+#define PIXEL_CHANGED(pixel)                                                   \
+    (   (memcmp(color + (pixel)*color_size,                                    \
+                old_color + (pixel)*color_size,                                \
+                color_size) != 0)                                              \
+     || (memcmp(depth + (pixel)*depth_size,                                    \
+                old_depth + (pixel)*depth_size,                                \
+                depth_size) != 0) )
+
+    for (y = 0; y < height; y++) {
+        const IceTSizeType row_begin = y*width;
+        const IceTSizeType row_end = row_begin + width;
+        IceTSizeType first;
+        IceTSizeType last;
+
+        for (first = row_begin;
+             (first < row_end) && !PIXEL_CHANGED(first);
+             first++);
+        if (first == row_end) continue;
+        for (last = row_end; !PIXEL_CHANGED(last-1); last--);
+
+        sequentialAddChangedRange(ranges,
+                                  num_ranges,
+                                  (IceTInt)first,
+                                  (IceTInt)last);
+    }
+
+#undef PIXEL_CHANGED
+
+    icetTimingCompressEnd();
+}
+
+static int sequentialCompareRanges(const void *a, const void *b)
+{
+    const IceTInt *range_a = (const IceTInt *)a;
+    const IceTInt *range_b = (const IceTInt *)b;
+
+    if (range_a[0] < range_b[0]) return -1;
+    if (range_a[0] > range_b[0]) return 1;
+    return 0;
+}
+
+static IceTBoolean sequentialRenderIsLayered(void)
+{
+    return (   icetUnsafeStateGetBoolean(ICET_PRE_RENDERED)[0]
+            && icetImageIsLayered(icetRetrieveStateImage(ICET_RENDER_BUFFER)) );
+}
+
+/* Composites a single tile like icetSequentialCompose, but only the pixels
+   that changed on some process since the last frame.  The changed ranges of
+   pixels are packed into one image, which is composited in one pass.  The
+   display node patches the composited pixels into the image it returned for
+   the last frame. */
+static IceTImage sequentialDeltaCompose(const IceTInt *compose_group,
+                                        IceTInt image_dest)
+{
+    IceTInt rank;
+    IceTInt num_proc;
+    IceTInt d_node;
+    IceTInt frame_count;
+    IceTInt background_color_word;
+    IceTSizeType tile_width;
+    IceTSizeType tile_height;
+    IceTSizeType num_pixels;
+    /* Number of ranges followed by their begin and end, with room for the
+       range that sequentialAddChangedRange appends before joining two. */
+    IceTInt local_ranges[2*SEQUENTIAL_MAX_CHANGED_RANGES + 3];
+    IceTInt *all_ranges;
+    IceTInt *sorted_ranges;
+    IceTInt num_sorted_ranges;
+    IceTInt changed_ranges[2*SEQUENTIAL_MAX_CHANGED_RANGES + 2];
+    IceTInt num_changed_ranges;
+    IceTSizeType changed_num;
+    IceTImage tile_image;
+    IceTImage my_image;
+    int proc;
+    int i;
+
+    icetGetIntegerv(ICET_RANK, &rank);
+    icetGetIntegerv(ICET_NUM_PROCESSES, &num_proc);
+    icetGetIntegerv(ICET_FRAME_COUNT, &frame_count);
+    icetGetIntegerv(ICET_TRUE_BACKGROUND_COLOR_WORD, &background_color_word);
+    d_node = icetUnsafeStateGetInteger(ICET_DISPLAY_NODES)[0];
+    tile_width = icetUnsafeStateGetInteger(ICET_TILE_VIEWPORTS)[2];
+    tile_height = icetUnsafeStateGetInteger(ICET_TILE_VIEWPORTS)[3];
+    num_pixels = tile_width*tile_height;
+
+    /* Alternate between two buffers so that the rendered image of the last
+       frame is still around to compare against. */
+    tile_image = icetGetStateBufferImage((frame_count%2 == 0)
+                                         ? SEQUENTIAL_TILE_IMAGE_BUFFER_EVEN
+                                         : SEQUENTIAL_TILE_IMAGE_BUFFER_ODD,
+                                         tile_width, tile_height);
+    icetGetTileImage(0, tile_image);
+
+    local_ranges[0] = 0;
+    if (sequentialDeltaBaseValid(frame_count)) {
+        IceTImage old_tile_image
+            = icetRetrieveStateImage((frame_count%2 == 0)
+                                     ? SEQUENTIAL_TILE_IMAGE_BUFFER_ODD
+                                     : SEQUENTIAL_TILE_IMAGE_BUFFER_EVEN);
+        sequentialFindChangedPixels(tile_image,
+                                    old_tile_image,
+                                    local_ranges + 1,
+                                    local_ranges);
+    } else {
+        sequentialAddChangedRange(local_ranges + 1,
+                                  local_ranges,
+                                  0,
+                                  (IceTInt)num_pixels);
+    }
+
+    /* The composited color of a pixel depends on the images of all
+       processes, so each process must composite the pixels changed on any. */
+    all_ranges = icetGetStateBuffer(
+                     SEQUENTIAL_CHANGED_RANGES_BUFFER,
+                       num_proc*(2*SEQUENTIAL_MAX_CHANGED_RANGES + 1)
+                     * 2*sizeof(IceTInt));
+    sorted_ranges = all_ranges + num_proc*(2*SEQUENTIAL_MAX_CHANGED_RANGES + 1);
+    icetRaiseDebug("Gathering ranges of changed pixels.");
+    icetCommAllgather(local_ranges,
+                      2*SEQUENTIAL_MAX_CHANGED_RANGES + 1,
+                      ICET_INT,
+                      all_ranges);
+    num_sorted_ranges = 0;
+    for (proc = 0; proc < num_proc; proc++) {
+        const IceTInt *proc_ranges
+            = all_ranges + proc*(2*SEQUENTIAL_MAX_CHANGED_RANGES + 1);
+        memcpy(sorted_ranges + 2*num_sorted_ranges,
+               proc_ranges + 1,
+               2*proc_ranges[0]*sizeof(IceTInt));
+        num_sorted_ranges += proc_ranges[0];
+    }
+    qsort(sorted_ranges,
+          num_sorted_ranges,
+          2*sizeof(IceTInt),
+          sequentialCompareRanges);
+    num_changed_ranges = 0;
+    changed_num = 0;
+    for (i = 0; i < num_sorted_ranges; i++) {
+        sequentialAddChangedRange(changed_ranges,
+                                  &num_changed_ranges,
+                                  sorted_ranges[2*i + 0],
+                                  sorted_ranges[2*i + 1]);
+    }
+
+    /* Report the ranges as their offset and number of pixels. */
+    for (i = 0; i < num_changed_ranges; i++) {
+        changed_ranges[2*i + 1] -= changed_ranges[2*i + 0];
+        changed_num += changed_ranges[2*i + 1];
+    }
+    icetStateSetInteger(ICET_CHANGED_PIXELS_OFFSET,
+                        (num_changed_ranges > 0) ? changed_ranges[0] : 0);
+    icetStateSetInteger(ICET_CHANGED_PIXELS_NUM, (IceTInt)changed_num);
+    icetStateSetInteger(ICET_CHANGED_PIXELS_NUM_RANGES, num_changed_ranges);
+    icetStateSetIntegerv(ICET_CHANGED_PIXELS_RANGES,
+                         2*num_changed_ranges,
+                         changed_ranges);
+
+    if (changed_num == num_pixels) {
+        IceTSparseImage rendered_image;
+        IceTSparseImage composited_image;
+        IceTSizeType piece_offset;
+
+        rendered_image = icetCompressTileSubImage(tile_image, 0, num_pixels);
+        icetSingleImageCompose(compose_group,
+                               num_proc,
+                               image_dest,
+                               rendered_image,
+                               &composited_image,
+                               &piece_offset);
+
+        if (d_node == rank) {
+            my_image = icetGetStateBufferImage(SEQUENTIAL_FINAL_IMAGE_BUFFER,
+                                               tile_width, tile_height);
+        } else {
+            my_image = icetGetStateBufferImage(
+                                           SEQUENTIAL_INTERMEDIATE_IMAGE_BUFFER,
+                                           tile_width, tile_height);
+        }
+        icetSingleImageCollect(composited_image,
+                               d_node,
+                               piece_offset,
+                               my_image);
+    } else if (changed_num > 0) {
+        IceTImage packed_image;
+        IceTSparseImage rendered_image;
+        IceTSparseImage composited_image;
+        IceTSizeType piece_offset;
+        IceTSizeType packed_offset;
+
+        packed_image = icetGetStateBufferImage(SEQUENTIAL_PACKED_IMAGE_BUFFER,
+                                               changed_num, 1);
+        packed_offset = 0;
+        for (i = 0; i < num_changed_ranges; i++) {
+            icetImageCopyPixels(tile_image, changed_ranges[2*i + 0],
+                                packed_image, packed_offset,
+                                changed_ranges[2*i + 1]);
+            packed_offset += changed_ranges[2*i + 1];
+        }
+
+        rendered_image = icetCompressTileSubImage(packed_image, 0, changed_num);
+        icetSingleImageCompose(compose_group,
+                               num_proc,
+                               image_dest,
+                               rendered_image,
+                               &composited_image,
+                               &piece_offset);
+
+        my_image = icetGetStateBufferImage(SEQUENTIAL_INTERMEDIATE_IMAGE_BUFFER,
+                                           changed_num, 1);
+        icetSingleImageCollect(composited_image,
+                               d_node,
+                               piece_offset,
+                               my_image);
+
+        if (d_node == rank) {
+            IceTImage changed_image = my_image;
+            my_image = icetRetrieveStateImage(SEQUENTIAL_FINAL_IMAGE_BUFFER);
+            packed_offset = 0;
+            for (i = 0; i < num_changed_ranges; i++) {
+                icetImageCopyPixels(changed_image, packed_offset,
+                                    my_image, changed_ranges[2*i + 0],
+                                    changed_ranges[2*i + 1]);
+                packed_offset += changed_ranges[2*i + 1];
+            }
+        }
+    } else if (d_node == rank) {
+        icetRaiseDebug("No pixels changed since the last frame.");
+        my_image = icetRetrieveStateImage(SEQUENTIAL_FINAL_IMAGE_BUFFER);
+    } else {
+        my_image = icetImageNull();
+    }
+
+    {
+        IceTInt base[2];
+        base[0] = frame_count;
+        base[1] = background_color_word;
+        icetStateSetIntegerv(ICET_TEMPORAL_DELTA_BASE, 2, base);
+    }
+
+    return (d_node == rank) ? my_image : icetImageNull();
+}
 
 IceTImage icetSequentialCompose(void)
 {
@@ -28,6 +399,7 @@ IceTImage icetSequentialCompose(void)
     const IceTInt *tile_viewports;
     IceTBoolean ordered_composite;
     IceTBoolean image_collect;
+    IceTBoolean keep_deep_image;
     IceTImage my_image;
     IceTInt *compose_group;
     int i;
@@ -39,6 +411,7 @@ IceTImage icetSequentialCompose(void)
     tile_viewports = icetUnsafeStateGetInteger(ICET_TILE_VIEWPORTS);
     ordered_composite = icetIsEnabled(ICET_ORDERED_COMPOSITE);
     image_collect = icetIsEnabled(ICET_COLLECT_IMAGES);
+    keep_deep_image = *icetUnsafeStateGetBoolean(ICET_KEEP_DEEP_IMAGE);
 
     if (!image_collect && (num_tiles > 1)) {
         icetRaiseWarning(ICET_INVALID_OPERATION,
@@ -60,6 +433,32 @@ IceTImage icetSequentialCompose(void)
 	}
     }
 
+    if (icetIsEnabled(ICET_TEMPORAL_DELTA)) {
+        if (num_tiles != 1) {
+            icetRaiseWarning(ICET_INVALID_OPERATION,
+                             "ICET_TEMPORAL_DELTA is ignored with more than"
+                             " one tile.");
+        } else if (!image_collect) {
+            icetRaiseWarning(ICET_INVALID_OPERATION,
+                             "ICET_TEMPORAL_DELTA is ignored unless"
+                             " ICET_COLLECT_IMAGES is enabled.");
+        } else if (keep_deep_image || sequentialRenderIsLayered()) {
+            icetRaiseWarning(ICET_INVALID_OPERATION,
+                             "ICET_TEMPORAL_DELTA is ignored for layered"
+                             " images.");
+        } else {
+            int image_dest;
+            if (ordered_composite) {
+                for (image_dest = 0;
+                     compose_group[image_dest] != display_nodes[0];
+                     image_dest++);
+            } else {
+                image_dest = display_nodes[0];
+            }
+            return sequentialDeltaCompose(compose_group, image_dest);
+        }
+    }
+
   /* Render and compose every tile. */
     for (i = 0; i < num_tiles; i++) {
 	int d_node = display_nodes[i];
@@ -92,7 +491,31 @@ IceTImage icetSequentialCompose(void)
                                &composited_image,
                                &piece_offset);
 
-        if (image_collect) {
+        if (keep_deep_image) {
+            /* Leave the fragments unblended for icetCompositeImageLayeredDeep,
+               which finds the result in ICET_DEEP_IMAGE_BUF. */
+            if (image_collect) {
+                icetSingleImageCollectLayered(composited_image,
+                                              d_node,
+                                              piece_offset,
+                                              tile_width,
+                                              tile_height);
+            } else {
+                IceTSizeType piece_size
+                    = icetSparseImageGetNumPixels(composited_image);
+                if (piece_size > 0) {
+                    icetSingleImageKeepLayered(composited_image);
+                    icetStateSetInteger(ICET_VALID_PIXELS_TILE, i);
+                    icetStateSetInteger(ICET_VALID_PIXELS_OFFSET,
+                                        piece_offset);
+                    icetStateSetInteger(ICET_VALID_PIXELS_NUM, piece_size);
+                } else {
+                    icetStateSetInteger(ICET_VALID_PIXELS_TILE, -1);
+                    icetStateSetInteger(ICET_VALID_PIXELS_OFFSET, 0);
+                    icetStateSetInteger(ICET_VALID_PIXELS_NUM, 0);
+                }
+            }
+        } else if (image_collect) {
             IceTImage tile_image;
 
             /* If this processor is display node, make sure image goes to
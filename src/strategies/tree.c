@@ -14,7 +14,9 @@
 #include <IceTDevImage.h>
 
 #define TREE_IN_SPARSE_IMAGE_BUFFER     ICET_SI_STRATEGY_BUFFER_0
-#define TREE_SPARSE_IMAGE_BUFFER        ICET_SI_STRATEGY_BUFFER_1
+#define TREE_SPARSE_IMAGE_BUFFER_1      ICET_SI_STRATEGY_BUFFER_1
+#define TREE_SPARSE_IMAGE_BUFFER_2      ICET_SI_STRATEGY_BUFFER_2
+#define TREE_WIRE_BUFFER                ICET_SI_STRATEGY_BUFFER_3
 
 #define TREE_IMAGE_DATA 23
 
@@ -23,8 +25,8 @@ static void RecursiveTreeCompose(const IceTInt *compose_group,
                                  IceTInt group_rank,
                                  IceTInt image_dest,
                                  IceTSparseImage *imageData,
-                                 IceTVoid *inSparseImageBuffer,
-                                 IceTSparseImage *imageBuffer)
+                                 IceTEnum *imageDataBuffer,
+                                 IceTEnum *spareBuffer)
 {
     IceTInt middle;
     enum { NO_IMAGE, SEND_IMAGE, RECV_IMAGE } current_image;
@@ -38,7 +40,7 @@ static void RecursiveTreeCompose(const IceTInt *compose_group,
     middle = group_size/2;
     if (group_rank < middle) {
         RecursiveTreeCompose(compose_group, middle, group_rank, image_dest,
-                             imageData, inSparseImageBuffer, imageBuffer);
+                             imageData, imageDataBuffer, spareBuffer);
         if (group_rank == image_dest) {
           /* I'm the destination.  GIMME! */
             current_image = RECV_IMAGE;
@@ -64,7 +66,7 @@ static void RecursiveTreeCompose(const IceTInt *compose_group,
     } else {
         RecursiveTreeCompose(compose_group + middle, group_size - middle,
                              group_rank - middle, image_dest - middle,
-                             imageData, inSparseImageBuffer, imageBuffer);
+                             imageData, imageDataBuffer, spareBuffer);
         if (group_rank == image_dest) {
           /* I'm the destination.  GIMME! */
             current_image = RECV_IMAGE;
@@ -89,41 +91,53 @@ static void RecursiveTreeCompose(const IceTInt *compose_group,
       /* Hasta la vista, baby. */
         IceTVoid *package_buffer;
         IceTSizeType package_size;
+        IceTVoid *encode_buffer = NULL;
         icetRaiseDebug("Sending image to %d", (int)compose_group[pair_proc]);
-        icetSparseImagePackageForSend(*imageData,
-                                      &package_buffer,
-                                      &package_size);
+        if (icetSparseImageWireEncodingEnabled()) {
+            encode_buffer = icetGetStateBuffer(
+                                TREE_WIRE_BUFFER,
+                                icetSparseImageEncodeBufferSize(*imageData));
+        }
+        icetSparseImageEncodeForSend(*imageData,
+                                     encode_buffer,
+                                     &package_buffer,
+                                     &package_size);
         icetCommSend(package_buffer, package_size, ICET_BYTE,
                      compose_group[pair_proc], TREE_IMAGE_DATA);
     } else if (current_image == RECV_IMAGE) {
       /* Get my image. */
+        IceTVoid *inSparseImageBuffer;
+        IceTVoid *decode_buffer = NULL;
+        IceTSizeType decoded_size;
         IceTSparseImage inSparseImage;
-        IceTSizeType incoming_size;
         icetRaiseDebug("Getting image from %d", (int)compose_group[pair_proc]);
-        incoming_size = icetSparseImageBufferSizeType(
-                                      icetSparseImageGetColorFormat(*imageData),
-                                      icetSparseImageGetDepthFormat(*imageData),
-                                      icetSparseImageGetWidth(*imageData),
-                                      icetSparseImageGetHeight(*imageData));
-        icetCommRecv(inSparseImageBuffer, incoming_size, ICET_BYTE,
-                     compose_group[pair_proc], TREE_IMAGE_DATA);
-        inSparseImage
-            = icetSparseImageUnpackageFromReceive(inSparseImageBuffer);
+      /* The size of a layered image is not known in advance, so the incoming
+         buffer is allocated to fit the message. */
+        inSparseImageBuffer = icetCommRecvAlloc(TREE_IN_SPARSE_IMAGE_BUFFER,
+                                                ICET_BYTE,
+                                                compose_group[pair_proc],
+                                                TREE_IMAGE_DATA);
+        decoded_size = icetSparseImageDecodedBufferSize(inSparseImageBuffer);
+        if (decoded_size > 0) {
+            decode_buffer = icetGetStateBuffer(TREE_WIRE_BUFFER, decoded_size);
+        }
+        inSparseImage = icetSparseImageDecodeFromReceive(inSparseImageBuffer,
+                                                         decode_buffer);
         if (group_rank < pair_proc) {
-            icetCompressedCompressedComposite(*imageData,
-                                              inSparseImage,
-                                              *imageBuffer);
+            *imageData = icetCompressedCompressedCompositeAlloc(*imageData,
+                                                                inSparseImage,
+                                                                *spareBuffer);
         } else {
-            icetCompressedCompressedComposite(inSparseImage,
-                                              *imageData,
-                                              *imageBuffer);
+            *imageData = icetCompressedCompressedCompositeAlloc(inSparseImage,
+                                                                *imageData,
+                                                                *spareBuffer);
         }
-        /* The actual image data is now in imageBuffer, so switch imageBuffer
-           and imageData. */
+        /* The actual image data is now in spareBuffer, so switch spareBuffer
+           and imageDataBuffer. */
         {
-            IceTSparseImage oldImage = *imageData;
-            *imageData = *imageBuffer;
-            *imageBuffer = oldImage;
+            IceTEnum oldBuffer = *imageDataBuffer;
+            *imageDataBuffer = *spareBuffer;
+            *spareBuffer = oldBuffer;
         }
     }
 }
@@ -136,22 +150,13 @@ void icetTreeCompose(const IceTInt *compose_group,
                      IceTSizeType *piece_offset)
 {
     IceTInt group_rank;
-    IceTVoid *inSparseImageBuffer;
     IceTSparseImage imageData;
-    IceTSparseImage imageBuffer;
-    IceTSizeType width, height;
-    IceTSizeType sparseBufferSize;
-
-    width = icetSparseImageGetWidth(input_image);
-    height = icetSparseImageGetHeight(input_image);
-
-    sparseBufferSize = icetSparseImageBufferSize(width, height);
+    IceTEnum imageDataBuffer;
+    IceTEnum spareBuffer;
 
-    inSparseImageBuffer = icetGetStateBuffer(TREE_IN_SPARSE_IMAGE_BUFFER,
-                                             sparseBufferSize);
     imageData = input_image;
-    imageBuffer = icetGetStateBufferSparseImage(TREE_SPARSE_IMAGE_BUFFER,
-                                                width, height);
+    imageDataBuffer = TREE_SPARSE_IMAGE_BUFFER_1;
+    spareBuffer = TREE_SPARSE_IMAGE_BUFFER_2;
 
     group_rank = icetFindMyRankInGroup(compose_group, group_size);
     if (group_rank < 0) {
@@ -161,7 +166,7 @@ void icetTreeCompose(const IceTInt *compose_group,
     }
 
     RecursiveTreeCompose(compose_group, group_size, group_rank, image_dest,
-                         &imageData, inSparseImageBuffer, &imageBuffer);
+                         &imageData, &imageDataBuffer, &spareBuffer);
 
     *result_image = imageData;
     *piece_offset = 0;
@@ -0,0 +1,500 @@
+/* -*- c -*- *****************************************************************
+** Checks that sparse images stored in blocks with ICET_BLOCK_SPARSE_IMAGES
+** hold the same pixels as ones stored in runs.  Images of several shapes and
+** formats are compressed both ways and then decompressed, composited, copied,
+** split, interlaced and packaged, and every result must decompress to the
+** same image as that of the runs.  Compositing with every strategy must also
+** give the same image in either format.
+*****************************************************************************/
+
+#include <IceT.h>
+#include <IceTDevImage.h>
+#include "test_codes.h"
+#include "test_util.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Returns whether a pixel of a test pattern is active.  The patterns are thin
+ * diagonal lines, on which runs are short, and larger random patches. */
+static IceTBoolean PatternActive(IceTInt pattern,
+                                 IceTSizeType x,
+                                 IceTSizeType y)
+{
+    if (pattern == 0) {
+        return ((x + y)%13 == 0) || ((x - y + 1000)%29 < 2);
+    } else {
+        IceTUInt hash = (IceTUInt)((x/5)*73856093u ^ (y/3)*19349663u);
+        return (hash*2654435761u >> 28) < 7;
+    }
+}
+
+static void PatternImage(IceTImage image,
+                         IceTInt pattern,
+                         IceTSizeType width,
+                         IceTSizeType height)
+{
+    IceTEnum color_format = icetImageGetColorFormat(image);
+    IceTEnum depth_format = icetImageGetDepthFormat(image);
+    IceTSizeType x, y;
+
+    icetImageSetDimensions(image, width, height);
+    for (y = 0; y < height; y++) {
+        for (x = 0; x < width; x++) {
+            IceTSizeType pixel = y*width + x;
+            IceTBoolean active = PatternActive(pattern, x, y);
+            IceTFloat value = 0.001f*(IceTFloat)((x*7 + y*3 + pattern)%997);
+
+            if (color_format == ICET_IMAGE_COLOR_RGBA_UBYTE) {
+                IceTUByte *color = icetImageGetColorub(image) + 4*pixel;
+                color[0] = (IceTUByte)(x + 17*pattern);
+                color[1] = (IceTUByte)y;
+                color[2] = (IceTUByte)(x*y);
+                color[3] = active ? (IceTUByte)(128 + 64*pattern) : 0;
+            } else if (color_format == ICET_IMAGE_COLOR_RGBA_FLOAT) {
+                IceTFloat *color = icetImageGetColorf(image) + 4*pixel;
+                color[0] = value;
+                color[1] = 1.0f - value;
+                color[2] = 0.5f*(IceTFloat)pattern;
+                color[3] = active ? 1.0f : 0.0f;
+            }
+            if (depth_format == ICET_IMAGE_DEPTH_FLOAT) {
+                icetImageGetDepthf(image)[pixel] = active ? value : 1.0f;
+            }
+        }
+    }
+}
+
+/* Compares the decompressed pixels of two sparse images, which may be stored
+ * differently. */
+static IceTBoolean SparseImagesMatch(const IceTSparseImage image0,
+                                     const IceTSparseImage image1,
+                                     IceTImage scratch0,
+                                     IceTImage scratch1)
+{
+    IceTSizeType num_pixels = icetSparseImageGetNumPixels(image0);
+    IceTSizeType pixel_size;
+
+    if (num_pixels != icetSparseImageGetNumPixels(image1)) return ICET_FALSE;
+
+    icetImageSetDimensions(scratch0, num_pixels, 1);
+    icetImageSetDimensions(scratch1, num_pixels, 1);
+    icetDecompressSubImage(image0, 0, scratch0);
+    icetDecompressSubImage(image1, 0, scratch1);
+
+    if (icetImageGetColorFormat(scratch0) != ICET_IMAGE_COLOR_NONE) {
+        const IceTVoid *color0 = icetImageGetColorConstVoid(scratch0,
+                                                            &pixel_size);
+        const IceTVoid *color1 = icetImageGetColorConstVoid(scratch1, NULL);
+        if (memcmp(color0, color1, num_pixels*pixel_size) != 0) {
+            return ICET_FALSE;
+        }
+    }
+    if (icetImageGetDepthFormat(scratch0) != ICET_IMAGE_DEPTH_NONE) {
+        const IceTVoid *depth0 = icetImageGetDepthConstVoid(scratch0,
+                                                            &pixel_size);
+        const IceTVoid *depth1 = icetImageGetDepthConstVoid(scratch1, NULL);
+        if (memcmp(depth0, depth1, num_pixels*pixel_size) != 0) {
+            return ICET_FALSE;
+        }
+    }
+    return ICET_TRUE;
+}
+
+#define NUM_IMAGES      4
+
+static IceTBoolean TryShape(IceTSizeType width, IceTSizeType height)
+{
+    static const IceTInt num_partitions_list[] = { 2, 3, 7 };
+    const IceTSizeType num_pixels = width*height;
+    IceTVoid *buffers[2 + 2*NUM_IMAGES];
+    IceTImage images[2];
+    IceTSparseImage runs[NUM_IMAGES];
+    IceTSparseImage blocks[NUM_IMAGES];
+    IceTSizeType offsets[8];
+    IceTSizeType pixel;
+    IceTBoolean success = ICET_TRUE;
+    int i;
+
+    printstat("  %dx%d pixels\n", (int)width, (int)height);
+
+    /* Buffers allocated with the blocks enabled fit images of either kind. */
+    icetEnable(ICET_BLOCK_SPARSE_IMAGES);
+    for (i = 0; i < 2; i++) {
+        buffers[i] = malloc(icetImageBufferSize(width, height));
+        images[i] = icetImageAssignBuffer(buffers[i], width, height);
+    }
+    for (i = 0; i < NUM_IMAGES; i++) {
+        buffers[2 + i] = malloc(icetSparseImageBufferSize(width, height));
+        blocks[i] = icetSparseImageAssignBuffer(buffers[2 + i], width, height);
+    }
+    icetDisable(ICET_BLOCK_SPARSE_IMAGES);
+    for (i = 0; i < NUM_IMAGES; i++) {
+        buffers[2 + NUM_IMAGES + i]
+            = malloc(icetSparseImageBufferSize(width, height));
+        runs[i] = icetSparseImageAssignBuffer(buffers[2 + NUM_IMAGES + i],
+                                              width, height);
+    }
+
+    if (   !icetSparseImageIsBlocked(blocks[0])
+        || icetSparseImageIsBlocked(runs[0]) ) {
+        printrank("***** Images do not follow ICET_BLOCK_SPARSE_IMAGES"
+                  " *****\n");
+        success = ICET_FALSE;
+    }
+
+    /* Compress two patterns both ways. */
+    for (i = 0; i < 2; i++) {
+        PatternImage(images[0], i, width, height);
+        icetCompressImage(images[0], runs[i]);
+        icetCompressImage(images[0], blocks[i]);
+        if (   !icetSparseImageIsBlocked(blocks[i])
+            || !SparseImagesMatch(runs[i], blocks[i], images[0], images[1])) {
+            printrank("***** Compressing pattern %d to blocks differs *****\n",
+                      i);
+            success = ICET_FALSE;
+        }
+        printstat("    Pattern %d: %d bytes in runs, %d bytes in blocks\n",
+                  i,
+                  (int)icetSparseImageGetCompressedBufferSize(runs[i]),
+                  (int)icetSparseImageGetCompressedBufferSize(blocks[i]));
+    }
+
+    /* Composite them. */
+    icetCompressedCompressedComposite(runs[0], runs[1], runs[2]);
+    icetCompressedCompressedComposite(blocks[0], blocks[1], blocks[2]);
+    if (   !icetSparseImageIsBlocked(blocks[2])
+        || !SparseImagesMatch(runs[2], blocks[2], images[0], images[1])) {
+        printrank("***** Compositing blocks differs *****\n");
+        success = ICET_FALSE;
+    }
+
+    /* Copy ranges starting at every pixel of the first rows. */
+    for (pixel = 0;
+         (pixel < num_pixels) && (pixel < 3*width + 70) && success;
+         pixel++) {
+        const IceTSizeType lengths[3] = { 1, 67, num_pixels - pixel };
+        int j;
+        for (j = 0; j < 3; j++) {
+            if (pixel + lengths[j] > num_pixels) continue;
+            icetSparseImageCopyPixels(runs[2], pixel, lengths[j], runs[3]);
+            icetSparseImageCopyPixels(blocks[2], pixel, lengths[j], blocks[3]);
+            if (   !icetSparseImageIsBlocked(blocks[3])
+                || !SparseImagesMatch(runs[3], blocks[3],
+                                      images[0], images[1])) {
+                printrank("***** Copying %d pixels from %d of blocks differs"
+                          " *****\n", (int)lengths[j], (int)pixel);
+                success = ICET_FALSE;
+                break;
+            }
+        }
+    }
+
+    /* Split into new images and in place, and interlace. */
+    for (i = 0;
+         i < (int)(sizeof(num_partitions_list)/sizeof(IceTInt)) && success;
+         i++) {
+        IceTInt num_partitions = num_partitions_list[i];
+        IceTSparseImage run_pieces[7];
+        IceTSparseImage block_pieces[7];
+        IceTInt partition;
+
+        if (num_partitions > num_pixels) continue;
+
+        for (partition = 0; partition < num_partitions; partition++) {
+            run_pieces[partition] = block_pieces[partition]
+                = icetSparseImageNull();
+        }
+        icetSparseImageSplitAlloc(runs[2], 0, num_partitions, num_partitions,
+                                  ICET_SI_STRATEGY_BUFFER_0, run_pieces,
+                                  offsets);
+        icetSparseImageSplitAlloc(blocks[2], 0, num_partitions, num_partitions,
+                                  ICET_SI_STRATEGY_BUFFER_1, block_pieces,
+                                  offsets);
+        for (partition = 0; partition < num_partitions; partition++) {
+            if (   !icetSparseImageIsBlocked(block_pieces[partition])
+                || !SparseImagesMatch(run_pieces[partition],
+                                      block_pieces[partition],
+                                      images[0], images[1]) ) {
+                printrank("***** Splitting blocks into %d partitions differs"
+                          " *****\n", num_partitions);
+                success = ICET_FALSE;
+            }
+        }
+
+        icetSparseImageInterlace(runs[2], num_partitions,
+                                 ICET_SI_STRATEGY_BUFFER_0, runs[3]);
+        icetSparseImageInterlace(blocks[2], num_partitions,
+                                 ICET_SI_STRATEGY_BUFFER_0, blocks[3]);
+        if (   !icetSparseImageIsBlocked(blocks[3])
+            || !SparseImagesMatch(runs[3], blocks[3], images[0], images[1])) {
+            printrank("***** Interlacing blocks for %d partitions differs"
+                      " *****\n", num_partitions);
+            success = ICET_FALSE;
+        }
+    }
+
+    /* Split in place, keeping the first partition in the input. */
+    if (success && (num_pixels >= 3)) {
+        IceTSparseImage run_pieces[3];
+        IceTSparseImage block_pieces[3];
+        IceTInt partition;
+
+        icetSparseImageCopyPixels(runs[2], 0, num_pixels, runs[3]);
+        icetSparseImageCopyPixels(blocks[2], 0, num_pixels, blocks[3]);
+        run_pieces[0] = runs[3];
+        run_pieces[1] = runs[0];
+        run_pieces[2] = runs[1];
+        block_pieces[0] = blocks[3];
+        block_pieces[1] = blocks[0];
+        block_pieces[2] = blocks[1];
+        icetSparseImageSplit(runs[3], 0, 3, 3, run_pieces, offsets);
+        icetSparseImageSplit(blocks[3], 0, 3, 3, block_pieces, offsets);
+        for (partition = 0; partition < 3; partition++) {
+            if (   !icetSparseImageIsBlocked(block_pieces[partition])
+                || !SparseImagesMatch(run_pieces[partition],
+                                      block_pieces[partition],
+                                      images[0], images[1]) ) {
+                printrank("***** Splitting blocks in place differs *****\n");
+                success = ICET_FALSE;
+            }
+        }
+
+        /* Restore the patterns. */
+        for (i = 0; i < 2; i++) {
+            PatternImage(images[0], i, width, height);
+            icetCompressImage(images[0], runs[i]);
+            icetCompressImage(images[0], blocks[i]);
+        }
+    }
+
+    /* Compositing with a single row image reshapes its blocks. */
+    if (success && (height > 1)) {
+        IceTSparseImage run_result;
+        IceTSparseImage block_result;
+
+        PatternImage(images[0], 1, width, height);
+        icetCompressSubImage(images[0], 0, num_pixels, blocks[3]);
+        run_result = icetCompressedCompressedCompositeAlloc(
+                                   runs[0], runs[1], ICET_SI_STRATEGY_BUFFER_0);
+        block_result = icetCompressedCompressedCompositeAlloc(
+                               blocks[0], blocks[3], ICET_SI_STRATEGY_BUFFER_1);
+        if (   !icetSparseImageIsBlocked(block_result)
+            || (icetSparseImageGetWidth(block_result) != width)
+            || !SparseImagesMatch(run_result, block_result,
+                                  images[0], images[1])) {
+            printrank("***** Compositing blocks of different shapes differs"
+                      " *****\n");
+            success = ICET_FALSE;
+        }
+    }
+
+    /* Packaging sends the blocks as they are. */
+    if (success) {
+        IceTVoid *package;
+        IceTSizeType package_size;
+        IceTVoid *received_buffer;
+        IceTSparseImage received;
+
+        icetSparseImagePackageForSend(blocks[2], &package, &package_size);
+        received_buffer = malloc(package_size);
+        memcpy(received_buffer, package, package_size);
+        received = icetSparseImageUnpackageFromReceive(received_buffer);
+        if (   icetSparseImageIsNull(received)
+            || !icetSparseImageIsBlocked(received)
+            || !SparseImagesMatch(runs[2], received, images[0], images[1])) {
+            printrank("***** Packaged blocks differ *****\n");
+            success = ICET_FALSE;
+        }
+        free(received_buffer);
+    }
+
+    for (i = 0; i < 2 + 2*NUM_IMAGES; i++) {
+        free(buffers[i]);
+    }
+
+    return success;
+}
+
+static IceTBoolean TryFormat(IceTEnum composite_mode,
+                             IceTEnum color_format,
+                             IceTEnum depth_format)
+{
+    static const IceTSizeType shapes[][2] = {
+        { 1, 1 }, { 70, 1 }, { 13, 7 }, { 8, 8 }, { 67, 19 }, { 128, 64 }
+    };
+    IceTBoolean success = ICET_TRUE;
+    int i;
+
+    icetCompositeMode(composite_mode);
+    icetSetColorFormat(color_format);
+    icetSetDepthFormat(depth_format);
+
+    for (i = 0; i < (int)(sizeof(shapes)/sizeof(shapes[0])); i++) {
+        success &= TryShape(shapes[i][0], shapes[i][1]);
+    }
+
+    return success;
+}
+
+/* Composites the buffers and copies the colors of the displayed tile into
+   result.  Returns false if IceT raised an error. */
+static IceTBoolean Composite(IceTBoolean use_blocks,
+                             const IceTUByte *color_buffer,
+                             const IceTFloat *depth_buffer,
+                             IceTUByte *result)
+{
+    IceTFloat background_color[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    IceTImage image;
+    IceTInt tile_displayed;
+
+    if (use_blocks) {
+        icetEnable(ICET_BLOCK_SPARSE_IMAGES);
+    } else {
+        icetDisable(ICET_BLOCK_SPARSE_IMAGES);
+    }
+    image = icetCompositeImage(color_buffer,
+                               depth_buffer,
+                               NULL,
+                               NULL,
+                               NULL,
+                               background_color);
+    icetDisable(ICET_BLOCK_SPARSE_IMAGES);
+
+    if (icetGetError() != ICET_NO_ERROR) return ICET_FALSE;
+
+    icetGetIntegerv(ICET_TILE_DISPLAYED, &tile_displayed);
+    if (tile_displayed >= 0) {
+        memcpy(result,
+               icetImageGetColorcub(image),
+               4*SCREEN_WIDTH*SCREEN_HEIGHT);
+    }
+    return ICET_TRUE;
+}
+
+static IceTBoolean TryStrategies(void)
+{
+    const IceTSizeType num_pixels = SCREEN_WIDTH*SCREEN_HEIGHT;
+    IceTUByte *color_buffer;
+    IceTFloat *depth_buffer;
+    IceTUByte *runs_result;
+    IceTUByte *blocks_result;
+    IceTInt rank;
+    IceTSizeType x, y;
+    IceTBoolean success = ICET_TRUE;
+    int strategy_index;
+
+    icetResetTiles();
+    icetAddTile(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT, 0);
+    icetCompositeMode(ICET_COMPOSITE_MODE_Z_BUFFER);
+    icetSetColorFormat(ICET_IMAGE_COLOR_RGBA_UBYTE);
+    icetSetDepthFormat(ICET_IMAGE_DEPTH_FLOAT);
+    icetDisable(ICET_ORDERED_COMPOSITE);
+
+    color_buffer = malloc(4*num_pixels);
+    depth_buffer = malloc(num_pixels*sizeof(IceTFloat));
+    runs_result = malloc(4*num_pixels);
+    blocks_result = malloc(4*num_pixels);
+
+    /* Thin diagonal lines that differ on each process. */
+    icetGetIntegerv(ICET_RANK, &rank);
+    for (y = 0; y < SCREEN_HEIGHT; y++) {
+        for (x = 0; x < SCREEN_WIDTH; x++) {
+            IceTSizeType pixel = y*SCREEN_WIDTH + x;
+            IceTUByte *color = color_buffer + 4*pixel;
+            if ((x + y + 5*rank)%11 == 0) {
+                color[0] = (IceTUByte)(x + rank);
+                color[1] = (IceTUByte)y;
+                color[2] = (IceTUByte)(64*rank);
+                color[3] = 255;
+                depth_buffer[pixel] = 0.01f*((x + 2*y + rank)%97);
+            } else {
+                color[0] = color[1] = color[2] = color[3] = 0;
+                depth_buffer[pixel] = 1.0f;
+            }
+        }
+    }
+
+    for (strategy_index = 0;
+         strategy_index < STRATEGY_LIST_SIZE;
+         strategy_index++) {
+        IceTEnum strategy = strategy_list[strategy_index];
+        int single_image_strategy_index;
+        int num_single_image_strategy;
+
+        icetStrategy(strategy);
+        if (strategy_uses_single_image_strategy(strategy)) {
+            num_single_image_strategy = SINGLE_IMAGE_STRATEGY_LIST_SIZE;
+        } else {
+            num_single_image_strategy = 1;
+        }
+
+        for (single_image_strategy_index = 0;
+             single_image_strategy_index < num_single_image_strategy;
+             single_image_strategy_index++) {
+            IceTInt tile_displayed;
+
+            icetSingleImageStrategy(
+                single_image_strategy_list[single_image_strategy_index]);
+            printstat("  Strategy %s, %s\n",
+                      icetGetStrategyName(),
+                      icetGetSingleImageStrategyName());
+
+            if (   !Composite(ICET_FALSE,
+                              color_buffer, depth_buffer, runs_result)
+                || !Composite(ICET_TRUE,
+                              color_buffer, depth_buffer, blocks_result) ) {
+                printrank("***** Compositing raised an error *****\n");
+                success = ICET_FALSE;
+                continue;
+            }
+
+            icetGetIntegerv(ICET_TILE_DISPLAYED, &tile_displayed);
+            if (   (tile_displayed >= 0)
+                && (memcmp(runs_result, blocks_result, 4*num_pixels) != 0)) {
+                printrank("***** Compositing blocks gives a different image"
+                          " *****\n");
+                success = ICET_FALSE;
+            }
+        }
+    }
+
+    free(color_buffer);
+    free(depth_buffer);
+    free(runs_result);
+    free(blocks_result);
+
+    return success;
+}
+
+static int BlockSparseRun(void)
+{
+    IceTBoolean success = ICET_TRUE;
+
+    printstat("Blended colors\n");
+    success &= TryFormat(ICET_COMPOSITE_MODE_BLEND,
+                         ICET_IMAGE_COLOR_RGBA_UBYTE,
+                         ICET_IMAGE_DEPTH_NONE);
+    printstat("Z buffer, float colors\n");
+    success &= TryFormat(ICET_COMPOSITE_MODE_Z_BUFFER,
+                         ICET_IMAGE_COLOR_RGBA_FLOAT,
+                         ICET_IMAGE_DEPTH_FLOAT);
+    printstat("Z buffer, depth only\n");
+    success &= TryFormat(ICET_COMPOSITE_MODE_Z_BUFFER,
+                         ICET_IMAGE_COLOR_NONE,
+                         ICET_IMAGE_DEPTH_FLOAT);
+    printstat("Compositing\n");
+    success &= TryStrategies();
+
+    return (success ? TEST_PASSED : TEST_FAILED);
+}
+
+int BlockSparse(int argc, char *argv[])
+{
+    /* Suppress warning. */
+    (void)argc;
+    (void)argv;
+
+    return run_test(BlockSparseRun);
+}
@@ -0,0 +1,279 @@
+/* -*- c -*- *****************************************************************
+** Checks the kernels that composite runs of regular pixels against
+** compositing each pixel with the scalar operations of IceTDevImage.h.  Both
+** icetComposite and icetCompressedCompressedComposite are checked for Z
+** buffer and blend compositing of RGBA ubyte, float and half colors.  Blended
+** float colors may differ by rounding, all other results must be identical.
+*****************************************************************************/
+
+#include <IceT.h>
+#include <IceTDevImage.h>
+#include <IceTDevState.h>
+#include "test_codes.h"
+#include "test_util.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+/* Odd sizes so that runs do not line up with vector lengths. */
+#define KERNEL_WIDTH    253
+#define KERNEL_HEIGHT   117
+
+#define FLOAT_BLEND_TOLERANCE   1e-6f
+
+/* Fills an image with random premultiplied colors and depths.  A quarter of
+ * the pixels are background with all channels 0 and depth 1, so compressing
+ * the image drops nothing that compositing would use.  Depths are quantized
+ * so that some pixels of two images tie. */
+static void FillImage(IceTImage image)
+{
+    IceTEnum color_format = icetImageGetColorFormat(image);
+    IceTEnum depth_format = icetImageGetDepthFormat(image);
+    IceTSizeType num_pixels = icetImageGetNumPixels(image);
+    IceTSizeType pixel;
+
+    for (pixel = 0; pixel < num_pixels; pixel++) {
+        IceTBoolean active = (rand()%4 != 0);
+        IceTFloat alpha = active ? 0.05f + 0.95f*random_float() : 0.0f;
+        int channel;
+
+        if (color_format == ICET_IMAGE_COLOR_RGBA_UBYTE) {
+            IceTUByte *color = icetImageGetColorub(image) + 4*pixel;
+            color[3] = (IceTUByte)(255.0f*alpha);
+            if (active && (color[3] == 0)) color[3] = 1;
+            for (channel = 0; channel < 3; channel++) {
+                color[channel] = (IceTUByte)(color[3]*random_float());
+            }
+        } else if (color_format == ICET_IMAGE_COLOR_RGBA_HALF) {
+            IceTUShort *color =
+                (IceTUShort *)icetImageGetColorVoid(image, NULL) + 4*pixel;
+            color[3] = icetFloatToHalf(alpha);
+            for (channel = 0; channel < 3; channel++) {
+                color[channel] = icetFloatToHalf(alpha*random_float());
+            }
+        } else {
+            IceTFloat *color = icetImageGetColorf(image) + 4*pixel;
+            color[3] = alpha;
+            for (channel = 0; channel < 3; channel++) {
+                color[channel] = alpha*random_float();
+            }
+        }
+
+        if (depth_format == ICET_IMAGE_DEPTH_FLOAT) {
+            icetImageGetDepthf(image)[pixel] =
+                active ? (IceTFloat)(rand()%64)/64.0f : 1.0f;
+        }
+    }
+}
+
+/* Composites front and back into result one pixel at a time. */
+static void CompositeScalar(const IceTImage front,
+                            const IceTImage back,
+                            IceTImage result)
+{
+    IceTEnum color_format = icetImageGetColorFormat(front);
+    IceTEnum depth_format = icetImageGetDepthFormat(front);
+    IceTSizeType num_pixels = icetImageGetNumPixels(front);
+    IceTSizeType pixel;
+
+    for (pixel = 0; pixel < num_pixels; pixel++) {
+        if (depth_format == ICET_IMAGE_DEPTH_FLOAT) {
+            const IceTFloat *front_depth = icetImageGetDepthcf(front);
+            const IceTFloat *back_depth = icetImageGetDepthcf(back);
+            const IceTImage *nearest =
+                (front_depth[pixel] < back_depth[pixel]) ? &front : &back;
+            icetImageCopyPixels(*nearest, pixel, result, pixel, 1);
+        } else if (color_format == ICET_IMAGE_COLOR_RGBA_UBYTE) {
+            ICET_BLEND_UBYTE(icetImageGetColorcub(front) + 4*pixel,
+                             icetImageGetColorcub(back) + 4*pixel,
+                             icetImageGetColorub(result) + 4*pixel);
+        } else if (color_format == ICET_IMAGE_COLOR_RGBA_HALF) {
+            const IceTUShort *front_color =
+                (const IceTUShort *)icetImageGetColorConstVoid(front, NULL);
+            const IceTUShort *back_color =
+                (const IceTUShort *)icetImageGetColorConstVoid(back, NULL);
+            IceTUShort *result_color =
+                (IceTUShort *)icetImageGetColorVoid(result, NULL);
+            ICET_BLEND_HALF(front_color + 4*pixel,
+                            back_color + 4*pixel,
+                            result_color + 4*pixel);
+        } else {
+            ICET_BLEND_FLOAT(icetImageGetColorcf(front) + 4*pixel,
+                             icetImageGetColorcf(back) + 4*pixel,
+                             icetImageGetColorf(result) + 4*pixel);
+        }
+    }
+}
+
+static IceTBoolean CompareImages(const IceTImage image,
+                                 const IceTImage expected,
+                                 const char *path)
+{
+    IceTEnum color_format = icetImageGetColorFormat(image);
+    IceTEnum depth_format = icetImageGetDepthFormat(image);
+    IceTSizeType num_pixels = icetImageGetNumPixels(image);
+    IceTSizeType pixel;
+
+    for (pixel = 0; pixel < num_pixels; pixel++) {
+        IceTBoolean match = ICET_TRUE;
+        int channel;
+
+        if (color_format == ICET_IMAGE_COLOR_RGBA_UBYTE) {
+            match = (  icetImageGetColorcui(image)[pixel]
+                    == icetImageGetColorcui(expected)[pixel]);
+        } else if (color_format == ICET_IMAGE_COLOR_RGBA_HALF) {
+            const IceTUShort *color =
+                (const IceTUShort *)icetImageGetColorConstVoid(image, NULL)
+                + 4*pixel;
+            const IceTUShort *expected_color =
+                (const IceTUShort *)icetImageGetColorConstVoid(expected, NULL)
+                + 4*pixel;
+            for (channel = 0; channel < 4; channel++) {
+                if (color[channel] != expected_color[channel]) {
+                    match = ICET_FALSE;
+                }
+            }
+        } else {
+            const IceTFloat *color = icetImageGetColorcf(image) + 4*pixel;
+            const IceTFloat *expected_color =
+                icetImageGetColorcf(expected) + 4*pixel;
+            IceTFloat tolerance = (depth_format == ICET_IMAGE_DEPTH_FLOAT)
+                ? 0.0f : FLOAT_BLEND_TOLERANCE;
+            for (channel = 0; channel < 4; channel++) {
+                IceTFloat difference = color[channel]-expected_color[channel];
+                if (fabs(difference) > tolerance) match = ICET_FALSE;
+            }
+        }
+
+        if (   (depth_format == ICET_IMAGE_DEPTH_FLOAT)
+            && (  icetImageGetDepthcf(image)[pixel]
+               != icetImageGetDepthcf(expected)[pixel]) ) {
+            match = ICET_FALSE;
+        }
+
+        if (!match) {
+            printrank("%s differs from the scalar result at pixel %d.\n",
+                      path, pixel);
+            return ICET_FALSE;
+        }
+    }
+
+    return ICET_TRUE;
+}
+
+static IceTImage NewImage(void)
+{
+    return icetImageAssignBuffer(
+                malloc(icetImageBufferSize(KERNEL_WIDTH, KERNEL_HEIGHT)),
+                KERNEL_WIDTH, KERNEL_HEIGHT);
+}
+
+static IceTSparseImage NewSparseImage(void)
+{
+    return icetSparseImageAssignBuffer(
+                malloc(icetSparseImageBufferSize(KERNEL_WIDTH, KERNEL_HEIGHT)),
+                KERNEL_WIDTH, KERNEL_HEIGHT);
+}
+
+static IceTBoolean TryKernel(IceTEnum color_format, IceTEnum composite_mode)
+{
+    const IceTSizeType num_pixels = KERNEL_WIDTH*KERNEL_HEIGHT;
+    IceTImage front, back, expected, result;
+    IceTSparseImage sparse_front, sparse_back, sparse_result;
+    IceTBoolean success = ICET_TRUE;
+
+    icetSetColorFormat(color_format);
+    if (composite_mode == ICET_COMPOSITE_MODE_Z_BUFFER) {
+        icetSetDepthFormat(ICET_IMAGE_DEPTH_FLOAT);
+    } else {
+        icetSetDepthFormat(ICET_IMAGE_DEPTH_NONE);
+    }
+    icetCompositeMode(composite_mode);
+
+    front = NewImage();
+    back = NewImage();
+    expected = NewImage();
+    result = NewImage();
+    FillImage(front);
+    FillImage(back);
+    CompositeScalar(front, back, expected);
+
+    printstat("  icetComposite\n");
+    icetImageCopyPixels(back, 0, result, 0, num_pixels);
+    icetComposite(result, front, 1);
+    success &= CompareImages(result, expected, "icetComposite");
+
+    if (composite_mode == ICET_COMPOSITE_MODE_BLEND) {
+        printstat("  icetComposite with source below\n");
+        icetImageCopyPixels(front, 0, result, 0, num_pixels);
+        icetComposite(result, back, 0);
+        success &= CompareImages(result, expected, "icetComposite under");
+    }
+
+    printstat("  icetCompressedCompressedComposite\n");
+    sparse_front = NewSparseImage();
+    sparse_back = NewSparseImage();
+    sparse_result = NewSparseImage();
+    icetCompressImage(front, sparse_front);
+    icetCompressImage(back, sparse_back);
+    icetCompressedCompressedComposite(sparse_front, sparse_back,
+                                      sparse_result);
+    icetDecompressImage(sparse_result, result);
+    success &= CompareImages(result,
+                             expected,
+                             "icetCompressedCompressedComposite");
+
+    free(front.opaque_internals);
+    free(back.opaque_internals);
+    free(expected.opaque_internals);
+    free(result.opaque_internals);
+    free(sparse_front.opaque_internals);
+    free(sparse_back.opaque_internals);
+    free(sparse_result.opaque_internals);
+
+    return success;
+}
+
+static int CompositeKernelsRun(void)
+{
+    IceTFloat black[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    IceTBoolean success = ICET_TRUE;
+
+    srand(7);
+
+    /* Background pixels of decompressed images must match the scalar
+       composite of two background pixels. */
+    icetStateSetFloatv(ICET_BACKGROUND_COLOR, 4, black);
+    icetStateSetInteger(ICET_BACKGROUND_COLOR_WORD, 0);
+
+    printstat("Z buffer compositing of RGBA ubyte colors\n");
+    success &= TryKernel(ICET_IMAGE_COLOR_RGBA_UBYTE,
+                         ICET_COMPOSITE_MODE_Z_BUFFER);
+    printstat("Z buffer compositing of RGBA float colors\n");
+    success &= TryKernel(ICET_IMAGE_COLOR_RGBA_FLOAT,
+                         ICET_COMPOSITE_MODE_Z_BUFFER);
+    printstat("Z buffer compositing of RGBA half colors\n");
+    success &= TryKernel(ICET_IMAGE_COLOR_RGBA_HALF,
+                         ICET_COMPOSITE_MODE_Z_BUFFER);
+    printstat("Blending RGBA ubyte colors\n");
+    success &= TryKernel(ICET_IMAGE_COLOR_RGBA_UBYTE,
+                         ICET_COMPOSITE_MODE_BLEND);
+    printstat("Blending RGBA float colors\n");
+    success &= TryKernel(ICET_IMAGE_COLOR_RGBA_FLOAT,
+                         ICET_COMPOSITE_MODE_BLEND);
+    printstat("Blending RGBA half colors\n");
+    success &= TryKernel(ICET_IMAGE_COLOR_RGBA_HALF,
+                         ICET_COMPOSITE_MODE_BLEND);
+
+    return (success ? TEST_PASSED : TEST_FAILED);
+}
+
+int CompositeKernels(int argc, char *argv[])
+{
+    /* Suppress warning. */
+    (void)argc;
+    (void)argv;
+
+    return run_test(CompositeKernelsRun);
+}
@@ -0,0 +1,319 @@
+/* -*- c -*- *****************************************************************
+** Checks that compressing regular images finds the same active pixels as
+** testing each pixel on its own.  Compression scans runs of pixels in blocks
+** of 32, so the images are filled with runs whose lengths are at and around
+** multiples of 32, and are compressed whole, from offsets and as regions
+** whose rows end inside a block.  Inactive pixels hold values that differ
+** from the background, so every pixel classified wrongly changes the
+** decompressed image.  All color formats with float depths are checked for Z
+** buffer compositing, and all RGBA color formats for blending.
+*****************************************************************************/
+
+#include <IceT.h>
+#include <IceTDevImage.h>
+#include <IceTDevState.h>
+#include "test_codes.h"
+#include "test_util.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+static const IceTSizeType run_lengths[] = {
+    1, 2, 31, 32, 33, 63, 64, 65, 95, 96, 97, 127, 128, 129, 300
+};
+
+static const IceTSizeType image_sizes[][2] = {
+    { 128, 9 },
+    { 97, 13 },
+    { 33, 33 },
+    { 1, 70 }
+};
+
+static const IceTSizeType sub_image_offsets[] = { 0, 1, 31, 32, 33, 65 };
+
+/* Sets a pixel to random values that compress as active or inactive.
+ * Inactive pixels have nonzero colors and, unless the image has colors,
+ * depths greater than 1, so they differ from the background. */
+static void SetPixel(IceTImage image, IceTSizeType pixel, IceTBoolean active)
+{
+    IceTEnum color_format = icetImageGetColorFormat(image);
+    IceTEnum depth_format = icetImageGetDepthFormat(image);
+    IceTEnum composite_mode;
+    IceTBoolean blend;
+    IceTFloat alpha;
+    int channel;
+
+    icetGetEnumv(ICET_COMPOSITE_MODE, &composite_mode);
+    blend = (composite_mode == ICET_COMPOSITE_MODE_BLEND);
+    alpha = (blend && !active) ? 0.0f : 0.1f + 0.9f*random_float();
+    /* Negative zero alphas are inactive too. */
+    if ((alpha == 0.0f) && (rand()%2 == 0)) alpha = -0.0f;
+
+    if (color_format == ICET_IMAGE_COLOR_RGBA_UBYTE) {
+        IceTUByte *color = icetImageGetColorub(image) + 4*pixel;
+        for (channel = 0; channel < 3; channel++) {
+            color[channel] = (IceTUByte)(1 + rand()%255);
+        }
+        color[3] = (IceTUByte)(255.0f*alpha + 0.5f);
+        if ((alpha != 0.0f) && (color[3] == 0)) color[3] = 1;
+    } else if (color_format == ICET_IMAGE_COLOR_RGBA_HALF) {
+        IceTUShort *color =
+            (IceTUShort *)icetImageGetColorVoid(image, NULL) + 4*pixel;
+        for (channel = 0; channel < 3; channel++) {
+            color[channel] = icetFloatToHalf(0.1f + 0.9f*random_float());
+        }
+        color[3] = icetFloatToHalf(alpha);
+    } else if (color_format == ICET_IMAGE_COLOR_RGBA_FLOAT) {
+        IceTFloat *color = icetImageGetColorf(image) + 4*pixel;
+        for (channel = 0; channel < 3; channel++) {
+            color[channel] = 0.1f + 0.9f*random_float();
+        }
+        color[3] = alpha;
+    } else if (color_format == ICET_IMAGE_COLOR_RGB_FLOAT) {
+        IceTFloat *color = icetImageGetColorf(image) + 3*pixel;
+        for (channel = 0; channel < 3; channel++) {
+            color[channel] = 0.1f + 0.9f*random_float();
+        }
+    }
+
+    if (depth_format == ICET_IMAGE_DEPTH_FLOAT) {
+        IceTFloat *depth = icetImageGetDepthf(image) + pixel;
+        if (active) {
+            *depth = 0.99f*random_float();
+        } else if (   (color_format != ICET_IMAGE_COLOR_NONE)
+                   && (rand()%2 == 0) ) {
+            *depth = 1.0f;
+        } else {
+            *depth = 1.0f + random_float();
+        }
+    }
+}
+
+/* Fills an image with alternating runs of active and inactive pixels and
+ * records which pixels are active. */
+static void FillImage(IceTImage image, IceTBoolean *active_pixels)
+{
+    IceTSizeType num_pixels = icetImageGetNumPixels(image);
+    IceTSizeType pixel = 0;
+    IceTBoolean active = (rand()%2 == 0);
+
+    while (pixel < num_pixels) {
+        IceTSizeType run_end = pixel
+            + run_lengths[rand()%(sizeof(run_lengths)/sizeof(IceTSizeType))];
+        if (run_end > num_pixels) run_end = num_pixels;
+        for ( ; pixel < run_end; pixel++) {
+            SetPixel(image, pixel, active);
+            active_pixels[pixel] = active;
+        }
+        active = !active;
+    }
+}
+
+static IceTImage NewImage(IceTSizeType width, IceTSizeType height)
+{
+    return icetImageAssignBuffer(malloc(icetImageBufferSize(width, height)),
+                                 width, height);
+}
+
+static IceTSparseImage NewSparseImage(IceTSizeType width, IceTSizeType height)
+{
+    return icetSparseImageAssignBuffer(
+                malloc(icetSparseImageBufferSize(width, height)),
+                width, height);
+}
+
+static IceTBoolean CompareImages(const IceTImage image,
+                                 const IceTImage expected,
+                                 const char *path)
+{
+    IceTSizeType num_pixels = icetImageGetNumPixels(image);
+    IceTSizeType color_size;
+    IceTSizeType depth_size;
+    const IceTByte *color;
+    const IceTByte *expected_color;
+    const IceTByte *depth;
+    const IceTByte *expected_depth;
+    IceTSizeType pixel;
+
+    color = icetImageGetColorConstVoid(image, &color_size);
+    expected_color = icetImageGetColorConstVoid(expected, NULL);
+    depth = icetImageGetDepthConstVoid(image, &depth_size);
+    expected_depth = icetImageGetDepthConstVoid(expected, NULL);
+
+    for (pixel = 0; pixel < num_pixels; pixel++) {
+        if (   (memcmp(color + pixel*color_size,
+                       expected_color + pixel*color_size,
+                       color_size) != 0)
+            || (memcmp(depth + pixel*depth_size,
+                       expected_depth + pixel*depth_size,
+                       depth_size) != 0) ) {
+            printrank("%s differs from per pixel scanning at pixel %d.\n",
+                      path, (int)pixel);
+            return ICET_FALSE;
+        }
+    }
+
+    return ICET_TRUE;
+}
+
+static IceTBoolean TrySize(IceTSizeType width, IceTSizeType height)
+{
+    const IceTSizeType num_pixels = width*height;
+    IceTImage image, background, expected, result;
+    IceTSparseImage sparse_image;
+    IceTBoolean *active_pixels;
+    IceTSizeType pixel;
+    IceTInt source_viewport[4];
+    IceTInt target_viewport[4];
+    IceTSizeType x, y;
+    int i;
+    IceTBoolean success = ICET_TRUE;
+
+    image = NewImage(width, height);
+    background = NewImage(width, height);
+    expected = NewImage(width, height);
+    result = NewImage(width, height);
+    sparse_image = NewSparseImage(width, height);
+    active_pixels = malloc(num_pixels*sizeof(IceTBoolean));
+
+    /* Decompressing an image without active pixels gives the background. */
+    for (pixel = 0; pixel < num_pixels; pixel++) {
+        SetPixel(image, pixel, ICET_FALSE);
+    }
+    icetCompressImage(image, sparse_image);
+    icetDecompressImage(sparse_image, background);
+
+    FillImage(image, active_pixels);
+    for (pixel = 0; pixel < num_pixels; pixel++) {
+        icetImageCopyPixels(active_pixels[pixel] ? image : background, pixel,
+                            expected, pixel, 1);
+    }
+
+    icetCompressImage(image, sparse_image);
+    icetDecompressImage(sparse_image, result);
+    success &= CompareImages(result, expected, "Compressed image");
+
+    for (i = 0;
+         i < (int)(sizeof(sub_image_offsets)/sizeof(IceTSizeType));
+         i++) {
+        IceTSizeType offset = sub_image_offsets[i];
+        IceTSizeType count = num_pixels - offset - i;
+        if (count < 1) continue;
+        icetCompressSubImage(image, offset, count, sparse_image);
+        icetImageCopyPixels(background, 0, result, 0, num_pixels);
+        icetImageCopyPixels(expected, 0, result, 0, offset);
+        icetImageCopyPixels(expected, offset + count,
+                            result, offset + count,
+                            num_pixels - offset - count);
+        icetDecompressSubImage(sparse_image, offset, result);
+        success &= CompareImages(result, expected, "Compressed sub image");
+    }
+
+    /* A region whose rows start and end at odd positions, placed so that
+     * its rows end at different positions in the compressed image. */
+    if ((width > 4) && (height > 2)) {
+        source_viewport[0] = 3;
+        source_viewport[1] = 1;
+        source_viewport[2] = (IceTInt)width - 4;
+        source_viewport[3] = (IceTInt)height - 2;
+        target_viewport[0] = 1;
+        target_viewport[1] = 2;
+        target_viewport[2] = source_viewport[2];
+        target_viewport[3] = source_viewport[3];
+
+        icetImageCopyPixels(background, 0, expected, 0, num_pixels);
+        for (y = 0; y < target_viewport[3]; y++) {
+            for (x = 0; x < target_viewport[2]; x++) {
+                IceTSizeType source_pixel = (y + source_viewport[1])*width
+                                          + x + source_viewport[0];
+                IceTSizeType target_pixel = (y + target_viewport[1])*width
+                                          + x + target_viewport[0];
+                if (active_pixels[source_pixel]) {
+                    icetImageCopyPixels(image, source_pixel,
+                                        expected, target_pixel, 1);
+                }
+            }
+        }
+
+        icetSparseImageSetDimensions(sparse_image, width, height);
+        icetCompressImageRegion(image, source_viewport, target_viewport,
+                                width, height, sparse_image);
+        icetDecompressImage(sparse_image, result);
+        success &= CompareImages(result, expected, "Compressed region");
+    }
+
+    free(image.opaque_internals);
+    free(background.opaque_internals);
+    free(expected.opaque_internals);
+    free(result.opaque_internals);
+    free(sparse_image.opaque_internals);
+    free(active_pixels);
+
+    return success;
+}
+
+static IceTBoolean TryFormat(IceTEnum composite_mode,
+                             IceTEnum color_format,
+                             IceTEnum depth_format)
+{
+    IceTBoolean success = ICET_TRUE;
+    int i;
+
+    icetCompositeMode(composite_mode);
+    icetSetColorFormat(color_format);
+    icetSetDepthFormat(depth_format);
+
+    for (i = 0; i < (int)(sizeof(image_sizes)/sizeof(image_sizes[0])); i++) {
+        success &= TrySize(image_sizes[i][0], image_sizes[i][1]);
+    }
+
+    return success;
+}
+
+static int CompressScanRun(void)
+{
+    IceTFloat background[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    IceTBoolean success = ICET_TRUE;
+
+    srand(13);
+
+    icetStateSetFloatv(ICET_BACKGROUND_COLOR, 4, background);
+    icetStateSetInteger(ICET_BACKGROUND_COLOR_WORD, 0);
+
+    printstat("Z buffer, float depths, no colors\n");
+    success &= TryFormat(ICET_COMPOSITE_MODE_Z_BUFFER,
+                         ICET_IMAGE_COLOR_NONE, ICET_IMAGE_DEPTH_FLOAT);
+    printstat("Z buffer, float depths, RGBA ubyte colors\n");
+    success &= TryFormat(ICET_COMPOSITE_MODE_Z_BUFFER,
+                         ICET_IMAGE_COLOR_RGBA_UBYTE, ICET_IMAGE_DEPTH_FLOAT);
+    printstat("Z buffer, float depths, RGB float colors\n");
+    success &= TryFormat(ICET_COMPOSITE_MODE_Z_BUFFER,
+                         ICET_IMAGE_COLOR_RGB_FLOAT, ICET_IMAGE_DEPTH_FLOAT);
+    printstat("Z buffer, float depths, RGBA float colors\n");
+    success &= TryFormat(ICET_COMPOSITE_MODE_Z_BUFFER,
+                         ICET_IMAGE_COLOR_RGBA_FLOAT, ICET_IMAGE_DEPTH_FLOAT);
+    printstat("Z buffer, float depths, RGBA half colors\n");
+    success &= TryFormat(ICET_COMPOSITE_MODE_Z_BUFFER,
+                         ICET_IMAGE_COLOR_RGBA_HALF, ICET_IMAGE_DEPTH_FLOAT);
+    printstat("Blending RGBA ubyte colors\n");
+    success &= TryFormat(ICET_COMPOSITE_MODE_BLEND,
+                         ICET_IMAGE_COLOR_RGBA_UBYTE, ICET_IMAGE_DEPTH_NONE);
+    printstat("Blending RGBA float colors\n");
+    success &= TryFormat(ICET_COMPOSITE_MODE_BLEND,
+                         ICET_IMAGE_COLOR_RGBA_FLOAT, ICET_IMAGE_DEPTH_NONE);
+    printstat("Blending RGBA half colors\n");
+    success &= TryFormat(ICET_COMPOSITE_MODE_BLEND,
+                         ICET_IMAGE_COLOR_RGBA_HALF, ICET_IMAGE_DEPTH_NONE);
+
+    return (success ? TEST_PASSED : TEST_FAILED);
+}
+
+int CompressScan(int argc, char *argv[])
+{
+    /* Suppress warning. */
+    (void)argc;
+    (void)argv;
+
+    return run_test(CompressScanRun);
+}
@@ -0,0 +1,237 @@
+/* -*- c -*- *****************************************************************
+** Checks that coalescing the fragments of merged layered images with
+** ICET_COALESCE_FRAGMENTS gives the same image as keeping them separate.
+** Each process places its fragments within the depth range of its geometry
+** bounds.  When these ranges are disjoint, merged fragments are coalesced
+** early; when neighboring ranges overlap, fragments between which another
+** process may still place its own must be kept apart.  Every single image
+** strategy is run, also with a composite order that reverses the ranks.
+*****************************************************************************/
+
+#include <IceT.h>
+#include <IceTDevMatrix.h>
+#include "test_codes.h"
+#include "test_util.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#define NUM_LAYERS      4
+
+/* Returns the range of normalized device depths this process places its
+ * fragments in, either disjoint from or overlapping with those of the
+ * processes next in rank. */
+static void DepthRange(IceTBoolean overlapping, IceTDouble range[2])
+{
+    IceTInt rank;
+    IceTInt num_proc;
+
+    icetGetIntegerv(ICET_RANK, &rank);
+    icetGetIntegerv(ICET_NUM_PROCESSES, &num_proc);
+
+    if (overlapping) {
+        /* Each range overlaps half of the next one. */
+        range[0] = -1.0 + 2.0*rank/(num_proc + 1);
+        range[1] = range[0] + 4.0/(num_proc + 1);
+    } else {
+        /* Leave a gap between ranges wider than the padding of bounds. */
+        range[0] = -1.0 + (2.0*rank + 0.1)/num_proc;
+        range[1] = -1.0 + (2.0*rank + 1.9)/num_proc;
+    }
+}
+
+/* Fills layered buffers with up to NUM_LAYERS fragments per pixel, ordered
+ * front to back within the given range of normalized device depths. */
+static void MakeLayeredBuffers(const IceTDouble range[2],
+                               IceTFloat **color_buffer_p,
+                               IceTFloat **depth_buffer_p)
+{
+    const IceTSizeType num_pixels = SCREEN_WIDTH*SCREEN_HEIGHT;
+    const IceTFloat depth_near = (IceTFloat)(0.5*range[0] + 0.5);
+    const IceTFloat depth_far = (IceTFloat)(0.5*range[1] + 0.5);
+    IceTFloat *color_buffer;
+    IceTFloat *depth_buffer;
+    IceTSizeType pixel;
+
+    color_buffer = malloc(4*num_pixels*NUM_LAYERS*sizeof(IceTFloat));
+    depth_buffer = malloc(num_pixels*NUM_LAYERS*sizeof(IceTFloat));
+
+    for (pixel = 0; pixel < num_pixels; pixel++) {
+        IceTInt num_active = rand()%(NUM_LAYERS + 1);
+        IceTInt layer;
+        for (layer = 0; layer < NUM_LAYERS; layer++) {
+            IceTFloat *color = color_buffer + 4*(pixel*NUM_LAYERS + layer);
+            IceTFloat *depth = depth_buffer + pixel*NUM_LAYERS + layer;
+            if (layer < num_active) {
+                IceTFloat alpha = 0.1f + 0.6f*random_float();
+                color[0] = alpha*random_float();
+                color[1] = alpha*random_float();
+                color[2] = alpha*random_float();
+                color[3] = alpha;
+                *depth = depth_near
+                    + (depth_far - depth_near)
+                      *(layer + random_float())/NUM_LAYERS;
+            } else {
+                color[0] = color[1] = color[2] = color[3] = 0.0f;
+                *depth = 1.0f;
+            }
+        }
+    }
+
+    *color_buffer_p = color_buffer;
+    *depth_buffer_p = depth_buffer;
+}
+
+/* Composites the layered buffers and copies the colors of the displayed tile
+ * into result, if this process displays it. */
+static void Composite(const IceTFloat *color_buffer,
+                      const IceTFloat *depth_buffer,
+                      IceTFloat *result)
+{
+    IceTFloat background_color[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    IceTDouble identity[16];
+    IceTImage image;
+    IceTInt tile_displayed;
+
+    icetMatrixIdentity(identity);
+    image = icetCompositeImageLayered(color_buffer,
+                                      depth_buffer,
+                                      NUM_LAYERS,
+                                      NULL,
+                                      identity,
+                                      identity,
+                                      background_color);
+
+    icetGetIntegerv(ICET_TILE_DISPLAYED, &tile_displayed);
+    if (tile_displayed >= 0) {
+        icetImageCopyColorf(image, result, ICET_IMAGE_COLOR_RGBA_FLOAT);
+    }
+}
+
+static IceTBoolean TryStrategy(const IceTFloat *color_buffer,
+                               const IceTFloat *depth_buffer)
+{
+    const IceTSizeType num_pixels = SCREEN_WIDTH*SCREEN_HEIGHT;
+    IceTFloat *separate_result;
+    IceTFloat *coalesced_result;
+    IceTInt tile_displayed;
+    IceTBoolean success = ICET_TRUE;
+
+    separate_result = malloc(4*num_pixels*sizeof(IceTFloat));
+    coalesced_result = malloc(4*num_pixels*sizeof(IceTFloat));
+
+    icetDisable(ICET_COALESCE_FRAGMENTS);
+    Composite(color_buffer, depth_buffer, separate_result);
+    icetEnable(ICET_COALESCE_FRAGMENTS);
+    Composite(color_buffer, depth_buffer, coalesced_result);
+    icetDisable(ICET_COALESCE_FRAGMENTS);
+
+    icetGetIntegerv(ICET_TILE_DISPLAYED, &tile_displayed);
+    if (tile_displayed >= 0) {
+        IceTSizeType i;
+        for (i = 0; i < 4*num_pixels; i++) {
+            if (fabs(coalesced_result[i] - separate_result[i]) > 1e-5f) {
+                printrank("***** Pixel %d differs when coalescing fragments:"
+                          " %f instead of %f *****\n",
+                          (int)(i/4),
+                          coalesced_result[i],
+                          separate_result[i]);
+                success = ICET_FALSE;
+                break;
+            }
+        }
+    }
+
+    free(separate_result);
+    free(coalesced_result);
+
+    return success;
+}
+
+static IceTBoolean TryDepthRanges(IceTBoolean overlapping)
+{
+    static const IceTEnum strategies[] = {
+        ICET_SINGLE_IMAGE_STRATEGY_AUTOMATIC,
+        ICET_SINGLE_IMAGE_STRATEGY_BSWAP,
+        ICET_SINGLE_IMAGE_STRATEGY_TREE,
+        ICET_SINGLE_IMAGE_STRATEGY_RADIXK,
+        ICET_SINGLE_IMAGE_STRATEGY_RADIXKR
+    };
+    IceTDouble range[2];
+    IceTFloat *color_buffer;
+    IceTFloat *depth_buffer;
+    IceTInt num_proc;
+    IceTInt *process_order;
+    IceTInt ordered;
+    IceTBoolean success = ICET_TRUE;
+    int i;
+
+    icetGetIntegerv(ICET_NUM_PROCESSES, &num_proc);
+
+    DepthRange(overlapping, range);
+    icetBoundingBoxd(-1.0, 1.0, -1.0, 1.0, range[0], range[1]);
+    MakeLayeredBuffers(range, &color_buffer, &depth_buffer);
+
+    process_order = malloc(num_proc*sizeof(IceTInt));
+    for (i = 0; i < num_proc; i++) {
+        process_order[i] = num_proc - 1 - i;
+    }
+    icetCompositeOrder(process_order);
+
+    for (ordered = 0; ordered < 2; ordered++) {
+        if (ordered) {
+            icetEnable(ICET_ORDERED_COMPOSITE);
+        } else {
+            icetDisable(ICET_ORDERED_COMPOSITE);
+        }
+        for (i = 0; i < (int)(sizeof(strategies)/sizeof(IceTEnum)); i++) {
+            icetSingleImageStrategy(strategies[i]);
+            printstat("  Strategy %s%s\n",
+                      icetGetSingleImageStrategyName(),
+                      ordered ? ", reversed composite order" : "");
+            success &= TryStrategy(color_buffer, depth_buffer);
+        }
+    }
+    icetDisable(ICET_ORDERED_COMPOSITE);
+
+    icetBoundingVertices(0, ICET_VOID, 0, 0, NULL);
+    free(process_order);
+    free(color_buffer);
+    free(depth_buffer);
+
+    return success;
+}
+
+static int LayeredCoalesceRun(void)
+{
+    IceTInt rank;
+    IceTBoolean success = ICET_TRUE;
+
+    icetGetIntegerv(ICET_RANK, &rank);
+    srand(23 + rank);
+
+    icetResetTiles();
+    icetAddTile(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT, 0);
+    icetStrategy(ICET_STRATEGY_REDUCE);
+    icetCompositeMode(ICET_COMPOSITE_MODE_BLEND);
+    icetSetColorFormat(ICET_IMAGE_COLOR_RGBA_FLOAT);
+    icetSetDepthFormat(ICET_IMAGE_DEPTH_FLOAT);
+
+    printstat("Disjoint depth ranges\n");
+    success &= TryDepthRanges(ICET_FALSE);
+    printstat("Overlapping depth ranges\n");
+    success &= TryDepthRanges(ICET_TRUE);
+
+    return (success ? TEST_PASSED : TEST_FAILED);
+}
+
+int LayeredCoalesce(int argc, char *argv[])
+{
+    /* Suppress warning. */
+    (void)argc;
+    (void)argv;
+
+    return run_test(LayeredCoalesceRun);
+}
@@ -0,0 +1,363 @@
+/* -*- c -*- *****************************************************************
+** Checks compositing layered images of processes with ICET_CONVEX_DATA, whose
+** fragments are blended into a single fragment per pixel during compression,
+** together with images of processes without it and images with a single
+** layer.  Depths are chosen so that no fragment of another process lies
+** between the fragments of a convex process, so the result must match
+** blending all fragments front to back.  The same mix is first merged on a
+** single process to check that promoting single-fragment images stays within
+** icetSparseLayeredImagePromotedBufferSize, then composited with every
+** single image strategy.
+*****************************************************************************/
+
+#include <IceT.h>
+#include <IceTDevImage.h>
+#include <IceTDevState.h>
+#include "test_codes.h"
+#include "test_util.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#define NUM_LAYERS      4
+
+#define KIND_CONVEX     0
+#define KIND_LAYERED    1
+#define KIND_ONE_LAYER  2
+
+#define MERGE_WIDTH     67
+#define MERGE_HEIGHT    23
+
+static IceTInt RankKind(IceTInt rank)
+{
+    return rank%3;
+}
+
+/* Computes the fragments of a process at a pixel.  The depth range is divided
+ * into NUM_LAYERS*num_proc slots.  Fragments of layered processes each take the
+ * slot of their layer, while all fragments of a convex process and the
+ * fragment of a process with one layer share one slot of a randomly chosen
+ * layer.  No two processes use the same slot, so fragments never interleave
+ * with those of a convex process. */
+static IceTInt Fragments(IceTInt rank,
+                         IceTInt num_proc,
+                         IceTSizeType pixel,
+                         IceTFloat (*colors)[4],
+                         IceTFloat *depths)
+{
+    const IceTInt kind = RankKind(rank);
+    const IceTInt slot_layer =
+        (IceTInt)(hash_float(rank, pixel, -1)*NUM_LAYERS);
+    IceTInt num_fragments;
+    IceTInt layer;
+
+    if (kind == KIND_ONE_LAYER) {
+        num_fragments = (hash_float(rank, pixel, 0) < 0.5f) ? 1 : 0;
+    } else {
+        num_fragments = layered_num_active(rank, pixel, NUM_LAYERS);
+    }
+
+    for (layer = 0; layer < num_fragments; layer++) {
+        layered_fragment_color(rank, pixel, layer, 0.1f, 0.9f, colors[layer]);
+        if (kind == KIND_LAYERED) {
+            depths[layer] = layered_fragment_depth(rank, layer, num_proc,
+                                                   NUM_LAYERS);
+        } else {
+            depths[layer] =
+                (  slot_layer*num_proc + rank + (layer + 0.5f)/NUM_LAYERS)
+                /(NUM_LAYERS*num_proc);
+        }
+    }
+
+    return num_fragments;
+}
+
+/* Returns the number of layers of the image of a process. */
+static IceTLayerCount NumLayers(IceTInt rank)
+{
+    return (RankKind(rank) == KIND_ONE_LAYER) ? 1 : NUM_LAYERS;
+}
+
+static IceTBoolean CompareToReference(const IceTFloat *result,
+                                      IceTInt num_proc,
+                                      IceTSizeType num_pixels)
+{
+    IceTSizeType pixel;
+
+    for (pixel = 0; pixel < num_pixels; pixel++) {
+        IceTFloat expected[4];
+        int channel;
+        reference_pixel(Fragments, num_proc, NUM_LAYERS, pixel, 0.0f,
+                        expected);
+        for (channel = 0; channel < 4; channel++) {
+            if (fabs(result[4*pixel + channel] - expected[channel]) > 1e-5f) {
+                printrank("***** Pixel %d differs from the reference:"
+                          " %f instead of %f *****\n",
+                          (int)pixel,
+                          result[4*pixel + channel],
+                          expected[channel]);
+                return ICET_FALSE;
+            }
+        }
+    }
+
+    return ICET_TRUE;
+}
+
+/* Compresses the image of the given process as that process would. */
+static IceTSparseImage CompressProcessImage(IceTInt rank, IceTInt num_proc)
+{
+    const IceTSizeType num_pixels = MERGE_WIDTH*MERGE_HEIGHT;
+    IceTVoid *color_buffer, *depth_buffer;
+    IceTImage image;
+    IceTSparseImage sparse_image;
+
+    make_layered_buffers(Fragments, rank, num_proc, num_pixels,
+                         NumLayers(rank),
+                         ICET_IMAGE_COLOR_RGBA_FLOAT, ICET_IMAGE_DEPTH_FLOAT,
+                         &color_buffer, &depth_buffer);
+    image = icetLayeredImagePointerAssignBuffer(
+                malloc(icetLayeredImagePointerBufferSize()),
+                MERGE_WIDTH, MERGE_HEIGHT, NumLayers(rank),
+                color_buffer, depth_buffer);
+    sparse_image = icetSparseLayeredImageAssignBuffer(
+                malloc(icetSparseLayeredImageBufferSize(
+                           MERGE_WIDTH, MERGE_HEIGHT, NumLayers(rank))),
+                MERGE_WIDTH, MERGE_HEIGHT);
+
+    if (RankKind(rank) == KIND_CONVEX) {
+        icetEnable(ICET_CONVEX_DATA);
+    } else {
+        icetDisable(ICET_CONVEX_DATA);
+    }
+    icetCompressImage(image, sparse_image);
+    icetDisable(ICET_CONVEX_DATA);
+
+    free(color_buffer);
+    free(depth_buffer);
+    free(image.opaque_internals);
+
+    return sparse_image;
+}
+
+/* Merges two sparse layered images into a new buffer sized by the promoted
+ * sizes of both and checks that the result fits. */
+static IceTSparseImage Merge(const IceTSparseImage front,
+                             const IceTSparseImage back,
+                             IceTBoolean *success)
+{
+    IceTSizeType bound =
+          icetSparseLayeredImagePromotedBufferSize(
+              icetSparseImageGetCompressedBufferSize(front))
+        + icetSparseLayeredImagePromotedBufferSize(
+              icetSparseImageGetCompressedBufferSize(back));
+    IceTSparseImage result;
+
+    result = icetSparseLayeredImageAssignBuffer(malloc(bound),
+                                                MERGE_WIDTH, MERGE_HEIGHT);
+    icetCompressedCompressedComposite(front, back, result);
+
+    if (icetSparseImageIsSingleFragment(result)) {
+        printrank("***** Merged image still has single fragments *****\n");
+        *success = ICET_FALSE;
+    }
+    if (icetSparseImageGetCompressedBufferSize(result) > bound) {
+        printrank("***** Promoted image takes %d bytes, more than the bound"
+                  " of %d *****\n",
+                  (int)icetSparseImageGetCompressedBufferSize(result),
+                  (int)bound);
+        *success = ICET_FALSE;
+    }
+
+    return result;
+}
+
+/* Merges the images of one convex, one layered and one single layer process
+ * locally and compares the result with the reference. */
+static IceTBoolean TryMerge(void)
+{
+    /* Pairs of processes merged first, followed by the remaining one. */
+    static const IceTInt orders[][3] = {
+        { KIND_CONVEX, KIND_ONE_LAYER, KIND_LAYERED },
+        { KIND_LAYERED, KIND_CONVEX, KIND_ONE_LAYER },
+        { KIND_ONE_LAYER, KIND_LAYERED, KIND_CONVEX }
+    };
+    const IceTInt num_proc = 3;
+    const IceTSizeType num_pixels = MERGE_WIDTH*MERGE_HEIGHT;
+    IceTSparseImage sparse_images[3];
+    IceTSparseImage empty;
+    IceTImage image;
+    IceTFloat *result;
+    IceTFloat *single_result;
+    IceTBoolean success = ICET_TRUE;
+    IceTInt rank;
+    int i;
+
+    for (rank = 0; rank < num_proc; rank++) {
+        sparse_images[rank] = CompressProcessImage(rank, num_proc);
+    }
+    if (   !icetSparseImageIsSingleFragment(sparse_images[KIND_CONVEX])
+        || !icetSparseImageIsSingleFragment(sparse_images[KIND_ONE_LAYER])
+        || icetSparseImageIsSingleFragment(sparse_images[KIND_LAYERED]) ) {
+        printrank("***** Images not compressed with the expected number of"
+                  " fragments per pixel *****\n");
+        success = ICET_FALSE;
+    }
+
+    image = icetImageAssignBuffer(
+                malloc(icetImageBufferSize(MERGE_WIDTH, MERGE_HEIGHT)),
+                MERGE_WIDTH, MERGE_HEIGHT);
+    result = malloc(4*num_pixels*sizeof(IceTFloat));
+    single_result = malloc(4*num_pixels*sizeof(IceTFloat));
+
+    /* Merging with an image without fragments promotes every pixel without
+     * sharing any runs, which is where promotion grows images the most. */
+    empty = icetSparseLayeredImageAssignBuffer(
+                malloc(icetSparseLayeredImageBufferSize(
+                           MERGE_WIDTH, MERGE_HEIGHT, NUM_LAYERS)),
+                MERGE_WIDTH, MERGE_HEIGHT);
+    for (rank = 0; rank < num_proc; rank++) {
+        IceTSparseImage promoted;
+
+        if (!icetSparseImageIsSingleFragment(sparse_images[rank])) continue;
+
+        printstat("  Promoting image of process kind %d\n", rank);
+        promoted = Merge(sparse_images[rank], empty, &success);
+
+        icetDecompressImage(sparse_images[rank], image);
+        icetImageCopyColorf(image, single_result, ICET_IMAGE_COLOR_RGBA_FLOAT);
+        icetDecompressImage(promoted, image);
+        icetImageCopyColorf(image, result, ICET_IMAGE_COLOR_RGBA_FLOAT);
+        if (memcmp(result, single_result,
+                   4*num_pixels*sizeof(IceTFloat)) != 0) {
+            printrank("***** Promoted image has different colors *****\n");
+            success = ICET_FALSE;
+        }
+
+        free(promoted.opaque_internals);
+    }
+    free(empty.opaque_internals);
+
+    for (i = 0; i < (int)(sizeof(orders)/sizeof(orders[0])); i++) {
+        IceTSparseImage pair, merged;
+
+        printstat("  Merging process kinds %d and %d, then %d\n",
+                  orders[i][0], orders[i][1], orders[i][2]);
+        pair = Merge(sparse_images[orders[i][0]],
+                     sparse_images[orders[i][1]],
+                     &success);
+        merged = Merge(sparse_images[orders[i][2]], pair, &success);
+
+        icetDecompressImage(merged, image);
+        icetImageCopyColorf(image, result, ICET_IMAGE_COLOR_RGBA_FLOAT);
+        success &= CompareToReference(result, num_proc, num_pixels);
+
+        free(pair.opaque_internals);
+        free(merged.opaque_internals);
+    }
+
+    for (rank = 0; rank < num_proc; rank++) {
+        free(sparse_images[rank].opaque_internals);
+    }
+    free(image.opaque_internals);
+    free(result);
+    free(single_result);
+
+    return success;
+}
+
+/* Composites the images of all processes with the current single image
+ * strategy and compares the result with the reference. */
+static IceTBoolean TryStrategy(void)
+{
+    const IceTSizeType num_pixels = SCREEN_WIDTH*SCREEN_HEIGHT;
+    IceTFloat background_color[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    IceTVoid *color_buffer, *depth_buffer;
+    IceTImage image;
+    IceTInt rank;
+    IceTInt num_proc;
+    IceTInt tile_displayed;
+    IceTBoolean success = ICET_TRUE;
+
+    icetGetIntegerv(ICET_RANK, &rank);
+    icetGetIntegerv(ICET_NUM_PROCESSES, &num_proc);
+
+    make_layered_buffers(Fragments, rank, num_proc, num_pixels,
+                         NumLayers(rank),
+                         ICET_IMAGE_COLOR_RGBA_FLOAT, ICET_IMAGE_DEPTH_FLOAT,
+                         &color_buffer, &depth_buffer);
+    if (RankKind(rank) == KIND_CONVEX) {
+        icetEnable(ICET_CONVEX_DATA);
+    } else {
+        icetDisable(ICET_CONVEX_DATA);
+    }
+
+    image = icetCompositeImageLayered(color_buffer,
+                                      depth_buffer,
+                                      NumLayers(rank),
+                                      NULL,
+                                      NULL,
+                                      NULL,
+                                      background_color);
+
+    icetGetIntegerv(ICET_TILE_DISPLAYED, &tile_displayed);
+    if (tile_displayed >= 0) {
+        IceTFloat *result = malloc(4*num_pixels*sizeof(IceTFloat));
+        icetImageCopyColorf(image, result, ICET_IMAGE_COLOR_RGBA_FLOAT);
+        success &= CompareToReference(result, num_proc, num_pixels);
+        free(result);
+    }
+
+    icetDisable(ICET_CONVEX_DATA);
+    free(color_buffer);
+    free(depth_buffer);
+
+    return success;
+}
+
+static int LayeredConvexRun(void)
+{
+    static const IceTEnum strategies[] = {
+        ICET_SINGLE_IMAGE_STRATEGY_AUTOMATIC,
+        ICET_SINGLE_IMAGE_STRATEGY_BSWAP,
+        ICET_SINGLE_IMAGE_STRATEGY_TREE,
+        ICET_SINGLE_IMAGE_STRATEGY_RADIXK,
+        ICET_SINGLE_IMAGE_STRATEGY_RADIXKR
+    };
+    IceTFloat background[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    IceTBoolean success = ICET_TRUE;
+    int i;
+
+    icetCompositeMode(ICET_COMPOSITE_MODE_BLEND);
+    icetSetColorFormat(ICET_IMAGE_COLOR_RGBA_FLOAT);
+    icetSetDepthFormat(ICET_IMAGE_DEPTH_FLOAT);
+
+    printstat("Merging images on one process\n");
+    icetStateSetFloatv(ICET_BACKGROUND_COLOR, 4, background);
+    icetStateSetInteger(ICET_BACKGROUND_COLOR_WORD, 0);
+    success &= TryMerge();
+
+    icetResetTiles();
+    icetAddTile(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT, 0);
+    icetStrategy(ICET_STRATEGY_REDUCE);
+    icetDisable(ICET_ORDERED_COMPOSITE);
+
+    for (i = 0; i < (int)(sizeof(strategies)/sizeof(IceTEnum)); i++) {
+        icetSingleImageStrategy(strategies[i]);
+        printstat("Strategy %s\n", icetGetSingleImageStrategyName());
+        success &= TryStrategy();
+    }
+
+    return (success ? TEST_PASSED : TEST_FAILED);
+}
+
+int LayeredConvex(int argc, char *argv[])
+{
+    /* Suppress warning. */
+    (void)argc;
+    (void)argv;
+
+    return run_test(LayeredConvexRun);
+}
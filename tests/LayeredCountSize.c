@@ -0,0 +1,183 @@
+/* -*- c -*- *****************************************************************
+** Checks that sparse layered images store the number of fragments of each
+** pixel with enough bytes when the total number of layers of all processes
+** crosses 255 and 65535.  The layers are spread over the processes, and one
+** pixel holds every fragment of all of them, so a count that is not widened
+** while merging would wrap.  The composited image is compared with blending
+** the fragments of all processes front to back, also with
+** ICET_MAX_FRAGMENTS_PER_PIXEL bounding the count size.
+*****************************************************************************/
+
+#include <IceT.h>
+#include <IceTDevImage.h>
+#include "test_codes.h"
+#include "test_util.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#define COUNT_WIDTH     4
+#define COUNT_HEIGHT    4
+
+/* Returns the number of layers of a process when total_layers are spread
+ * over all of them. */
+static IceTInt NumLayers(IceTInt rank, IceTInt num_proc, IceTInt total_layers)
+{
+    return total_layers/num_proc + ((rank < total_layers%num_proc) ? 1 : 0);
+}
+
+/* The total number of layers of all processes whose fragments Fragments
+ * computes. */
+static IceTInt current_total_layers;
+
+/* Computes the fragments of a process.  The first pixel holds all layers, the
+ * second none and the others a random number.  Depths interleave the layers of
+ * all processes, so every merge mixes fragments of both inputs.  Alphas shrink
+ * with the number of layers so that back fragments still show. */
+static IceTInt Fragments(IceTInt rank,
+                         IceTInt num_proc,
+                         IceTSizeType pixel,
+                         IceTFloat (*colors)[4],
+                         IceTFloat *depths)
+{
+    const IceTInt total_layers = current_total_layers;
+    const IceTInt num_layers = NumLayers(rank, num_proc, total_layers);
+    const IceTInt max_layers = (total_layers + num_proc - 1)/num_proc;
+    const IceTFloat alpha_scale =
+        (total_layers > 8) ? 8.0f/total_layers : 1.0f;
+    IceTInt num_active;
+    IceTInt layer;
+
+    if (pixel == 0) {
+        num_active = num_layers;
+    } else if (pixel == 1) {
+        num_active = 0;
+    } else {
+        num_active = layered_num_active(rank, pixel, num_layers);
+    }
+
+    for (layer = 0; layer < num_active; layer++) {
+        layered_fragment_color(rank, pixel, layer,
+                               0.1f*alpha_scale, 0.9f*alpha_scale,
+                               colors[layer]);
+        depths[layer] = layered_fragment_depth(rank, layer, num_proc,
+                                               max_layers);
+    }
+
+    return num_active;
+}
+
+static IceTBoolean TryTotalLayers(IceTInt total_layers,
+                                  IceTInt max_fragments)
+{
+    const IceTSizeType num_pixels = COUNT_WIDTH*COUNT_HEIGHT;
+    /* Fragments beyond ICET_MAX_FRAGMENTS_PER_PIXEL are blended into the last
+       one kept, which can misorder them with fragments merged later. */
+    const IceTFloat tolerance = (max_fragments > 0) ? 1e-2f : 1e-3f;
+    IceTFloat background_color[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    IceTInt rank;
+    IceTInt num_proc;
+    IceTInt num_layers;
+    IceTVoid *color_buffer;
+    IceTVoid *depth_buffer;
+    IceTImage image;
+    IceTInt tile_displayed;
+    IceTSizeType pixel;
+    IceTBoolean success = ICET_TRUE;
+
+    icetGetIntegerv(ICET_RANK, &rank);
+    icetGetIntegerv(ICET_NUM_PROCESSES, &num_proc);
+    num_layers = NumLayers(rank, num_proc, total_layers);
+
+    current_total_layers = total_layers;
+    make_layered_buffers(Fragments, rank, num_proc, num_pixels, num_layers,
+                         ICET_IMAGE_COLOR_RGBA_FLOAT, ICET_IMAGE_DEPTH_FLOAT,
+                         &color_buffer, &depth_buffer);
+
+    icetMaxFragmentsPerPixel(max_fragments);
+    image = icetCompositeImageLayered(color_buffer,
+                                      depth_buffer,
+                                      num_layers,
+                                      NULL,
+                                      NULL,
+                                      NULL,
+                                      background_color);
+    icetMaxFragmentsPerPixel(0);
+
+    icetGetIntegerv(ICET_TILE_DISPLAYED, &tile_displayed);
+    if (tile_displayed >= 0) {
+        const IceTFloat *result = icetImageGetColorcf(image);
+        for (pixel = 0; pixel < num_pixels; pixel++) {
+            IceTFloat expected[4];
+            int channel;
+            reference_pixel(Fragments, num_proc,
+                            (total_layers + num_proc - 1)/num_proc,
+                            pixel, 0.0f, expected);
+            for (channel = 0; channel < 4; channel++) {
+                if (fabs(result[4*pixel + channel] - expected[channel])
+                    > tolerance) {
+                    printrank("***** Pixel %d channel %d is %f, expected %f"
+                              " *****\n",
+                              (int)pixel, channel,
+                              result[4*pixel + channel], expected[channel]);
+                    success = ICET_FALSE;
+                    pixel = num_pixels;
+                    break;
+                }
+            }
+        }
+    }
+
+    free(color_buffer);
+    free(depth_buffer);
+
+    return success;
+}
+
+static int LayeredCountSizeRun(void)
+{
+    static const struct {
+        IceTInt total_layers;
+        IceTInt max_fragments;
+    } cases[] = {
+        { 255, 0 },
+        { 256, 0 },
+        { 65535, 0 },
+        { 65536, 0 },
+        { 65536, 255 }
+    };
+    IceTBoolean success = ICET_TRUE;
+    int i;
+
+    icetResetTiles();
+    icetAddTile(0, 0, COUNT_WIDTH, COUNT_HEIGHT, 0);
+    icetStrategy(ICET_STRATEGY_REDUCE);
+    icetSingleImageStrategy(ICET_SINGLE_IMAGE_STRATEGY_AUTOMATIC);
+    icetCompositeMode(ICET_COMPOSITE_MODE_BLEND);
+    icetSetColorFormat(ICET_IMAGE_COLOR_RGBA_FLOAT);
+    icetSetDepthFormat(ICET_IMAGE_DEPTH_FLOAT);
+    icetDisable(ICET_ORDERED_COMPOSITE);
+
+    for (i = 0; i < (int)(sizeof(cases)/sizeof(cases[0])); i++) {
+        if (cases[i].max_fragments > 0) {
+            printstat("%d layers in total, at most %d fragments per pixel\n",
+                      cases[i].total_layers, cases[i].max_fragments);
+        } else {
+            printstat("%d layers in total\n", cases[i].total_layers);
+        }
+        success &= TryTotalLayers(cases[i].total_layers,
+                                  cases[i].max_fragments);
+    }
+
+    return (success ? TEST_PASSED : TEST_FAILED);
+}
+
+int LayeredCountSize(int argc, char *argv[])
+{
+    /* Suppress warning. */
+    (void)argc;
+    (void)argv;
+
+    return run_test(LayeredCountSizeRun);
+}
@@ -0,0 +1,279 @@
+/* -*- c -*- *****************************************************************
+** Tests decompressing sparse layered images, which blends the fragments of
+** each pixel front to back, rounding only once per pixel, and stops at the
+** first opaque fragment.  The result is checked against blending the fragments back to
+** front in the precision of the color format, as decompression used to do,
+** and against blending them in double precision.  Many pixels contain opaque
+** fragments in front of others, so the early exit is taken often.
+*****************************************************************************/
+
+#include <IceT.h>
+#include <IceTDevImage.h>
+#include <IceTDevState.h>
+#include "test_codes.h"
+#include "test_util.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#define DECOMPRESS_WIDTH        211
+#define DECOMPRESS_HEIGHT       97
+#define MAX_LAYERS              6
+
+/* Rounds a color channel to the given color format. */
+static IceTFloat RoundChannel(IceTFloat value, IceTEnum color_format)
+{
+    if (color_format == ICET_IMAGE_COLOR_RGBA_UBYTE) {
+        return (IceTFloat)(IceTUByte)(255.0f*value + 0.5f)/255.0f;
+    } else if (color_format == ICET_IMAGE_COLOR_RGBA_HALF) {
+        return icetHalfToFloat(icetFloatToHalf(value));
+    } else {
+        return value;
+    }
+}
+
+/* Fills each pixel with up to MAX_LAYERS fragments in depth order.  A quarter
+ * of the fragments are opaque, so that the fragments behind them are hidden.
+ * Colors are premultiplied and already rounded to the color format. */
+static void MakeFragments(IceTEnum color_format,
+                          IceTFloat *colors,
+                          IceTFloat *depths)
+{
+    const IceTSizeType num_pixels = DECOMPRESS_WIDTH*DECOMPRESS_HEIGHT;
+    IceTSizeType pixel;
+
+    for (pixel = 0; pixel < num_pixels; pixel++) {
+        IceTInt num_active = rand()%(MAX_LAYERS + 1);
+        IceTInt layer;
+        for (layer = 0; layer < MAX_LAYERS; layer++) {
+            IceTFloat *color = colors + 4*(pixel*MAX_LAYERS + layer);
+            IceTFloat *depth = depths + pixel*MAX_LAYERS + layer;
+            if (layer < num_active) {
+                IceTFloat alpha = (rand()%4 == 0)
+                    ? 1.0f : RoundChannel(0.05f + 0.9f*random_float(),
+                                          color_format);
+                int channel;
+                for (channel = 0; channel < 3; channel++) {
+                    color[channel] = RoundChannel(alpha*random_float(),
+                                                  color_format);
+                }
+                color[3] = alpha;
+                *depth = (layer + random_float())/MAX_LAYERS;
+            } else {
+                color[0] = color[1] = color[2] = color[3] = 0.0f;
+                *depth = 1.0f;
+            }
+        }
+    }
+}
+
+/* Converts float colors to the given color format. */
+static IceTVoid *ConvertColors(const IceTFloat *colors,
+                               IceTSizeType num_fragments,
+                               IceTEnum color_format)
+{
+    const IceTSizeType color_size = color_pixel_size(color_format);
+    IceTByte *out = malloc(num_fragments*color_size);
+    IceTSizeType i;
+
+    for (i = 0; i < num_fragments; i++) {
+        store_fragment(out + i*color_size, NULL,
+                       color_format, ICET_IMAGE_DEPTH_NONE,
+                       colors + 4*i, 0.0f);
+    }
+
+    return out;
+}
+
+/* Blends the fragments of a pixel back to front over the background with
+ * the over operator of the color format, rounding after every fragment. */
+static void BlendBackToFront(const IceTVoid *colors,
+                             IceTSizeType pixel,
+                             IceTInt num_active,
+                             IceTEnum color_format,
+                             const IceTFloat background[4],
+                             IceTFloat result[4])
+{
+    IceTInt layer;
+    int channel;
+
+    if (color_format == ICET_IMAGE_COLOR_RGBA_UBYTE) {
+        const IceTUByte *in = (const IceTUByte *)colors + 4*pixel*MAX_LAYERS;
+        IceTUByte dest[4];
+        for (channel = 0; channel < 4; channel++) {
+            dest[channel] = (IceTUByte)(255.0f*background[channel] + 0.5f);
+        }
+        for (layer = num_active - 1; layer >= 0; layer--) {
+            ICET_OVER_UBYTE(in + 4*layer, dest);
+        }
+        for (channel = 0; channel < 4; channel++) {
+            result[channel] = dest[channel]/255.0f;
+        }
+    } else if (color_format == ICET_IMAGE_COLOR_RGBA_HALF) {
+        const IceTUShort *in = (const IceTUShort *)colors + 4*pixel*MAX_LAYERS;
+        IceTUShort dest[4];
+        for (channel = 0; channel < 4; channel++) {
+            dest[channel] = icetFloatToHalf(background[channel]);
+        }
+        for (layer = num_active - 1; layer >= 0; layer--) {
+            ICET_OVER_HALF(in + 4*layer, dest);
+        }
+        for (channel = 0; channel < 4; channel++) {
+            result[channel] = icetHalfToFloat(dest[channel]);
+        }
+    } else {
+        const IceTFloat *in = (const IceTFloat *)colors + 4*pixel*MAX_LAYERS;
+        for (channel = 0; channel < 4; channel++) {
+            result[channel] = background[channel];
+        }
+        for (layer = num_active - 1; layer >= 0; layer--) {
+            ICET_OVER_FLOAT(in + 4*layer, result);
+        }
+    }
+}
+
+/* Blends the fragments of a pixel front to back in double precision. */
+static void BlendExact(const IceTFloat *colors,
+                       IceTSizeType pixel,
+                       IceTInt num_active,
+                       const IceTFloat background[4],
+                       IceTFloat result[4])
+{
+    IceTDouble accum[4] = { 0.0, 0.0, 0.0, 0.0 };
+    IceTInt layer;
+    int channel;
+
+    for (layer = 0; layer < num_active; layer++) {
+        const IceTFloat *color = colors + 4*(pixel*MAX_LAYERS + layer);
+        IceTDouble transmittance = 1.0 - accum[3];
+        for (channel = 0; channel < 4; channel++) {
+            accum[channel] += transmittance*color[channel];
+        }
+    }
+    for (channel = 0; channel < 4; channel++) {
+        result[channel] =
+            (IceTFloat)(accum[channel] + (1.0 - accum[3])*background[channel]);
+    }
+}
+
+static IceTBoolean ComparePixel(const IceTFloat *color,
+                                const IceTFloat expected[4],
+                                IceTFloat tolerance,
+                                IceTSizeType pixel,
+                                const char *reference)
+{
+    int channel;
+    for (channel = 0; channel < 4; channel++) {
+        if (fabs(color[channel] - expected[channel]) > tolerance) {
+            printrank("***** Pixel %d differs from %s: %f instead of %f"
+                      " *****\n",
+                      (int)pixel, reference, color[channel],
+                      expected[channel]);
+            return ICET_FALSE;
+        }
+    }
+    return ICET_TRUE;
+}
+
+static IceTBoolean TryFormat(IceTEnum color_format,
+                             IceTFloat old_tolerance,
+                             IceTFloat exact_tolerance)
+{
+    const IceTSizeType num_pixels = DECOMPRESS_WIDTH*DECOMPRESS_HEIGHT;
+    IceTFloat background[4];
+    IceTFloat *colors, *depths;
+    IceTVoid *format_colors;
+    IceTFloat *result;
+    IceTImage layered_image, image;
+    IceTSparseImage sparse_image;
+    IceTSizeType pixel;
+    IceTBoolean success = ICET_TRUE;
+
+    icetSetColorFormat(color_format);
+    icetGetFloatv(ICET_BACKGROUND_COLOR, background);
+
+    colors = malloc(4*num_pixels*MAX_LAYERS*sizeof(IceTFloat));
+    depths = malloc(num_pixels*MAX_LAYERS*sizeof(IceTFloat));
+    MakeFragments(color_format, colors, depths);
+    format_colors = ConvertColors(colors, num_pixels*MAX_LAYERS, color_format);
+
+    layered_image = icetLayeredImagePointerAssignBuffer(
+                malloc(icetLayeredImagePointerBufferSize()),
+                DECOMPRESS_WIDTH, DECOMPRESS_HEIGHT, MAX_LAYERS,
+                format_colors, depths);
+    sparse_image = icetSparseLayeredImageAssignBuffer(
+                malloc(icetSparseLayeredImageBufferSize(
+                           DECOMPRESS_WIDTH, DECOMPRESS_HEIGHT, MAX_LAYERS)),
+                DECOMPRESS_WIDTH, DECOMPRESS_HEIGHT);
+    image = icetImageAssignBuffer(
+                malloc(icetImageBufferSize(DECOMPRESS_WIDTH,
+                                           DECOMPRESS_HEIGHT)),
+                DECOMPRESS_WIDTH, DECOMPRESS_HEIGHT);
+    result = malloc(4*num_pixels*sizeof(IceTFloat));
+
+    icetCompressImage(layered_image, sparse_image);
+    icetDecompressImage(sparse_image, image);
+    icetImageCopyColorf(image, result, ICET_IMAGE_COLOR_RGBA_FLOAT);
+
+    for (pixel = 0; (pixel < num_pixels) && success; pixel++) {
+        IceTFloat expected[4];
+        IceTInt num_active = 0;
+        while (   (num_active < MAX_LAYERS)
+               && (depths[pixel*MAX_LAYERS + num_active] < 1.0f) ) {
+            num_active++;
+        }
+
+        BlendBackToFront(format_colors, pixel, num_active, color_format,
+                         background, expected);
+        success &= ComparePixel(result + 4*pixel, expected, old_tolerance,
+                                pixel, "back to front blending");
+
+        BlendExact(colors, pixel, num_active, background, expected);
+        success &= ComparePixel(result + 4*pixel, expected, exact_tolerance,
+                                pixel, "exact blending");
+    }
+
+    free(colors);
+    free(depths);
+    free(format_colors);
+    free(result);
+    free(layered_image.opaque_internals);
+    free(sparse_image.opaque_internals);
+    free(image.opaque_internals);
+
+    return success;
+}
+
+static int LayeredDecompressRun(void)
+{
+    IceTFloat background[4] = { 0.25f, 0.5f, 0.75f, 1.0f };
+    IceTBoolean success = ICET_TRUE;
+
+    srand(5);
+
+    icetStateSetFloatv(ICET_BACKGROUND_COLOR, 4, background);
+    icetStateSetInteger(ICET_BACKGROUND_COLOR_WORD, 0xFFBF8040);
+    icetSetDepthFormat(ICET_IMAGE_DEPTH_FLOAT);
+    icetCompositeMode(ICET_COMPOSITE_MODE_BLEND);
+
+    /* Blending back to front rounds once per fragment, blending front to
+     * back only once per pixel. */
+    printstat("RGBA ubyte colors\n");
+    success &= TryFormat(ICET_IMAGE_COLOR_RGBA_UBYTE, 4.0f/255.0f, 1.0f/255.0f);
+    printstat("RGBA half colors\n");
+    success &= TryFormat(ICET_IMAGE_COLOR_RGBA_HALF, 4e-3f, 1e-3f);
+    printstat("RGBA float colors\n");
+    success &= TryFormat(ICET_IMAGE_COLOR_RGBA_FLOAT, 1e-5f, 1e-5f);
+
+    return (success ? TEST_PASSED : TEST_FAILED);
+}
+
+int LayeredDecompress(int argc, char *argv[])
+{
+    /* Suppress warning. */
+    (void)argc;
+    (void)argv;
+
+    return run_test(LayeredDecompressRun);
+}
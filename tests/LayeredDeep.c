@@ -0,0 +1,249 @@
+/* -*- c -*- *****************************************************************
+** Checks that the merged fragments returned by icetCompositeImageLayeredDeep
+** give exactly the image of icetCompositeImageLayered when decompressed over
+** the same transparent background.  Both strategies that support layered
+** images are run with every single image strategy, collecting the image on
+** the display node and, with ICET_COLLECT_IMAGES disabled, leaving a piece on
+** each process.  Every color format supported for blending layered images is
+** checked.
+*****************************************************************************/
+
+#include <IceT.h>
+#include <IceTDevImage.h>
+#include "test_codes.h"
+#include "test_util.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#define NUM_LAYERS      4
+
+/* Fills layered buffers with up to NUM_LAYERS fragments per pixel, sorted
+ * front to back, in the given formats. */
+static void MakeFragments(IceTEnum color_format,
+                          IceTEnum depth_format,
+                          IceTByte *color_buffer,
+                          IceTByte *depth_buffer)
+{
+    const IceTSizeType num_pixels = SCREEN_WIDTH*SCREEN_HEIGHT;
+    const IceTSizeType color_size = color_pixel_size(color_format);
+    const IceTSizeType depth_size = depth_pixel_size(depth_format);
+    IceTSizeType pixel;
+
+    for (pixel = 0; pixel < num_pixels; pixel++) {
+        IceTInt num_active = rand()%(NUM_LAYERS + 1);
+        IceTInt layer;
+        for (layer = 0; layer < NUM_LAYERS; layer++) {
+            IceTSizeType fragment = pixel*NUM_LAYERS + layer;
+            store_random_fragment(color_buffer + fragment*color_size,
+                                  depth_buffer + fragment*depth_size,
+                                  color_format, depth_format,
+                                  layer < num_active,
+                                  (layer + 0.99f*random_float())/NUM_LAYERS);
+        }
+    }
+}
+
+static IceTBoolean TryStrategy(const IceTByte *color_buffer,
+                               const IceTByte *depth_buffer)
+{
+    IceTFloat background_color[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    const IceTSizeType num_pixels = SCREEN_WIDTH*SCREEN_HEIGHT;
+    IceTEnum color_format;
+    IceTSizeType color_size;
+    IceTImage image;
+    IceTSparseImage deep_image;
+    IceTImage deep_blended;
+    IceTByte *expected;
+    IceTInt tile_displayed;
+    IceTInt valid_offset, valid_num;
+    IceTBoolean success = ICET_TRUE;
+
+    icetGetEnumv(ICET_COLOR_FORMAT, &color_format);
+    color_size = color_pixel_size(color_format);
+    expected = malloc(num_pixels*color_size);
+
+    image = icetCompositeImageLayered(color_buffer,
+                                      depth_buffer,
+                                      NUM_LAYERS,
+                                      NULL,
+                                      NULL,
+                                      NULL,
+                                      background_color);
+    if (icetIsEnabled(ICET_COLLECT_IMAGES)) {
+        icetGetIntegerv(ICET_TILE_DISPLAYED, &tile_displayed);
+        valid_offset = 0;
+        valid_num = (tile_displayed >= 0) ? (IceTInt)num_pixels : 0;
+    } else {
+        icetGetIntegerv(ICET_VALID_PIXELS_OFFSET, &valid_offset);
+        icetGetIntegerv(ICET_VALID_PIXELS_NUM, &valid_num);
+    }
+    if (valid_num > 0) {
+        memcpy(expected,
+               icetImageGetColorConstVoid(image, NULL),
+               num_pixels*color_size);
+    }
+
+    deep_image = icetCompositeImageLayeredDeep(color_buffer,
+                                               depth_buffer,
+                                               NUM_LAYERS,
+                                               NULL,
+                                               NULL,
+                                               NULL);
+    if (!icetIsEnabled(ICET_COLLECT_IMAGES)) {
+        IceTInt deep_valid_offset, deep_valid_num;
+        icetGetIntegerv(ICET_VALID_PIXELS_OFFSET, &deep_valid_offset);
+        icetGetIntegerv(ICET_VALID_PIXELS_NUM, &deep_valid_num);
+        if (   (deep_valid_offset != valid_offset)
+            || (deep_valid_num != valid_num) ) {
+            printrank("***** Deep image holds pixels %d to %d, expected"
+                      " %d to %d *****\n",
+                      deep_valid_offset, deep_valid_offset + deep_valid_num,
+                      valid_offset, valid_offset + valid_num);
+            free(expected);
+            return ICET_FALSE;
+        }
+    }
+
+    if (valid_num <= 0) {
+        if (!icetSparseImageIsNull(deep_image)) {
+            printrank("***** Got a deep image without valid pixels *****\n");
+            success = ICET_FALSE;
+        }
+        free(expected);
+        return success;
+    }
+
+    if (   icetSparseImageIsNull(deep_image)
+        || !icetSparseImageIsLayered(deep_image)
+        || (icetSparseImageGetNumPixels(deep_image) != valid_num) ) {
+        printrank("***** Expected a sparse layered image of %d pixels"
+                  " *****\n", valid_num);
+        free(expected);
+        return ICET_FALSE;
+    }
+
+    /* The deep frame leaves a transparent background, so decompressing
+       blends the fragments as the layered composite did. */
+    deep_blended = icetImageAssignBuffer(
+                       malloc(icetImageBufferSize(SCREEN_WIDTH,
+                                                  SCREEN_HEIGHT)),
+                       SCREEN_WIDTH, SCREEN_HEIGHT);
+    icetDecompressSubImage(deep_image, valid_offset, deep_blended);
+
+    if (memcmp((const IceTByte *)icetImageGetColorConstVoid(deep_blended,
+                                                            NULL)
+                   + valid_offset*color_size,
+               expected + valid_offset*color_size,
+               valid_num*color_size) != 0) {
+        printrank("***** Decompressed deep image differs from layered"
+                  " composite *****\n");
+        success = ICET_FALSE;
+    }
+
+    free(deep_blended.opaque_internals);
+    free(expected);
+
+    return success;
+}
+
+static IceTBoolean TryFormat(IceTEnum color_format, IceTEnum depth_format)
+{
+    static const IceTEnum strategies[] = {
+        ICET_STRATEGY_SEQUENTIAL,
+        ICET_STRATEGY_REDUCE
+    };
+    static const IceTEnum single_image_strategies[] = {
+        ICET_SINGLE_IMAGE_STRATEGY_BSWAP,
+        ICET_SINGLE_IMAGE_STRATEGY_TREE,
+        ICET_SINGLE_IMAGE_STRATEGY_RADIXK,
+        ICET_SINGLE_IMAGE_STRATEGY_RADIXKR
+    };
+    const IceTSizeType num_pixels = SCREEN_WIDTH*SCREEN_HEIGHT;
+    IceTByte *color_buffer, *depth_buffer;
+    IceTBoolean success = ICET_TRUE;
+    int i, j;
+    int collect;
+
+    icetSetColorFormat(color_format);
+    icetSetDepthFormat(depth_format);
+
+    color_buffer = malloc(num_pixels*NUM_LAYERS*color_pixel_size(color_format));
+    depth_buffer = malloc(num_pixels*NUM_LAYERS*depth_pixel_size(depth_format));
+    MakeFragments(color_format, depth_format, color_buffer, depth_buffer);
+
+    for (collect = 1; collect >= 0; collect--) {
+        if (collect) {
+            icetEnable(ICET_COLLECT_IMAGES);
+        } else {
+            icetDisable(ICET_COLLECT_IMAGES);
+        }
+        for (i = 0; i < (int)(sizeof(strategies)/sizeof(IceTEnum)); i++) {
+            icetStrategy(strategies[i]);
+            for (j = 0;
+                 j < (int)(  sizeof(single_image_strategies)
+                           / sizeof(IceTEnum));
+                 j++) {
+                icetSingleImageStrategy(single_image_strategies[j]);
+                printstat("  Strategy %s, %s%s\n",
+                          icetGetStrategyName(),
+                          icetGetSingleImageStrategyName(),
+                          collect ? "" : ", not collected");
+                success &= TryStrategy(color_buffer, depth_buffer);
+            }
+        }
+    }
+    icetEnable(ICET_COLLECT_IMAGES);
+
+    free(color_buffer);
+    free(depth_buffer);
+
+    return success;
+}
+
+static int LayeredDeepRun(void)
+{
+    static const struct {
+        const char *name;
+        IceTEnum color_format;
+        IceTEnum depth_format;
+    } formats[] = {
+        { "RGBA ubyte colors, float depths",
+          ICET_IMAGE_COLOR_RGBA_UBYTE, ICET_IMAGE_DEPTH_FLOAT },
+        { "RGBA half colors, float depths",
+          ICET_IMAGE_COLOR_RGBA_HALF, ICET_IMAGE_DEPTH_FLOAT },
+        { "RGBA float colors, float depths",
+          ICET_IMAGE_COLOR_RGBA_FLOAT, ICET_IMAGE_DEPTH_FLOAT },
+        { "RGBA ubyte colors, 16-bit depths",
+          ICET_IMAGE_COLOR_RGBA_UBYTE, ICET_IMAGE_DEPTH_USHORT }
+    };
+    IceTInt rank;
+    IceTBoolean success = ICET_TRUE;
+    int i;
+
+    icetGetIntegerv(ICET_RANK, &rank);
+    srand(29 + rank);
+
+    icetResetTiles();
+    icetAddTile(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT, 0);
+    icetCompositeMode(ICET_COMPOSITE_MODE_BLEND);
+    icetDisable(ICET_ORDERED_COMPOSITE);
+
+    for (i = 0; i < (int)(sizeof(formats)/sizeof(formats[0])); i++) {
+        printstat("%s\n", formats[i].name);
+        success &= TryFormat(formats[i].color_format,
+                             formats[i].depth_format);
+    }
+
+    return (success ? TEST_PASSED : TEST_FAILED);
+}
+
+int LayeredDeep(int argc, char *argv[])
+{
+    /* Suppress warning. */
+    (void)argc;
+    (void)argv;
+
+    return run_test(LayeredDeepRun);
+}
@@ -0,0 +1,233 @@
+/* -*- c -*- *****************************************************************
+** Tests blending layered images with every combination of RGBA ubyte, half
+** and float colors with float and 16-bit depths.  Supported combinations are
+** checked against blending the fragments of all processes in depth order.
+** Float colors with 16-bit depths, and 16-bit depths with Z buffer
+** compositing, must be rejected before compositing starts.
+*****************************************************************************/
+
+#include <IceT.h>
+#include <IceTDevImage.h>
+#include "test_codes.h"
+#include "test_util.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#define NUM_LAYERS      3
+
+/* The color format in which Fragments returns colors. */
+static IceTEnum current_color_format;
+
+/* Computes the fragments of a process with their colors as they are stored in
+ * the current color format. */
+static IceTInt Fragments(IceTInt rank,
+                         IceTInt num_proc,
+                         IceTSizeType pixel,
+                         IceTFloat (*colors)[4],
+                         IceTFloat *depths)
+{
+    IceTInt num_active = layered_num_active(rank, pixel, NUM_LAYERS);
+    IceTInt layer;
+    int channel;
+
+    for (layer = 0; layer < num_active; layer++) {
+        IceTFloat *color = colors[layer];
+
+        layered_fragment_color(rank, pixel, layer, 0.1f, 0.9f, color);
+        for (channel = 0; channel < 4; channel++) {
+            if (current_color_format == ICET_IMAGE_COLOR_RGBA_UBYTE) {
+                color[channel] =
+                    (IceTFloat)(IceTUByte)(255.0f*color[channel] + 0.5f)
+                    /255.0f;
+            } else if (current_color_format == ICET_IMAGE_COLOR_RGBA_HALF) {
+                color[channel] =
+                    icetHalfToFloat(icetFloatToHalf(color[channel]));
+            }
+        }
+        depths[layer] = layered_fragment_depth(rank, layer, num_proc,
+                                               NUM_LAYERS);
+    }
+
+    return num_active;
+}
+
+/* Fills layered buffers in the given formats with the fragments of this
+ * process. */
+static void MakeLayeredBuffers(IceTEnum color_format,
+                               IceTEnum depth_format,
+                               IceTVoid **color_buffer_p,
+                               IceTVoid **depth_buffer_p)
+{
+    IceTInt rank;
+    IceTInt num_proc;
+
+    icetGetIntegerv(ICET_RANK, &rank);
+    icetGetIntegerv(ICET_NUM_PROCESSES, &num_proc);
+
+    current_color_format = color_format;
+    make_layered_buffers(Fragments, rank, num_proc,
+                         SCREEN_WIDTH*SCREEN_HEIGHT, NUM_LAYERS,
+                         color_format, depth_format,
+                         color_buffer_p, depth_buffer_p);
+}
+
+static IceTBoolean TryFormat(IceTEnum color_format, IceTEnum depth_format)
+{
+    IceTFloat background_color[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    IceTVoid *color_buffer;
+    IceTVoid *depth_buffer;
+    IceTImage image;
+    IceTInt tile_displayed;
+    IceTInt num_proc;
+    IceTFloat tolerance;
+    IceTBoolean success = ICET_TRUE;
+
+    icetSetColorFormat(color_format);
+    icetSetDepthFormat(depth_format);
+    MakeLayeredBuffers(color_format, depth_format,
+                       &color_buffer, &depth_buffer);
+
+    image = icetCompositeImageLayered(color_buffer,
+                                      depth_buffer,
+                                      NUM_LAYERS,
+                                      NULL,
+                                      NULL,
+                                      NULL,
+                                      background_color);
+
+    icetGetIntegerv(ICET_NUM_PROCESSES, &num_proc);
+    if (color_format == ICET_IMAGE_COLOR_RGBA_UBYTE) {
+        /* Every ubyte blend truncates, losing up to 1/255 per fragment. */
+        tolerance = (IceTFloat)(NUM_LAYERS*num_proc)/255.0f;
+    } else if (color_format == ICET_IMAGE_COLOR_RGBA_HALF) {
+        tolerance = 4e-3f;
+    } else {
+        tolerance = 1e-5f;
+    }
+
+    icetGetIntegerv(ICET_TILE_DISPLAYED, &tile_displayed);
+    if (tile_displayed >= 0) {
+        const IceTSizeType num_pixels = icetImageGetNumPixels(image);
+        IceTFloat *color = malloc(4*num_pixels*sizeof(IceTFloat));
+        IceTSizeType pixel;
+
+        icetImageCopyColorf(image, color, ICET_IMAGE_COLOR_RGBA_FLOAT);
+        for (pixel = 0; pixel < num_pixels; pixel++) {
+            IceTFloat expected[4];
+            int channel;
+            reference_pixel(Fragments, num_proc, NUM_LAYERS, pixel, 0.0f,
+                            expected);
+            for (channel = 0; channel < 4; channel++) {
+                if (  fabs(color[4*pixel + channel] - expected[channel])
+                    > tolerance ) {
+                    printrank("***** Pixel %d differs from the reference:"
+                              " %f instead of %f *****\n",
+                              (int)pixel,
+                              color[4*pixel + channel],
+                              expected[channel]);
+                    success = ICET_FALSE;
+                    break;
+                }
+            }
+            if (!success) break;
+        }
+
+        free(color);
+    }
+
+    free(color_buffer);
+    free(depth_buffer);
+
+    return success;
+}
+
+/* Checks that compositing with the current formats and composite mode is
+ * rejected up front.  Every process must return without communicating. */
+static IceTBoolean TryRejected(IceTEnum color_format, IceTEnum depth_format)
+{
+    IceTFloat background_color[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    IceTVoid *color_buffer;
+    IceTVoid *depth_buffer;
+    IceTImage image;
+    IceTEnum diag_level;
+    IceTEnum error;
+    IceTBoolean success = ICET_TRUE;
+
+    icetSetColorFormat(color_format);
+    icetSetDepthFormat(depth_format);
+    MakeLayeredBuffers(color_format, depth_format,
+                       &color_buffer, &depth_buffer);
+
+    /* The expected error must not be reported as a test failure. */
+    icetGetEnumv(ICET_DIAGNOSTIC_LEVEL, &diag_level);
+    icetDiagnostics(ICET_DIAG_OFF);
+    icetGetError();
+    image = icetCompositeImageLayered(color_buffer,
+                                      depth_buffer,
+                                      NUM_LAYERS,
+                                      NULL,
+                                      NULL,
+                                      NULL,
+                                      background_color);
+    error = icetGetError();
+    icetDiagnostics(diag_level);
+
+    if (!icetImageIsNull(image)) {
+        printrank("***** Composite did not return a null image *****\n");
+        success = ICET_FALSE;
+    }
+    if (error != ICET_INVALID_OPERATION) {
+        printrank("***** Composite did not raise an invalid operation"
+                  " error *****\n");
+        success = ICET_FALSE;
+    }
+
+    free(color_buffer);
+    free(depth_buffer);
+
+    return success;
+}
+
+static int LayeredFormatsRun(void)
+{
+    IceTBoolean success = ICET_TRUE;
+
+    icetResetTiles();
+    icetAddTile(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT, 0);
+    icetStrategy(ICET_STRATEGY_REDUCE);
+    icetSingleImageStrategy(ICET_SINGLE_IMAGE_STRATEGY_RADIXK);
+    icetCompositeMode(ICET_COMPOSITE_MODE_BLEND);
+    icetDisable(ICET_ORDERED_COMPOSITE);
+
+    printstat("RGBA ubyte colors, float depths\n");
+    success &= TryFormat(ICET_IMAGE_COLOR_RGBA_UBYTE, ICET_IMAGE_DEPTH_FLOAT);
+    printstat("RGBA half colors, float depths\n");
+    success &= TryFormat(ICET_IMAGE_COLOR_RGBA_HALF, ICET_IMAGE_DEPTH_FLOAT);
+    printstat("RGBA float colors, float depths\n");
+    success &= TryFormat(ICET_IMAGE_COLOR_RGBA_FLOAT, ICET_IMAGE_DEPTH_FLOAT);
+    printstat("RGBA ubyte colors, 16-bit depths\n");
+    success &= TryFormat(ICET_IMAGE_COLOR_RGBA_UBYTE, ICET_IMAGE_DEPTH_USHORT);
+    printstat("RGBA half colors, 16-bit depths\n");
+    success &= TryFormat(ICET_IMAGE_COLOR_RGBA_HALF, ICET_IMAGE_DEPTH_USHORT);
+    printstat("RGBA float colors, 16-bit depths are rejected\n");
+    success &= TryRejected(ICET_IMAGE_COLOR_RGBA_FLOAT,
+                           ICET_IMAGE_DEPTH_USHORT);
+
+    printstat("Z buffer compositing with 16-bit depths is rejected\n");
+    icetCompositeMode(ICET_COMPOSITE_MODE_Z_BUFFER);
+    success &= TryRejected(ICET_IMAGE_COLOR_RGBA_UBYTE,
+                           ICET_IMAGE_DEPTH_USHORT);
+
+    return (success ? TEST_PASSED : TEST_FAILED);
+}
+
+int LayeredFormats(int argc, char *argv[])
+{
+    /* Suppress warning. */
+    (void)argc;
+    (void)argv;
+
+    return run_test(LayeredFormatsRun);
+}
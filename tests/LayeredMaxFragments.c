@@ -0,0 +1,205 @@
+/* -*- c -*- *****************************************************************
+** Checks that ICET_MAX_FRAGMENTS_PER_PIXEL blends the fragments beyond the
+** limit into the last kept fragment of a pixel rather than dropping them, so
+** that the composited image still matches blending all fragments of all
+** processes front to back.  The limit is hit both when compressing the layers
+** of a process and when merging the images of several processes.
+*****************************************************************************/
+
+#include <IceT.h>
+#include <IceTDevImage.h>
+#include "test_codes.h"
+#include "test_util.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#define TILE_WIDTH      16
+#define TILE_HEIGHT     16
+
+/* In the first case, only the first process renders anything, with more
+ * layers than the limit, so the limit only applies when compressing.  In the
+ * second case, all processes render and the limit is hit when merging.
+ */
+#define CASE_COMPRESS   0
+#define CASE_MERGE      1
+
+static IceTInt NumLayers(IceTInt test_case)
+{
+    return (test_case == CASE_COMPRESS) ? 6 : 4;
+}
+
+/* The limit is below the number of layers of a process in the first case.
+ * In the second, it leaves room for the front fragment of every process. */
+static IceTInt MaxFragments(IceTInt test_case, IceTInt num_proc)
+{
+    return (test_case == CASE_COMPRESS) ? 3 : num_proc + 1;
+}
+
+/* The case whose fragments Fragments computes. */
+static IceTInt current_case;
+
+/* Computes the fragments of a process.  In the second case, each process has
+ * a front fragment in the front half of the depth range and back fragments
+ * interleaved with those of the other processes in the back half.  Merging
+ * the images of some processes blends back fragments into the last kept one,
+ * and back fragments of processes merged later can belong between them.  The
+ * back fragments therefore share one hue, under which their order does not
+ * matter.  The front fragments are never blended, since the limit leaves room
+ * for all of them, and must keep their order and colors. */
+static IceTInt Fragments(IceTInt rank,
+                         IceTInt num_proc,
+                         IceTSizeType pixel,
+                         IceTFloat (*colors)[4],
+                         IceTFloat *depths)
+{
+    const IceTInt num_layers = NumLayers(current_case);
+    IceTInt num_active;
+    IceTInt layer;
+
+    if ((current_case == CASE_COMPRESS) && (rank != 0)) {
+        num_active = 0;
+    } else if (pixel == 0) {
+        num_active = num_layers;
+    } else {
+        num_active = layered_num_active(rank, pixel, num_layers);
+    }
+
+    for (layer = 0; layer < num_active; layer++) {
+        IceTFloat *color = colors[layer];
+
+        layered_fragment_color(rank, pixel, layer, 0.1f, 0.6f, color);
+        if ((current_case == CASE_MERGE) && (layer > 0)) {
+            color[0] = color[3]*0.25f;
+            color[1] = color[3]*0.5f;
+            color[2] = color[3]*0.75f;
+        }
+
+        if (current_case == CASE_COMPRESS) {
+            depths[layer] = (layer + 0.5f)/num_layers;
+        } else if (layer == 0) {
+            depths[layer] = (rank + 0.5f)/(2*num_proc);
+        } else {
+            depths[layer] = 0.5f + 0.5f*layered_fragment_depth(rank,
+                                                               layer - 1,
+                                                               num_proc,
+                                                               num_layers - 1);
+        }
+    }
+
+    return num_active;
+}
+
+static IceTBoolean TryCase(IceTInt test_case)
+{
+    static const IceTEnum strategies[] = {
+        ICET_STRATEGY_SEQUENTIAL,
+        ICET_STRATEGY_REDUCE
+    };
+    static const IceTEnum single_image_strategies[] = {
+        ICET_SINGLE_IMAGE_STRATEGY_BSWAP,
+        ICET_SINGLE_IMAGE_STRATEGY_TREE,
+        ICET_SINGLE_IMAGE_STRATEGY_RADIXK,
+        ICET_SINGLE_IMAGE_STRATEGY_RADIXKR
+    };
+    const IceTSizeType num_pixels = TILE_WIDTH*TILE_HEIGHT;
+    const IceTInt num_layers = NumLayers(test_case);
+    IceTFloat background_color[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    IceTInt rank;
+    IceTInt num_proc;
+    IceTVoid *color_buffer;
+    IceTVoid *depth_buffer;
+    IceTFloat *expected;
+    IceTSizeType pixel;
+    IceTBoolean success = ICET_TRUE;
+    int i, j;
+
+    icetGetIntegerv(ICET_RANK, &rank);
+    icetGetIntegerv(ICET_NUM_PROCESSES, &num_proc);
+
+    current_case = test_case;
+    make_layered_buffers(Fragments, rank, num_proc, num_pixels, num_layers,
+                         ICET_IMAGE_COLOR_RGBA_FLOAT, ICET_IMAGE_DEPTH_FLOAT,
+                         &color_buffer, &depth_buffer);
+
+    expected = malloc(4*num_pixels*sizeof(IceTFloat));
+    for (pixel = 0; pixel < num_pixels; pixel++) {
+        reference_pixel(Fragments, num_proc, num_layers, pixel, 0.0f,
+                        expected + 4*pixel);
+    }
+
+    for (i = 0; i < (int)(sizeof(strategies)/sizeof(IceTEnum)); i++) {
+        icetStrategy(strategies[i]);
+        for (j = 0;
+             j < (int)(sizeof(single_image_strategies)/sizeof(IceTEnum));
+             j++) {
+            IceTImage image;
+            IceTInt tile_displayed;
+
+            icetSingleImageStrategy(single_image_strategies[j]);
+            printstat("  Strategy %s, %s\n",
+                      icetGetStrategyName(),
+                      icetGetSingleImageStrategyName());
+
+            icetMaxFragmentsPerPixel(MaxFragments(test_case, num_proc));
+            image = icetCompositeImageLayered(color_buffer,
+                                              depth_buffer,
+                                              num_layers,
+                                              NULL,
+                                              NULL,
+                                              NULL,
+                                              background_color);
+            icetMaxFragmentsPerPixel(0);
+
+            icetGetIntegerv(ICET_TILE_DISPLAYED, &tile_displayed);
+            if (tile_displayed >= 0) {
+                const IceTFloat *result = icetImageGetColorcf(image);
+                for (pixel = 0; pixel < 4*num_pixels; pixel++) {
+                    if (fabs(result[pixel] - expected[pixel]) > 1e-4f) {
+                        printrank("***** Pixel %d channel %d is %f, expected"
+                                  " %f *****\n",
+                                  (int)(pixel/4), (int)(pixel%4),
+                                  result[pixel], expected[pixel]);
+                        success = ICET_FALSE;
+                        break;
+                    }
+                }
+            }
+        }
+    }
+
+    free(color_buffer);
+    free(depth_buffer);
+    free(expected);
+
+    return success;
+}
+
+static int LayeredMaxFragmentsRun(void)
+{
+    IceTBoolean success = ICET_TRUE;
+
+    icetResetTiles();
+    icetAddTile(0, 0, TILE_WIDTH, TILE_HEIGHT, 0);
+    icetCompositeMode(ICET_COMPOSITE_MODE_BLEND);
+    icetSetColorFormat(ICET_IMAGE_COLOR_RGBA_FLOAT);
+    icetSetDepthFormat(ICET_IMAGE_DEPTH_FLOAT);
+    icetDisable(ICET_ORDERED_COMPOSITE);
+
+    printstat("Limit hit when compressing\n");
+    success &= TryCase(CASE_COMPRESS);
+    printstat("Limit hit when merging\n");
+    success &= TryCase(CASE_MERGE);
+
+    return (success ? TEST_PASSED : TEST_FAILED);
+}
+
+int LayeredMaxFragments(int argc, char *argv[])
+{
+    /* Suppress warning. */
+    (void)argc;
+    (void)argv;
+
+    return run_test(LayeredMaxFragmentsRun);
+}
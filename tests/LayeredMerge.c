@@ -0,0 +1,277 @@
+/* -*- c -*- *****************************************************************
+** Tests merging the fragments of two sparse layered images for several
+** distributions of fragments per pixel.  The merged image is checked against
+** the compression of a layered image that already contains the fragments of
+** both images in depth order.  With the -benchmark argument, the time spent
+** merging is also reported.
+*****************************************************************************/
+
+#include <IceT.h>
+#include <IceTDevImage.h>
+#include "test_codes.h"
+#include "test_util.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#define MERGE_WIDTH     256
+#define MERGE_HEIGHT    256
+#define MERGE_REPEATS   20
+
+static IceTBoolean g_benchmark = ICET_FALSE;
+
+/* Describes how many fragments each of the two merged images has per pixel
+ * and how their depths interleave. */
+typedef struct {
+    const char *name;
+    IceTInt min_front, max_front;
+    IceTInt min_back, max_back;
+    /* When set, all fragments of the front image lie in front of those of the
+     * back image.  Otherwise, depths are random. */
+    IceTBoolean separated;
+    /* When set, depths take one of a few values, so that fragments of both
+     * images often have the same depth. */
+    IceTBoolean ties;
+} MergeDistribution;
+
+static const MergeDistribution g_distributions[] = {
+    { "sparse",      0, 2,  0, 2,  ICET_FALSE, ICET_FALSE },
+    { "uniform",     1, 8,  1, 8,  ICET_FALSE, ICET_FALSE },
+    { "interleaved", 8, 8,  8, 8,  ICET_FALSE, ICET_FALSE },
+    { "separated",   8, 8,  8, 8,  ICET_TRUE,  ICET_FALSE },
+    { "skewed",      1, 1,  16, 16, ICET_FALSE, ICET_FALSE },
+    { "ties",        1, 8,  1, 8,  ICET_FALSE, ICET_TRUE  },
+};
+
+static IceTInt RandomCount(IceTInt min, IceTInt max)
+{
+    return min + rand()%(max - min + 1);
+}
+
+static IceTFloat RandomDepth(const MergeDistribution *dist, IceTBoolean back)
+{
+    if (dist->ties) {
+        return (IceTFloat)(rand()%8)/8.0f;
+    } else if (dist->separated) {
+        return 0.5f*random_float() + (back ? 0.5f : 0.0f);
+    } else {
+        return random_float();
+    }
+}
+
+static int CompareDepths(const void *a, const void *b)
+{
+    IceTFloat depth_a = *(const IceTFloat *)a;
+    IceTFloat depth_b = *(const IceTFloat *)b;
+    return (depth_a > depth_b) - (depth_a < depth_b);
+}
+
+/* Writes `count` active fragments with sorted depths from `depths` to the
+ * given pixel and pads it with empty fragments. */
+static void WritePixel(IceTFloat *color,
+                       IceTFloat *depth,
+                       IceTInt num_layers,
+                       const IceTFloat *depths,
+                       IceTInt count)
+{
+    IceTInt layer;
+    for (layer = 0; layer < num_layers; layer++) {
+        if (layer < count) {
+            IceTFloat alpha = 0.1f + 0.8f*random_float();
+            color[4*layer + 0] = alpha*random_float();
+            color[4*layer + 1] = alpha*random_float();
+            color[4*layer + 2] = alpha*random_float();
+            color[4*layer + 3] = alpha;
+            depth[layer] = depths[layer];
+        } else {
+            color[4*layer + 0] = color[4*layer + 1] = 0.0f;
+            color[4*layer + 2] = color[4*layer + 3] = 0.0f;
+            depth[layer] = 1.0f;
+        }
+    }
+}
+
+static IceTSparseImage CompressLayered(const IceTFloat *color,
+                                       const IceTFloat *depth,
+                                       IceTInt num_layers)
+{
+    IceTImage image;
+    IceTSparseImage sparse_image;
+
+    image = icetLayeredImagePointerAssignBuffer(
+                malloc(icetLayeredImagePointerBufferSize()),
+                MERGE_WIDTH, MERGE_HEIGHT, (IceTLayerCount)num_layers,
+                color, depth);
+    sparse_image = icetSparseLayeredImageAssignBuffer(
+                malloc(icetSparseLayeredImageBufferSize(
+                           MERGE_WIDTH, MERGE_HEIGHT,
+                           (IceTLayerCount)num_layers)),
+                MERGE_WIDTH, MERGE_HEIGHT);
+    icetCompressImage(image, sparse_image);
+    free(image.opaque_internals);
+
+    return sparse_image;
+}
+
+static IceTBoolean MergeTryDistribution(const MergeDistribution *dist)
+{
+    const IceTSizeType num_pixels = MERGE_WIDTH*MERGE_HEIGHT;
+    const IceTInt front_layers = dist->max_front;
+    const IceTInt back_layers = dist->max_back;
+    const IceTInt merged_layers = front_layers + back_layers;
+    IceTFloat *front_color, *front_depth;
+    IceTFloat *back_color, *back_depth;
+    IceTFloat *merged_color, *merged_depth;
+    IceTSparseImage front, back, expected, merged;
+    IceTSizeType pixel;
+    IceTSizeType num_fragments = 0;
+    IceTVoid *expected_buffer, *merged_buffer;
+    IceTSizeType expected_size, merged_size;
+    IceTBoolean success = ICET_TRUE;
+
+    front_color = malloc(4*num_pixels*front_layers*sizeof(IceTFloat));
+    front_depth = malloc(num_pixels*front_layers*sizeof(IceTFloat));
+    back_color = malloc(4*num_pixels*back_layers*sizeof(IceTFloat));
+    back_depth = malloc(num_pixels*back_layers*sizeof(IceTFloat));
+    merged_color = malloc(4*num_pixels*merged_layers*sizeof(IceTFloat));
+    merged_depth = malloc(num_pixels*merged_layers*sizeof(IceTFloat));
+
+    for (pixel = 0; pixel < num_pixels; pixel++) {
+        IceTFloat depths[2][32];
+        IceTInt num_front = RandomCount(dist->min_front, dist->max_front);
+        IceTInt num_back = RandomCount(dist->min_back, dist->max_back);
+        IceTFloat *pixel_color = merged_color + 4*pixel*merged_layers;
+        IceTFloat *pixel_depth = merged_depth + pixel*merged_layers;
+        IceTInt i, f, b;
+
+        for (i = 0; i < num_front; i++) {
+            depths[0][i] = RandomDepth(dist, ICET_FALSE);
+        }
+        for (i = 0; i < num_back; i++) {
+            depths[1][i] = RandomDepth(dist, ICET_TRUE);
+        }
+        qsort(depths[0], num_front, sizeof(IceTFloat), CompareDepths);
+        qsort(depths[1], num_back, sizeof(IceTFloat), CompareDepths);
+
+        WritePixel(front_color + 4*pixel*front_layers,
+                   front_depth + pixel*front_layers,
+                   front_layers, depths[0], num_front);
+        WritePixel(back_color + 4*pixel*back_layers,
+                   back_depth + pixel*back_layers,
+                   back_layers, depths[1], num_back);
+
+        /* Merge both pixels in depth order, preferring the front image for
+         * equal depths. */
+        for (i = 0, f = 0, b = 0; i < merged_layers; i++) {
+            const IceTFloat *src_color;
+            IceTFloat src_depth;
+            if (   (f < num_front)
+                && ((b >= num_back) || (depths[0][f] <= depths[1][b])) ) {
+                src_color = front_color + 4*(pixel*front_layers + f);
+                src_depth = depths[0][f++];
+            } else if (b < num_back) {
+                src_color = back_color + 4*(pixel*back_layers + b);
+                src_depth = depths[1][b++];
+            } else {
+                memset(pixel_color + 4*i, 0, 4*sizeof(IceTFloat));
+                pixel_depth[i] = 1.0f;
+                continue;
+            }
+            memcpy(pixel_color + 4*i, src_color, 4*sizeof(IceTFloat));
+            pixel_depth[i] = src_depth;
+        }
+
+        num_fragments += num_front + num_back;
+    }
+
+    front = CompressLayered(front_color, front_depth, front_layers);
+    back = CompressLayered(back_color, back_depth, back_layers);
+    expected = CompressLayered(merged_color, merged_depth, merged_layers);
+    merged = icetSparseLayeredImageAssignBuffer(
+                 malloc(icetSparseLayeredImageBufferSize(
+                            MERGE_WIDTH, MERGE_HEIGHT,
+                            (IceTLayerCount)merged_layers)),
+                 MERGE_WIDTH, MERGE_HEIGHT);
+
+    if (g_benchmark) {
+        /* Report the fastest of several merges to reduce noise from other
+         * work on the machine. */
+        IceTDouble merge_time = -1.0;
+        IceTInt repeat;
+        for (repeat = 0; repeat < MERGE_REPEATS; repeat++) {
+            IceTDouble start_time = icetWallTime();
+            IceTDouble time;
+            icetCompressedCompressedComposite(front, back, merged);
+            time = icetWallTime() - start_time;
+            if ((merge_time < 0.0) || (time < merge_time)) merge_time = time;
+        }
+
+        printstat("  %-12s %8.3f ms per merge, %7.1f M fragments/s\n",
+                  dist->name, 1000.0*merge_time,
+                  1e-6*num_fragments/merge_time);
+    } else {
+        printstat("  %s\n", dist->name);
+        icetCompressedCompressedComposite(front, back, merged);
+    }
+
+    icetSparseImagePackageForSend(expected, &expected_buffer, &expected_size);
+    icetSparseImagePackageForSend(merged, &merged_buffer, &merged_size);
+    if (   (expected_size != merged_size)
+        || (memcmp(expected_buffer, merged_buffer, merged_size) != 0) ) {
+        printrank("***** Merged image differs for %s fragments *****\n",
+                  dist->name);
+        success = ICET_FALSE;
+    }
+
+    free(front.opaque_internals);
+    free(back.opaque_internals);
+    free(expected.opaque_internals);
+    free(merged.opaque_internals);
+    free(front_color);
+    free(front_depth);
+    free(back_color);
+    free(back_depth);
+    free(merged_color);
+    free(merged_depth);
+
+    return success;
+}
+
+static int LayeredMergeRun(void)
+{
+    IceTBoolean success = ICET_TRUE;
+    size_t i;
+
+    srand(42);
+
+    icetSetColorFormat(ICET_IMAGE_COLOR_RGBA_FLOAT);
+    icetSetDepthFormat(ICET_IMAGE_DEPTH_FLOAT);
+    icetCompositeMode(ICET_COMPOSITE_MODE_BLEND);
+
+    printstat("Merging %dx%d layered images\n", MERGE_WIDTH, MERGE_HEIGHT);
+    for (i = 0; i < sizeof(g_distributions)/sizeof(g_distributions[0]); i++) {
+        success &= MergeTryDistribution(&g_distributions[i]);
+    }
+
+    return (success ? TEST_PASSED : TEST_FAILED);
+}
+
+int LayeredMerge(int argc, char *argv[])
+{
+    int arg;
+
+    for (arg = 1; arg < argc; arg++) {
+        if (strcmp(argv[arg], "-benchmark") == 0) {
+            g_benchmark = ICET_TRUE;
+        } else {
+            printstat("Unknown option `%s'.\n", argv[arg]);
+            printstat("\nUSAGE: %s [-benchmark]\n", argv[0]);
+            printstat("  -benchmark  Report the fastest of %d merges for each"
+                      " distribution.\n", MERGE_REPEATS);
+            return TEST_NOT_RUN;
+        }
+    }
+
+    return run_test(LayeredMergeRun);
+}
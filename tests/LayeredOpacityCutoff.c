@@ -0,0 +1,200 @@
+/* -*- c -*- *****************************************************************
+** Checks ICET_LAYERED_OPACITY_CUTOFF.  A cutoff of 1 only drops fragments
+** behind fully opaque ones, so it must give exactly the same image as no
+** cutoff.  A lower cutoff must drop exactly the fragments behind the one at
+** which the opacity accumulated front to back over the fragments of all
+** processes reaches it, which is compared with a reference blend.
+*****************************************************************************/
+
+#include <IceT.h>
+#include <IceTDevImage.h>
+#include "test_codes.h"
+#include "test_util.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#define TILE_WIDTH      16
+#define TILE_HEIGHT     16
+#define NUM_LAYERS      4
+
+#define LOW_CUTOFF      0.6f
+
+/* Computes the fragments of a process.  The first pixel holds all layers of
+ * all processes.  Depths interleave the layers of all processes.  Some
+ * fragments are opaque.  The others are faint enough that even all fragments
+ * of a pixel cannot round the accumulated opacity to 1, and their opacities
+ * are chosen from few values so that the accumulated opacity never comes
+ * close to LOW_CUTOFF. */
+static IceTInt Fragments(IceTInt rank,
+                         IceTInt num_proc,
+                         IceTSizeType pixel,
+                         IceTFloat (*colors)[4],
+                         IceTFloat *depths)
+{
+    IceTInt num_active = (pixel == 0) ? NUM_LAYERS
+                       : layered_num_active(rank, pixel, NUM_LAYERS);
+    IceTInt layer;
+
+    for (layer = 0; layer < num_active; layer++) {
+        IceTFloat select = hash_float(rank, pixel, 4*layer + 1);
+        IceTFloat alpha = (select < 0.125f) ? 1.0f
+                        : (select < 0.5f) ? 0.25f : 0.125f;
+        layered_fragment_color(rank, pixel, layer, alpha, alpha, colors[layer]);
+        depths[layer] = layered_fragment_depth(rank, layer, num_proc,
+                                               NUM_LAYERS);
+    }
+
+    return num_active;
+}
+
+/* Composites the buffers with the given cutoff and copies the colors of the
+ * displayed tile into result. */
+static void Composite(IceTFloat cutoff,
+                      const IceTFloat *color_buffer,
+                      const IceTFloat *depth_buffer,
+                      IceTFloat *result)
+{
+    IceTFloat background_color[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    IceTImage image;
+    IceTInt tile_displayed;
+
+    icetLayeredOpacityCutoff(cutoff);
+    image = icetCompositeImageLayered(color_buffer,
+                                      depth_buffer,
+                                      NUM_LAYERS,
+                                      NULL,
+                                      NULL,
+                                      NULL,
+                                      background_color);
+    icetLayeredOpacityCutoff(0.0f);
+
+    icetGetIntegerv(ICET_TILE_DISPLAYED, &tile_displayed);
+    if (tile_displayed >= 0) {
+        memcpy(result,
+               icetImageGetColorcf(image),
+               4*TILE_WIDTH*TILE_HEIGHT*sizeof(IceTFloat));
+    }
+}
+
+/* Compares a composited image with the reference blend for a cutoff. */
+static IceTBoolean CheckReference(const IceTFloat *result, IceTFloat cutoff)
+{
+    const IceTSizeType num_pixels = TILE_WIDTH*TILE_HEIGHT;
+    IceTInt num_proc;
+    IceTSizeType pixel;
+
+    icetGetIntegerv(ICET_NUM_PROCESSES, &num_proc);
+
+    for (pixel = 0; pixel < num_pixels; pixel++) {
+        IceTFloat expected[4];
+        int channel;
+        reference_pixel(Fragments, num_proc, NUM_LAYERS, pixel, cutoff,
+                        expected);
+        for (channel = 0; channel < 4; channel++) {
+            if (fabs(result[4*pixel + channel] - expected[channel]) > 1e-5f) {
+                printrank("***** Cutoff %f: pixel %d channel %d is %f,"
+                          " expected %f *****\n",
+                          cutoff, (int)pixel, channel,
+                          result[4*pixel + channel], expected[channel]);
+                return ICET_FALSE;
+            }
+        }
+    }
+
+    return ICET_TRUE;
+}
+
+static int LayeredOpacityCutoffRun(void)
+{
+    static const IceTEnum strategies[] = {
+        ICET_STRATEGY_SEQUENTIAL,
+        ICET_STRATEGY_REDUCE
+    };
+    static const IceTEnum single_image_strategies[] = {
+        ICET_SINGLE_IMAGE_STRATEGY_BSWAP,
+        ICET_SINGLE_IMAGE_STRATEGY_TREE,
+        ICET_SINGLE_IMAGE_STRATEGY_RADIXK,
+        ICET_SINGLE_IMAGE_STRATEGY_RADIXKR
+    };
+    const IceTSizeType num_pixels = TILE_WIDTH*TILE_HEIGHT;
+    IceTInt rank;
+    IceTInt num_proc;
+    IceTVoid *color_buffer;
+    IceTVoid *depth_buffer;
+    IceTFloat *no_cutoff_result;
+    IceTFloat *full_cutoff_result;
+    IceTFloat *low_cutoff_result;
+    IceTBoolean success = ICET_TRUE;
+    int i, j;
+
+    icetGetIntegerv(ICET_RANK, &rank);
+    icetGetIntegerv(ICET_NUM_PROCESSES, &num_proc);
+
+    icetResetTiles();
+    icetAddTile(0, 0, TILE_WIDTH, TILE_HEIGHT, 0);
+    icetCompositeMode(ICET_COMPOSITE_MODE_BLEND);
+    icetSetColorFormat(ICET_IMAGE_COLOR_RGBA_FLOAT);
+    icetSetDepthFormat(ICET_IMAGE_DEPTH_FLOAT);
+    icetDisable(ICET_ORDERED_COMPOSITE);
+    /* Coalesced fragments are kept or dropped as a whole. */
+    icetDisable(ICET_COALESCE_FRAGMENTS);
+
+    make_layered_buffers(Fragments, rank, num_proc, num_pixels, NUM_LAYERS,
+                         ICET_IMAGE_COLOR_RGBA_FLOAT, ICET_IMAGE_DEPTH_FLOAT,
+                         &color_buffer, &depth_buffer);
+
+    no_cutoff_result = malloc(4*num_pixels*sizeof(IceTFloat));
+    full_cutoff_result = malloc(4*num_pixels*sizeof(IceTFloat));
+    low_cutoff_result = malloc(4*num_pixels*sizeof(IceTFloat));
+
+    for (i = 0; i < (int)(sizeof(strategies)/sizeof(IceTEnum)); i++) {
+        icetStrategy(strategies[i]);
+        for (j = 0;
+             j < (int)(sizeof(single_image_strategies)/sizeof(IceTEnum));
+             j++) {
+            IceTInt tile_displayed;
+
+            icetSingleImageStrategy(single_image_strategies[j]);
+            printstat("Strategy %s, %s\n",
+                      icetGetStrategyName(),
+                      icetGetSingleImageStrategyName());
+
+            Composite(0.0f, color_buffer, depth_buffer, no_cutoff_result);
+            Composite(1.0f, color_buffer, depth_buffer, full_cutoff_result);
+            Composite(LOW_CUTOFF, color_buffer, depth_buffer,
+                      low_cutoff_result);
+
+            icetGetIntegerv(ICET_TILE_DISPLAYED, &tile_displayed);
+            if (tile_displayed < 0) continue;
+
+            if (memcmp(no_cutoff_result,
+                       full_cutoff_result,
+                       4*num_pixels*sizeof(IceTFloat)) != 0) {
+                printrank("***** Cutoff of 1 changes the image *****\n");
+                success = ICET_FALSE;
+            }
+            success &= CheckReference(no_cutoff_result, 0.0f);
+            success &= CheckReference(low_cutoff_result, LOW_CUTOFF);
+        }
+    }
+
+    free(color_buffer);
+    free(depth_buffer);
+    free(no_cutoff_result);
+    free(full_cutoff_result);
+    free(low_cutoff_result);
+
+    return (success ? TEST_PASSED : TEST_FAILED);
+}
+
+int LayeredOpacityCutoff(int argc, char *argv[])
+{
+    /* Suppress warning. */
+    (void)argc;
+    (void)argv;
+
+    return run_test(LayeredOpacityCutoffRun);
+}
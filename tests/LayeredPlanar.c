@@ -0,0 +1,233 @@
+/* -*- c -*- *****************************************************************
+** Checks that compositing layered images stored as one buffer per layer with
+** icetCompositeImageLayeredPlanar gives exactly the same image as compositing
+** the same fragments stored per pixel with icetCompositeImageLayered.  Every
+** color format supported for blending layered images is checked with
+** fragments stored front to back and, with ICET_SORT_INPUT_FRAGMENTS, in
+** random order.  Each case is also run with a valid pixels viewport.
+*****************************************************************************/
+
+#include <IceT.h>
+#include <IceTDevImage.h>
+#include "test_codes.h"
+#include "test_util.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#define NUM_LAYERS      5
+
+/* Fills interleaved buffers with the fragments of each pixel stored
+ * contiguously, in depth order unless shuffled is set. */
+static void MakeFragments(IceTEnum color_format,
+                          IceTEnum depth_format,
+                          IceTBoolean shuffled,
+                          IceTByte *color_buffer,
+                          IceTByte *depth_buffer)
+{
+    const IceTSizeType num_pixels = SCREEN_WIDTH*SCREEN_HEIGHT;
+    const IceTSizeType color_size = color_pixel_size(color_format);
+    const IceTSizeType depth_size = depth_pixel_size(depth_format);
+    IceTSizeType pixel;
+
+    for (pixel = 0; pixel < num_pixels; pixel++) {
+        IceTInt num_active = rand()%(NUM_LAYERS + 1);
+        IceTInt layer;
+        for (layer = 0; layer < NUM_LAYERS; layer++) {
+            IceTSizeType fragment = pixel*NUM_LAYERS + layer;
+            IceTFloat depth_value = shuffled
+                ? 0.99f*random_float()
+                : (layer + 0.99f*random_float())/NUM_LAYERS;
+            store_random_fragment(color_buffer + fragment*color_size,
+                                  depth_buffer + fragment*depth_size,
+                                  color_format, depth_format,
+                                  layer < num_active, depth_value);
+        }
+    }
+}
+
+/* Copies interleaved fragments into one buffer per layer. */
+static void SplitLayers(const IceTByte *buffer,
+                        IceTSizeType fragment_size,
+                        IceTByte **layers)
+{
+    const IceTSizeType num_pixels = SCREEN_WIDTH*SCREEN_HEIGHT;
+    IceTSizeType pixel;
+    IceTInt layer;
+
+    for (layer = 0; layer < NUM_LAYERS; layer++) {
+        layers[layer] = malloc(num_pixels*fragment_size);
+        for (pixel = 0; pixel < num_pixels; pixel++) {
+            memcpy(layers[layer] + pixel*fragment_size,
+                   buffer + (pixel*NUM_LAYERS + layer)*fragment_size,
+                   fragment_size);
+        }
+    }
+}
+
+/* Composites with the given entry point and copies the colors of the
+ * displayed tile into result, if this process displays it. */
+static void Composite(IceTBoolean planar,
+                      const IceTByte *color_buffer,
+                      const IceTByte *depth_buffer,
+                      IceTByte *const *color_layers,
+                      IceTByte *const *depth_layers,
+                      const IceTInt *valid_pixels_viewport,
+                      IceTByte *result)
+{
+    IceTFloat background_color[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    IceTImage image;
+    IceTInt tile_displayed;
+
+    if (planar) {
+        image = icetCompositeImageLayeredPlanar(
+                    (const IceTVoid *const *)color_layers,
+                    (const IceTVoid *const *)depth_layers,
+                    NUM_LAYERS,
+                    valid_pixels_viewport,
+                    NULL,
+                    NULL,
+                    background_color);
+    } else {
+        image = icetCompositeImageLayered(color_buffer,
+                                          depth_buffer,
+                                          NUM_LAYERS,
+                                          valid_pixels_viewport,
+                                          NULL,
+                                          NULL,
+                                          background_color);
+    }
+
+    icetGetIntegerv(ICET_TILE_DISPLAYED, &tile_displayed);
+    if (tile_displayed >= 0) {
+        IceTSizeType color_size;
+        const IceTVoid *color = icetImageGetColorConstVoid(image, &color_size);
+        memcpy(result, color, icetImageGetNumPixels(image)*color_size);
+    }
+}
+
+static IceTBoolean TryFormat(IceTEnum color_format,
+                             IceTEnum depth_format,
+                             IceTBoolean sort)
+{
+    const IceTSizeType num_pixels = SCREEN_WIDTH*SCREEN_HEIGHT;
+    const IceTSizeType color_size = color_pixel_size(color_format);
+    const IceTSizeType depth_size = depth_pixel_size(depth_format);
+    IceTByte *color_buffer, *depth_buffer;
+    IceTByte *color_layers[NUM_LAYERS], *depth_layers[NUM_LAYERS];
+    IceTByte *interleaved_result, *planar_result;
+    IceTInt valid_pixels_viewport[4];
+    IceTInt tile_displayed;
+    IceTInt layer;
+    int use_viewport;
+    IceTBoolean success = ICET_TRUE;
+
+    icetSetColorFormat(color_format);
+    icetSetDepthFormat(depth_format);
+    if (sort) {
+        icetEnable(ICET_SORT_INPUT_FRAGMENTS);
+    } else {
+        icetDisable(ICET_SORT_INPUT_FRAGMENTS);
+    }
+
+    color_buffer = malloc(num_pixels*NUM_LAYERS*color_size);
+    depth_buffer = malloc(num_pixels*NUM_LAYERS*depth_size);
+    MakeFragments(color_format, depth_format, sort,
+                  color_buffer, depth_buffer);
+    SplitLayers(color_buffer, color_size, color_layers);
+    SplitLayers(depth_buffer, depth_size, depth_layers);
+    interleaved_result = malloc(num_pixels*color_size);
+    planar_result = malloc(num_pixels*color_size);
+
+    valid_pixels_viewport[0] = 3;
+    valid_pixels_viewport[1] = 5;
+    valid_pixels_viewport[2] = (IceTInt)SCREEN_WIDTH - 10;
+    valid_pixels_viewport[3] = (IceTInt)SCREEN_HEIGHT - 7;
+
+    for (use_viewport = 0; use_viewport < 2; use_viewport++) {
+        const IceTInt *viewport = use_viewport ? valid_pixels_viewport : NULL;
+
+        Composite(ICET_FALSE, color_buffer, depth_buffer, NULL, NULL,
+                  viewport, interleaved_result);
+        Composite(ICET_TRUE, NULL, NULL, color_layers, depth_layers,
+                  viewport, planar_result);
+
+        icetGetIntegerv(ICET_TILE_DISPLAYED, &tile_displayed);
+        if (   (tile_displayed >= 0)
+            && (memcmp(interleaved_result, planar_result,
+                       num_pixels*color_size) != 0) ) {
+            printrank("***** Planar layers give a different image%s *****\n",
+                      use_viewport ? " with a valid pixels viewport" : "");
+            success = ICET_FALSE;
+        }
+    }
+
+    icetDisable(ICET_SORT_INPUT_FRAGMENTS);
+
+    for (layer = 0; layer < NUM_LAYERS; layer++) {
+        free(color_layers[layer]);
+        free(depth_layers[layer]);
+    }
+    free(color_buffer);
+    free(depth_buffer);
+    free(interleaved_result);
+    free(planar_result);
+
+    return success;
+}
+
+static int LayeredPlanarRun(void)
+{
+    static const struct {
+        const char *name;
+        IceTEnum color_format;
+        IceTEnum depth_format;
+    } formats[] = {
+        { "RGBA ubyte colors, float depths",
+          ICET_IMAGE_COLOR_RGBA_UBYTE, ICET_IMAGE_DEPTH_FLOAT },
+        { "RGBA half colors, float depths",
+          ICET_IMAGE_COLOR_RGBA_HALF, ICET_IMAGE_DEPTH_FLOAT },
+        { "RGBA float colors, float depths",
+          ICET_IMAGE_COLOR_RGBA_FLOAT, ICET_IMAGE_DEPTH_FLOAT },
+        { "RGBA ubyte colors, 16-bit depths",
+          ICET_IMAGE_COLOR_RGBA_UBYTE, ICET_IMAGE_DEPTH_USHORT },
+        { "RGBA half colors, 16-bit depths",
+          ICET_IMAGE_COLOR_RGBA_HALF, ICET_IMAGE_DEPTH_USHORT }
+    };
+    IceTInt rank;
+    IceTBoolean success = ICET_TRUE;
+    int i;
+
+    icetGetIntegerv(ICET_RANK, &rank);
+    srand(17 + rank);
+
+    icetResetTiles();
+    icetAddTile(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT, 0);
+    icetStrategy(ICET_STRATEGY_REDUCE);
+    icetSingleImageStrategy(ICET_SINGLE_IMAGE_STRATEGY_RADIXK);
+    icetCompositeMode(ICET_COMPOSITE_MODE_BLEND);
+    icetDisable(ICET_ORDERED_COMPOSITE);
+
+    for (i = 0; i < (int)(sizeof(formats)/sizeof(formats[0])); i++) {
+        printstat("%s, sorted\n", formats[i].name);
+        success &= TryFormat(formats[i].color_format,
+                             formats[i].depth_format,
+                             ICET_FALSE);
+        printstat("%s, sorted while compressing\n", formats[i].name);
+        success &= TryFormat(formats[i].color_format,
+                             formats[i].depth_format,
+                             ICET_TRUE);
+    }
+
+    return (success ? TEST_PASSED : TEST_FAILED);
+}
+
+int LayeredPlanar(int argc, char *argv[])
+{
+    /* Suppress warning. */
+    (void)argc;
+    (void)argv;
+
+    return run_test(LayeredPlanarRun);
+}
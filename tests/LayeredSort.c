@@ -0,0 +1,242 @@
+/* -*- c -*- *****************************************************************
+** Checks that compressing layered images whose fragments are stored in any
+** order with ICET_SORT_INPUT_FRAGMENTS gives exactly the same sparse image as
+** compressing the same fragments already sorted front to back.  Pixels hold
+** 0 to 12 fragments, so both the sorting networks and the insertion sort for
+** larger counts are used, and many fragments share a depth to check that ties
+** keep their input order.  Fragments beyond ICET_MAX_FRAGMENTS_PER_PIXEL must
+** be dropped after sorting, not before.
+*****************************************************************************/
+
+#include <IceT.h>
+#include <IceTDevImage.h>
+#include "test_codes.h"
+#include "test_util.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#define SORT_LAYERS     12
+#define SORT_WIDTH      (3*(SORT_LAYERS + 1))
+#define SORT_HEIGHT     7
+
+/* Fills each pixel with pixel%(SORT_LAYERS + 1) fragments in random order.
+ * Depths take one of a few values, so fragments often share a depth.
+ * Colors are premultiplied with nonzero alphas. */
+static void MakeShuffledFragments(IceTFloat *colors, IceTFloat *depths)
+{
+    const IceTSizeType num_pixels = SORT_WIDTH*SORT_HEIGHT;
+    IceTSizeType pixel;
+
+    for (pixel = 0; pixel < num_pixels; pixel++) {
+        IceTInt num_active = (IceTInt)(pixel%(SORT_LAYERS + 1));
+        IceTInt layer;
+        for (layer = 0; layer < SORT_LAYERS; layer++) {
+            IceTFloat *color = colors + 4*(pixel*SORT_LAYERS + layer);
+            IceTFloat *depth = depths + pixel*SORT_LAYERS + layer;
+            if (layer < num_active) {
+                IceTFloat alpha = 0.1f + 0.8f*random_float();
+                color[0] = alpha*random_float();
+                color[1] = alpha*random_float();
+                color[2] = alpha*random_float();
+                color[3] = alpha;
+                *depth = (IceTFloat)(rand()%6)/8.0f;
+            } else {
+                color[0] = color[1] = color[2] = color[3] = 0.0f;
+                *depth = 1.0f;
+            }
+        }
+    }
+}
+
+/* Copies the fragments of each pixel front to back, keeping fragments with
+ * equal depths in their input order. */
+static void SortFragments(const IceTFloat *in_colors,
+                          const IceTFloat *in_depths,
+                          IceTFloat *out_colors,
+                          IceTFloat *out_depths)
+{
+    const IceTSizeType num_pixels = SORT_WIDTH*SORT_HEIGHT;
+    IceTSizeType pixel;
+
+    memcpy(out_colors, in_colors,
+           4*num_pixels*SORT_LAYERS*sizeof(IceTFloat));
+    memcpy(out_depths, in_depths, num_pixels*SORT_LAYERS*sizeof(IceTFloat));
+
+    for (pixel = 0; pixel < num_pixels; pixel++) {
+        IceTSizeType first = pixel*SORT_LAYERS;
+        IceTInt num_active = (IceTInt)(pixel%(SORT_LAYERS + 1));
+        IceTInt num_sorted = 0;
+        IceTInt i;
+        for (i = 0; i < num_active; i++) {
+            insert_fragment(out_colors + 4*first,
+                            out_depths + first,
+                            &num_sorted,
+                            in_colors + 4*(first + i),
+                            in_depths[first + i]);
+        }
+    }
+}
+
+/* Converts fragments to the given formats in newly allocated buffers. */
+static void ConvertFragments(const IceTFloat *colors,
+                             const IceTFloat *depths,
+                             IceTEnum color_format,
+                             IceTEnum depth_format,
+                             IceTVoid **color_buffer_p,
+                             IceTVoid **depth_buffer_p)
+{
+    const IceTSizeType num_fragments = SORT_WIDTH*SORT_HEIGHT*SORT_LAYERS;
+    const IceTSizeType color_size = color_pixel_size(color_format);
+    const IceTSizeType depth_size = depth_pixel_size(depth_format);
+    IceTByte *color_buffer = malloc(num_fragments*color_size);
+    IceTByte *depth_buffer = malloc(num_fragments*depth_size);
+    IceTSizeType i;
+
+    for (i = 0; i < num_fragments; i++) {
+        store_fragment(color_buffer + i*color_size,
+                       depth_buffer + i*depth_size,
+                       color_format, depth_format,
+                       colors + 4*i, depths[i]);
+    }
+
+    *color_buffer_p = color_buffer;
+    *depth_buffer_p = depth_buffer;
+}
+
+static IceTSparseImage Compress(IceTVoid *color_buffer,
+                                IceTVoid *depth_buffer,
+                                IceTBoolean sort)
+{
+    IceTEnum composite_mode;
+    IceTImage image;
+    IceTSparseImage sparse_image;
+
+    icetGetEnumv(ICET_COMPOSITE_MODE, &composite_mode);
+
+    image = icetLayeredImagePointerAssignBuffer(
+                malloc(icetLayeredImagePointerBufferSize()),
+                SORT_WIDTH, SORT_HEIGHT, SORT_LAYERS,
+                color_buffer, depth_buffer);
+    if (composite_mode == ICET_COMPOSITE_MODE_BLEND) {
+        sparse_image = icetSparseLayeredImageAssignBuffer(
+                    malloc(icetSparseLayeredImageBufferSize(
+                               SORT_WIDTH, SORT_HEIGHT, SORT_LAYERS)),
+                    SORT_WIDTH, SORT_HEIGHT);
+    } else {
+        sparse_image = icetSparseImageAssignBuffer(
+                    malloc(icetSparseImageBufferSize(SORT_WIDTH, SORT_HEIGHT)),
+                    SORT_WIDTH, SORT_HEIGHT);
+    }
+
+    if (sort) {
+        icetEnable(ICET_SORT_INPUT_FRAGMENTS);
+    } else {
+        icetDisable(ICET_SORT_INPUT_FRAGMENTS);
+    }
+    icetCompressImage(image, sparse_image);
+    icetDisable(ICET_SORT_INPUT_FRAGMENTS);
+
+    free(image.opaque_internals);
+    return sparse_image;
+}
+
+static IceTBoolean TryFormat(IceTEnum composite_mode,
+                             IceTEnum color_format,
+                             IceTEnum depth_format)
+{
+    static const IceTInt max_fragments[] = { 0, 5, 1 };
+    const IceTSizeType num_fragments = SORT_WIDTH*SORT_HEIGHT*SORT_LAYERS;
+    IceTFloat *colors, *depths;
+    IceTFloat *sorted_colors, *sorted_depths;
+    IceTVoid *shuffled_color_buffer, *shuffled_depth_buffer;
+    IceTVoid *sorted_color_buffer, *sorted_depth_buffer;
+    IceTBoolean success = ICET_TRUE;
+    int i;
+
+    icetCompositeMode(composite_mode);
+    icetSetColorFormat(color_format);
+    icetSetDepthFormat(depth_format);
+
+    colors = malloc(4*num_fragments*sizeof(IceTFloat));
+    depths = malloc(num_fragments*sizeof(IceTFloat));
+    sorted_colors = malloc(4*num_fragments*sizeof(IceTFloat));
+    sorted_depths = malloc(num_fragments*sizeof(IceTFloat));
+    MakeShuffledFragments(colors, depths);
+    SortFragments(colors, depths, sorted_colors, sorted_depths);
+    ConvertFragments(colors, depths, color_format, depth_format,
+                     &shuffled_color_buffer, &shuffled_depth_buffer);
+    ConvertFragments(sorted_colors, sorted_depths, color_format, depth_format,
+                     &sorted_color_buffer, &sorted_depth_buffer);
+
+    for (i = 0; i < (int)(sizeof(max_fragments)/sizeof(IceTInt)); i++) {
+        IceTSparseImage sorted, shuffled;
+        IceTSizeType size;
+
+        icetMaxFragmentsPerPixel(max_fragments[i]);
+        sorted = Compress(sorted_color_buffer, sorted_depth_buffer,
+                          ICET_FALSE);
+        shuffled = Compress(shuffled_color_buffer, shuffled_depth_buffer,
+                            ICET_TRUE);
+
+        size = icetSparseImageGetCompressedBufferSize(sorted);
+        if (   (icetSparseImageGetCompressedBufferSize(shuffled) != size)
+            || (memcmp(shuffled.opaque_internals, sorted.opaque_internals,
+                       size) != 0) ) {
+            printrank("***** Sorting while compressing differs from sorted"
+                      " input (ICET_MAX_FRAGMENTS_PER_PIXEL %d) *****\n",
+                      max_fragments[i]);
+            success = ICET_FALSE;
+        }
+
+        free(sorted.opaque_internals);
+        free(shuffled.opaque_internals);
+    }
+    icetMaxFragmentsPerPixel(0);
+
+    free(colors);
+    free(depths);
+    free(sorted_colors);
+    free(sorted_depths);
+    free(shuffled_color_buffer);
+    free(shuffled_depth_buffer);
+    free(sorted_color_buffer);
+    free(sorted_depth_buffer);
+
+    return success;
+}
+
+static int LayeredSortRun(void)
+{
+    IceTBoolean success = ICET_TRUE;
+
+    srand(7);
+
+    printstat("Blending RGBA ubyte colors, float depths\n");
+    success &= TryFormat(ICET_COMPOSITE_MODE_BLEND,
+                         ICET_IMAGE_COLOR_RGBA_UBYTE, ICET_IMAGE_DEPTH_FLOAT);
+    printstat("Blending RGBA half colors, float depths\n");
+    success &= TryFormat(ICET_COMPOSITE_MODE_BLEND,
+                         ICET_IMAGE_COLOR_RGBA_HALF, ICET_IMAGE_DEPTH_FLOAT);
+    printstat("Blending RGBA float colors, float depths\n");
+    success &= TryFormat(ICET_COMPOSITE_MODE_BLEND,
+                         ICET_IMAGE_COLOR_RGBA_FLOAT, ICET_IMAGE_DEPTH_FLOAT);
+    printstat("Blending RGBA ubyte colors, 16-bit depths\n");
+    success &= TryFormat(ICET_COMPOSITE_MODE_BLEND,
+                         ICET_IMAGE_COLOR_RGBA_UBYTE, ICET_IMAGE_DEPTH_USHORT);
+    printstat("Z buffer, RGBA float colors, float depths\n");
+    success &= TryFormat(ICET_COMPOSITE_MODE_Z_BUFFER,
+                         ICET_IMAGE_COLOR_RGBA_FLOAT, ICET_IMAGE_DEPTH_FLOAT);
+
+    return (success ? TEST_PASSED : TEST_FAILED);
+}
+
+int LayeredSort(int argc, char *argv[])
+{
+    /* Suppress warning. */
+    (void)argc;
+    (void)argv;
+
+    return run_test(LayeredSortRun);
+}
@@ -0,0 +1,228 @@
+/* -*- c -*- *****************************************************************
+** Tests compositing layered images with the tree single image strategy by
+** comparing its result against that of the radix-k strategy.
+*****************************************************************************/
+
+#include <IceT.h>
+#include <IceTDevCommunication.h>
+#include "test_codes.h"
+#include "test_util.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+
+#define MAX_LAYERS 3
+
+static IceTInt g_num_layers;
+
+static void SetUpTiles(IceTInt tile_dimension)
+{
+    IceTInt tile_index = 0;
+    IceTInt tile_x;
+    IceTInt tile_y;
+
+    icetResetTiles();
+    for (tile_y = 0; tile_y < tile_dimension; tile_y++) {
+        for (tile_x = 0; tile_x < tile_dimension; tile_x++) {
+            icetAddTile(tile_x*SCREEN_WIDTH,
+                        tile_y*SCREEN_HEIGHT,
+                        SCREEN_WIDTH,
+                        SCREEN_HEIGHT,
+                        tile_index);
+            tile_index++;
+        }
+    }
+}
+
+/* Fills the layered buffers with a random number of active fragments per
+ * pixel.  Depths are unique across processes so that the merged fragment
+ * order, and thus the composited image, does not depend on the strategy. */
+static void MakeLayeredBuffers(IceTFloat **color_buffer_p,
+                               IceTFloat **depth_buffer_p)
+{
+    IceTFloat *color_buffer;
+    IceTFloat *depth_buffer;
+    IceTInt global_viewport[4];
+    IceTInt rank;
+    IceTInt num_proc;
+    IceTSizeType num_pixels;
+    IceTSizeType pixel;
+
+    icetGetIntegerv(ICET_GLOBAL_VIEWPORT, global_viewport);
+    icetGetIntegerv(ICET_RANK, &rank);
+    icetGetIntegerv(ICET_NUM_PROCESSES, &num_proc);
+
+    num_pixels = global_viewport[2]*global_viewport[3];
+    color_buffer = malloc(num_pixels*g_num_layers*4*sizeof(IceTFloat));
+    depth_buffer = malloc(num_pixels*g_num_layers*sizeof(IceTFloat));
+
+    for (pixel = 0; pixel < num_pixels; pixel++) {
+        IceTInt num_active = rand()%(g_num_layers + 1);
+        IceTInt layer;
+        for (layer = 0; layer < g_num_layers; layer++) {
+            IceTFloat *color = color_buffer + 4*(pixel*g_num_layers + layer);
+            IceTFloat *depth = depth_buffer + pixel*g_num_layers + layer;
+            if (layer < num_active) {
+                IceTFloat alpha = 0.1f + 0.8f*((IceTFloat)rand()/RAND_MAX);
+                color[0] = alpha*((IceTFloat)rand()/RAND_MAX);
+                color[1] = alpha*((IceTFloat)rand()/RAND_MAX);
+                color[2] = alpha*((IceTFloat)rand()/RAND_MAX);
+                color[3] = alpha;
+                *depth = (layer + (rank + 0.5f)/num_proc)/MAX_LAYERS;
+            } else {
+                color[0] = color[1] = color[2] = color[3] = 0.0f;
+                *depth = 1.0f;
+            }
+        }
+    }
+
+    *color_buffer_p = color_buffer;
+    *depth_buffer_p = depth_buffer;
+}
+
+static IceTImage LayeredTreeComposite(IceTEnum single_image_strategy,
+                                      const IceTFloat *color_buffer,
+                                      const IceTFloat *depth_buffer)
+{
+    IceTFloat background_color[4] = { 0.25f, 0.5f, 0.75f, 1.0f };
+
+    icetSingleImageStrategy(single_image_strategy);
+    printstat("    Using %s single image strategy.\n",
+              icetGetSingleImageStrategyName());
+
+    return icetCompositeImageLayered(color_buffer,
+                                     depth_buffer,
+                                     g_num_layers,
+                                     NULL,
+                                     NULL,
+                                     NULL,
+                                     background_color);
+}
+
+static IceTBoolean LayeredTreeTryStrategy(const IceTFloat *color_buffer,
+                                          const IceTFloat *depth_buffer)
+{
+    IceTImage image;
+    IceTInt tile_displayed;
+    IceTSizeType num_pixels;
+    IceTFloat *radixk_color;
+    const IceTFloat *tree_color;
+    IceTSizeType i;
+    IceTBoolean success = ICET_TRUE;
+
+    image = LayeredTreeComposite(ICET_SINGLE_IMAGE_STRATEGY_RADIXK,
+                                 color_buffer, depth_buffer);
+
+    icetGetIntegerv(ICET_TILE_DISPLAYED, &tile_displayed);
+    num_pixels = (tile_displayed >= 0) ? icetImageGetNumPixels(image) : 0;
+    radixk_color = malloc(4*num_pixels*sizeof(IceTFloat));
+    if (num_pixels > 0) {
+        icetImageCopyColorf(image, radixk_color, ICET_IMAGE_COLOR_RGBA_FLOAT);
+    }
+
+    image = LayeredTreeComposite(ICET_SINGLE_IMAGE_STRATEGY_TREE,
+                                 color_buffer, depth_buffer);
+
+    if (num_pixels > 0) {
+        if (icetImageGetNumPixels(image) != num_pixels) {
+            printrank("***** Images have different sizes! *****\n");
+            success = ICET_FALSE;
+        } else {
+            tree_color = icetImageGetColorcf(image);
+            for (i = 0; i < 4*num_pixels; i++) {
+                if (tree_color[i] != radixk_color[i]) {
+                    printrank("***** Images differ at pixel %d *****\n",
+                              (int)(i/4));
+                    printrank("radix-k: %f, tree: %f\n",
+                              radixk_color[i], tree_color[i]);
+                    success = ICET_FALSE;
+                    break;
+                }
+            }
+        }
+    }
+
+    free(radixk_color);
+
+    return success;
+}
+
+static IceTBoolean LayeredTreeTryTiles(void)
+{
+    IceTBoolean success = ICET_TRUE;
+    IceTInt num_proc;
+    IceTInt tile_dimension;
+
+    icetGetIntegerv(ICET_NUM_PROCESSES, &num_proc);
+
+    for (tile_dimension = 1;
+         (tile_dimension <= 2) && (tile_dimension*tile_dimension <= num_proc);
+         tile_dimension++) {
+        IceTFloat *color_buffer;
+        IceTFloat *depth_buffer;
+
+        printstat("\nUsing %dx%d tiles\n", tile_dimension, tile_dimension);
+
+        SetUpTiles(tile_dimension);
+        MakeLayeredBuffers(&color_buffer, &depth_buffer);
+
+        icetStrategy(ICET_STRATEGY_SEQUENTIAL);
+        printstat("  Using %s strategy.\n", icetGetStrategyName());
+        success &= LayeredTreeTryStrategy(color_buffer, depth_buffer);
+
+        icetStrategy(ICET_STRATEGY_REDUCE);
+        printstat("  Using %s strategy.\n", icetGetStrategyName());
+        success &= LayeredTreeTryStrategy(color_buffer, depth_buffer);
+
+        free(color_buffer);
+        free(depth_buffer);
+    }
+
+    return success;
+}
+
+static int LayeredTreeRun(void)
+{
+    IceTInt rank;
+    IceTInt num_proc;
+    unsigned int seed;
+
+    icetGetIntegerv(ICET_RANK, &rank);
+    icetGetIntegerv(ICET_NUM_PROCESSES, &num_proc);
+
+    /* Establish a random seed. */
+    if (rank == 0) {
+        IceTInt remote_process;
+
+        seed = (int)time(NULL);
+        printstat("Base seed = %u\n", seed);
+        srand(seed);
+
+        for (remote_process = 1; remote_process < num_proc; remote_process++) {
+            icetCommSend(&seed, 1, ICET_INT, remote_process, 29);
+        }
+    } else {
+        icetCommRecv(&seed, 1, ICET_INT, 0, 29);
+        srand(seed + rank);
+    }
+
+    /* The number of layers may differ between processes. */
+    g_num_layers = 1 + rank%MAX_LAYERS;
+
+    icetSetColorFormat(ICET_IMAGE_COLOR_RGBA_FLOAT);
+    icetSetDepthFormat(ICET_IMAGE_DEPTH_FLOAT);
+    icetCompositeMode(ICET_COMPOSITE_MODE_BLEND);
+    icetDisable(ICET_ORDERED_COMPOSITE);
+
+    return (LayeredTreeTryTiles() ? TEST_PASSED : TEST_FAILED);
+}
+
+int LayeredTree(int argc, char *argv[])
+{
+    /* Suppress warning. */
+    (void)argc;
+    (void)argv;
+
+    return run_test(LayeredTreeRun);
+}
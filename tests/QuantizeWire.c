@@ -0,0 +1,291 @@
+/* -*- c -*- *****************************************************************
+** Checks that ICET_QUANTIZE_WIRE_COLORS sends RGBA float colors with 8 bits
+** per channel.  Composited colors must stay within half a step of 1/255 of
+** those sent unquantized, or one step per fragment once fragments are
+** blended, and must differ by less than half a step on average.  Depths must
+** be unchanged, and colors in formats that are not quantized must come
+** through bit for bit.  The sequential and reduce strategies are run with
+** every single image strategy, both for regular images composited with a
+** z-buffer and for blended layered images.
+*****************************************************************************/
+
+#include <IceT.h>
+#include <IceTDevImage.h>
+#include "test_codes.h"
+#include "test_util.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#define NUM_LAYERS      3
+
+/* Fills buffers of num_layers fragments per pixel with random colors in the
+ * given format and float depths.  Each pixel holds a random number of active
+ * fragments sorted front to back.  Depths interleave the layers of all
+ * processes. */
+static void MakeBuffers(IceTEnum color_format,
+                        IceTInt num_layers,
+                        IceTByte *color_buffer,
+                        IceTFloat *depth_buffer)
+{
+    const IceTSizeType num_pixels = SCREEN_WIDTH*SCREEN_HEIGHT;
+    const IceTSizeType color_size = color_pixel_size(color_format);
+    IceTInt rank;
+    IceTInt num_proc;
+    IceTSizeType pixel;
+
+    icetGetIntegerv(ICET_RANK, &rank);
+    icetGetIntegerv(ICET_NUM_PROCESSES, &num_proc);
+
+    for (pixel = 0; pixel < num_pixels; pixel++) {
+        IceTInt num_active = rand()%(num_layers + 1);
+        IceTInt layer;
+        for (layer = 0; layer < num_layers; layer++) {
+            IceTSizeType fragment = pixel*num_layers + layer;
+            IceTFloat depth = (layer*num_proc + rank + random_float())
+                              /(num_layers*num_proc);
+            store_random_fragment(color_buffer + fragment*color_size,
+                                  depth_buffer + fragment,
+                                  color_format, ICET_IMAGE_DEPTH_FLOAT,
+                                  layer < num_active, depth);
+        }
+    }
+}
+
+/* Composites the buffers and copies the colors and depths of the displayed
+ * tile into the results. */
+static void Composite(IceTBoolean quantize,
+                      IceTBoolean layered,
+                      const IceTByte *color_buffer,
+                      const IceTFloat *depth_buffer,
+                      IceTByte *color_result,
+                      IceTFloat *depth_result)
+{
+    IceTFloat background_color[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    IceTImage image;
+    IceTInt tile_displayed;
+
+    if (quantize) {
+        icetEnable(ICET_QUANTIZE_WIRE_COLORS);
+    } else {
+        icetDisable(ICET_QUANTIZE_WIRE_COLORS);
+    }
+    if (layered) {
+        image = icetCompositeImageLayered(color_buffer,
+                                          depth_buffer,
+                                          NUM_LAYERS,
+                                          NULL,
+                                          NULL,
+                                          NULL,
+                                          background_color);
+    } else {
+        image = icetCompositeImage(color_buffer,
+                                   depth_buffer,
+                                   NULL,
+                                   NULL,
+                                   NULL,
+                                   background_color);
+    }
+    icetDisable(ICET_QUANTIZE_WIRE_COLORS);
+
+    icetGetIntegerv(ICET_TILE_DISPLAYED, &tile_displayed);
+    if (tile_displayed >= 0) {
+        IceTSizeType num_pixels = icetImageGetNumPixels(image);
+        IceTSizeType color_size;
+        const IceTVoid *color = icetImageGetColorConstVoid(image, &color_size);
+        memcpy(color_result, color, num_pixels*color_size);
+        if (icetImageGetDepthFormat(image) != ICET_IMAGE_DEPTH_NONE) {
+            memcpy(depth_result,
+                   icetImageGetDepthcf(image),
+                   num_pixels*sizeof(IceTFloat));
+        }
+    }
+}
+
+/* Compares colors composited with and without quantization.  RGBA float colors
+ * may differ by the given tolerance and by half a step on average, all other
+ * formats must match. */
+static IceTBoolean CompareColors(IceTEnum color_format,
+                                 IceTFloat tolerance,
+                                 const IceTByte *plain_colors,
+                                 const IceTByte *quantized_colors)
+{
+    const IceTSizeType num_pixels = SCREEN_WIDTH*SCREEN_HEIGHT;
+    IceTInt num_proc;
+    IceTSizeType i;
+    IceTBoolean changed = ICET_FALSE;
+    double total_error = 0.0;
+
+    if (color_format != ICET_IMAGE_COLOR_RGBA_FLOAT) {
+        if (memcmp(plain_colors,
+                   quantized_colors,
+                   num_pixels*color_pixel_size(color_format)) != 0) {
+            printrank("***** Colors that cannot be quantized changed"
+                      " *****\n");
+            return ICET_FALSE;
+        }
+        return ICET_TRUE;
+    }
+
+    for (i = 0; i < 4*num_pixels; i++) {
+        IceTFloat plain = ((const IceTFloat *)plain_colors)[i];
+        IceTFloat quantized = ((const IceTFloat *)quantized_colors)[i];
+        if (fabs(quantized - plain) > tolerance) {
+            printrank("***** Pixel %d is %f after quantizing, expected %f"
+                      " *****\n", (int)(i/4), quantized, plain);
+            return ICET_FALSE;
+        }
+        if (quantized != plain) changed = ICET_TRUE;
+        total_error += fabs(quantized - plain);
+    }
+
+    if (total_error/(4*num_pixels) > 0.5/255.0) {
+        printrank("***** Quantized colors are off by %f steps on average"
+                  " *****\n", 255.0*total_error/(4*num_pixels));
+        return ICET_FALSE;
+    }
+
+    /* Colors from other processes must have been quantized on the way. */
+    icetGetIntegerv(ICET_NUM_PROCESSES, &num_proc);
+    if ((num_proc > 1) && !changed) {
+        printrank("***** No colors were quantized *****\n");
+        return ICET_FALSE;
+    }
+
+    return ICET_TRUE;
+}
+
+static IceTBoolean TryFormat(IceTEnum composite_mode, IceTEnum color_format)
+{
+    static const IceTEnum strategies[] = {
+        ICET_STRATEGY_SEQUENTIAL,
+        ICET_STRATEGY_REDUCE
+    };
+    static const IceTEnum single_image_strategies[] = {
+        ICET_SINGLE_IMAGE_STRATEGY_BSWAP,
+        ICET_SINGLE_IMAGE_STRATEGY_TREE,
+        ICET_SINGLE_IMAGE_STRATEGY_RADIXK,
+        ICET_SINGLE_IMAGE_STRATEGY_RADIXKR
+    };
+    const IceTSizeType num_pixels = SCREEN_WIDTH*SCREEN_HEIGHT;
+    const IceTBoolean layered = (composite_mode == ICET_COMPOSITE_MODE_BLEND);
+    const IceTInt num_layers = layered ? NUM_LAYERS : 1;
+    IceTInt num_proc;
+    IceTFloat tolerance;
+    IceTByte *color_buffer;
+    IceTFloat *depth_buffer;
+    IceTByte *plain_colors, *quantized_colors;
+    IceTFloat *plain_depths, *quantized_depths;
+    IceTInt tile_displayed;
+    IceTBoolean success = ICET_TRUE;
+    int i, j;
+
+    /* Each color sent is rounded to the nearest of 256 steps.  Blending is
+       linear in the color and the alpha of each fragment with weights of at
+       most one, so each fragment may move the result by up to a step. */
+    icetGetIntegerv(ICET_NUM_PROCESSES, &num_proc);
+    if (layered) {
+        tolerance = (IceTFloat)(num_layers*num_proc)/255.0f + 1e-5f;
+    } else {
+        tolerance = 0.5f/255.0f + 1e-5f;
+    }
+
+    icetCompositeMode(composite_mode);
+    icetSetColorFormat(color_format);
+    icetSetDepthFormat(ICET_IMAGE_DEPTH_FLOAT);
+
+    color_buffer = malloc(num_pixels*num_layers*color_pixel_size(color_format));
+    depth_buffer = malloc(num_pixels*num_layers*sizeof(IceTFloat));
+    MakeBuffers(color_format, num_layers, color_buffer, depth_buffer);
+    plain_colors = malloc(num_pixels*color_pixel_size(color_format));
+    quantized_colors = malloc(num_pixels*color_pixel_size(color_format));
+    plain_depths = malloc(num_pixels*sizeof(IceTFloat));
+    quantized_depths = malloc(num_pixels*sizeof(IceTFloat));
+
+    for (i = 0; i < (int)(sizeof(strategies)/sizeof(IceTEnum)); i++) {
+        icetStrategy(strategies[i]);
+        for (j = 0;
+             j < (int)(sizeof(single_image_strategies)/sizeof(IceTEnum));
+             j++) {
+            icetSingleImageStrategy(single_image_strategies[j]);
+            printstat("  Strategy %s, %s\n",
+                      icetGetStrategyName(),
+                      icetGetSingleImageStrategyName());
+
+            memset(plain_depths, 0, num_pixels*sizeof(IceTFloat));
+            memset(quantized_depths, 0, num_pixels*sizeof(IceTFloat));
+            Composite(ICET_FALSE, layered, color_buffer, depth_buffer,
+                      plain_colors, plain_depths);
+            Composite(ICET_TRUE, layered, color_buffer, depth_buffer,
+                      quantized_colors, quantized_depths);
+
+            icetGetIntegerv(ICET_TILE_DISPLAYED, &tile_displayed);
+            if (tile_displayed < 0) continue;
+
+            success &= CompareColors(color_format,
+                                     tolerance,
+                                     plain_colors,
+                                     quantized_colors);
+            if (memcmp(plain_depths,
+                       quantized_depths,
+                       num_pixels*sizeof(IceTFloat)) != 0) {
+                printrank("***** Quantizing colors changed depths *****\n");
+                success = ICET_FALSE;
+            }
+        }
+    }
+
+    free(color_buffer);
+    free(depth_buffer);
+    free(plain_colors);
+    free(quantized_colors);
+    free(plain_depths);
+    free(quantized_depths);
+
+    return success;
+}
+
+static int QuantizeWireRun(void)
+{
+    IceTInt rank;
+    IceTBoolean success = ICET_TRUE;
+
+    icetGetIntegerv(ICET_RANK, &rank);
+    srand(31 + rank);
+
+    icetResetTiles();
+    icetAddTile(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT, 0);
+    icetDisable(ICET_ORDERED_COMPOSITE);
+
+    printstat("Z buffer, RGBA float colors\n");
+    success &= TryFormat(ICET_COMPOSITE_MODE_Z_BUFFER,
+                         ICET_IMAGE_COLOR_RGBA_FLOAT);
+    printstat("Blended layers, RGBA float colors\n");
+    success &= TryFormat(ICET_COMPOSITE_MODE_BLEND,
+                         ICET_IMAGE_COLOR_RGBA_FLOAT);
+    printstat("Z buffer, RGBA ubyte colors\n");
+    success &= TryFormat(ICET_COMPOSITE_MODE_Z_BUFFER,
+                         ICET_IMAGE_COLOR_RGBA_UBYTE);
+    printstat("Z buffer, RGB float colors\n");
+    success &= TryFormat(ICET_COMPOSITE_MODE_Z_BUFFER,
+                         ICET_IMAGE_COLOR_RGB_FLOAT);
+    printstat("Blended layers, RGBA ubyte colors\n");
+    success &= TryFormat(ICET_COMPOSITE_MODE_BLEND,
+                         ICET_IMAGE_COLOR_RGBA_UBYTE);
+    printstat("Blended layers, RGBA half colors\n");
+    success &= TryFormat(ICET_COMPOSITE_MODE_BLEND,
+                         ICET_IMAGE_COLOR_RGBA_HALF);
+
+    return (success ? TEST_PASSED : TEST_FAILED);
+}
+
+int QuantizeWire(int argc, char *argv[])
+{
+    /* Suppress warning. */
+    (void)argc;
+    (void)argv;
+
+    return run_test(QuantizeWireRun);
+}
@@ -0,0 +1,350 @@
+/* -*- c -*- *****************************************************************
+** Checks that the run length index of ICET_SPARSE_IMAGE_INDEX gives exactly
+** the same results as scanning the run lengths.  Sparse images with numbers
+** of runs just below and above multiples of the index stride are copied from
+** every pixel and interlaced into many partitions with and without the
+** index.  Packaging an image for sending must strip the index, so the sent
+** buffers must match too, and compositing with every strategy must give the
+** same image whether or not the index is built.
+*****************************************************************************/
+
+#include <IceT.h>
+#include <IceTDevImage.h>
+#include "test_codes.h"
+#include "test_util.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Matches the stride of the index in image.c. */
+#define INDEX_STRIDE    32
+
+/* Returns the lengths of the inactive and active pixels of a run. */
+static IceTSizeType RunInactive(IceTInt run) { return 1 + run%3; }
+static IceTSizeType RunActive(IceTInt run) { return 1 + (run*7)%5; }
+
+static IceTSizeType RunsNumPixels(IceTInt num_runs)
+{
+    IceTSizeType num_pixels = 0;
+    IceTInt run;
+
+    for (run = 0; run < num_runs; run++) {
+        num_pixels += RunInactive(run) + RunActive(run);
+    }
+    return num_pixels;
+}
+
+/* Fills a one row image so that it compresses to num_runs run lengths. */
+static void RunsImage(IceTImage image, IceTInt num_runs)
+{
+    IceTUInt *color = icetImageGetColorui(image);
+    IceTFloat *depth = NULL;
+    IceTSizeType pixel = 0;
+    IceTInt run;
+
+    if (icetImageGetDepthFormat(image) == ICET_IMAGE_DEPTH_FLOAT) {
+        depth = icetImageGetDepthf(image);
+    }
+
+    for (run = 0; run < num_runs; run++) {
+        IceTSizeType i;
+        for (i = 0; i < RunInactive(run); i++, pixel++) {
+            color[pixel] = 0;
+            if (depth) depth[pixel] = 1.0f;
+        }
+        for (i = 0; i < RunActive(run); i++, pixel++) {
+            color[pixel] = 0xFF000000u | (IceTUInt)(pixel*2654435761u >> 8);
+            if (depth) depth[pixel] = 0.5f;
+        }
+    }
+}
+
+/* Compares two sparse images as they would be sent. */
+static IceTBoolean SparseImagesMatch(IceTSparseImage image0,
+                                     IceTSparseImage image1)
+{
+    IceTVoid *buffer0;
+    IceTVoid *buffer1;
+    IceTSizeType size0;
+    IceTSizeType size1;
+
+    icetSparseImagePackageForSend(image0, &buffer0, &size0);
+    icetSparseImagePackageForSend(image1, &buffer1, &size1);
+
+    return (size0 == size1) && (memcmp(buffer0, buffer1, size0) == 0);
+}
+
+static IceTBoolean TryNumRuns(IceTInt num_runs)
+{
+    static const IceTInt num_partitions_list[] = { 2, 3, 7, 32, 100, 256 };
+    const IceTSizeType num_pixels = RunsNumPixels(num_runs);
+    IceTVoid *image_buffer;
+    IceTImage image;
+    IceTVoid *plain_buffer;
+    IceTSparseImage plain;
+    IceTVoid *indexed_buffer;
+    IceTSparseImage indexed;
+    IceTVoid *plain_out_buffer;
+    IceTSparseImage plain_out;
+    IceTVoid *indexed_out_buffer;
+    IceTSparseImage indexed_out;
+    IceTSizeType start;
+    int i;
+    IceTBoolean success = ICET_TRUE;
+
+    printstat("  %d runs in %d pixels\n", num_runs, (int)num_pixels);
+
+    image_buffer = malloc(icetImageBufferSize(num_pixels, 1));
+    image = icetImageAssignBuffer(image_buffer, num_pixels, 1);
+    RunsImage(image, num_runs);
+
+    plain_buffer = malloc(icetSparseImageBufferSize(num_pixels, 1));
+    plain = icetSparseImageAssignBuffer(plain_buffer, num_pixels, 1);
+    indexed_buffer = malloc(icetSparseImageBufferSize(num_pixels, 1));
+    indexed = icetSparseImageAssignBuffer(indexed_buffer, num_pixels, 1);
+    plain_out_buffer = malloc(icetSparseImageBufferSize(num_pixels, 1));
+    plain_out = icetSparseImageAssignBuffer(plain_out_buffer, num_pixels, 1);
+    indexed_out_buffer = malloc(icetSparseImageBufferSize(num_pixels, 1));
+    indexed_out = icetSparseImageAssignBuffer(indexed_out_buffer,
+                                              num_pixels, 1);
+
+    icetDisable(ICET_SPARSE_IMAGE_INDEX);
+    icetCompressImage(image, plain);
+    icetEnable(ICET_SPARSE_IMAGE_INDEX);
+    icetCompressImage(image, indexed);
+    icetDisable(ICET_SPARSE_IMAGE_INDEX);
+
+    for (start = 0; (start < num_pixels) && success; start++) {
+        const IceTSizeType lengths[3] = { 1, 9, num_pixels - start };
+        int j;
+        for (j = 0; j < 3; j++) {
+            IceTSizeType length = lengths[j];
+            if (start + length > num_pixels) continue;
+            icetSparseImageCopyPixels(plain, start, length, plain_out);
+            icetSparseImageCopyPixels(indexed, start, length, indexed_out);
+            if (!SparseImagesMatch(plain_out, indexed_out)) {
+                printrank("***** Copying %d pixels from %d differs with the"
+                          " index *****\n", (int)length, (int)start);
+                success = ICET_FALSE;
+                break;
+            }
+        }
+    }
+
+    for (i = 0;
+         i < (int)(sizeof(num_partitions_list)/sizeof(IceTInt)) && success;
+         i++) {
+        IceTInt num_partitions = num_partitions_list[i];
+        if (num_partitions > num_pixels) continue;
+        icetSparseImageInterlace(plain,
+                                 num_partitions,
+                                 ICET_SI_STRATEGY_BUFFER_0,
+                                 plain_out);
+        icetSparseImageInterlace(indexed,
+                                 num_partitions,
+                                 ICET_SI_STRATEGY_BUFFER_0,
+                                 indexed_out);
+        if (!SparseImagesMatch(plain_out, indexed_out)) {
+            printrank("***** Interlacing for %d partitions differs with the"
+                      " index *****\n", num_partitions);
+            success = ICET_FALSE;
+        }
+    }
+
+    /* Packaging strips the index, so the images must be sent identically. */
+    if (success && !SparseImagesMatch(plain, indexed)) {
+        printrank("***** Indexed image is not stripped for sending *****\n");
+        success = ICET_FALSE;
+    }
+
+    free(image_buffer);
+    free(plain_buffer);
+    free(indexed_buffer);
+    free(plain_out_buffer);
+    free(indexed_out_buffer);
+
+    return success;
+}
+
+static IceTBoolean TryFormat(IceTEnum composite_mode,
+                             IceTEnum depth_format)
+{
+    static const IceTInt num_runs_list[] = {
+        1,
+        INDEX_STRIDE - 1, INDEX_STRIDE, INDEX_STRIDE + 1,
+        2*INDEX_STRIDE - 1, 2*INDEX_STRIDE, 2*INDEX_STRIDE + 1,
+        8*INDEX_STRIDE + 1
+    };
+    IceTBoolean success = ICET_TRUE;
+    int i;
+
+    icetCompositeMode(composite_mode);
+    icetSetColorFormat(ICET_IMAGE_COLOR_RGBA_UBYTE);
+    icetSetDepthFormat(depth_format);
+
+    for (i = 0; i < (int)(sizeof(num_runs_list)/sizeof(IceTInt)); i++) {
+        success &= TryNumRuns(num_runs_list[i]);
+    }
+
+    return success;
+}
+
+/* Fills buffers with diagonal stripes that differ on each process. */
+static void StripesBuffers(IceTUByte *color_buffer, IceTFloat *depth_buffer)
+{
+    IceTInt rank;
+    IceTSizeType x, y;
+
+    icetGetIntegerv(ICET_RANK, &rank);
+
+    for (y = 0; y < SCREEN_HEIGHT; y++) {
+        for (x = 0; x < SCREEN_WIDTH; x++) {
+            IceTSizeType pixel = y*SCREEN_WIDTH + x;
+            IceTUByte *color = color_buffer + 4*pixel;
+            if ((x + 3*y + 5*rank)%7 < 3) {
+                color[0] = (IceTUByte)(x + rank);
+                color[1] = (IceTUByte)y;
+                color[2] = (IceTUByte)(64*rank);
+                color[3] = 255;
+                depth_buffer[pixel] = 0.01f*((x + 2*y + rank)%97);
+            } else {
+                color[0] = color[1] = color[2] = color[3] = 0;
+                depth_buffer[pixel] = 1.0f;
+            }
+        }
+    }
+}
+
+/* Composites the buffers and copies the colors of the displayed tile into
+   result.  Returns false if IceT raised an error. */
+static IceTBoolean Composite(IceTBoolean use_index,
+                             const IceTUByte *color_buffer,
+                             const IceTFloat *depth_buffer,
+                             IceTUByte *result)
+{
+    IceTFloat background_color[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    IceTImage image;
+    IceTInt tile_displayed;
+
+    if (use_index) {
+        icetEnable(ICET_SPARSE_IMAGE_INDEX);
+    } else {
+        icetDisable(ICET_SPARSE_IMAGE_INDEX);
+    }
+    image = icetCompositeImage(color_buffer,
+                               depth_buffer,
+                               NULL,
+                               NULL,
+                               NULL,
+                               background_color);
+    icetDisable(ICET_SPARSE_IMAGE_INDEX);
+
+    if (icetGetError() != ICET_NO_ERROR) return ICET_FALSE;
+
+    icetGetIntegerv(ICET_TILE_DISPLAYED, &tile_displayed);
+    if (tile_displayed >= 0) {
+        memcpy(result,
+               icetImageGetColorcub(image),
+               4*SCREEN_WIDTH*SCREEN_HEIGHT);
+    }
+    return ICET_TRUE;
+}
+
+static IceTBoolean TryStrategies(void)
+{
+    const IceTSizeType num_pixels = SCREEN_WIDTH*SCREEN_HEIGHT;
+    IceTUByte *color_buffer;
+    IceTFloat *depth_buffer;
+    IceTUByte *plain_result;
+    IceTUByte *indexed_result;
+    IceTBoolean success = ICET_TRUE;
+    int strategy_index;
+
+    icetResetTiles();
+    icetAddTile(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT, 0);
+    icetCompositeMode(ICET_COMPOSITE_MODE_Z_BUFFER);
+    icetSetColorFormat(ICET_IMAGE_COLOR_RGBA_UBYTE);
+    icetSetDepthFormat(ICET_IMAGE_DEPTH_FLOAT);
+    icetDisable(ICET_ORDERED_COMPOSITE);
+
+    color_buffer = malloc(4*num_pixels);
+    depth_buffer = malloc(num_pixels*sizeof(IceTFloat));
+    plain_result = malloc(4*num_pixels);
+    indexed_result = malloc(4*num_pixels);
+    StripesBuffers(color_buffer, depth_buffer);
+
+    for (strategy_index = 0;
+         strategy_index < STRATEGY_LIST_SIZE;
+         strategy_index++) {
+        IceTEnum strategy = strategy_list[strategy_index];
+        int single_image_strategy_index;
+        int num_single_image_strategy;
+
+        icetStrategy(strategy);
+        if (strategy_uses_single_image_strategy(strategy)) {
+            num_single_image_strategy = SINGLE_IMAGE_STRATEGY_LIST_SIZE;
+        } else {
+            num_single_image_strategy = 1;
+        }
+
+        for (single_image_strategy_index = 0;
+             single_image_strategy_index < num_single_image_strategy;
+             single_image_strategy_index++) {
+            IceTInt tile_displayed;
+
+            icetSingleImageStrategy(
+                single_image_strategy_list[single_image_strategy_index]);
+            printstat("  Strategy %s, %s\n",
+                      icetGetStrategyName(),
+                      icetGetSingleImageStrategyName());
+
+            if (   !Composite(ICET_FALSE,
+                              color_buffer, depth_buffer, plain_result)
+                || !Composite(ICET_TRUE,
+                              color_buffer, depth_buffer, indexed_result) ) {
+                printrank("***** Compositing raised an error *****\n");
+                success = ICET_FALSE;
+                continue;
+            }
+
+            icetGetIntegerv(ICET_TILE_DISPLAYED, &tile_displayed);
+            if (   (tile_displayed >= 0)
+                && (memcmp(plain_result, indexed_result, 4*num_pixels) != 0)) {
+                printrank("***** Compositing with the index gives a different"
+                          " image *****\n");
+                success = ICET_FALSE;
+            }
+        }
+    }
+
+    free(color_buffer);
+    free(depth_buffer);
+    free(plain_result);
+    free(indexed_result);
+
+    return success;
+}
+
+static int SparseImageIndexRun(void)
+{
+    IceTBoolean success = ICET_TRUE;
+
+    printstat("Blended colors\n");
+    success &= TryFormat(ICET_COMPOSITE_MODE_BLEND, ICET_IMAGE_DEPTH_NONE);
+    printstat("Z buffer, float depths\n");
+    success &= TryFormat(ICET_COMPOSITE_MODE_Z_BUFFER, ICET_IMAGE_DEPTH_FLOAT);
+    printstat("Compositing\n");
+    success &= TryStrategies();
+
+    return (success ? TEST_PASSED : TEST_FAILED);
+}
+
+int SparseImageIndex(int argc, char *argv[])
+{
+    /* Suppress warning. */
+    (void)argc;
+    (void)argv;
+
+    return run_test(SparseImageIndexRun);
+}
@@ -0,0 +1,198 @@
+/* -*- c -*- *****************************************************************
+** Checks that splitting images into partitions with equal numbers of
+** fragments (ICET_SPLIT_BALANCE_FRAGMENTS) gives the same composited image as
+** splitting them into partitions with equal numbers of pixels.  Most
+** fragments lie in a band at the bottom of the image and in the images of
+** the first processes, so balanced partitions differ greatly from equal ones.
+** Binary swap, radix-k and radix-kr are each run with and without image
+** interlacing, which balancing suspends without changing the enable state.
+*****************************************************************************/
+
+#include <IceT.h>
+#include "test_codes.h"
+#include "test_util.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#define MAX_LAYERS      8
+
+/* Pixels in the bottom eighth of the image have up to MAX_LAYERS fragments
+ * on the first half of the processes.  All other pixels have at most one. */
+static IceTInt Fragments(IceTInt rank,
+                         IceTInt num_proc,
+                         IceTSizeType pixel,
+                         IceTFloat (*colors)[4],
+                         IceTFloat *depths)
+{
+    IceTInt num_active;
+    IceTInt layer;
+
+    if (   (pixel < SCREEN_WIDTH*SCREEN_HEIGHT/8)
+        && (rank <= (num_proc - 1)/2) ) {
+        num_active = layered_num_active(rank, pixel, MAX_LAYERS);
+    } else {
+        num_active = (hash_float(rank, pixel, 0) < 0.25f) ? 1 : 0;
+    }
+
+    for (layer = 0; layer < num_active; layer++) {
+        layered_fragment_color(rank, pixel, layer, 0.1f, 0.9f, colors[layer]);
+        depths[layer] = layered_fragment_depth(rank, layer, num_proc,
+                                               MAX_LAYERS);
+    }
+
+    return num_active;
+}
+
+/* Composites the layered buffers and copies the colors of the displayed tile
+ * into result, if this process displays it. */
+static void Composite(const IceTFloat *color_buffer,
+                      const IceTFloat *depth_buffer,
+                      IceTFloat *result)
+{
+    IceTFloat background_color[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    IceTImage image;
+    IceTInt tile_displayed;
+
+    image = icetCompositeImageLayered(color_buffer,
+                                      depth_buffer,
+                                      MAX_LAYERS,
+                                      NULL,
+                                      NULL,
+                                      NULL,
+                                      background_color);
+
+    icetGetIntegerv(ICET_TILE_DISPLAYED, &tile_displayed);
+    if (tile_displayed >= 0) {
+        icetImageCopyColorf(image, result, ICET_IMAGE_COLOR_RGBA_FLOAT);
+    }
+}
+
+static IceTBoolean TryStrategy(const IceTFloat *color_buffer,
+                               const IceTFloat *depth_buffer,
+                               IceTBoolean interlace)
+{
+    const IceTSizeType num_pixels = SCREEN_WIDTH*SCREEN_HEIGHT;
+    IceTInt num_proc;
+    IceTFloat *equal_result;
+    IceTFloat *balanced_result;
+    IceTInt tile_displayed;
+    IceTBoolean success = ICET_TRUE;
+
+    icetGetIntegerv(ICET_NUM_PROCESSES, &num_proc);
+
+    equal_result = malloc(4*num_pixels*sizeof(IceTFloat));
+    balanced_result = malloc(4*num_pixels*sizeof(IceTFloat));
+
+    if (interlace) {
+        icetEnable(ICET_INTERLACE_IMAGES);
+    } else {
+        icetDisable(ICET_INTERLACE_IMAGES);
+    }
+
+    icetDisable(ICET_SPLIT_BALANCE_FRAGMENTS);
+    Composite(color_buffer, depth_buffer, equal_result);
+    icetEnable(ICET_SPLIT_BALANCE_FRAGMENTS);
+    Composite(color_buffer, depth_buffer, balanced_result);
+    icetDisable(ICET_SPLIT_BALANCE_FRAGMENTS);
+
+    if (icetIsEnabled(ICET_INTERLACE_IMAGES) != interlace) {
+        printrank("***** Balanced compositing changed"
+                  " ICET_INTERLACE_IMAGES *****\n");
+        success = ICET_FALSE;
+    }
+
+    icetGetIntegerv(ICET_TILE_DISPLAYED, &tile_displayed);
+    if (tile_displayed >= 0) {
+        IceTSizeType pixel;
+
+        if (memcmp(equal_result, balanced_result,
+                   4*num_pixels*sizeof(IceTFloat)) != 0) {
+            printrank("***** Balanced partitions give a different image"
+                      " *****\n");
+            success = ICET_FALSE;
+        }
+
+        for (pixel = 0; pixel < num_pixels; pixel++) {
+            IceTFloat expected[4];
+            int channel;
+            reference_pixel(Fragments, num_proc, MAX_LAYERS, pixel, 0.0f,
+                            expected);
+            for (channel = 0; channel < 4; channel++) {
+                if (fabs(balanced_result[4*pixel + channel] - expected[channel])
+                    > 1e-5f) {
+                    printrank("***** Pixel %d differs from the reference:"
+                              " %f instead of %f *****\n",
+                              (int)pixel,
+                              balanced_result[4*pixel + channel],
+                              expected[channel]);
+                    success = ICET_FALSE;
+                    break;
+                }
+            }
+            if (!success) break;
+        }
+    }
+
+    free(equal_result);
+    free(balanced_result);
+
+    return success;
+}
+
+static int SplitBalanceRun(void)
+{
+    static const IceTEnum strategies[] = {
+        ICET_SINGLE_IMAGE_STRATEGY_BSWAP,
+        ICET_SINGLE_IMAGE_STRATEGY_RADIXK,
+        ICET_SINGLE_IMAGE_STRATEGY_RADIXKR
+    };
+    IceTInt rank;
+    IceTInt num_proc;
+    IceTVoid *color_buffer;
+    IceTVoid *depth_buffer;
+    IceTBoolean success = ICET_TRUE;
+    int i;
+
+    icetGetIntegerv(ICET_RANK, &rank);
+    icetGetIntegerv(ICET_NUM_PROCESSES, &num_proc);
+
+    icetResetTiles();
+    icetAddTile(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT, 0);
+    icetStrategy(ICET_STRATEGY_REDUCE);
+    icetCompositeMode(ICET_COMPOSITE_MODE_BLEND);
+    icetDisable(ICET_ORDERED_COMPOSITE);
+    icetSetColorFormat(ICET_IMAGE_COLOR_RGBA_FLOAT);
+    icetSetDepthFormat(ICET_IMAGE_DEPTH_FLOAT);
+
+    make_layered_buffers(Fragments, rank, num_proc,
+                         SCREEN_WIDTH*SCREEN_HEIGHT, MAX_LAYERS,
+                         ICET_IMAGE_COLOR_RGBA_FLOAT, ICET_IMAGE_DEPTH_FLOAT,
+                         &color_buffer, &depth_buffer);
+
+    for (i = 0; i < (int)(sizeof(strategies)/sizeof(IceTEnum)); i++) {
+        icetSingleImageStrategy(strategies[i]);
+        printstat("Strategy %s, not interlaced\n",
+                  icetGetSingleImageStrategyName());
+        success &= TryStrategy(color_buffer, depth_buffer, ICET_FALSE);
+        printstat("Strategy %s, interlaced\n",
+                  icetGetSingleImageStrategyName());
+        success &= TryStrategy(color_buffer, depth_buffer, ICET_TRUE);
+    }
+
+    free(color_buffer);
+    free(depth_buffer);
+
+    return (success ? TEST_PASSED : TEST_FAILED);
+}
+
+int SplitBalance(int argc, char *argv[])
+{
+    /* Suppress warning. */
+    (void)argc;
+    (void)argv;
+
+    return run_test(SplitBalanceRun);
+}
@@ -0,0 +1,447 @@
+/* -*- c -*- *****************************************************************
+** Checks that ICET_TEMPORAL_DELTA composites exactly the image of a full
+** composite over several frames in which small squares move on some of the
+** processes.  The patched image of the display node is compared with the
+** image of a second context that composites every frame in full, and the
+** ranges in ICET_CHANGED_PIXELS_RANGES must cover the pixels that changed on
+** any process with fewer pixels than the smallest single range could.  Both
+** z-buffer compositing and ordered blending are checked, as well as the
+** warning raised when the option cannot be used.
+*****************************************************************************/
+
+#include <IceT.h>
+#include <IceTDevContext.h>
+#include <IceTDevImage.h>
+#include "test_codes.h"
+#include "test_util.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#define DELTA_WIDTH     96
+#define DELTA_HEIGHT    64
+#define NUM_FRAMES      8
+
+/* Returns whether the square of a process moves in a frame.  Nothing moves in
+ * the second frame, so it must not composite any pixels. */
+static IceTBoolean SquareMoves(IceTInt rank, IceTInt frame)
+{
+    return (frame >= 2) && ((frame + rank)%3 == 0);
+}
+
+/* Computes a pixel of the image a process renders in a frame.  Each process
+ * has a static rectangle overlapping those of the others and a small square
+ * in front of it that moves diagonally whenever SquareMoves says so.  Colors
+ * are premultiplied with half opacity when blending. */
+static void RenderPixel(IceTInt rank,
+                        IceTInt frame,
+                        IceTBoolean blend,
+                        IceTSizeType x,
+                        IceTSizeType y,
+                        IceTUByte color[4],
+                        IceTFloat *depth)
+{
+    IceTInt shift = 0;
+    IceTSizeType square_x, square_y;
+    IceTInt f;
+
+    for (f = 1; f <= frame; f++) {
+        if (SquareMoves(rank, f)) shift++;
+    }
+    square_x = 8 + 4*rank + 2*shift;
+    square_y = 8 + 3*rank + shift;
+
+    if (   (x >= square_x) && (x < square_x + 6)
+        && (y >= square_y) && (y < square_y + 6) ) {
+        color[0] = 255;
+        color[1] = (IceTUByte)(32*rank);
+        color[2] = 64;
+        color[3] = 255;
+        *depth = 0.25f + 0.01f*rank;
+    } else if ((x >= 4*rank) && (x < 4*rank + 48) && (y >= 16) && (y < 48)) {
+        color[0] = (IceTUByte)(30*rank);
+        color[1] = 128;
+        color[2] = (IceTUByte)(255 - 30*rank);
+        color[3] = 255;
+        *depth = 0.5f + 0.01f*rank;
+    } else {
+        color[0] = color[1] = color[2] = color[3] = 0;
+        *depth = 1.0f;
+        return;
+    }
+
+    if (blend) {
+        color[0] /= 2;
+        color[1] /= 2;
+        color[2] /= 2;
+        color[3] = 128;
+    }
+}
+
+static void RenderImage(IceTInt rank,
+                        IceTInt frame,
+                        IceTBoolean blend,
+                        IceTUByte *color_buffer,
+                        IceTFloat *depth_buffer)
+{
+    IceTSizeType x, y;
+
+    for (y = 0; y < DELTA_HEIGHT; y++) {
+        for (x = 0; x < DELTA_WIDTH; x++) {
+            IceTSizeType pixel = y*DELTA_WIDTH + x;
+            RenderPixel(rank, frame, blend, x, y,
+                        color_buffer + 4*pixel, depth_buffer + pixel);
+        }
+    }
+}
+
+/* Marks the pixels that changed on any process since the last frame in
+ * changed, which holds a value for each pixel, and finds the number of pixels
+ * in the smallest single range containing all of them.  Returns whether that
+ * range holds unchanged pixels between rows, which happens when the changed
+ * pixels lie in more than one row of the moving squares. */
+static IceTBoolean ExpectedChangedPixels(IceTInt frame,
+                                         IceTBoolean blend,
+                                         IceTBoolean *changed,
+                                         IceTInt *num)
+{
+    const IceTSizeType num_pixels = DELTA_WIDTH*DELTA_HEIGHT;
+    IceTUByte *color, *old_color;
+    IceTFloat *depth, *old_depth;
+    IceTInt num_proc;
+    IceTInt rank;
+    IceTSizeType begin = num_pixels;
+    IceTSizeType end = 0;
+    IceTSizeType pixel;
+
+    if (frame == 0) {
+        for (pixel = 0; pixel < num_pixels; pixel++) {
+            changed[pixel] = ICET_TRUE;
+        }
+        *num = (IceTInt)num_pixels;
+        return ICET_FALSE;
+    }
+
+    icetGetIntegerv(ICET_NUM_PROCESSES, &num_proc);
+    color = malloc(4*num_pixels);
+    old_color = malloc(4*num_pixels);
+    depth = malloc(num_pixels*sizeof(IceTFloat));
+    old_depth = malloc(num_pixels*sizeof(IceTFloat));
+
+    for (pixel = 0; pixel < num_pixels; pixel++) {
+        changed[pixel] = ICET_FALSE;
+    }
+    for (rank = 0; rank < num_proc; rank++) {
+        RenderImage(rank, frame, blend, color, depth);
+        RenderImage(rank, frame - 1, blend, old_color, old_depth);
+        for (pixel = 0; pixel < num_pixels; pixel++) {
+            if (   (memcmp(color + 4*pixel, old_color + 4*pixel, 4) != 0)
+                || (!blend && (depth[pixel] != old_depth[pixel])) ) {
+                changed[pixel] = ICET_TRUE;
+                if (pixel < begin) begin = pixel;
+                if (pixel + 1 > end) end = pixel + 1;
+            }
+        }
+    }
+
+    free(color);
+    free(old_color);
+    free(depth);
+    free(old_depth);
+
+    if (end <= begin) {
+        *num = 0;
+        return ICET_FALSE;
+    } else {
+        *num = (IceTInt)(end - begin);
+        return (begin/DELTA_WIDTH != (end - 1)/DELTA_WIDTH);
+    }
+}
+
+/* Checks the ranges of pixels reported by the last composite against the
+ * pixels that changed and the smallest single range containing them. */
+static IceTBoolean CheckChangedRanges(const IceTBoolean *changed,
+                                      IceTInt expected_num,
+                                      IceTBoolean several_rows)
+{
+    const IceTSizeType num_pixels = DELTA_WIDTH*DELTA_HEIGHT;
+    IceTInt changed_offset, changed_num;
+    IceTInt num_ranges;
+    IceTInt *ranges;
+    IceTInt range_end;
+    IceTInt total;
+    IceTSizeType pixel;
+    IceTInt i;
+    IceTBoolean success = ICET_TRUE;
+
+    icetGetIntegerv(ICET_CHANGED_PIXELS_OFFSET, &changed_offset);
+    icetGetIntegerv(ICET_CHANGED_PIXELS_NUM, &changed_num);
+    icetGetIntegerv(ICET_CHANGED_PIXELS_NUM_RANGES, &num_ranges);
+    ranges = malloc((2*num_ranges + 1)*sizeof(IceTInt));
+    icetGetIntegerv(ICET_CHANGED_PIXELS_RANGES, ranges);
+
+    printstat("    %d ranges with %d pixels starting at %d,"
+              " smallest single range has %d\n",
+              num_ranges, changed_num, changed_offset, expected_num);
+
+    /* The ranges must be sorted, apart and not empty. */
+    range_end = -1;
+    total = 0;
+    for (i = 0; i < num_ranges; i++) {
+        if (   (ranges[2*i] <= range_end)
+            || (ranges[2*i + 1] <= 0)
+            || (ranges[2*i] + ranges[2*i + 1] > num_pixels) ) {
+            printrank("***** Range %d starting at %d with %d pixels is"
+                      " invalid *****\n", i, ranges[2*i], ranges[2*i + 1]);
+            success = ICET_FALSE;
+        }
+        range_end = ranges[2*i] + ranges[2*i + 1];
+        total += ranges[2*i + 1];
+    }
+    if (   (total != changed_num)
+        || (changed_offset != ((num_ranges > 0) ? ranges[0] : 0)) ) {
+        printrank("***** Ranges do not match the %d changed pixels starting"
+                  " at %d *****\n", changed_num, changed_offset);
+        success = ICET_FALSE;
+    }
+
+    /* Every changed pixel must be composited. */
+    i = 0;
+    for (pixel = 0; pixel < num_pixels; pixel++) {
+        while ((i < num_ranges) && (ranges[2*i] + ranges[2*i + 1] <= pixel)) {
+            i++;
+        }
+        if (changed[pixel] && ((i >= num_ranges) || (ranges[2*i] > pixel))) {
+            printrank("***** Changed pixel %d is not composited *****\n",
+                      (int)pixel);
+            success = ICET_FALSE;
+            break;
+        }
+    }
+
+    /* Rows are tracked separately, which must beat a single range as soon as
+     * pixels change in more than one row. */
+    if (several_rows ? (changed_num >= expected_num)
+                     : (changed_num != expected_num)) {
+        printrank("***** Composited %d pixels, smallest single range has %d"
+                  " *****\n", changed_num, expected_num);
+        success = ICET_FALSE;
+    }
+
+    free(ranges);
+
+    return success;
+}
+
+static void SetupContext(IceTBoolean blend, IceTBoolean temporal_delta)
+{
+    icetResetTiles();
+    icetAddTile(0, 0, DELTA_WIDTH, DELTA_HEIGHT, 0);
+    icetStrategy(ICET_STRATEGY_SEQUENTIAL);
+    icetSingleImageStrategy(ICET_SINGLE_IMAGE_STRATEGY_AUTOMATIC);
+    icetSetColorFormat(ICET_IMAGE_COLOR_RGBA_UBYTE);
+
+    if (blend) {
+        IceTInt num_proc;
+        IceTInt *process_order;
+        IceTInt i;
+
+        icetGetIntegerv(ICET_NUM_PROCESSES, &num_proc);
+        process_order = malloc(num_proc*sizeof(IceTInt));
+        for (i = 0; i < num_proc; i++) {
+            process_order[i] = num_proc - 1 - i;
+        }
+        icetCompositeOrder(process_order);
+        free(process_order);
+
+        icetCompositeMode(ICET_COMPOSITE_MODE_BLEND);
+        icetSetDepthFormat(ICET_IMAGE_DEPTH_NONE);
+        icetEnable(ICET_ORDERED_COMPOSITE);
+    } else {
+        /* Keep the depths so that patching them is checked as well. */
+        icetCompositeMode(ICET_COMPOSITE_MODE_Z_BUFFER);
+        icetSetDepthFormat(ICET_IMAGE_DEPTH_FLOAT);
+        icetDisable(ICET_ORDERED_COMPOSITE);
+        icetDisable(ICET_COMPOSITE_ONE_BUFFER);
+    }
+
+    if (temporal_delta) {
+        icetEnable(ICET_TEMPORAL_DELTA);
+    } else {
+        icetDisable(ICET_TEMPORAL_DELTA);
+    }
+}
+
+static IceTBoolean TryMode(IceTBoolean blend)
+{
+    const IceTSizeType num_pixels = DELTA_WIDTH*DELTA_HEIGHT;
+    IceTFloat background_color[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    IceTContext delta_context;
+    IceTContext full_context;
+    IceTEnum diag_level;
+    IceTUByte *color_buffer;
+    IceTFloat *depth_buffer;
+    IceTBoolean *changed;
+    IceTInt rank;
+    IceTInt frame;
+    IceTBoolean success = ICET_TRUE;
+
+    icetGetIntegerv(ICET_RANK, &rank);
+
+    delta_context = icetGetContext();
+    icetGetEnumv(ICET_DIAGNOSTIC_LEVEL, &diag_level);
+    full_context = icetCreateContext(icetGetCommunicator());
+    icetDiagnostics(diag_level);
+    SetupContext(blend, ICET_FALSE);
+    icetSetContext(delta_context);
+    SetupContext(blend, ICET_TRUE);
+
+    color_buffer = malloc(4*num_pixels);
+    depth_buffer = malloc(num_pixels*sizeof(IceTFloat));
+    changed = malloc(num_pixels*sizeof(IceTBoolean));
+
+    for (frame = 0; frame < NUM_FRAMES; frame++) {
+        IceTImage delta_image;
+        IceTImage full_image;
+        IceTInt expected_num;
+        IceTBoolean several_rows;
+        IceTInt tile_displayed;
+
+        RenderImage(rank, frame, blend, color_buffer, depth_buffer);
+
+        icetSetContext(delta_context);
+        delta_image = icetCompositeImage(color_buffer,
+                                         blend ? NULL : depth_buffer,
+                                         NULL,
+                                         NULL,
+                                         NULL,
+                                         background_color);
+        printstat("  Frame %d\n", frame);
+        several_rows = ExpectedChangedPixels(frame, blend, changed,
+                                             &expected_num);
+        success &= CheckChangedRanges(changed, expected_num, several_rows);
+        icetGetIntegerv(ICET_TILE_DISPLAYED, &tile_displayed);
+
+        icetSetContext(full_context);
+        full_image = icetCompositeImage(color_buffer,
+                                        blend ? NULL : depth_buffer,
+                                        NULL,
+                                        NULL,
+                                        NULL,
+                                        background_color);
+
+        if (tile_displayed >= 0) {
+            if (memcmp(icetImageGetColorcub(delta_image),
+                       icetImageGetColorcub(full_image),
+                       4*num_pixels) != 0) {
+                printrank("***** Patched colors differ from full composite"
+                          " *****\n");
+                success = ICET_FALSE;
+            }
+            if (   !blend
+                && (memcmp(icetImageGetDepthcf(delta_image),
+                           icetImageGetDepthcf(full_image),
+                           num_pixels*sizeof(IceTFloat)) != 0) ) {
+                printrank("***** Patched depths differ from full composite"
+                          " *****\n");
+                success = ICET_FALSE;
+            }
+        }
+    }
+
+    free(color_buffer);
+    free(depth_buffer);
+    free(changed);
+
+    icetSetContext(full_context);
+    icetDestroyContext(full_context);
+    icetSetContext(delta_context);
+    icetDisable(ICET_TEMPORAL_DELTA);
+    icetEnable(ICET_COMPOSITE_ONE_BUFFER);
+
+    return success;
+}
+
+/* Checks that enabling ICET_TEMPORAL_DELTA where it cannot be used raises an
+ * invalid operation warning and still composites the whole image. */
+static IceTBoolean TryIgnored(IceTEnum strategy, IceTBoolean collect)
+{
+    const IceTSizeType num_pixels = DELTA_WIDTH*DELTA_HEIGHT;
+    IceTFloat background_color[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    IceTUByte *color_buffer;
+    IceTFloat *depth_buffer;
+    IceTEnum diag_level;
+    IceTEnum error;
+    IceTInt changed_num;
+    IceTInt rank;
+    IceTBoolean success = ICET_TRUE;
+
+    icetGetIntegerv(ICET_RANK, &rank);
+    SetupContext(ICET_FALSE, ICET_TRUE);
+    icetStrategy(strategy);
+    if (!collect) icetDisable(ICET_COLLECT_IMAGES);
+
+    color_buffer = malloc(4*num_pixels);
+    depth_buffer = malloc(num_pixels*sizeof(IceTFloat));
+    RenderImage(rank, 0, ICET_FALSE, color_buffer, depth_buffer);
+
+    /* The expected warning must not be reported as a test failure. */
+    icetGetEnumv(ICET_DIAGNOSTIC_LEVEL, &diag_level);
+    icetDiagnostics(ICET_DIAG_OFF);
+    icetGetError();
+    icetCompositeImage(color_buffer,
+                       depth_buffer,
+                       NULL,
+                       NULL,
+                       NULL,
+                       background_color);
+    error = icetGetError();
+    icetDiagnostics(diag_level);
+    icetGetIntegerv(ICET_CHANGED_PIXELS_NUM, &changed_num);
+
+    if (error != ICET_INVALID_OPERATION) {
+        printrank("***** Composite did not raise an invalid operation"
+                  " warning *****\n");
+        success = ICET_FALSE;
+    }
+    if ((rank == 0) && (changed_num != num_pixels)) {
+        printrank("***** Composited %d pixels instead of all *****\n",
+                  changed_num);
+        success = ICET_FALSE;
+    }
+
+    free(color_buffer);
+    free(depth_buffer);
+
+    icetDisable(ICET_TEMPORAL_DELTA);
+    icetEnable(ICET_COLLECT_IMAGES);
+    icetEnable(ICET_COMPOSITE_ONE_BUFFER);
+
+    return success;
+}
+
+static int TemporalDeltaRun(void)
+{
+    IceTBoolean success = ICET_TRUE;
+
+    printstat("Z buffer\n");
+    success &= TryMode(ICET_FALSE);
+    printstat("Ordered blending\n");
+    success &= TryMode(ICET_TRUE);
+    printstat("Ignored with the reduce strategy\n");
+    success &= TryIgnored(ICET_STRATEGY_REDUCE, ICET_TRUE);
+    printstat("Ignored without collecting images\n");
+    success &= TryIgnored(ICET_STRATEGY_SEQUENTIAL, ICET_FALSE);
+
+    return (success ? TEST_PASSED : TEST_FAILED);
+}
+
+int TemporalDelta(int argc, char *argv[])
+{
+    /* Suppress warning. */
+    (void)argc;
+    (void)argv;
+
+    return run_test(TemporalDeltaRun);
+}
@@ -0,0 +1,328 @@
+/* -*- c -*- *****************************************************************
+** Checks that compressing an image and compositing two compressed images
+** with several threads gives exactly the same sparse image as doing so with
+** one thread.  Images are split among threads in contiguous pieces, so the
+** images are filled with runs that start, end and continue across the piece
+** boundaries.  This test is only built when IceT is compiled with
+** ICET_USE_OPENMP.
+*****************************************************************************/
+
+#include <IceT.h>
+#include <IceTDevImage.h>
+#include <IceTDevState.h>
+#include "test_codes.h"
+#include "test_util.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Run lengths of the random images are chosen up to this many pixels, so
+ * some pieces hold no more than part of a run. */
+#define MAX_RUN_LENGTH  24000
+
+#define FILL_RUNS       0
+#define FILL_EMPTY      1
+#define FILL_FULL       2
+
+static const IceTSizeType image_sizes[][2] = {
+    { 181, 181 },       /* Just below the size split among two threads,
+                           checked for compression only. */
+    { 256, 128 },       /* Exactly the size split among two threads. */
+    { 311, 211 },
+    { 1031, 67 }
+};
+
+static const IceTInt thread_counts[] = { 2, 3, 4, 7 };
+
+static void SetPixel(IceTImage image, IceTSizeType pixel, IceTBoolean active)
+{
+    IceTEnum color_format = icetImageGetColorFormat(image);
+    IceTEnum depth_format = icetImageGetDepthFormat(image);
+    int value = rand();
+    int channel;
+
+    if (color_format == ICET_IMAGE_COLOR_RGBA_UBYTE) {
+        IceTUByte *color = icetImageGetColorub(image) + 4*pixel;
+        for (channel = 0; channel < 4; channel++) {
+            color[channel] = active ? (IceTUByte)(1 + (value + channel)%255) : 0;
+        }
+    } else if (color_format == ICET_IMAGE_COLOR_RGBA_HALF) {
+        IceTUShort *color =
+            (IceTUShort *)icetImageGetColorVoid(image, NULL) + 4*pixel;
+        for (channel = 0; channel < 4; channel++) {
+            color[channel] = icetFloatToHalf(
+                    active ? (IceTFloat)(1 + (value + channel)%255)/255.0f : 0.0f);
+        }
+    } else if (color_format == ICET_IMAGE_COLOR_RGBA_FLOAT) {
+        IceTFloat *color = icetImageGetColorf(image) + 4*pixel;
+        for (channel = 0; channel < 4; channel++) {
+            color[channel] =
+                active ? (IceTFloat)(1 + (value + channel)%255)/255.0f : 0.0f;
+        }
+    }
+
+    if (depth_format == ICET_IMAGE_DEPTH_FLOAT) {
+        icetImageGetDepthf(image)[pixel] =
+            active ? (IceTFloat)(value%1000)/1000.0f : 1.0f;
+    }
+}
+
+/* Fills an image with runs of active and inactive pixels.  For FILL_RUNS, the
+ * pixels around each boundary between the pieces compressed by num_threads
+ * threads are then set so that, in turn, an active run continues across the
+ * boundary, an inactive run continues across it, an active run starts at it
+ * and an active run ends at it.  The turn of the first boundary is given by
+ * pattern. */
+static void FillImage(IceTImage image,
+                      int fill,
+                      IceTInt num_threads,
+                      int pattern)
+{
+    IceTSizeType num_pixels = icetImageGetNumPixels(image);
+    IceTSizeType piece_pixels = (num_pixels + num_threads - 1)/num_threads;
+    IceTSizeType pixel;
+    IceTBoolean active;
+    IceTInt boundary;
+
+    pixel = 0;
+    active = (rand()%2 == 0);
+    while (pixel < num_pixels) {
+        IceTSizeType run_length = 1 + rand()%MAX_RUN_LENGTH;
+        IceTSizeType run_end = pixel + run_length;
+        if (run_end > num_pixels) run_end = num_pixels;
+        if (fill == FILL_EMPTY) active = ICET_FALSE;
+        if (fill == FILL_FULL) active = ICET_TRUE;
+        for ( ; pixel < run_end; pixel++) {
+            SetPixel(image, pixel, active);
+        }
+        active = !active;
+    }
+
+    if (fill != FILL_RUNS) return;
+
+    for (boundary = 1; boundary < num_threads; boundary++) {
+        IceTSizeType first = boundary*piece_pixels;
+        if (first >= num_pixels) break;
+        switch ((boundary + pattern)%4) {
+          case 0:
+              SetPixel(image, first - 1, ICET_TRUE);
+              SetPixel(image, first, ICET_TRUE);
+              break;
+          case 1:
+              SetPixel(image, first - 1, ICET_FALSE);
+              SetPixel(image, first, ICET_FALSE);
+              break;
+          case 2:
+              SetPixel(image, first - 1, ICET_FALSE);
+              SetPixel(image, first, ICET_TRUE);
+              break;
+          case 3:
+              SetPixel(image, first - 1, ICET_TRUE);
+              SetPixel(image, first, ICET_FALSE);
+              break;
+        }
+    }
+}
+
+static IceTBoolean CompareSparseImages(const IceTSparseImage image,
+                                       const IceTSparseImage expected)
+{
+    IceTSizeType size = icetSparseImageGetCompressedBufferSize(image);
+    IceTSizeType expected_size =
+        icetSparseImageGetCompressedBufferSize(expected);
+
+    if (size != expected_size) {
+        printrank("Threaded image has %d bytes, serial image has %d.\n",
+                  size, expected_size);
+        return ICET_FALSE;
+    }
+    if (memcmp(image.opaque_internals, expected.opaque_internals, size) != 0) {
+        printrank("Threaded image bytes differ from serial image.\n");
+        return ICET_FALSE;
+    }
+
+    return ICET_TRUE;
+}
+
+static IceTBoolean TryCompress(IceTSizeType width,
+                               IceTSizeType height,
+                               IceTInt num_threads)
+{
+    IceTImage image;
+    IceTSparseImage serial, threaded;
+    IceTBoolean success = ICET_TRUE;
+    int fill;
+
+    image = icetImageAssignBuffer(malloc(icetImageBufferSize(width, height)),
+                                  width, height);
+    serial = icetSparseImageAssignBuffer(
+                        malloc(icetSparseImageBufferSize(width, height)),
+                        width, height);
+    threaded = icetSparseImageAssignBuffer(
+                        malloc(icetSparseImageBufferSize(width, height)),
+                        width, height);
+
+    for (fill = FILL_RUNS; fill <= FILL_FULL; fill++) {
+        FillImage(image, fill, num_threads, 0);
+
+        icetNumThreads(1);
+        icetCompressImage(image, serial);
+        icetNumThreads(num_threads);
+        icetCompressImage(image, threaded);
+        if (!CompareSparseImages(threaded, serial)) {
+            printrank("Failed compressing image (fill %d).\n", fill);
+            success = ICET_FALSE;
+        }
+
+        icetNumThreads(1);
+        icetCompressSubImage(image, 17, width*height - 17, serial);
+        icetNumThreads(num_threads);
+        icetCompressSubImage(image, 17, width*height - 17, threaded);
+        if (!CompareSparseImages(threaded, serial)) {
+            printrank("Failed compressing sub image (fill %d).\n", fill);
+            success = ICET_FALSE;
+        }
+    }
+
+    icetNumThreads(1);
+
+    free(image.opaque_internals);
+    free(serial.opaque_internals);
+    free(threaded.opaque_internals);
+
+    return success;
+}
+
+static IceTBoolean TryComposite(IceTSizeType width,
+                                IceTSizeType height,
+                                IceTInt num_threads)
+{
+    IceTImage image;
+    IceTSparseImage front, back, serial, threaded;
+    IceTBoolean success = ICET_TRUE;
+    int front_fill;
+    int back_fill;
+
+    image = icetImageAssignBuffer(malloc(icetImageBufferSize(width, height)),
+                                  width, height);
+    front = icetSparseImageAssignBuffer(
+                        malloc(icetSparseImageBufferSize(width, height)),
+                        width, height);
+    back = icetSparseImageAssignBuffer(
+                        malloc(icetSparseImageBufferSize(width, height)),
+                        width, height);
+    serial = icetSparseImageAssignBuffer(
+                        malloc(icetSparseImageBufferSize(width, height)),
+                        width, height);
+    threaded = icetSparseImageAssignBuffer(
+                        malloc(icetSparseImageBufferSize(width, height)),
+                        width, height);
+
+    icetNumThreads(1);
+    for (front_fill = FILL_RUNS; front_fill <= FILL_FULL; front_fill++) {
+        FillImage(image, front_fill, num_threads, 0);
+        icetCompressImage(image, front);
+        for (back_fill = FILL_RUNS; back_fill <= FILL_FULL; back_fill++) {
+            int pattern;
+            /* Offset the runs of the back image at the piece boundaries
+               against those of the front image so that runs of the two
+               images cross the boundaries in every combination. */
+            for (pattern = 0; pattern < 4; pattern++) {
+                FillImage(image, back_fill, num_threads, pattern);
+                icetCompressImage(image, back);
+
+                icetCompressedCompressedComposite(front, back, serial);
+                icetNumThreads(num_threads);
+                icetCompressedCompressedComposite(front, back, threaded);
+                icetNumThreads(1);
+                if (!CompareSparseImages(threaded, serial)) {
+                    printrank("Failed compositing (fills %d and %d,"
+                              " pattern %d).\n",
+                              front_fill, back_fill, pattern);
+                    success = ICET_FALSE;
+                }
+
+                if ((front_fill != FILL_RUNS) || (back_fill != FILL_RUNS)) {
+                    break;
+                }
+            }
+        }
+    }
+
+    free(image.opaque_internals);
+    free(front.opaque_internals);
+    free(back.opaque_internals);
+    free(serial.opaque_internals);
+    free(threaded.opaque_internals);
+
+    return success;
+}
+
+static IceTBoolean TryFormat(IceTEnum color_format, IceTEnum depth_format)
+{
+    IceTBoolean success = ICET_TRUE;
+    int size_index;
+    int thread_index;
+
+    icetSetColorFormat(color_format);
+    icetSetDepthFormat(depth_format);
+    if (depth_format == ICET_IMAGE_DEPTH_NONE) {
+        icetCompositeMode(ICET_COMPOSITE_MODE_BLEND);
+    } else {
+        icetCompositeMode(ICET_COMPOSITE_MODE_Z_BUFFER);
+    }
+
+    for (size_index = 0;
+         size_index < (int)(sizeof(image_sizes)/sizeof(image_sizes[0]));
+         size_index++) {
+        for (thread_index = 0;
+             thread_index < (int)(sizeof(thread_counts)/sizeof(IceTInt));
+             thread_index++) {
+            IceTSizeType width = image_sizes[size_index][0];
+            IceTSizeType height = image_sizes[size_index][1];
+            IceTInt num_threads = thread_counts[thread_index];
+            printstat("  %dx%d image, %d threads\n",
+                      width, height, num_threads);
+            success &= TryCompress(width, height, num_threads);
+            if (size_index > 0) {
+                success &= TryComposite(width, height, num_threads);
+            }
+        }
+    }
+
+    return success;
+}
+
+static int ThreadedCompressRun(void)
+{
+    IceTBoolean success = ICET_TRUE;
+
+    srand(11);
+
+    printstat("RGBA ubyte colors, float depth\n");
+    success &= TryFormat(ICET_IMAGE_COLOR_RGBA_UBYTE, ICET_IMAGE_DEPTH_FLOAT);
+    printstat("RGBA float colors, float depth\n");
+    success &= TryFormat(ICET_IMAGE_COLOR_RGBA_FLOAT, ICET_IMAGE_DEPTH_FLOAT);
+    printstat("RGBA half colors, float depth\n");
+    success &= TryFormat(ICET_IMAGE_COLOR_RGBA_HALF, ICET_IMAGE_DEPTH_FLOAT);
+    printstat("No colors, float depth\n");
+    success &= TryFormat(ICET_IMAGE_COLOR_NONE, ICET_IMAGE_DEPTH_FLOAT);
+    printstat("RGBA ubyte colors, no depth\n");
+    success &= TryFormat(ICET_IMAGE_COLOR_RGBA_UBYTE, ICET_IMAGE_DEPTH_NONE);
+    printstat("RGBA float colors, no depth\n");
+    success &= TryFormat(ICET_IMAGE_COLOR_RGBA_FLOAT, ICET_IMAGE_DEPTH_NONE);
+    printstat("RGBA half colors, no depth\n");
+    success &= TryFormat(ICET_IMAGE_COLOR_RGBA_HALF, ICET_IMAGE_DEPTH_NONE);
+
+    return (success ? TEST_PASSED : TEST_FAILED);
+}
+
+int ThreadedCompress(int argc, char *argv[])
+{
+    /* Suppress warning. */
+    (void)argc;
+    (void)argv;
+
+    return run_test(ThreadedCompressRun);
+}
@@ -0,0 +1,269 @@
+/* -*- c -*- *****************************************************************
+** Checks that sending sparse images with the lossless codec
+** ICET_WIRE_CODEC_BYTE_DELTA gives exactly the same images as sending them
+** unencoded.  The sequential and reduce strategies are run with every single
+** image strategy, which covers all strategies that encode the images they
+** exchange, both for regular images composited with a z-buffer and for
+** blended layered images.  The images are smooth so that the codec shrinks
+** them and is actually used, which is checked as well.
+*****************************************************************************/
+
+#include <IceT.h>
+#include <IceTDevImage.h>
+#include "test_codes.h"
+#include "test_util.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#define NUM_LAYERS      3
+
+/* Returns whether a pixel lies in the disk covered by a process. */
+static IceTBoolean InDisk(IceTInt rank,
+                          IceTInt num_proc,
+                          IceTSizeType x,
+                          IceTSizeType y)
+{
+    IceTSizeType center_x, center_y, radius;
+
+    center_x = SCREEN_WIDTH*(rank + 1)/(num_proc + 1);
+    center_y = SCREEN_HEIGHT/2;
+    radius = SCREEN_HEIGHT/3;
+
+    return (  (x - center_x)*(x - center_x) + (y - center_y)*(y - center_y)
+            < radius*radius);
+}
+
+/* Fills regular buffers with a smoothly shaded disk. */
+static void MakeRegularBuffers(IceTUByte *color_buffer,
+                               IceTFloat *depth_buffer)
+{
+    IceTInt rank;
+    IceTInt num_proc;
+    IceTSizeType x, y;
+
+    icetGetIntegerv(ICET_RANK, &rank);
+    icetGetIntegerv(ICET_NUM_PROCESSES, &num_proc);
+
+    for (y = 0; y < SCREEN_HEIGHT; y++) {
+        for (x = 0; x < SCREEN_WIDTH; x++) {
+            IceTUByte *color = color_buffer + 4*(y*SCREEN_WIDTH + x);
+            IceTFloat *depth = depth_buffer + y*SCREEN_WIDTH + x;
+            if (InDisk(rank, num_proc, x, y)) {
+                color[0] = (IceTUByte)(x/4);
+                color[1] = (IceTUByte)(y/4);
+                color[2] = (IceTUByte)(64*rank);
+                color[3] = 255;
+                *depth = (IceTFloat)(x + y)/(2*(SCREEN_WIDTH + SCREEN_HEIGHT))
+                       + 0.001f*rank;
+            } else {
+                color[0] = color[1] = color[2] = color[3] = 0;
+                *depth = 1.0f;
+            }
+        }
+    }
+}
+
+/* Computes up to NUM_LAYERS smoothly shaded fragments per pixel of the disk of
+ * a process. */
+static IceTInt Fragments(IceTInt rank,
+                         IceTInt num_proc,
+                         IceTSizeType pixel,
+                         IceTFloat (*colors)[4],
+                         IceTFloat *depths)
+{
+    const IceTSizeType x = pixel%SCREEN_WIDTH;
+    const IceTSizeType y = pixel/SCREEN_WIDTH;
+    IceTInt num_active;
+    IceTInt layer;
+
+    num_active = InDisk(rank, num_proc, x, y)
+               ? 1 + (IceTInt)((x/16 + y/16)%NUM_LAYERS) : 0;
+
+    for (layer = 0; layer < num_active; layer++) {
+        colors[layer][0] = 0.5f*x/SCREEN_WIDTH;
+        colors[layer][1] = 0.5f*y/SCREEN_HEIGHT;
+        colors[layer][2] = 0.125f*(layer + 1);
+        colors[layer][3] = 0.5f;
+        depths[layer] = layered_fragment_depth(rank, layer, num_proc,
+                                               NUM_LAYERS);
+    }
+
+    return num_active;
+}
+
+/* Composites the buffers with the given codec and copies the colors and, if
+ * any, depths of the displayed tile into result. */
+static void Composite(IceTEnum codec,
+                      IceTBoolean layered,
+                      const IceTVoid *color_buffer,
+                      const IceTVoid *depth_buffer,
+                      IceTByte *result)
+{
+    IceTFloat background_color[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    IceTImage image;
+    IceTInt tile_displayed;
+
+    icetWireCodec(codec);
+    if (layered) {
+        image = icetCompositeImageLayered(color_buffer,
+                                          depth_buffer,
+                                          NUM_LAYERS,
+                                          NULL,
+                                          NULL,
+                                          NULL,
+                                          background_color);
+    } else {
+        image = icetCompositeImage(color_buffer,
+                                   depth_buffer,
+                                   NULL,
+                                   NULL,
+                                   NULL,
+                                   background_color);
+    }
+    icetWireCodec(ICET_WIRE_CODEC_NONE);
+
+    icetGetIntegerv(ICET_TILE_DISPLAYED, &tile_displayed);
+    if (tile_displayed >= 0) {
+        IceTSizeType num_pixels = icetImageGetNumPixels(image);
+        IceTSizeType color_size;
+        IceTSizeType depth_size = 0;
+        const IceTVoid *color = icetImageGetColorConstVoid(image, &color_size);
+        memcpy(result, color, num_pixels*color_size);
+        if (icetImageGetDepthFormat(image) != ICET_IMAGE_DEPTH_NONE) {
+            const IceTVoid *depth =
+                icetImageGetDepthConstVoid(image, &depth_size);
+            memcpy(result + num_pixels*color_size,
+                   depth,
+                   num_pixels*depth_size);
+        }
+    }
+}
+
+static IceTBoolean TryImages(IceTBoolean layered,
+                             const IceTVoid *color_buffer,
+                             const IceTVoid *depth_buffer)
+{
+    static const IceTEnum strategies[] = {
+        ICET_STRATEGY_SEQUENTIAL,
+        ICET_STRATEGY_REDUCE
+    };
+    static const IceTEnum single_image_strategies[] = {
+        ICET_SINGLE_IMAGE_STRATEGY_BSWAP,
+        ICET_SINGLE_IMAGE_STRATEGY_TREE,
+        ICET_SINGLE_IMAGE_STRATEGY_RADIXK,
+        ICET_SINGLE_IMAGE_STRATEGY_RADIXKR
+    };
+    const IceTSizeType result_size =
+        SCREEN_WIDTH*SCREEN_HEIGHT*(4*sizeof(IceTFloat) + sizeof(IceTFloat));
+    IceTByte *plain_result;
+    IceTByte *encoded_result;
+    IceTInt tile_displayed;
+    IceTBoolean success = ICET_TRUE;
+    int i, j;
+
+    plain_result = malloc(result_size);
+    encoded_result = malloc(result_size);
+
+    for (i = 0; i < (int)(sizeof(strategies)/sizeof(IceTEnum)); i++) {
+        icetStrategy(strategies[i]);
+        for (j = 0;
+             j < (int)(sizeof(single_image_strategies)/sizeof(IceTEnum));
+             j++) {
+            IceTDouble encode_bytes_in;
+            IceTDouble encode_ratio;
+
+            icetSingleImageStrategy(single_image_strategies[j]);
+            printstat("  Strategy %s, %s\n",
+                      icetGetStrategyName(),
+                      icetGetSingleImageStrategyName());
+
+            memset(plain_result, 0, result_size);
+            memset(encoded_result, 0, result_size);
+            Composite(ICET_WIRE_CODEC_NONE, layered,
+                      color_buffer, depth_buffer, plain_result);
+            icetGetDoublev(ICET_ENCODE_BYTES_IN, &encode_bytes_in);
+            if (encode_bytes_in != 0.0) {
+                printrank("***** Encoded %g bytes without a codec *****\n",
+                          encode_bytes_in);
+                success = ICET_FALSE;
+            }
+            Composite(ICET_WIRE_CODEC_BYTE_DELTA, layered,
+                      color_buffer, depth_buffer, encoded_result);
+
+            /* Fragments are delta coded apart from the run lengths and
+             * counts between them, so smooth layers shrink as well. */
+            icetGetDoublev(ICET_ENCODE_BYTES_IN, &encode_bytes_in);
+            icetGetDoublev(ICET_ENCODE_RATIO, &encode_ratio);
+            if ((encode_bytes_in > 0.0) && (encode_ratio < 2.0)) {
+                printrank("***** Byte delta codec only shrinks images by %f"
+                          " *****\n", encode_ratio);
+                success = ICET_FALSE;
+            }
+
+            icetGetIntegerv(ICET_TILE_DISPLAYED, &tile_displayed);
+            if (   (tile_displayed >= 0)
+                && (memcmp(plain_result, encoded_result, result_size) != 0)) {
+                printrank("***** Byte delta codec gives a different image"
+                          " *****\n");
+                success = ICET_FALSE;
+            }
+        }
+    }
+
+    free(plain_result);
+    free(encoded_result);
+
+    return success;
+}
+
+static int WireCodecRun(void)
+{
+    const IceTSizeType num_pixels = SCREEN_WIDTH*SCREEN_HEIGHT;
+    IceTVoid *color_buffer;
+    IceTVoid *depth_buffer;
+    IceTInt rank;
+    IceTInt num_proc;
+    IceTBoolean success = ICET_TRUE;
+
+    icetGetIntegerv(ICET_RANK, &rank);
+    icetGetIntegerv(ICET_NUM_PROCESSES, &num_proc);
+
+    icetResetTiles();
+    icetAddTile(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT, 0);
+    icetDisable(ICET_ORDERED_COMPOSITE);
+
+    printstat("Z buffer, RGBA ubyte colors, float depths\n");
+    icetCompositeMode(ICET_COMPOSITE_MODE_Z_BUFFER);
+    icetSetColorFormat(ICET_IMAGE_COLOR_RGBA_UBYTE);
+    icetSetDepthFormat(ICET_IMAGE_DEPTH_FLOAT);
+    color_buffer = malloc(4*num_pixels*sizeof(IceTUByte));
+    depth_buffer = malloc(num_pixels*sizeof(IceTFloat));
+    MakeRegularBuffers(color_buffer, depth_buffer);
+    success &= TryImages(ICET_FALSE, color_buffer, depth_buffer);
+    free(color_buffer);
+    free(depth_buffer);
+
+    printstat("Blended layers, RGBA float colors, float depths\n");
+    icetCompositeMode(ICET_COMPOSITE_MODE_BLEND);
+    icetSetColorFormat(ICET_IMAGE_COLOR_RGBA_FLOAT);
+    icetSetDepthFormat(ICET_IMAGE_DEPTH_FLOAT);
+    make_layered_buffers(Fragments, rank, num_proc, num_pixels, NUM_LAYERS,
+                         ICET_IMAGE_COLOR_RGBA_FLOAT, ICET_IMAGE_DEPTH_FLOAT,
+                         &color_buffer, &depth_buffer);
+    success &= TryImages(ICET_TRUE, color_buffer, depth_buffer);
+    free(color_buffer);
+    free(depth_buffer);
+
+    return (success ? TEST_PASSED : TEST_FAILED);
+}
+
+int WireCodec(int argc, char *argv[])
+{
+    /* Suppress warning. */
+    (void)argc;
+    (void)argv;
+
+    return run_test(WireCodecRun);
+}
@@ -11,6 +11,7 @@
 #include "test_codes.h"
 
 #include <IceTDevCommunication.h>
+#include <IceTDevImage.h>
 #include <IceTDevPorting.h>
 
 #ifndef __USE_POSIX
@@ -270,6 +271,278 @@ IceTBoolean strategy_uses_single_image_strategy(IceTEnum strategy)
     }
 }
 
+IceTFloat random_float(void)
+{
+    return (IceTFloat)rand()/((IceTFloat)RAND_MAX + 1.0f);
+}
+
+IceTFloat hash_float(IceTInt rank, IceTSizeType pixel, IceTInt salt)
+{
+    IceTUInt hash = (IceTUInt)rank*73856093u
+                  ^ (IceTUInt)pixel*19349663u
+                  ^ (IceTUInt)salt*83492791u;
+    hash ^= hash >> 13;
+    hash *= 0x5BD1E995u;
+    hash ^= hash >> 15;
+    return (IceTFloat)(hash & 0xFFFF)/65536.0f;
+}
+
+IceTSizeType color_pixel_size(IceTEnum color_format)
+{
+    switch (color_format) {
+      case ICET_IMAGE_COLOR_RGBA_UBYTE: return 4*sizeof(IceTUByte);
+      case ICET_IMAGE_COLOR_RGBA_HALF:  return 4*sizeof(IceTUShort);
+      case ICET_IMAGE_COLOR_RGBA_FLOAT: return 4*sizeof(IceTFloat);
+      case ICET_IMAGE_COLOR_RGB_FLOAT:  return 3*sizeof(IceTFloat);
+      default:                          return 0;
+    }
+}
+
+IceTSizeType depth_pixel_size(IceTEnum depth_format)
+{
+    switch (depth_format) {
+      case ICET_IMAGE_DEPTH_FLOAT:      return sizeof(IceTFloat);
+      case ICET_IMAGE_DEPTH_USHORT:     return sizeof(IceTUShort);
+      default:                          return 0;
+    }
+}
+
+void store_fragment(IceTVoid *color,
+                    IceTVoid *depth,
+                    IceTEnum color_format,
+                    IceTEnum depth_format,
+                    const IceTFloat color_value[4],
+                    IceTFloat depth_value)
+{
+    int channel;
+
+    for (channel = 0; channel < 4; channel++) {
+        switch (color_format) {
+          case ICET_IMAGE_COLOR_RGBA_UBYTE:
+              ((IceTUByte *)color)[channel] =
+                  (IceTUByte)(255.0f*color_value[channel] + 0.5f);
+              break;
+          case ICET_IMAGE_COLOR_RGBA_HALF:
+              ((IceTUShort *)color)[channel] =
+                  icetFloatToHalf(color_value[channel]);
+              break;
+          case ICET_IMAGE_COLOR_RGBA_FLOAT:
+              ((IceTFloat *)color)[channel] = color_value[channel];
+              break;
+          case ICET_IMAGE_COLOR_RGB_FLOAT:
+              if (channel < 3) {
+                  ((IceTFloat *)color)[channel] = color_value[channel];
+              }
+              break;
+          default:
+              break;
+        }
+    }
+
+    if (depth_format == ICET_IMAGE_DEPTH_USHORT) {
+        *(IceTUShort *)depth = (IceTUShort)(65535.0f*depth_value + 0.5f);
+    } else if (depth_format == ICET_IMAGE_DEPTH_FLOAT) {
+        *(IceTFloat *)depth = depth_value;
+    }
+}
+
+void store_random_fragment(IceTVoid *color,
+                           IceTVoid *depth,
+                           IceTEnum color_format,
+                           IceTEnum depth_format,
+                           IceTBoolean active,
+                           IceTFloat depth_value)
+{
+    IceTFloat alpha = active ? 0.1f + 0.8f*random_float() : 0.0f;
+    IceTFloat value[4];
+
+    value[0] = alpha*random_float();
+    value[1] = alpha*random_float();
+    value[2] = alpha*random_float();
+    value[3] = alpha;
+    if (!active) depth_value = 1.0f;
+
+    store_fragment(color, depth, color_format, depth_format,
+                   value, depth_value);
+
+    /* Make sure an active ubyte fragment is not rounded to zero alpha. */
+    if (   active && (color_format == ICET_IMAGE_COLOR_RGBA_UBYTE)
+        && (((IceTUByte *)color)[3] == 0) ) {
+        ((IceTUByte *)color)[3] = 1;
+    }
+}
+
+void insert_fragment(IceTFloat *colors,
+                     IceTFloat *depths,
+                     IceTInt *num_fragments,
+                     const IceTFloat color[4],
+                     IceTFloat depth)
+{
+    IceTInt i;
+    int channel;
+
+    for (i = *num_fragments; (i > 0) && (depths[i-1] > depth); i--) {
+        depths[i] = depths[i-1];
+        for (channel = 0; channel < 4; channel++) {
+            colors[4*i + channel] = colors[4*(i-1) + channel];
+        }
+    }
+    depths[i] = depth;
+    for (channel = 0; channel < 4; channel++) {
+        colors[4*i + channel] = color[channel];
+    }
+    (*num_fragments)++;
+}
+
+void blend_fragments(const IceTFloat *colors,
+                     IceTInt num_fragments,
+                     IceTFloat opacity_cutoff,
+                     IceTFloat result[4])
+{
+    double accum[4] = { 0.0, 0.0, 0.0, 0.0 };
+    IceTInt i;
+    int channel;
+
+    for (i = 0; i < num_fragments; i++) {
+        double transmission = 1.0 - accum[3];
+        for (channel = 0; channel < 4; channel++) {
+            accum[channel] += transmission*colors[4*i + channel];
+        }
+        if ((opacity_cutoff > 0.0f) && (accum[3] >= opacity_cutoff)) break;
+    }
+
+    for (channel = 0; channel < 4; channel++) {
+        result[channel] = (IceTFloat)accum[channel];
+    }
+}
+
+IceTInt layered_num_active(IceTInt rank,
+                           IceTSizeType pixel,
+                           IceTInt num_layers)
+{
+    return (IceTInt)(hash_float(rank, pixel, 0)*(num_layers + 1));
+}
+
+IceTFloat layered_fragment_depth(IceTInt rank,
+                                 IceTInt layer,
+                                 IceTInt num_proc,
+                                 IceTInt num_layers)
+{
+    return (IceTFloat)(  ((double)layer*num_proc + rank + 0.5)
+                       / ((double)num_layers*num_proc) );
+}
+
+void layered_fragment_color(IceTInt rank,
+                            IceTSizeType pixel,
+                            IceTInt layer,
+                            IceTFloat min_alpha,
+                            IceTFloat max_alpha,
+                            IceTFloat color[4])
+{
+    IceTFloat alpha = min_alpha
+                    + (max_alpha - min_alpha)*hash_float(rank, pixel,
+                                                         4*layer + 1);
+
+    color[0] = alpha*hash_float(rank, pixel, 4*layer + 2);
+    color[1] = alpha*hash_float(rank, pixel, 4*layer + 3);
+    color[2] = alpha*hash_float(rank, pixel, 4*layer + 4);
+    color[3] = alpha;
+}
+
+void make_layered_buffers(LayeredFragmentsFunc fragments,
+                          IceTInt rank,
+                          IceTInt num_proc,
+                          IceTSizeType num_pixels,
+                          IceTInt num_layers,
+                          IceTEnum color_format,
+                          IceTEnum depth_format,
+                          IceTVoid **color_buffer_p,
+                          IceTVoid **depth_buffer_p)
+{
+    const IceTSizeType color_size = color_pixel_size(color_format);
+    const IceTSizeType depth_size = depth_pixel_size(depth_format);
+    const IceTSizeType num_fragments = num_pixels*num_layers;
+    IceTFloat (*colors)[4] = malloc(num_layers*sizeof(*colors));
+    IceTFloat *depths = malloc(num_layers*sizeof(IceTFloat));
+    IceTByte *color_buffer = malloc(num_fragments*color_size);
+    IceTByte *depth_buffer = malloc(num_fragments*depth_size);
+    IceTSizeType pixel;
+
+    for (pixel = 0; pixel < num_pixels; pixel++) {
+        IceTInt num_active = fragments(rank, num_proc, pixel, colors, depths);
+        IceTInt layer;
+        for (layer = 0; layer < num_layers; layer++) {
+            static const IceTFloat inactive_color[4] = { 0.0f,0.0f,0.0f,0.0f };
+            IceTSizeType fragment = pixel*num_layers + layer;
+            store_fragment(color_buffer + fragment*color_size,
+                           depth_buffer + fragment*depth_size,
+                           color_format, depth_format,
+                           (layer < num_active) ? colors[layer]
+                                                : inactive_color,
+                           (layer < num_active) ? depths[layer] : 1.0f);
+        }
+    }
+
+    free(colors);
+    free(depths);
+
+    *color_buffer_p = color_buffer;
+    *depth_buffer_p = depth_buffer;
+}
+
+typedef struct {
+    IceTFloat depth;
+    IceTFloat color[4];
+} ReferenceFragment;
+
+static int compare_reference_fragments(const void *a, const void *b)
+{
+    IceTFloat depth_a = ((const ReferenceFragment *)a)->depth;
+    IceTFloat depth_b = ((const ReferenceFragment *)b)->depth;
+    return (depth_a > depth_b) - (depth_a < depth_b);
+}
+
+void reference_pixel(LayeredFragmentsFunc fragments,
+                     IceTInt num_proc,
+                     IceTInt max_layers,
+                     IceTSizeType pixel,
+                     IceTFloat opacity_cutoff,
+                     IceTFloat result[4])
+{
+    ReferenceFragment *all = malloc(num_proc*max_layers*sizeof(*all));
+    IceTFloat *sorted_colors = malloc(4*num_proc*max_layers*sizeof(IceTFloat));
+    IceTFloat (*colors)[4] = malloc(max_layers*sizeof(*colors));
+    IceTFloat *depths = malloc(max_layers*sizeof(IceTFloat));
+    IceTInt num_fragments = 0;
+    IceTInt num_covering = 0;
+    IceTInt rank;
+    IceTInt i;
+
+    for (rank = 0; rank < num_proc; rank++) {
+        IceTInt num_active = fragments(rank, num_proc, pixel, colors, depths);
+        if (num_active > 0) num_covering++;
+        for (i = 0; i < num_active; i++) {
+            all[num_fragments].depth = depths[i];
+            memcpy(all[num_fragments].color, colors[i], sizeof(colors[i]));
+            num_fragments++;
+        }
+    }
+
+    qsort(all, num_fragments, sizeof(*all), compare_reference_fragments);
+    for (i = 0; i < num_fragments; i++) {
+        memcpy(sorted_colors + 4*i, all[i].color, sizeof(all[i].color));
+    }
+    blend_fragments(sorted_colors,
+                    num_fragments,
+                    (num_covering > 1) ? opacity_cutoff : 0.0f,
+                    result);
+
+    free(all);
+    free(sorted_colors);
+    free(colors);
+    free(depths);
+}
+
 int run_test_base(int (*test_function)())
 {
     int result;
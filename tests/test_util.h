@@ -51,6 +51,108 @@ void write_ppm(const char *filename,
 
 IceTBoolean strategy_uses_single_image_strategy(IceTEnum strategy);
 
+/* Returns the next value in [0,1) of the sequence of rand. */
+IceTFloat random_float(void);
+
+/* Returns a pseudorandom value in [0,1) that depends only on its arguments,
+   so that every process can compute the layers of any other process. */
+IceTFloat hash_float(IceTInt rank, IceTSizeType pixel, IceTInt salt);
+
+/* Returns the number of bytes a pixel or fragment takes in the given color
+   or depth format. */
+IceTSizeType color_pixel_size(IceTEnum color_format);
+IceTSizeType depth_pixel_size(IceTEnum depth_format);
+
+/* Stores a color given as floats and a depth in the given formats. */
+void store_fragment(IceTVoid *color,
+                    IceTVoid *depth,
+                    IceTEnum color_format,
+                    IceTEnum depth_format,
+                    const IceTFloat color_value[4],
+                    IceTFloat depth_value);
+
+/* Stores a fragment with a random premultiplied color, which takes values
+   from random_float, in the given formats.  Inactive fragments have zero
+   colors and the far depth. */
+void store_random_fragment(IceTVoid *color,
+                           IceTVoid *depth,
+                           IceTEnum color_format,
+                           IceTEnum depth_format,
+                           IceTBoolean active,
+                           IceTFloat depth_value);
+
+/* Inserts a premultiplied RGBA fragment into arrays of num_fragments
+   fragments sorted by depth and increments num_fragments. */
+void insert_fragment(IceTFloat *colors,
+                     IceTFloat *depths,
+                     IceTInt *num_fragments,
+                     const IceTFloat color[4],
+                     IceTFloat depth);
+
+/* Blends premultiplied RGBA fragments sorted by depth front to back.  If
+   opacity_cutoff is positive, stops after the fragment at which the
+   accumulated opacity reaches it. */
+void blend_fragments(const IceTFloat *colors,
+                     IceTInt num_fragments,
+                     IceTFloat opacity_cutoff,
+                     IceTFloat result[4]);
+
+/* Computes the fragments of a process at a pixel of a layered test image front
+   to back, as premultiplied RGBA colors and depths, and returns their number,
+   which is at most the number of layers of the image of the process.  Every
+   process must be able to compute the fragments of every other process. */
+typedef IceTInt (*LayeredFragmentsFunc)(IceTInt rank,
+                                        IceTInt num_proc,
+                                        IceTSizeType pixel,
+                                        IceTFloat (*colors)[4],
+                                        IceTFloat *depths);
+
+/* Returns a pseudorandom number of active fragments from 0 to num_layers. */
+IceTInt layered_num_active(IceTInt rank,
+                           IceTSizeType pixel,
+                           IceTInt num_layers);
+
+/* Returns the depth of a layer of a process.  Depths interleave the layers of
+   all processes and are unique, so that the blend order does not depend on
+   the strategy, even when stored with 16 bits. */
+IceTFloat layered_fragment_depth(IceTInt rank,
+                                 IceTInt layer,
+                                 IceTInt num_proc,
+                                 IceTInt num_layers);
+
+/* Computes a pseudorandom premultiplied color of a layer of a process with an
+   opacity between min_alpha and max_alpha. */
+void layered_fragment_color(IceTInt rank,
+                            IceTSizeType pixel,
+                            IceTInt layer,
+                            IceTFloat min_alpha,
+                            IceTFloat max_alpha,
+                            IceTFloat color[4]);
+
+/* Allocates layered buffers with num_layers fragments for each of num_pixels
+   pixels in the given formats and fills them with the fragments of a process.
+   Inactive fragments have zero colors and the far depth.  The buffers must be
+   freed with free. */
+void make_layered_buffers(LayeredFragmentsFunc fragments,
+                          IceTInt rank,
+                          IceTInt num_proc,
+                          IceTSizeType num_pixels,
+                          IceTInt num_layers,
+                          IceTEnum color_format,
+                          IceTEnum depth_format,
+                          IceTVoid **color_buffer_p,
+                          IceTVoid **depth_buffer_p);
+
+/* Blends the fragments of all processes at a pixel front to back, each of
+   which has at most max_layers.  Like ICET_LAYERED_OPACITY_CUTOFF, a positive
+   opacity_cutoff only applies to pixels covered by several processes. */
+void reference_pixel(LayeredFragmentsFunc fragments,
+                     IceTInt num_proc,
+                     IceTInt max_layers,
+                     IceTSizeType pixel,
+                     IceTFloat opacity_cutoff,
+                     IceTFloat result[4]);
+
 #ifdef __cplusplus
 }
 #endif